@@ -7,35 +7,102 @@
 #include "Tags/TerrainTags.h"
 #include "Layout/TerrainLayoutData.h"
 #include "Layout/TerrainLayoutSubsystem.h"
+#include "ProfilingDebugging/CpuProfilerTrace.h"
+#include "TerrainGeneratorMemory.h"
+#include "Layout/TerrainLayoutKernels.h"
 
 #pragma region Main Thread Code
 
-FCorridorLayoutWorker::FCorridorLayoutWorker(float CellSizeIn, TArray<FTerrain_RoomDistance> StartEndRoomIn, UTerrainLayoutData* TerrainLayoutDataIn, const TMap<FIntPoint, FRoomLayout>& RoomsLayoutMapIn, const TMap<FIntPoint, FCellLayout>& CellsLayoutMapIn)
+FCorridorLayoutWorker::FCorridorLayoutWorker(float CellSizeIn, TArray<FTerrain_RoomDistance> StartEndRoomIn, UTerrainLayoutData* TerrainLayoutDataIn, const TSharedRef<const TMap<FIntPoint, FRoomLayout>>& RoomsLayoutMapIn, const TSharedRef<const FTerrainLayoutCellsMap>& CellsLayoutMapIn, const FTerrainLayoutCancellationTokenPtr& CancellationTokenIn, const FTerrainLayoutStreamQueuePtr& StreamQueueIn)
+	: CellsLayoutMap(CellsLayoutMapIn)
+	, RoomsLayoutMap(RoomsLayoutMapIn)
+	, CancellationToken(CancellationTokenIn)
+	, StreamQueue(StreamQueueIn)
 {
 	CellSize = CellSizeIn;
 	StartEndRoom = StartEndRoomIn;
 	TerrainLayoutData = TerrainLayoutDataIn;
-	RoomsLayoutMap = RoomsLayoutMapIn;
-	CellsLayoutMap = CellsLayoutMapIn;
 }
 
 uint32 FCorridorLayoutWorker::Run()
 {
+	TRACE_CPUPROFILER_EVENT_SCOPE(FCorridorLayoutWorker::Run);
+	LLM_SCOPE_BYTAG(TerrainGenerator_LayoutWorkers);
+
+	StartTime = FPlatformTime::Seconds();
+	ThreadId = FPlatformTLS::GetCurrentThreadId();
 	GeneratedCorridorLayout.Empty();
+	GeneratedCorridorsAmount = 0;
+	PathNodesExpanded = 0;
+	FailedPathsAmount = 0;
+	FlowFieldsAmount = 0;
+	FlowFieldPathsAmount = 0;
+	PathCacheHits = 0;
+	PathCacheMisses = 0;
+	FlowFields.Empty();
+	FlowFieldsBytes = 0;
+	KeptCorridorCellsBytes = 0;
+	ReportedBytes = 0;
+	SearchHeatmap.Empty();
+
+	if (!StreamQueue.IsValid())
+	{
+		GeneratedCorridorLayout.Reserve(StartEndRoom.Num());
+	}
+
+	//All the scratch data of the worker is released when the worker ends, even if a corridor leaves something behind.
+	FMemMark WorkerMark(FMemStack::Get());
 
 	FCorridorLayout Layout = FCorridorLayout();
 	bool bLayoutGenerated = false;
-	for (const FTerrain_RoomDistance StartEnd : StartEndRoom)
+	for (int32 i = 0; i < StartEndRoom.Num(); i++)
 	{
-		Layout = GenerateCorridorLayout(StartEnd, bLayoutGenerated);
+		if (IsCancelled())
+		{
+			break;
+		}
+
+		FMemMark CorridorMark(FMemStack::Get());
+		Layout = GenerateCorridorLayout(StartEndRoom[i], bLayoutGenerated);
+
+		if (OnCorridorEnd)
+		{
+			OnCorridorEnd(FirstCorridorIndex + i, bLayoutGenerated ? &Layout : nullptr);
+		}
 	
 		if (bLayoutGenerated)
 		{
-			GeneratedCorridorLayout.Add(Layout);
-		}		
+			GeneratedCorridorsAmount++;
+
+			if (StreamQueue.IsValid())
+			{
+				StreamQueue->Corridors.Enqueue(MoveTemp(Layout));
+			}
+			else
+			{
+				KeptCorridorCellsBytes += Layout.Cells.GetAllocatedSize();
+				GeneratedCorridorLayout.Add(Layout);
+			}
+		}
+
+		ReportKeptBytes();
 	}
 	
-	UE_LOG(TerrainGeneratorLog, Log, TEXT("FCorridorLayoutWorker::GenerateCorridorLayoutData - Corridor layouts generated: %i."), GeneratedCorridorLayout.Num());
+	if (IsCancelled())
+	{
+		GeneratedCorridorLayout.Empty();
+		UE_LOG(TerrainGeneratorLog, Log, TEXT("FCorridorLayoutWorker::Run - Corridor layout generation cancelled."));
+	}
+	else
+	{
+		UE_LOG(TerrainGeneratorLog, Verbose, TEXT("FCorridorLayoutWorker::GenerateCorridorLayoutData - Corridor layouts generated: %i."), GeneratedCorridorsAmount);
+	}
+
+	FlowFields.Empty();
+	FlowFieldsBytes = 0;
+	ReportKeptBytes();
+
+	BusySeconds = FPlatformTime::Seconds() - StartTime;
 	bIsThreadCompleted = true;
 	return 0;
 }
@@ -43,48 +110,49 @@ uint32 FCorridorLayoutWorker::Run()
 void FCorridorLayoutWorker::OnThreadEnd() 
 {
 	UTerrainLayoutSubsystem* TerrainLayoutSubsystem = Cast<UTerrainLayoutSubsystem>(ThreadOwner);
-	if (!TerrainLayoutSubsystem)
+	if (!TerrainLayoutSubsystem || IsCancelled()) //A cancelled worker may end after a new generation started, it must not write into the new layout.
 	{
+		GeneratedCorridorLayout.Empty();
+		SearchHeatmap.Empty();
 		return;
 	}
 
-	for (const FCorridorLayout& layout : GeneratedCorridorLayout)
-	{		
-		for (const FIntPoint& cell : layout.Cells)
-		{				
-			FCellLayout CellLayout = FCellLayout();
-			if (TerrainLayoutSubsystem->CellsLayoutMap.Contains(cell))
-			{
-				CellLayout = TerrainLayoutSubsystem->CellsLayoutMap[cell];
-			}
-
-			CellLayout.CellID = cell;
-			CellLayout.Tags.AddTag(TAG_TERRAIN_CELL_TYPE_CORRIDOR);
+	TerrainLayoutSubsystem->LayoutStats.CorridorsAmount += GeneratedCorridorsAmount;
+	TerrainLayoutSubsystem->LayoutStats.FailedCorridorsAmount += StartEndRoom.Num() - GeneratedCorridorsAmount;
+	TerrainLayoutSubsystem->LayoutStats.FailedPathsAmount += FailedPathsAmount;
+	TerrainLayoutSubsystem->LayoutStats.PathNodesExpanded += PathNodesExpanded;
+	TerrainLayoutSubsystem->LayoutStats.FlowFieldsAmount += FlowFieldsAmount;
+	TerrainLayoutSubsystem->LayoutStats.FlowFieldPathsAmount += FlowFieldPathsAmount;
+	TerrainLayoutSubsystem->LayoutStats.PathCacheHits += PathCacheHits;
+	TerrainLayoutSubsystem->LayoutStats.PathCacheMisses += PathCacheMisses;
+
+	//The synchronous generation times the workers itself.
+	if (!TerrainLayoutSubsystem->bGenerateSynchronously)
+	{
+		TerrainLayoutSubsystem->AddStageWorkerBusyTime(ETerrainGen_LayoutStage::Corridors, BusySeconds, StartTime, ThreadId);
+	}
 
-			if (cell == layout.EndCellId)
-			{
-				CellLayout.Tags.AddTag(TAG_TERRAIN_CELL_LAYOUT_DOOR_ENDCORRIDOR);
-			}
-			else if (cell == layout.StartCellId)
-			{
-				CellLayout.Tags.AddTag(TAG_TERRAIN_CELL_LAYOUT_DOOR_STARTCORRIDOR);
-			}
+	//Merged with the results of the other workers when the stage ends.
+	TerrainLayoutSubsystem->PendingCorridorLayouts.Append(MoveTemp(GeneratedCorridorLayout));
 
-			TerrainLayoutSubsystem->CellsLayoutMap.Add(cell, CellLayout);
-		}
+	for (const TPair<FIntPoint, FTerrainLayoutCellSearch>& pair : SearchHeatmap)
+	{
+		TerrainLayoutSubsystem->CorridorSearchHeatmap.FindOrAdd(pair.Key).Add(pair.Value.Expansions, pair.Value.Cost);
 	}
+
+	SearchHeatmap.Empty();
 }
 
 FCorridorLayout FCorridorLayoutWorker::GenerateCorridorLayout(const FTerrain_RoomDistance& StartEndRoomIn, bool& SuccesOut) const
 {
-	if (!RoomsLayoutMap.Contains(StartEndRoomIn.RoomA))
+	if (!RoomsLayoutMap->Contains(StartEndRoomIn.RoomA))
 	{
 		UE_LOG(TerrainGeneratorLog, Error, TEXT("FCorridorLayoutWorker::GenerateCorridorLayoutData - Could not find layout data for start room."));
 		SuccesOut = false;
 		return FCorridorLayout();
 	}
 
-	if (!RoomsLayoutMap.Contains(StartEndRoomIn.RoomB))
+	if (!RoomsLayoutMap->Contains(StartEndRoomIn.RoomB))
 	{
 		UE_LOG(TerrainGeneratorLog, Error, TEXT("FCorridorLayoutWorker::GenerateCorridorLayoutData - Could not find layout data for end room."));
 		SuccesOut = false;
@@ -95,7 +163,8 @@ FCorridorLayout FCorridorLayoutWorker::GenerateCorridorLayout(const FTerrain_Roo
 	CorridorDataOut.StartRoomId = StartEndRoomIn.RoomA;
 	CorridorDataOut.EndRoomId = StartEndRoomIn.RoomB;
 
-	TArray<FTerrain_CellDistance> AllCorridorsPathDistances = GenerateAllCorridorsPathsDistance(CorridorDataOut.StartRoomId, CorridorDataOut.EndRoomId);
+	FCellDistanceScratchArray AllCorridorsPathDistances;
+	GenerateAllCorridorsPathsDistance(CorridorDataOut.StartRoomId, CorridorDataOut.EndRoomId, AllCorridorsPathDistances);
 	if (AllCorridorsPathDistances.Num() == 0)
 	{
 		UE_LOG(TerrainGeneratorLog, Error, TEXT("FCorridorLayoutWorker::GenerateCorridorLayoutData - Could not generate path for corridor. A room has no doors."));
@@ -104,6 +173,7 @@ FCorridorLayout FCorridorLayoutWorker::GenerateCorridorLayout(const FTerrain_Roo
 	}
 
 	bool PathGeneratedSuccesfully = false;
+	const bool bUseFlowField = FlowFieldRooms.Contains(CorridorDataOut.StartRoomId);
 	const int32 CorridorPaths = AllCorridorsPathDistances.Num();
 	int32 PathIndexOut = 0;
 	for (int32 i = 0; i < CorridorPaths; i++)  //Usually this only should be run once, but if the path somehow fails, we choose another one.
@@ -111,16 +181,23 @@ FCorridorLayout FCorridorLayoutWorker::GenerateCorridorLayout(const FTerrain_Roo
 		FTerrain_CellDistance SelectedPath = SelectCorridorPath(AllCorridorsPathDistances, PathIndexOut);		
 		CorridorDataOut.StartCellId = SelectedPath.CellA;
 		CorridorDataOut.EndCellId = SelectedPath.CellB;
-		CorridorDataOut.Cells = GeneratePath(SelectedPath.CellA, SelectedPath.CellB, PathGeneratedSuccesfully);
 
-		if (!PathGeneratedSuccesfully)
+		//The field reaches the end door from whichever start door is nearest to it.
+		if (bUseFlowField && GenerateFlowFieldPath(CorridorDataOut.StartRoomId, SelectedPath.CellB, CorridorDataOut.Cells, CorridorDataOut.StartCellId))
 		{
-			AllCorridorsPathDistances.RemoveAt(PathIndexOut);
+			PathGeneratedSuccesfully = true;
 		}
 		else
+		{
+			CorridorDataOut.Cells = GenerateCachedPath(SelectedPath.CellA, SelectedPath.CellB, PathGeneratedSuccesfully);
+		}
+
+		if (PathGeneratedSuccesfully || IsCancelled())
 		{
 			break;
 		}
+
+		AllCorridorsPathDistances.RemoveAt(PathIndexOut);
 	}
 
 	GenerateCorridorRange(CorridorDataOut);
@@ -129,38 +206,38 @@ FCorridorLayout FCorridorLayoutWorker::GenerateCorridorLayout(const FTerrain_Roo
 	return  CorridorDataOut;
 }
 
-TArray<FIntPoint> FCorridorLayoutWorker::GetAllCorridorDoorsOfRoom(const FIntPoint& RoomIn) const
+void FCorridorLayoutWorker::GetAllCorridorDoorsOfRoom(const FIntPoint& RoomIn, FCellScratchArray& DoorsOut) const
 {
-	if (!RoomsLayoutMap.Contains(RoomIn))
+	const FRoomLayout* RoomLayout = RoomsLayoutMap->Find(RoomIn);
+	if (!RoomLayout)
 	{
-		return TArray<FIntPoint>();
+		return;
 	}
 
-	TArray<FIntPoint> Doors = TArray<FIntPoint>();
-	for (const FIntPoint& cellId : RoomsLayoutMap[RoomIn].Cells)
+	TArray<FIntPoint, TInlineAllocator<4>> AdjacentCells;
+	for (const FIntPoint& cellId : RoomLayout->Cells)
 	{
-		if (!CellsLayoutMap.Contains(cellId))
+		const FCellLayout* CellLayout = CellsLayoutMap->Find(cellId);
+		if (!CellLayout)
 		{
 			continue;
 		}
 
-		if (CellsLayoutMap[cellId].Tags.HasTag(TAG_TERRAIN_CELL_LAYOUT_BORDER))
+		if (CellLayout->Tags.HasTag(TAG_TERRAIN_CELL_LAYOUT_BORDER))
 		{
-			TArray<FIntPoint> AdjacentCells = UTerrainLayoutFunctionLibrary::GetAdyacentCellsOfCell(cellId);
+			GetAdjacentCells(cellId, AdjacentCells);
 
 			for (const FIntPoint AdCell : AdjacentCells)
 			{
-				if (CellsLayoutMap.Contains(AdCell)) //Cell is used already?
+				if (CellsLayoutMap->Contains(AdCell)) //Cell is used already?
 				{
 					continue;
 				}
 
-				Doors.AddUnique(AdCell);
+				DoorsOut.AddUnique(AdCell);
 			}
 		}		
-	}	
-
-	return Doors;
+	}
 }
 
 int32 FCorridorLayoutWorker::GetCellUnitDistanceBetweenCells(const FIntPoint& CellA, const FIntPoint& CellB) const
@@ -168,17 +245,19 @@ int32 FCorridorLayoutWorker::GetCellUnitDistanceBetweenCells(const FIntPoint& Ce
 	return FMath::Abs(CellA.X - CellB.X) + FMath::Abs(CellA.Y - CellB.Y);
 }
 
-TArray<FTerrain_CellDistance> FCorridorLayoutWorker::GenerateAllCorridorsPathsDistance(const FIntPoint& StartRoomIn, const FIntPoint& EndRoomIn) const
+void FCorridorLayoutWorker::GenerateAllCorridorsPathsDistance(const FIntPoint& StartRoomIn, const FIntPoint& EndRoomIn, FCellDistanceScratchArray& PathDistancesOut) const
 {
-	TArray<FIntPoint> StartRoomCorridorDoors = GetAllCorridorDoorsOfRoom(StartRoomIn);
-	TArray<FIntPoint> EndRoomCorridorDoors = GetAllCorridorDoorsOfRoom(EndRoomIn);
+	FCellScratchArray StartRoomCorridorDoors;
+	FCellScratchArray EndRoomCorridorDoors;
+	GetAllCorridorDoorsOfRoom(StartRoomIn, StartRoomCorridorDoors);
+	GetAllCorridorDoorsOfRoom(EndRoomIn, EndRoomCorridorDoors);
 
 	if (StartRoomCorridorDoors.Num() == 0 || EndRoomCorridorDoors.Num() == 0)
 	{
-		return TArray<FTerrain_CellDistance>(); //If one room has no doors, then the corridor cannot be made.
+		return; //If one room has no doors, then the corridor cannot be made.
 	}
 	
-	TArray<FTerrain_CellDistance> PathDistances = TArray<FTerrain_CellDistance>();
+	PathDistancesOut.Reserve(StartRoomCorridorDoors.Num() * EndRoomCorridorDoors.Num());
 	FTerrain_CellDistance CellDistance = FTerrain_CellDistance();
 
 	for (const FIntPoint& StartDoor : StartRoomCorridorDoors)
@@ -188,17 +267,15 @@ TArray<FTerrain_CellDistance> FCorridorLayoutWorker::GenerateAllCorridorsPathsDi
 			CellDistance.CellA = StartDoor;
 			CellDistance.CellB = EndDoor;
 			CellDistance.UnitCellDistance = GetCellUnitDistanceBetweenCells(StartDoor, EndDoor);
-			PathDistances.Add(CellDistance);
+			PathDistancesOut.Add(CellDistance);
 		}
 	}
-
-	return PathDistances;
 }
 
-FTerrain_CellDistance FCorridorLayoutWorker::SelectCorridorPath(const TArray<FTerrain_CellDistance>& PathsDistanceIn, int32& PathIndexOut) const
+FTerrain_CellDistance FCorridorLayoutWorker::SelectCorridorPath(const FCellDistanceScratchArray& PathsDistanceIn, int32& PathIndexOut) const
 {
 	FTerrain_CellDistance SelectedPath = FTerrain_CellDistance();
-	TArray<FTerrain_CellDistance> MinDistancePaths = TArray<FTerrain_CellDistance>();
+	FCellDistanceScratchArray MinDistancePaths;
 	int32 RandomIndex = 0;
 	int32 MinimunDistance = 0;
 
@@ -209,10 +286,9 @@ FTerrain_CellDistance FCorridorLayoutWorker::SelectCorridorPath(const TArray<FTe
 		SelectedPath = PathsDistanceIn[RandomIndex];
 		break;
 	case ETerrainGen_CorridorPathSelection::Threshold:		
-		MinDistancePaths = GetMinimunCellDistancePaths(PathsDistanceIn);
-		MinimunDistance = MinDistancePaths[0].UnitCellDistance;
+		MinimunDistance = GetMinimunCellDistance(PathsDistanceIn);
 		
-		MinDistancePaths = GetThresholdCellDistance(PathsDistanceIn, TerrainLayoutData->CorridorSelectionThreshold + MinimunDistance);
+		GetThresholdCellDistance(PathsDistanceIn, TerrainLayoutData->CorridorSelectionThreshold + MinimunDistance, MinDistancePaths);
 		
 		RandomIndex = Stream.RandRange(0, MinDistancePaths.Num() - 1);
 		SelectedPath = MinDistancePaths[RandomIndex];
@@ -224,48 +300,70 @@ FTerrain_CellDistance FCorridorLayoutWorker::SelectCorridorPath(const TArray<FTe
 	return SelectedPath;
 }
 
-TArray<FTerrain_CellDistance> FCorridorLayoutWorker::GetMinimunCellDistancePaths(const TArray<FTerrain_CellDistance>& PathsDistanceIn) const
+int32 FCorridorLayoutWorker::GetMinimunCellDistance(const FCellDistanceScratchArray& PathsDistanceIn) const
 {
-	int SmallestDistance = 10000000;
-	TArray<FTerrain_CellDistance> AllSelectedPaths = TArray<FTerrain_CellDistance>();
+	int32 SmallestDistance = 10000000;
 	
 	for (const FTerrain_CellDistance& Path : PathsDistanceIn)
 	{
-		if (Path.UnitCellDistance < SmallestDistance)
-		{
-			SmallestDistance = Path.UnitCellDistance;
-			AllSelectedPaths.Empty();
-			AllSelectedPaths.Add(Path);
-		}
-		else if (Path.UnitCellDistance == SmallestDistance)
-		{
-			AllSelectedPaths.Add(Path);
-		}
+		SmallestDistance = FMath::Min(SmallestDistance, Path.UnitCellDistance);
 	}
 
-	return AllSelectedPaths;
+	return SmallestDistance;
 }
 
-TArray<FTerrain_CellDistance> FCorridorLayoutWorker::GetThresholdCellDistance(const TArray<FTerrain_CellDistance>& PathsDistanceIn, int32 Threshold) const
+void FCorridorLayoutWorker::GetThresholdCellDistance(const FCellDistanceScratchArray& PathsDistanceIn, int32 Threshold, FCellDistanceScratchArray& PathsDistanceOut) const
 {
-	TArray<FTerrain_CellDistance> AllSelectedPaths = TArray<FTerrain_CellDistance>();
-	
 	for (const FTerrain_CellDistance& Path : PathsDistanceIn)
 	{
 		if (Path.UnitCellDistance <= Threshold)
 		{
-			AllSelectedPaths.Add(Path);
+			PathsDistanceOut.Add(Path);
 		}
 	}
+}
 
-	return AllSelectedPaths;
+TArray<FIntPoint> FCorridorLayoutWorker::GenerateCachedPath(const FIntPoint& StartCell, const FIntPoint& EndCell, bool& SuccesOut) const
+{
+	if (!PathCache.IsValid() || MaxPathIterations != DefaultMaxPathIterations)
+	{
+		return GeneratePath(StartCell, EndCell, SuccesOut);
+	}
+
+	TArray<FIntPoint> Path;
+	if (PathCache->FindPath(StartCell, EndCell, [this](const FIntPoint& Cell) { return IsNodeBlocking(Cell); }, SuccesOut, Path))
+	{
+		PathCacheHits++;
+		return Path;
+	}
+
+	PathCacheMisses++;
+	PathQueries.Reset();
+	Path = GeneratePath(StartCell, EndCell, SuccesOut, &PathQueries);
+
+	if (!IsCancelled()) //A cancelled search did not end, its result is not the path.
+	{
+		PathCache->AddPath(StartCell, EndCell, PathQueries, SuccesOut, Path);
+	}
+
+	return Path;
 }
 
-TArray<FIntPoint> FCorridorLayoutWorker::GeneratePath(const FIntPoint& StartCell, const FIntPoint& EndCell, bool& SuccesOut) const
+TArray<FIntPoint> FCorridorLayoutWorker::GeneratePath(const FIntPoint& StartCell, const FIntPoint& EndCell, bool& SuccesOut, FTerrainLayoutPathQueries* QueriesOut) const
 {
-	TArray<FPathFindingCellData> NodesTrack = TArray<FPathFindingCellData>(); //Nodes track
+	TRACE_CPUPROFILER_EVENT_SCOPE(FCorridorLayoutWorker::GeneratePath);
 
-	if (IsNodeBlocking(EndCell))
+	//Failed paths are retried inside the same corridor, so each search releases its own nodes.
+	FMemMark PathMark(FMemStack::Get());
+	FPathNodesTrack NodesTrack; //Nodes track
+
+	const bool bIsEndCellBlocking = IsNodeBlocking(EndCell);
+	if (QueriesOut)
+	{
+		QueriesOut->Add(EndCell, bIsEndCellBlocking);
+	}
+
+	if (bIsEndCellBlocking)
 	{
 		SuccesOut = false;
 		UE_LOG(TerrainGeneratorLog, Error, TEXT("FCorridorLayoutWorker::GeneratePath -  End cell of path is blocking cell. Aborted corridor generation."));
@@ -277,7 +375,8 @@ TArray<FIntPoint> FCorridorLayoutWorker::GeneratePath(const FIntPoint& StartCell
 	CurrentAdjacentNodeTrack.State = EPathFindingNodeState::Open;
 	NodesTrack.Add(CurrentAdjacentNodeTrack);
 
-	TArray<FIntPoint> AdjacentCells = TArray<FIntPoint>();
+	TArray<FIntPoint, TInlineAllocator<4>> AdjacentCells;
+	float AdjacentHeuristicCosts[4];
 
 	int CurrentNodeIndex = 0;
 
@@ -286,10 +385,16 @@ TArray<FIntPoint> FCorridorLayoutWorker::GeneratePath(const FIntPoint& StartCell
 	bool whileEnable = true;
 	int32 whilecounter = 0;
 
-	while (whileEnable && whilecounter < 100)
+	while (whileEnable && whilecounter < MaxPathIterations)
 	{
 		whilecounter++;
 
+		if (IsCancelled())
+		{
+			SuccesOut = false;
+			return TArray<FIntPoint>();
+		}
+
 		FoundFirstOpenNode = false;
 
 		for (int i = 1; i < NodesTrack.Num(); i++)
@@ -313,6 +418,11 @@ TArray<FIntPoint> FCorridorLayoutWorker::GeneratePath(const FIntPoint& StartCell
 		}
 		
 		NodesTrack[CurrentNodeIndex].State = EPathFindingNodeState::Closed;
+
+		if (bCollectSearchHeatmap)
+		{
+			AddSearchedCell(NodesTrack[CurrentNodeIndex].Cell_ID, NodesTrack[CurrentNodeIndex].GetFCost());
+		}
 		
 		if (NodesTrack[CurrentNodeIndex].Cell_ID == EndCell)
 		{	
@@ -322,23 +432,33 @@ TArray<FIntPoint> FCorridorLayoutWorker::GeneratePath(const FIntPoint& StartCell
 		else //did not end the while
 		{
 			//Get Current node adyacent cells
-			AdjacentCells = UTerrainLayoutFunctionLibrary::GetAdyacentCellsOfCell(NodesTrack[CurrentNodeIndex].Cell_ID);
+			GetAdjacentCells(NodesTrack[CurrentNodeIndex].Cell_ID, AdjacentCells);
+
+			//Adjacent cells are always one cell away, so only the heuristic needs a distance. All of them in one pass.
+			FTerrainLayoutKernels::DistancesToCell(AdjacentCells, EndCell, CellSize, AdjacentHeuristicCosts);
 
-			for (const FIntPoint& CurrentAdyCell : AdjacentCells)
+			for (int32 AdjacentIndex = 0; AdjacentIndex < AdjacentCells.Num(); AdjacentIndex++)
 			{
+				const FIntPoint& CurrentAdyCell = AdjacentCells[AdjacentIndex];
 				CurrentAdjacentNodeTrack = GetPathNodeTrack(CurrentAdyCell, NodesTrack);
 				
 				if (CurrentAdjacentNodeTrack.State == EPathFindingNodeState::Closed) continue;
 				
-				if(IsNodeBlocking(CurrentAdyCell)) continue; //If using path weight instead, this line should be removed. The problem is that weights are not useful in this situation since corridors are all independant etc.
+				const bool bIsAdyCellBlocking = IsNodeBlocking(CurrentAdyCell);
+				if (QueriesOut)
+				{
+					QueriesOut->Add(CurrentAdyCell, bIsAdyCellBlocking);
+				}
+
+				if(bIsAdyCellBlocking) continue; //If using path weight instead, this line should be removed. The problem is that weights are not useful in this situation since corridors are all independant etc.
 				
-				NewMovementCostToAdyacent = NodesTrack[CurrentNodeIndex].GCost + UTerrainLayoutFunctionLibrary::GetWorldDistanceBetweenCells(NodesTrack[CurrentNodeIndex].Cell_ID, CurrentAdyCell, CellSize);// +GetNodePathWeigth(CurrentAdyCell);
+				NewMovementCostToAdyacent = NodesTrack[CurrentNodeIndex].GCost + CellSize;// +GetNodePathWeigth(CurrentAdyCell);
 
 				//If the cost is lower or the current ady is not in open array
 				if (NewMovementCostToAdyacent < CurrentAdjacentNodeTrack.GCost || CurrentAdjacentNodeTrack.State != EPathFindingNodeState::Open)
 				{
 					CurrentAdjacentNodeTrack.GCost = NewMovementCostToAdyacent;
-					CurrentAdjacentNodeTrack.HCost = UTerrainLayoutFunctionLibrary::GetWorldDistanceBetweenCells(CurrentAdyCell, EndCell, CellSize);
+					CurrentAdjacentNodeTrack.HCost = AdjacentHeuristicCosts[AdjacentIndex];
 					CurrentAdjacentNodeTrack.Parent = NodesTrack[CurrentNodeIndex].Cell_ID;
 					
 					CurrentAdjacentNodeTrack.State = EPathFindingNodeState::Open;
@@ -348,25 +468,27 @@ TArray<FIntPoint> FCorridorLayoutWorker::GeneratePath(const FIntPoint& StartCell
 			}
 		}
 
-		if (whilecounter >= 100) // Sometimes the path is invalid if attempts to go outside the level borders. We will choose another path.
+		if (whilecounter >= MaxPathIterations) // Sometimes the path is invalid if attempts to go outside the level borders. We will choose another path.
 		{
 			whileEnable = false;
 			SuccesOut = false;
-			UE_LOG(TerrainGeneratorLog, Log, TEXT("FCorridorLayoutWorker::GeneratePath -  Generate Path failed reaching max While Counter: %i."), whilecounter);
+			UE_LOG(TerrainGeneratorLog, Verbose, TEXT("FCorridorLayoutWorker::GeneratePath -  Generate Path failed reaching max While Counter: %i."), whilecounter);
 		}
 	}
 
-	UE_LOG(TerrainGeneratorLog, Log, TEXT("FCorridorLayoutWorker::GeneratePath -  Generate Path While Counter: %i."), whilecounter);
+	UE_LOG(TerrainGeneratorLog, Verbose, TEXT("FCorridorLayoutWorker::GeneratePath -  Generate Path While Counter: %i."), whilecounter);
+	PathNodesExpanded += whilecounter;
 
 	if (!SuccesOut)
 	{
+		FailedPathsAmount++;
 		return TArray<FIntPoint>();
 	}
 	
 	return RetracePath(StartCell, EndCell, NodesTrack);
 }
 
-TArray<FIntPoint> FCorridorLayoutWorker::RetracePath(const FIntPoint& StartCell, const FIntPoint& EndCell, const TArray<FPathFindingCellData>& TrackIn) const
+TArray<FIntPoint> FCorridorLayoutWorker::RetracePath(const FIntPoint& StartCell, const FIntPoint& EndCell, const FPathNodesTrack& TrackIn) const
 {
 	if (TrackIn.Num() == 0)
 	{
@@ -378,8 +500,9 @@ TArray<FIntPoint> FCorridorLayoutWorker::RetracePath(const FIntPoint& StartCell,
 
 	FIntPoint CurrentNode = EndCell;  //Start from the end cell and trace path backwards
 	int32 whilecounter = 0;
+	const int32 MaxRetraceIterations = FMath::Max(500, MaxPathIterations);
 
-	while (CurrentNode != StartCell && whilecounter<500)
+	while (CurrentNode != StartCell && whilecounter < MaxRetraceIterations)
 	{
 		whilecounter++;
 		Path.AddUnique(CurrentNode);
@@ -388,18 +511,133 @@ TArray<FIntPoint> FCorridorLayoutWorker::RetracePath(const FIntPoint& StartCell,
 
 	Path.AddUnique(StartCell); //Start cell is not added at the end of the while loop. I add it manually
 
-	if (whilecounter >= 500)
+	if (whilecounter >= MaxRetraceIterations)
 	{
 		UE_LOG(TerrainGeneratorLog, Error, TEXT("FCorridorLayoutWorker::RetracePath - Retraced Path failed since reaching max while counter: %i"), whilecounter);
 	}
 	else
 	{
-		UE_LOG(TerrainGeneratorLog, Log, TEXT("FCorridorLayoutWorker::RetracePath - Retraced Path with %i cells. While counter: %i"), Path.Num(), whilecounter);
+		UE_LOG(TerrainGeneratorLog, Verbose, TEXT("FCorridorLayoutWorker::RetracePath - Retraced Path with %i cells. While counter: %i"), Path.Num(), whilecounter);
 	}
 	
 	return Path;
 }
 
+bool FCorridorLayoutWorker::GenerateFlowFieldPath(const FIntPoint& StartRoom, const FIntPoint& EndCell, TArray<FIntPoint>& PathOut, FIntPoint& StartCellOut) const
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(FCorridorLayoutWorker::GenerateFlowFieldPath);
+
+	const FCorridorFlowField* FlowField = FlowFields.Find(StartRoom);
+	if (!FlowField)
+	{
+		FCorridorFlowField& NewFlowField = FlowFields.Add(StartRoom);
+		GenerateFlowField(StartRoom, NewFlowField);
+		FlowField = &NewFlowField;
+		FlowFieldsAmount++;
+		FlowFieldsBytes += NewFlowField.GetAllocatedSize();
+	}
+
+	const FCorridorFlowFieldCell* EndFieldCell = FlowField->Find(EndCell);
+	if (!EndFieldCell)
+	{
+		return false;
+	}
+
+	//Same order as RetracePath, from the end cell back to the start cell.
+	const FIntPoint Door = EndFieldCell->Door;
+	PathOut.Reset(EndFieldCell->Distance + 1);
+	PathOut.Add(EndCell);
+
+	TArray<FIntPoint, TInlineAllocator<4>> AdjacentCells;
+	FIntPoint CurrentNode = EndCell;
+
+	//Each cell was reached from a cell of the same door one step closer, so that one always exists.
+	for (int32 Distance = EndFieldCell->Distance; Distance > 0; Distance--)
+	{
+		GetAdjacentCells(CurrentNode, AdjacentCells);
+
+		for (const FIntPoint& AdjacentCell : AdjacentCells)
+		{
+			const FCorridorFlowFieldCell* AdjacentFieldCell = FlowField->Find(AdjacentCell);
+			if (AdjacentFieldCell && AdjacentFieldCell->Distance == Distance - 1 && AdjacentFieldCell->Door == Door)
+			{
+				CurrentNode = AdjacentCell;
+				break;
+			}
+		}
+
+		PathOut.Add(CurrentNode);
+	}
+
+	StartCellOut = Door;
+	FlowFieldPathsAmount++;
+	return true;
+}
+
+void FCorridorLayoutWorker::GenerateFlowField(const FIntPoint& StartRoom, FCorridorFlowField& FlowFieldOut) const
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(FCorridorLayoutWorker::GenerateFlowField);
+
+	FMemMark FlowFieldMark(FMemStack::Get());
+	FCellScratchArray Frontier;
+	GetAllCorridorDoorsOfRoom(StartRoom, Frontier);
+
+	const int32 Radius = TerrainLayoutData->FlowFieldRadius;
+	FlowFieldOut.Reserve(Frontier.Num() + 2 * Radius * Radius);
+
+	for (const FIntPoint& Door : Frontier)
+	{
+		FCorridorFlowFieldCell DoorCell = FCorridorFlowFieldCell();
+		DoorCell.Door = Door;
+		FlowFieldOut.Add(Door, DoorCell);
+	}
+
+	TArray<FIntPoint, TInlineAllocator<4>> AdjacentCells;
+	for (int32 i = 0; i < Frontier.Num(); i++)
+	{
+		if (IsCancelled())
+		{
+			break;
+		}
+
+		const FIntPoint Cell = Frontier[i];
+		const FCorridorFlowFieldCell FieldCell = FlowFieldOut.FindChecked(Cell);
+
+		if (bCollectSearchHeatmap)
+		{
+			AddSearchedCell(Cell, FieldCell.Distance * CellSize);
+		}
+
+		if (FieldCell.Distance >= Radius)
+		{
+			continue;
+		}
+
+		GetAdjacentCells(Cell, AdjacentCells);
+
+		for (const FIntPoint& AdjacentCell : AdjacentCells)
+		{
+			if (IsNodeBlocking(AdjacentCell) || FlowFieldOut.Contains(AdjacentCell))
+			{
+				continue;
+			}
+
+			FCorridorFlowFieldCell AdjacentFieldCell = FCorridorFlowFieldCell();
+			AdjacentFieldCell.Distance = FieldCell.Distance + 1;
+			AdjacentFieldCell.Door = FieldCell.Door;
+			FlowFieldOut.Add(AdjacentCell, AdjacentFieldCell);
+			Frontier.Add(AdjacentCell);
+		}
+	}
+
+	PathNodesExpanded += Frontier.Num();
+}
+
+void FCorridorLayoutWorker::AddSearchedCell(const FIntPoint& CellIn, float CostIn) const
+{
+	SearchHeatmap.FindOrAdd(CellIn).Add(1, CostIn);
+}
+
 float FCorridorLayoutWorker::GetNodePathWeigth(const FIntPoint& NodeIn) const
 {
 	int32 NodePathingWeight = 0; //Default value, no penalty for empty cells
@@ -427,11 +665,29 @@ float FCorridorLayoutWorker::GetNodePathWeigth(const FIntPoint& NodeIn) const
 	return NodePathingWeight;
 }
 
+bool FCorridorLayoutWorker::IsCancelled() const
+{
+	return CancellationToken.IsValid() && CancellationToken->IsCancelled();
+}
+
+void FCorridorLayoutWorker::ReportKeptBytes()
+{
+	if (!CancellationToken.IsValid())
+	{
+		return;
+	}
+
+	//The path search scratch data is in the mem stack and released per corridor, it is not kept.
+	const int64 KeptBytes = GeneratedCorridorLayout.GetAllocatedSize() + KeptCorridorCellsBytes + FlowFields.GetAllocatedSize() + FlowFieldsBytes + SearchHeatmap.GetAllocatedSize();
+	CancellationToken->AddWorkerBytes(KeptBytes - ReportedBytes);
+	ReportedBytes = KeptBytes;
+}
+
 bool FCorridorLayoutWorker::IsNodeBlocking(const FIntPoint& NodeIn) const
 {
 	bool IsBlocking = false; //Default value, no penalty for empty cells
 
-	if (CellsLayoutMap.Contains(NodeIn))
+	if (CellsLayoutMap->Contains(NodeIn))
 	{
 		IsBlocking = true;
 	}
@@ -439,7 +695,16 @@ bool FCorridorLayoutWorker::IsNodeBlocking(const FIntPoint& NodeIn) const
 	return IsBlocking;
 }
 
-int32 FCorridorLayoutWorker::SetPathNodeTrack(const FIntPoint& NodeIn, const FPathFindingCellData& NewValue, TArray<FPathFindingCellData>& TrackOut) const
+void FCorridorLayoutWorker::GetAdjacentCells(const FIntPoint& CellIn, TArray<FIntPoint, TInlineAllocator<4>>& AdjacentCellsOut) const
+{
+	AdjacentCellsOut.Reset();
+	AdjacentCellsOut.Add(FIntPoint(CellIn.X + 1, CellIn.Y));
+	AdjacentCellsOut.Add(FIntPoint(CellIn.X - 1, CellIn.Y));
+	AdjacentCellsOut.Add(FIntPoint(CellIn.X, CellIn.Y + 1));
+	AdjacentCellsOut.Add(FIntPoint(CellIn.X, CellIn.Y - 1));
+}
+
+int32 FCorridorLayoutWorker::SetPathNodeTrack(const FIntPoint& NodeIn, const FPathFindingCellData& NewValue, FPathNodesTrack& TrackOut) const
 {
 	bool UpdatedNode = false;
 	int32 index = -1;
@@ -466,7 +731,7 @@ int32 FCorridorLayoutWorker::SetPathNodeTrack(const FIntPoint& NodeIn, const FPa
 	return index;
 }
 
-FPathFindingCellData FCorridorLayoutWorker::GetPathNodeTrack(const FIntPoint& NodeIn, const TArray<FPathFindingCellData>& TrackIn) const
+FPathFindingCellData FCorridorLayoutWorker::GetPathNodeTrack(const FIntPoint& NodeIn, const FPathNodesTrack& TrackIn) const
 {
 	FPathFindingCellData TrackOut = FPathFindingCellData();
 	TrackOut.Cell_ID = NodeIn; 	// If the node is not found, returns the empty struct, but must ensure the ID is correct
@@ -485,8 +750,7 @@ FPathFindingCellData FCorridorLayoutWorker::GetPathNodeTrack(const FIntPoint& No
 
 void FCorridorLayoutWorker::GenerateCorridorRange(FCorridorLayout& CorridorLayoutOut) const
 {
-	TArray <FIntPoint> GeneratedCells;
-	GeneratedCells.Empty();
+	FCellScratchArray GeneratedCells;
 
 	const int32 GeneratedRange = Stream.RandRange(TerrainLayoutData->CorridorsMinRange, TerrainLayoutData->CorridorsMaxRange);
 
@@ -496,7 +760,7 @@ void FCorridorLayoutWorker::GenerateCorridorRange(FCorridorLayout& CorridorLayou
 
 		for (const FIntPoint& CurrentGenCell : CurrentGeneratedCells)
 		{
-			if (CellsLayoutMap.Contains(CurrentGenCell))
+			if (CellsLayoutMap->Contains(CurrentGenCell))
 			{
 				continue;
 			}
@@ -6,18 +6,60 @@
 #include "MultiThread/BaseTerrainWorker.h"
 #include "Layout/LayoutTypes.h"
 #include "Layout/CorridorTypes.h"
+#include "Layout/TerrainLayoutCancellation.h"
+#include "Layout/TerrainLayoutStream.h"
+#include "Layout/TerrainLayoutPathCache.h"
+#include "Layout/TerrainLayoutStats.h"
+#include "Layout/TerrainLayoutCellsMap.h"
+#include "Misc/MemStack.h"
 
 class UTerrainLayoutData;
 
+/* Scratch containers of the corridor search. Allocated in the worker thread FMemStack and released in bulk by FMemMark.*/
+typedef TArray<FPathFindingCellData, TMemStackAllocator<>> FPathNodesTrack;
+typedef TArray<FTerrain_CellDistance, TMemStackAllocator<>> FCellDistanceScratchArray;
+typedef TArray<FIntPoint, TMemStackAllocator<>> FCellScratchArray;
+
+/* A cell of a room flow field: the distance in cells to the nearest door of the room, and that door.*/
+struct FCorridorFlowFieldCell
+{
+	int32 Distance = 0;
+	FIntPoint Door = FIntPoint::ZeroValue;
+};
+
+typedef TMap<FIntPoint, FCorridorFlowFieldCell> FCorridorFlowField;
+
 /* Single corridor layout worker for multithreading.*/
 class TERRAINGENERATOR_API FCorridorLayoutWorker : public FBaseTerrainWorker
 {
 public:
-	FCorridorLayoutWorker(float CellSizeIn, TArray <FTerrain_RoomDistance> StartEndRoomIn, UTerrainLayoutData* TerrainLayoutDataIn, const TMap <FIntPoint, FRoomLayout>& RoomsLayoutMapIn, const TMap <FIntPoint, FCellLayout>& CellsLayoutMapIn);
+	FCorridorLayoutWorker(float CellSizeIn, TArray <FTerrain_RoomDistance> StartEndRoomIn, UTerrainLayoutData* TerrainLayoutDataIn, const TSharedRef<const TMap <FIntPoint, FRoomLayout>>& RoomsLayoutMapIn, const TSharedRef<const FTerrainLayoutCellsMap>& CellsLayoutMapIn, const FTerrainLayoutCancellationTokenPtr& CancellationTokenIn, const FTerrainLayoutStreamQueuePtr& StreamQueueIn);
 
 	uint32 Run() override;
 
+	/* The corridors to merge when the thread ends. Empty when the corridors are streamed.*/
 	TArray <FCorridorLayout> GeneratedCorridorLayout;
+
+	int32 GeneratedCorridorsAmount = 0;
+
+	/* Nodes a path search can expand before the path is considered invalid.*/
+	static const int32 DefaultMaxPathIterations = 100;
+	int32 MaxPathIterations = DefaultMaxPathIterations;
+
+	/* Start rooms whose corridors follow a single flow field of the room instead of a path search each.*/
+	TSet<FIntPoint> FlowFieldRooms;
+
+	/* If valid, path searches are looked up here first and added after searching. Only used with the default MaxPathIterations, that the cached paths were searched with.*/
+	FTerrainLayoutPathCachePtr PathCache;
+
+	/* If the expanded cells are counted one by one for the search heatmaps, besides the totals of the stats.*/
+	bool bCollectSearchHeatmap = false;
+
+	/* If set, called from the worker thread once per corridor, with its index in the stage. The layout is null for the failed corridors.*/
+	TFunction<void(int32 CorridorIndexIn, const FCorridorLayout* LayoutIn)> OnCorridorEnd;
+
+	/* Index in the stage of the first corridor of the worker.*/
+	int32 FirstCorridorIndex = 0;
 		
 	virtual void OnThreadEnd() override;
 
@@ -28,9 +70,50 @@ private:
 
 	TArray <FTerrain_RoomDistance> StartEndRoom;	
 
-	TMap<FIntPoint, FCellLayout> CellsLayoutMap;
+	/* Read only copies of the layout at the start of the stage, shared by all the corridor workers.*/
+	TSharedRef<const FTerrainLayoutCellsMap> CellsLayoutMap;
+
+	TSharedRef<const TMap <FIntPoint, FRoomLayout>> RoomsLayoutMap;
+
+	/* The generation this worker belongs to. When cancelled the worker stops and its results are discarded.*/
+	FTerrainLayoutCancellationTokenPtr CancellationToken;
 
-	TMap <FIntPoint, FRoomLayout> RoomsLayoutMap;
+	bool IsCancelled() const;
+
+	/* Counters of the path searches, reported to the layout stats when the thread ends. Updated by the const search functions.*/
+	mutable int64 PathNodesExpanded = 0;
+	mutable int32 FailedPathsAmount = 0;
+
+	mutable int32 FlowFieldsAmount = 0;
+	mutable int32 FlowFieldPathsAmount = 0;
+	mutable int32 PathCacheHits = 0;
+	mutable int32 PathCacheMisses = 0;
+
+	/* Expanded cells of this worker only, so the searches do not share anything. Added to the subsystem heatmap when the thread ends.*/
+	mutable FTerrainLayoutSearchHeatmap SearchHeatmap;
+
+	void AddSearchedCell(const FIntPoint& CellIn, float CostIn) const;
+
+	/* The cells asked by the last path search, to add it to the path cache. Reused by all the searches of the worker.*/
+	mutable FTerrainLayoutPathQueries PathQueries;
+
+	double BusySeconds = 0;
+	double StartTime = 0;
+	uint32 ThreadId = 0;
+
+	/* Flow field of each start room, from all its doors at once. Kept for the whole worker, so every corridor of the room after the first only walks it.*/
+	mutable TMap<FIntPoint, FCorridorFlowField> FlowFields;
+	mutable int64 FlowFieldsBytes = 0;
+
+	/* Memory the worker keeps until the merge, reported to the generation token for its memory budget.*/
+	int64 KeptCorridorCellsBytes = 0;
+	int64 ReportedBytes = 0;
+
+	/* Adds the change of the kept memory since the last report to the generation token.*/
+	void ReportKeptBytes();
+
+	/* If valid, each corridor is pushed here as soon as it is generated.*/
+	FTerrainLayoutStreamQueuePtr StreamQueue;
 					
 	/**
 	*	Generates a sub grid layout data for a corridor, that can be populated with Terrains after.
@@ -39,29 +122,42 @@ private:
 	*/
 	FCorridorLayout	GenerateCorridorLayout(const FTerrain_RoomDistance& StartEndRoomIn, bool& SuccesOut) const;
 	
-	TArray <FIntPoint> GetAllCorridorDoorsOfRoom(const FIntPoint& RoomIn) const;
+	void GetAllCorridorDoorsOfRoom(const FIntPoint& RoomIn, FCellScratchArray& DoorsOut) const;
 
 	int32 GetCellUnitDistanceBetweenCells(const FIntPoint& CellA, const FIntPoint& CellB) const;
 	
-	TArray <FTerrain_CellDistance> GenerateAllCorridorsPathsDistance(const FIntPoint& StartRoomIn, const FIntPoint& EndRoomIn) const;
+	void GenerateAllCorridorsPathsDistance(const FIntPoint& StartRoomIn, const FIntPoint& EndRoomIn, FCellDistanceScratchArray& PathDistancesOut) const;
 
-	FTerrain_CellDistance SelectCorridorPath(const TArray<FTerrain_CellDistance>& PathsDistanceIn, int32& PathIndexOut) const;
+	FTerrain_CellDistance SelectCorridorPath(const FCellDistanceScratchArray& PathsDistanceIn, int32& PathIndexOut) const;
 	
-	TArray <FTerrain_CellDistance> GetMinimunCellDistancePaths(const TArray<FTerrain_CellDistance>& PathsDistanceIn) const;
+	int32 GetMinimunCellDistance(const FCellDistanceScratchArray& PathsDistanceIn) const;
 	
-	TArray <FTerrain_CellDistance> GetThresholdCellDistance(const TArray<FTerrain_CellDistance>& PathsDistanceIn, int32 Threshold = 1) const;
+	void GetThresholdCellDistance(const FCellDistanceScratchArray& PathsDistanceIn, int32 Threshold, FCellDistanceScratchArray& PathsDistanceOut) const;
 	
-	TArray <FIntPoint> GeneratePath(const FIntPoint& StartCell, const FIntPoint& EndCell, bool& SuccesOut) const;
+	/* QueriesOut receives the cells the search asked about, if valid.*/
+	TArray <FIntPoint> GeneratePath(const FIntPoint& StartCell, const FIntPoint& EndCell, bool& SuccesOut, FTerrainLayoutPathQueries* QueriesOut = nullptr) const;
+
+	/* GeneratePath through the path cache.*/
+	TArray <FIntPoint> GenerateCachedPath(const FIntPoint& StartCell, const FIntPoint& EndCell, bool& SuccesOut) const;
 	
-	TArray <FIntPoint> RetracePath(const FIntPoint& StartCell, const FIntPoint& EndCell, const TArray<FPathFindingCellData>& TrackIn) const;
+	TArray <FIntPoint> RetracePath(const FIntPoint& StartCell, const FIntPoint& EndCell, const FPathNodesTrack& TrackIn) const;
+
+	/* Follows the flow field of the start room from the end cell down to the nearest door, returned in StartCellOut. Returns false if the end cell is out of the field.*/
+	bool GenerateFlowFieldPath(const FIntPoint& StartRoom, const FIntPoint& EndCell, TArray<FIntPoint>& PathOut, FIntPoint& StartCellOut) const;
+
+	/* Breadth first distances over the free cells from all the doors of the room at once, up to FlowFieldRadius from the nearest door.*/
+	void GenerateFlowField(const FIntPoint& StartRoom, FCorridorFlowField& FlowFieldOut) const;
+
+	/* The four orthogonal neighbours of a cell, as UTerrainLayoutFunctionLibrary::GetAdyacentCellsOfCell, without allocating.*/
+	void GetAdjacentCells(const FIntPoint& CellIn, TArray<FIntPoint, TInlineAllocator<4>>& AdjacentCellsOut) const;
 	
 	float GetNodePathWeigth(const FIntPoint& NodeIn) const;
 	
 	bool IsNodeBlocking(const FIntPoint& NodeIn) const;
 	
-	int32 SetPathNodeTrack(const FIntPoint& NodeIn, const FPathFindingCellData& NewValue, TArray<FPathFindingCellData>& TrackOut) const;
+	int32 SetPathNodeTrack(const FIntPoint& NodeIn, const FPathFindingCellData& NewValue, FPathNodesTrack& TrackOut) const;
 	
-	FPathFindingCellData GetPathNodeTrack(const FIntPoint& NodeIn, const TArray<FPathFindingCellData>& TrackIn) const;
+	FPathFindingCellData GetPathNodeTrack(const FIntPoint& NodeIn, const FPathNodesTrack& TrackIn) const;
 
 	void GenerateCorridorRange(FCorridorLayout& CorridorLayoutOut) const;
 };
@@ -0,0 +1,38 @@
+//Copyright 2020 Marchetti S. Alfredo I. All Rights Reserved.
+
+#include "TerrainGeneratorMemory.h"
+
+LLM_DEFINE_TAG(TerrainGenerator);
+LLM_DEFINE_TAG(TerrainGenerator_Layout);
+LLM_DEFINE_TAG(TerrainGenerator_LayoutWorkers);
+LLM_DEFINE_TAG(TerrainGenerator_LayoutPathCache);
+LLM_DEFINE_TAG(TerrainGenerator_Biomes);
+LLM_DEFINE_TAG(TerrainGenerator_Mesh);
+
+namespace TerrainGeneratorMemory
+{
+	bool IsTracked()
+	{
+#if ENABLE_LOW_LEVEL_MEM_TRACKER
+		return FLowLevelMemTracker::IsEnabled();
+#else
+		return false;
+#endif
+	}
+
+	int64 GetLayoutTrackedBytes()
+	{
+#if ENABLE_LOW_LEVEL_MEM_TRACKER
+		if (!IsTracked())
+		{
+			return 0;
+		}
+
+		FLowLevelMemTracker& Tracker = FLowLevelMemTracker::Get();
+		return Tracker.GetTagAmountForTracker(ELLMTracker::Default, LLM_TAG_NAME(TerrainGenerator_Layout), ELLMTagSet::None)
+			+ Tracker.GetTagAmountForTracker(ELLMTracker::Default, LLM_TAG_NAME(TerrainGenerator_LayoutWorkers), ELLMTagSet::None);
+#else
+		return 0;
+#endif
+	}
+}
@@ -0,0 +1,37 @@
+//Copyright 2020 Marchetti S. Alfredo I. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/LowLevelMemTracker.h"
+
+/**
+*	Low level memory tracker tags of the terrain generator. Shown under TerrainGenerator in the LLM stats and in memreport, when LLM is enabled.
+*	The innermost scope of a thread tags its allocations, so worker scopes inside a stage scope are tagged as workers.
+*/
+LLM_DECLARE_TAG_API(TerrainGenerator, TERRAINGENERATOR_API);
+
+/* The layout maps of the subsystem and the merges into them.*/
+LLM_DECLARE_TAG_API(TerrainGenerator_Layout, TERRAINGENERATOR_API);
+
+/* The layout copies and scratch data of the stage workers and region tasks.*/
+LLM_DECLARE_TAG_API(TerrainGenerator_LayoutWorkers, TERRAINGENERATOR_API);
+
+/* The corridor paths kept between generations.*/
+LLM_DECLARE_TAG_API(TerrainGenerator_LayoutPathCache, TERRAINGENERATOR_API);
+
+LLM_DECLARE_TAG_API(TerrainGenerator_Biomes, TERRAINGENERATOR_API);
+
+LLM_DECLARE_TAG_API(TerrainGenerator_Mesh, TERRAINGENERATOR_API);
+
+namespace TerrainGeneratorMemory
+{
+	/* If LLM is compiled in and enabled, so the tags above have totals.*/
+	TERRAINGENERATOR_API bool IsTracked();
+
+	/**
+	*	Bytes currently tracked under the layout and layout workers tags, by every thread. 0 if not IsTracked.
+	*	The totals are gathered from the threads once per frame by the engine, call FLowLevelMemTracker::UpdateStatsPerFrame before for the exact amount.
+	*/
+	TERRAINGENERATOR_API int64 GetLayoutTrackedBytes();
+}
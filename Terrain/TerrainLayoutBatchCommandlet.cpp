@@ -0,0 +1,281 @@
+//Copyright 2020 Marchetti S. Alfredo I. All Rights Reserved.
+
+#include "Layout/TerrainLayoutBatchCommandlet.h"
+#include "Layout/TerrainLayoutSubsystem.h"
+#include "Terrain/TerrainData.h"
+#include "TerrainGeneratorLogs.h"
+#include "Async/ParallelFor.h"
+#include "UObject/StrongObjectPtr.h"
+#include "JsonObjectConverter.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+
+UTerrainLayoutBatchCommandlet::UTerrainLayoutBatchCommandlet()
+{
+	IsClient = false;
+	IsServer = false;
+	IsEditor = true;
+	LogToConsole = true;
+
+	HelpDescription = TEXT("Generates terrain layouts for a range of seeds in parallel and writes the metrics of each seed.");
+	HelpUsage = TEXT("-run=TerrainLayoutBatch -TerrainData=<Path> -Seeds=<Start>-<End> -Concurrency=<N> -Output=<File> [-Format=CSV|JSON] [-MaxFailedCorridors=<N>] [-CompareBarrier]");
+}
+
+int32 UTerrainLayoutBatchCommandlet::Main(const FString& Params)
+{
+	FString TerrainDataPath;
+	if (!FParse::Value(*Params, TEXT("TerrainData="), TerrainDataPath))
+	{
+		UE_LOG(TerrainGeneratorLog, Error, TEXT("UTerrainLayoutBatchCommandlet::Main - Missing -TerrainData parameter."));
+		return 1;
+	}
+
+	UTerrainData* TerrainData = LoadObject<UTerrainData>(nullptr, *TerrainDataPath);
+	if (!TerrainData)
+	{
+		UE_LOG(TerrainGeneratorLog, Error, TEXT("UTerrainLayoutBatchCommandlet::Main - Could not load terrain data %s."), *TerrainDataPath);
+		return 1;
+	}
+
+	FString SeedsString = TEXT("0-15");
+	FParse::Value(*Params, TEXT("Seeds="), SeedsString);
+
+	TArray<int32> Seeds;
+	if (!ParseSeeds(SeedsString, Seeds))
+	{
+		UE_LOG(TerrainGeneratorLog, Error, TEXT("UTerrainLayoutBatchCommandlet::Main - Invalid seeds range %s. Expected <Start>-<End>."), *SeedsString);
+		return 1;
+	}
+
+	int32 Concurrency = FPlatformMisc::NumberOfCoresIncludingHyperthreads();
+	FParse::Value(*Params, TEXT("Concurrency="), Concurrency);
+	Concurrency = FMath::Clamp(Concurrency, 1, Seeds.Num());
+
+	FString OutputPath = FPaths::ProjectSavedDir() / TEXT("TerrainLayoutBatch") / TEXT("LayoutStats.csv");
+	FParse::Value(*Params, TEXT("Output="), OutputPath);
+
+	FString Format = FPaths::GetExtension(OutputPath);
+	FParse::Value(*Params, TEXT("Format="), Format);
+
+	int32 MaxFailedCorridors = -1;
+	FParse::Value(*Params, TEXT("MaxFailedCorridors="), MaxFailedCorridors);
+
+	//Each slot has its own subsystem, the layout state is stored in the subsystem so they cannot be shared between seeds in flight.
+	TArray<TStrongObjectPtr<UTerrainLayoutSubsystem>> Generators;
+	for (int32 i = 0; i < Concurrency; i++)
+	{
+		Generators.Emplace(NewObject<UTerrainLayoutSubsystem>(GEngine));
+	}
+
+	FTerrainLayoutBatchResult Result = FTerrainLayoutBatchResult();
+	Result.TerrainData = TerrainDataPath;
+	Result.Concurrency = Concurrency;
+	Result.Seeds.SetNum(Seeds.Num());
+
+	const double StartTime = FPlatformTime::Seconds();
+
+	ParallelFor(Concurrency, [&](int32 Slot)
+	{
+		UTerrainLayoutSubsystem* Generator = Generators[Slot].Get();
+
+		for (int32 SeedIndex = Slot; SeedIndex < Seeds.Num(); SeedIndex += Concurrency)
+		{
+			Generator->GenerateTerrainLayoutSynchronous(TerrainData, Seeds[SeedIndex]);
+			Result.Seeds[SeedIndex] = Generator->GetLayoutStats();
+		}
+	});
+
+	Result.TotalSeconds = FPlatformTime::Seconds() - StartTime;
+	Result.SeedsPerSecond = Result.TotalSeconds > 0 ? Seeds.Num() / Result.TotalSeconds : 0;
+	Result.PeakUsedPhysicalBytes = FPlatformMemory::GetStats().PeakUsedPhysical;
+
+	//Same seeds and concurrency, only the barrier between stages changes. Not counted in the batch time.
+	if (FParse::Param(*Params, TEXT("CompareBarrier")))
+	{
+		Result.BarrierCorridorsToRegionsSeconds.SetNum(Seeds.Num());
+
+		ParallelFor(Concurrency, [&](int32 Slot)
+		{
+			UTerrainLayoutSubsystem* Generator = Generators[Slot].Get();
+			Generator->SetPipelineLayoutRegions(false);
+
+			for (int32 SeedIndex = Slot; SeedIndex < Seeds.Num(); SeedIndex += Concurrency)
+			{
+				Generator->GenerateTerrainLayoutSynchronous(TerrainData, Seeds[SeedIndex]);
+				Result.BarrierCorridorsToRegionsSeconds[SeedIndex] = Generator->GetLayoutStats().CorridorsToRegionsSeconds;
+			}
+
+			Generator->SetPipelineLayoutRegions(true);
+		});
+	}
+
+	const FString Output = Format.Equals(TEXT("json"), ESearchCase::IgnoreCase) ? GetResultJson(Result) : GetResultCSV(Result);
+	if (!FFileHelper::SaveStringToFile(Output, *OutputPath))
+	{
+		UE_LOG(TerrainGeneratorLog, Error, TEXT("UTerrainLayoutBatchCommandlet::Main - Could not write output file %s."), *OutputPath);
+		return 1;
+	}
+
+	LogSummary(Result);
+
+	int32 ReturnCode = 0;
+	for (const FTerrainLayoutStats& Stats : Result.Seeds)
+	{
+		if (Stats.RoomsAmount <= 0)
+		{
+			UE_LOG(TerrainGeneratorLog, Error, TEXT("UTerrainLayoutBatchCommandlet::Main - Seed %i generated no rooms."), Stats.Seed);
+			ReturnCode = 1;
+		}
+
+		if (MaxFailedCorridors >= 0 && Stats.FailedCorridorsAmount > MaxFailedCorridors)
+		{
+			UE_LOG(TerrainGeneratorLog, Error, TEXT("UTerrainLayoutBatchCommandlet::Main - Seed %i failed %i corridors. Max allowed: %i."), Stats.Seed, Stats.FailedCorridorsAmount, MaxFailedCorridors);
+			ReturnCode = 1;
+		}
+	}
+
+	return ReturnCode;
+}
+
+bool UTerrainLayoutBatchCommandlet::ParseSeeds(const FString& SeedsIn, TArray<int32>& SeedsOut) const
+{
+	FString StartString;
+	FString EndString;
+
+	if (!SeedsIn.Split(TEXT("-"), &StartString, &EndString))
+	{
+		StartString = SeedsIn;
+		EndString = SeedsIn;
+	}
+
+	if (!StartString.IsNumeric() || !EndString.IsNumeric())
+	{
+		return false;
+	}
+
+	const int32 Start = FCString::Atoi(*StartString);
+	const int32 End = FCString::Atoi(*EndString);
+
+	if (End < Start)
+	{
+		return false;
+	}
+
+	for (int32 Seed = Start; Seed <= End; Seed++)
+	{
+		SeedsOut.Add(Seed);
+	}
+
+	return true;
+}
+
+FString UTerrainLayoutBatchCommandlet::GetResultCSV(const FTerrainLayoutBatchResult& ResultIn) const
+{
+	const UEnum* StageEnum = StaticEnum<ETerrainGen_LayoutStage>();
+	const int32 StagesAmount = StaticCast<int32>(ETerrainGen_LayoutStage::ETLS_MAX);
+
+	FString Output = TEXT("Seed,TotalSeconds");
+	for (int32 i = 0; i < StagesAmount; i++)
+	{
+		Output += FString::Printf(TEXT(",%sSeconds,%sCpuSeconds,%sPeakBytes"), *StageEnum->GetNameStringByIndex(i), *StageEnum->GetNameStringByIndex(i), *StageEnum->GetNameStringByIndex(i));
+	}
+	Output += TEXT(",Rooms,Corridors,FailedCorridors,FailedPaths,PathNodesExpanded,WallCells,Cells,PeakLayoutBytes,CorridorMergeSeconds,Regions,CorridorsToRegionsSeconds,BarrierCorridorsToRegionsSeconds\n");
+
+	for (int32 SeedIndex = 0; SeedIndex < ResultIn.Seeds.Num(); SeedIndex++)
+	{
+		const FTerrainLayoutStats& Stats = ResultIn.Seeds[SeedIndex];
+		Output += FString::Printf(TEXT("%i,%f"), Stats.Seed, Stats.TotalSeconds);
+
+		//The CPU column is left empty for stages whose workers didn't report their times.
+		for (const FTerrainLayoutStageStats& Stage : Stats.Stages)
+		{
+			const FString CpuSeconds = Stage.bWorkerTimesMissing ? FString() : FString::Printf(TEXT("%f"), Stage.CpuSeconds);
+			Output += FString::Printf(TEXT(",%f,%s,%lld"), Stage.WallSeconds, *CpuSeconds, Stage.PeakBytes);
+		}
+
+		//Without -CompareBarrier the barrier column is left empty, not zero.
+		Output += FString::Printf(TEXT(",%i,%i,%i,%i,%lld,%i,%i,%lld,%f,%i,%f,%s\n"),
+			Stats.RoomsAmount,
+			Stats.CorridorsAmount,
+			Stats.FailedCorridorsAmount,
+			Stats.FailedPathsAmount,
+			Stats.PathNodesExpanded,
+			Stats.WallCellsAmount,
+			Stats.CellsAmount,
+			Stats.PeakLayoutBytes,
+			Stats.CorridorMergeSeconds,
+			Stats.RegionsAmount,
+			Stats.CorridorsToRegionsSeconds,
+			ResultIn.BarrierCorridorsToRegionsSeconds.IsValidIndex(SeedIndex) ? *LexToString(ResultIn.BarrierCorridorsToRegionsSeconds[SeedIndex]) : TEXT(""));
+	}
+
+	return Output;
+}
+
+FString UTerrainLayoutBatchCommandlet::GetResultJson(const FTerrainLayoutBatchResult& ResultIn) const
+{
+	FString Output;
+	FJsonObjectConverter::UStructToJsonObjectString(ResultIn, Output);
+	return Output;
+}
+
+void UTerrainLayoutBatchCommandlet::LogSummary(const FTerrainLayoutBatchResult& ResultIn) const
+{
+	if (ResultIn.Seeds.Num() == 0)
+	{
+		return;
+	}
+
+	const UEnum* StageEnum = StaticEnum<ETerrainGen_LayoutStage>();
+	const int32 StagesAmount = StaticCast<int32>(ETerrainGen_LayoutStage::ETLS_MAX);
+
+	UE_LOG(TerrainGeneratorLog, Display, TEXT("UTerrainLayoutBatchCommandlet - %i seeds in %.3fs with %i concurrent generations (%.2f seeds/s). Peak used physical: %.1f MB."),
+		ResultIn.Seeds.Num(),
+		ResultIn.TotalSeconds,
+		ResultIn.Concurrency,
+		ResultIn.SeedsPerSecond,
+		ResultIn.PeakUsedPhysicalBytes / (1024.0 * 1024.0));
+
+	for (int32 i = 0; i < StagesAmount; i++)
+	{
+		double TotalStageSeconds = 0;
+		double MaxStageSeconds = 0;
+		int64 MaxStagePeakBytes = 0;
+
+		for (const FTerrainLayoutStats& Stats : ResultIn.Seeds)
+		{
+			TotalStageSeconds += Stats.Stages[i].WallSeconds;
+			MaxStageSeconds = FMath::Max(MaxStageSeconds, Stats.Stages[i].WallSeconds);
+			MaxStagePeakBytes = FMath::Max(MaxStagePeakBytes, Stats.Stages[i].PeakBytes);
+		}
+
+		UE_LOG(TerrainGeneratorLog, Display, TEXT("UTerrainLayoutBatchCommandlet - %s: Average %.4fs, Max %.4fs, Peak %.1f MB."),
+			*StageEnum->GetNameStringByIndex(i),
+			TotalStageSeconds / ResultIn.Seeds.Num(),
+			MaxStageSeconds,
+			MaxStagePeakBytes / (1024.0 * 1024.0));
+	}
+
+	double TotalRegionsSeconds = 0;
+	for (const FTerrainLayoutStats& Stats : ResultIn.Seeds)
+	{
+		TotalRegionsSeconds += Stats.CorridorsToRegionsSeconds;
+	}
+
+	if (ResultIn.BarrierCorridorsToRegionsSeconds.Num() == 0)
+	{
+		UE_LOG(TerrainGeneratorLog, Display, TEXT("UTerrainLayoutBatchCommandlet - Corridors to walls and depth regions end: Average %.4fs."),
+			TotalRegionsSeconds / ResultIn.Seeds.Num());
+		return;
+	}
+
+	double TotalBarrierSeconds = 0;
+	for (const double Seconds : ResultIn.BarrierCorridorsToRegionsSeconds)
+	{
+		TotalBarrierSeconds += Seconds;
+	}
+
+	UE_LOG(TerrainGeneratorLog, Display, TEXT("UTerrainLayoutBatchCommandlet - Corridors to walls and depth regions end: Average pipelined %.4fs, average with a barrier between stages %.4fs."),
+		TotalRegionsSeconds / ResultIn.Seeds.Num(),
+		TotalBarrierSeconds / ResultIn.BarrierCorridorsToRegionsSeconds.Num());
+}
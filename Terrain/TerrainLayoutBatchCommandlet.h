@@ -0,0 +1,70 @@
+//Copyright 2020 Marchetti S. Alfredo I. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+#include "Layout/TerrainLayoutStats.h"
+#include "TerrainLayoutBatchCommandlet.generated.h"
+
+/* The output of a batch layout generation.*/
+USTRUCT()
+struct TERRAINGENERATOR_API FTerrainLayoutBatchResult
+{
+	GENERATED_BODY()
+
+	UPROPERTY()
+	FString TerrainData;
+
+	UPROPERTY()
+	int32 Concurrency = 1;
+
+	/* Wall time of the whole batch, in seconds.*/
+	UPROPERTY()
+	double TotalSeconds = 0;
+
+	UPROPERTY()
+	double SeedsPerSecond = 0;
+
+	/* Peak used physical memory of the process during the batch.*/
+	UPROPERTY()
+	int64 PeakUsedPhysicalBytes = 0;
+
+	UPROPERTY()
+	TArray<FTerrainLayoutStats> Seeds;
+
+	/* CorridorsToRegionsSeconds of each seed generated again with a barrier between stages. Empty without -CompareBarrier.*/
+	UPROPERTY()
+	TArray<double> BarrierCorridorsToRegionsSeconds;
+};
+
+/**
+*	Generates the layout of a terrain data for a range of seeds without the editor UI, and writes the metrics of each seed.
+*	Each concurrent slot owns its own layout subsystem instance, so several seeds are generated in parallel.
+*
+*	Usage:
+*	-run=TerrainLayoutBatch -TerrainData=/TerrainGenerator/Data/DebugTerrainData.DebugTerrainData -Seeds=0-99 -Concurrency=8 -Output=Stats.csv
+*
+*	Optional:
+*	-Format=CSV|JSON			Defaults to the output file extension.
+*	-MaxFailedCorridors=N		Returns an error code if any seed has more failed corridors. Used as regression gate.
+*	-CompareBarrier				Generates each seed again with a barrier between the corridors, walls and depth stages, and reports both region timelines.
+*/
+UCLASS()
+class TERRAINGENERATOR_API UTerrainLayoutBatchCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	UTerrainLayoutBatchCommandlet();
+
+	virtual int32 Main(const FString& Params) override;
+
+private:
+	bool ParseSeeds(const FString& SeedsIn, TArray<int32>& SeedsOut) const;
+
+	FString GetResultCSV(const FTerrainLayoutBatchResult& ResultIn) const;
+	FString GetResultJson(const FTerrainLayoutBatchResult& ResultIn) const;
+
+	void LogSummary(const FTerrainLayoutBatchResult& ResultIn) const;
+};
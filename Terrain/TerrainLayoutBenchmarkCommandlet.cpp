@@ -0,0 +1,446 @@
+//Copyright 2020 Marchetti S. Alfredo I. All Rights Reserved.
+
+#include "Layout/TerrainLayoutBenchmarkCommandlet.h"
+#include "Layout/TerrainLayoutSubsystem.h"
+#include "Layout/TerrainLayoutKernels.h"
+#include "Layout/TerrainLayoutFunctionLibrary.h"
+#include "Layout/TerrainLayoutBenchmarkPresets.h"
+#include "Layout/TerrainLayoutData.h"
+#include "Terrain/TerrainData.h"
+#include "TerrainGeneratorLogs.h"
+#include "UObject/StrongObjectPtr.h"
+#include "UObject/Package.h"
+#include "TerrainGeneratorMemory.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+
+namespace TerrainLayoutBenchmark
+{
+	/**
+	*	Bytes currently tracked under the layout tags, by every thread. Only valid if TerrainGeneratorMemory::IsTracked.
+	*	Only the generator tags its allocations with them, so work of other systems on the task threads is not counted.
+	*/
+	int64 GetLayoutTrackedBytes()
+	{
+#if ENABLE_LOW_LEVEL_MEM_TRACKER
+		if (!TerrainGeneratorMemory::IsTracked())
+		{
+			return 0;
+		}
+
+		//Gathers the amounts still pending in the threads of the tracker.
+		FLowLevelMemTracker& Tracker = FLowLevelMemTracker::Get();
+		Tracker.UpdateStatsPerFrame();
+
+		return TerrainGeneratorMemory::GetLayoutTrackedBytes()
+			+ Tracker.GetTagAmountForTracker(ELLMTracker::Default, LLM_TAG_NAME(TerrainGenerator_LayoutPathCache), ELLMTagSet::None);
+#else
+		return 0;
+#endif
+	}
+}
+
+UTerrainLayoutBenchmarkCommandlet::UTerrainLayoutBenchmarkCommandlet()
+{
+	IsClient = false;
+	IsServer = false;
+	IsEditor = true;
+	LogToConsole = true;
+
+	HelpDescription = TEXT("Measures each terrain layout stage in isolation on preset terrain datas with fixed seeds.");
+	HelpUsage = TEXT("-run=TerrainLayoutBenchmark [-Presets=<Preset>,<Path>] [-Seeds=<Seed>,<Seed>] [-Iterations=<N>] [-Output=<File>] [-Baseline=<File>] [-Tolerance=<Percent>] [-Kernels] [-NoMemory]");
+}
+
+int32 UTerrainLayoutBenchmarkCommandlet::Main(const FString& Params)
+{
+	FString PresetsString = FString::Join(TerrainLayoutBenchmarkPresets::GetPresetNames(), TEXT(","));
+	FParse::Value(*Params, TEXT("Presets="), PresetsString, false);
+
+	//The memory column is the net change of the LLM tags, without LLM there is nothing to report.
+	const bool bMeasureMemory = !FParse::Param(*Params, TEXT("NoMemory"));
+	if (bMeasureMemory && !TerrainGeneratorMemory::IsTracked())
+	{
+		UE_LOG(TerrainGeneratorLog, Error, TEXT("UTerrainLayoutBenchmarkCommandlet::Main - LLM is disabled, the stage memory can not be measured. Run with -llm, or with -NoMemory to skip it."));
+		return 1;
+	}
+
+	FString SeedsString = TEXT("1337,4242,9001");
+	FParse::Value(*Params, TEXT("Seeds="), SeedsString, false);
+
+	int32 Iterations = 5;
+	FParse::Value(*Params, TEXT("Iterations="), Iterations);
+	Iterations = FMath::Max(Iterations, 1);
+
+	FString OutputPath = FPaths::ProjectSavedDir() / TEXT("TerrainLayoutBenchmark") / TEXT("LayoutBenchmark.csv");
+	FParse::Value(*Params, TEXT("Output="), OutputPath);
+
+	//The kernels need no preset, they run on their own cells.
+	if (FParse::Param(*Params, TEXT("Kernels")))
+	{
+		BenchmarkKernels(Iterations);
+	}
+
+	TArray<FString> Presets;
+	PresetsString.ParseIntoArray(Presets, TEXT(","));
+
+	TArray<FString> SeedsStrings;
+	SeedsString.ParseIntoArray(SeedsStrings, TEXT(","));
+
+	TArray<FTerrainLayoutBenchmarkEntry> Entries;
+
+	for (const FString& Preset : Presets)
+	{
+		//Built in presets by name, anything else is the path of a terrain data asset.
+		UTerrainData* TerrainData = TerrainLayoutBenchmarkPresets::CreatePreset(Preset);
+		if (!TerrainData)
+		{
+			TerrainData = LoadObject<UTerrainData>(nullptr, *Preset);
+		}
+
+		if (!TerrainData)
+		{
+			UE_LOG(TerrainGeneratorLog, Error, TEXT("UTerrainLayoutBenchmarkCommandlet::Main - Could not load preset %s."), *Preset);
+			return 1;
+		}
+
+		TStrongObjectPtr<UTerrainData> TerrainDataReference(TerrainData);
+
+		for (const FString& Seed : SeedsStrings)
+		{
+			BenchmarkPreset(TerrainData, FPackageName::GetShortName(Preset), FCString::Atoi(*Seed), Iterations, bMeasureMemory, Entries);
+		}
+	}
+
+	if (!FFileHelper::SaveStringToFile(GetEntriesCSV(Entries, bMeasureMemory), *OutputPath))
+	{
+		UE_LOG(TerrainGeneratorLog, Error, TEXT("UTerrainLayoutBenchmarkCommandlet::Main - Could not write output file %s."), *OutputPath);
+		return 1;
+	}
+
+	const UEnum* StageEnum = StaticEnum<ETerrainGen_LayoutStage>();
+	for (const FTerrainLayoutBenchmarkEntry& Entry : Entries)
+	{
+		UE_LOG(TerrainGeneratorLog, Display, TEXT("%-32s Seed %-6i %-14s %10.3f ms  %12.0f cells/s  %10.1f corridors/s  %10s LLM net bytes"),
+			*Entry.Preset,
+			Entry.Seed,
+			*StageEnum->GetNameStringByValue(StaticCast<int64>(Entry.Stage)),
+			Entry.MedianSeconds * 1000.0,
+			Entry.GetCellsPerSecond(),
+			Entry.GetCorridorsPerSecond(),
+			bMeasureMemory ? *LexToString(Entry.LLMNetBytes) : TEXT("-"));
+
+		if (Entry.Stage == ETerrainGen_LayoutStage::Walls)
+		{
+			UE_LOG(TerrainGeneratorLog, Display, TEXT("%-32s Seed %-6i Corridors to walls and depth regions end: pipelined %10.3f ms, with a barrier between stages %10.3f ms"),
+				*Entry.Preset,
+				Entry.Seed,
+				Entry.PipelinedRegionsSeconds * 1000.0,
+				Entry.BarrierRegionsSeconds * 1000.0);
+		}
+	}
+
+	FString BaselinePath;
+	if (FParse::Value(*Params, TEXT("Baseline="), BaselinePath))
+	{
+		float TolerancePercent = 10.f;
+		FParse::Value(*Params, TEXT("Tolerance="), TolerancePercent);
+
+		if (CompareWithBaseline(Entries, BaselinePath, TolerancePercent) > 0)
+		{
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+void UTerrainLayoutBenchmarkCommandlet::BenchmarkPreset(UTerrainData* TerrainDataIn, const FString& PresetIn, int32 SeedIn, int32 IterationsIn, bool bMeasureMemoryIn, TArray<FTerrainLayoutBenchmarkEntry>& EntriesOut) const
+{
+	TStrongObjectPtr<UTerrainLayoutSubsystem> Generator(NewObject<UTerrainLayoutSubsystem>(GEngine));
+
+	//A full generation provides the input of every stage.
+	Generator->SetCaptureStageSnapshots(true);
+	Generator->GenerateTerrainLayoutSynchronous(TerrainDataIn, SeedIn);
+
+	const int32 StagesAmount = StaticCast<int32>(ETerrainGen_LayoutStage::ETLS_MAX);
+	TArray<FTerrainLayoutSnapshot> Snapshots;
+	for (int32 i = 0; i < StagesAmount; i++)
+	{
+		Snapshots.Add(Generator->GetStageSnapshot(StaticCast<ETerrainGen_LayoutStage>(i)));
+	}
+
+	Generator->SetCaptureStageSnapshots(false);
+
+	const double PipelinedRegionsSeconds = MeasureRegionsTimeline(Generator.Get(), TerrainDataIn, SeedIn, IterationsIn, true);
+	const double BarrierRegionsSeconds = MeasureRegionsTimeline(Generator.Get(), TerrainDataIn, SeedIn, IterationsIn, false);
+
+	for (int32 i = 0; i < StagesAmount; i++)
+	{
+		const ETerrainGen_LayoutStage Stage = StaticCast<ETerrainGen_LayoutStage>(i);
+
+		TArray<double> Seconds;
+		int64 LLMNetBytes = 0;
+
+		for (int32 Iteration = 0; Iteration < IterationsIn + 1; Iteration++) //First iteration warms up caches and is discarded
+		{
+			if (!Generator->RestoreLayoutSnapshot(TerrainDataIn, Snapshots[i]))
+			{
+				break;
+			}
+
+			const int64 StartBytes = bMeasureMemoryIn ? TerrainLayoutBenchmark::GetLayoutTrackedBytes() : 0;
+
+			Generator->RunLayoutStageSynchronous(Stage);
+
+			const int64 EndBytes = bMeasureMemoryIn ? TerrainLayoutBenchmark::GetLayoutTrackedBytes() : 0;
+
+			if (Iteration == 0)
+			{
+				continue;
+			}
+
+			Seconds.Add(Generator->GetLayoutStats().GetStage(Stage).WallSeconds);
+			LLMNetBytes += EndBytes - StartBytes;
+		}
+
+		if (Seconds.Num() == 0)
+		{
+			continue;
+		}
+
+		Seconds.Sort();
+
+		FTerrainLayoutBenchmarkEntry Entry = FTerrainLayoutBenchmarkEntry();
+		Entry.Preset = PresetIn;
+		Entry.Seed = SeedIn;
+		Entry.Stage = Stage;
+		Entry.MedianSeconds = Seconds[Seconds.Num() / 2];
+		Entry.MinSeconds = Seconds[0];
+		if (Stage == ETerrainGen_LayoutStage::Walls)
+		{
+			Entry.PipelinedRegionsSeconds = PipelinedRegionsSeconds;
+			Entry.BarrierRegionsSeconds = BarrierRegionsSeconds;
+		}
+
+		Entry.CorridorsAmount = Generator->GetLayoutStats().CorridorsAmount;
+		Entry.LLMNetBytes = LLMNetBytes / Seconds.Num();
+
+		//Room stages store their cells in the rooms, the rest in the cells map.
+		int32 RoomCellsAmount = 0;
+		for (const TPair<FIntPoint, FRoomLayout>& pair : Generator->GetRoomsLayoutMap())
+		{
+			RoomCellsAmount += pair.Value.Cells.Num();
+		}
+
+		Entry.CellsAmount = FMath::Max(Generator->GetLayoutStats().CellsAmount, RoomCellsAmount);
+
+		EntriesOut.Add(Entry);
+	}
+}
+
+double UTerrainLayoutBenchmarkCommandlet::MeasureRegionsTimeline(UTerrainLayoutSubsystem* GeneratorIn, UTerrainData* TerrainDataIn, int32 SeedIn, int32 IterationsIn, bool bPipelinedIn) const
+{
+	GeneratorIn->SetPipelineLayoutRegions(bPipelinedIn);
+
+	TArray<double> Seconds;
+	for (int32 Iteration = 0; Iteration < IterationsIn + 1; Iteration++) //First iteration warms up caches and is discarded
+	{
+		GeneratorIn->GenerateTerrainLayoutSynchronous(TerrainDataIn, SeedIn);
+
+		if (Iteration > 0)
+		{
+			Seconds.Add(GeneratorIn->GetLayoutStats().CorridorsToRegionsSeconds);
+		}
+	}
+
+	GeneratorIn->SetPipelineLayoutRegions(true);
+
+	Seconds.Sort();
+	return Seconds[Seconds.Num() / 2];
+}
+
+void UTerrainLayoutBenchmarkCommandlet::BenchmarkKernels(int32 IterationsIn) const
+{
+	//Enough cells to leave the caches, in the range of the huge preset.
+	static const int32 CellsAmount = 1 << 20;
+	static const float CellSize = 100.f;
+
+	//GetCellWorldPosition only reads the cell size of the terrain data, an empty layout is enough.
+	TStrongObjectPtr<UTerrainData> TerrainData(NewObject<UTerrainData>(GetTransientPackage(), TEXT("BenchmarkKernelsTerrainData")));
+	TerrainData->CellSize = CellSize;
+	TerrainData->TerrainLayoutData = NewObject<UTerrainLayoutData>(TerrainData.Get());
+
+	FTerrainLayoutSnapshot EmptySnapshot = FTerrainLayoutSnapshot();
+	EmptySnapshot.bIsValid = true;
+
+	TStrongObjectPtr<UTerrainLayoutSubsystem> Generator(NewObject<UTerrainLayoutSubsystem>(GEngine));
+	if (!Generator->RestoreLayoutSnapshot(TerrainData.Get(), EmptySnapshot))
+	{
+		return;
+	}
+
+	FRandomStream Stream = FRandomStream(1337);
+	TArray<FIntPoint> Cells;
+	Cells.SetNumUninitialized(CellsAmount);
+	for (FIntPoint& Cell : Cells)
+	{
+		Cell = FIntPoint(Stream.RandRange(-2048, 2048), Stream.RandRange(-2048, 2048));
+	}
+
+	const FIntPoint Target = FIntPoint(17, -31);
+
+	TArray<float> ScalarDistances;
+	TArray<float> KernelDistances;
+	TArray<FVector> ScalarPositions;
+	TArray<FVector> KernelPositions;
+	ScalarDistances.SetNumUninitialized(CellsAmount);
+	KernelDistances.SetNumUninitialized(CellsAmount);
+	ScalarPositions.SetNumUninitialized(CellsAmount);
+	KernelPositions.SetNumUninitialized(CellsAmount);
+
+	//Median of the iterations, the first one warms up the caches and is discarded.
+	auto Measure = [IterationsIn](TFunctionRef<void()> FunctionIn)
+	{
+		TArray<double> Seconds;
+		for (int32 Iteration = 0; Iteration < IterationsIn + 1; Iteration++)
+		{
+			const double StartTime = FPlatformTime::Seconds();
+			FunctionIn();
+			if (Iteration > 0)
+			{
+				Seconds.Add(FPlatformTime::Seconds() - StartTime);
+			}
+		}
+
+		Seconds.Sort();
+		return Seconds[Seconds.Num() / 2];
+	};
+
+	const double ScalarDistancesSeconds = Measure([&]()
+	{
+		for (int32 i = 0; i < CellsAmount; i++)
+		{
+			ScalarDistances[i] = UTerrainLayoutFunctionLibrary::GetWorldDistanceBetweenCells(Cells[i], Target, CellSize);
+		}
+	});
+
+	const double KernelDistancesSeconds = Measure([&]()
+	{
+		FTerrainLayoutKernels::DistancesToCell(Cells, Target, CellSize, KernelDistances);
+	});
+
+	const FVector2D Anchor = FVector2D(.5, .5);
+	const double ScalarPositionsSeconds = Measure([&]()
+	{
+		for (int32 i = 0; i < CellsAmount; i++)
+		{
+			ScalarPositions[i] = Generator->GetCellWorldPosition(Cells[i], Anchor);
+		}
+	});
+
+	const double KernelPositionsSeconds = Measure([&]()
+	{
+		Generator->GetCellsWorldPositions(Cells, Anchor, KernelPositions);
+	});
+
+	double MaxDistanceDifference = 0;
+	double MaxPositionDifference = 0;
+	for (int32 i = 0; i < CellsAmount; i++)
+	{
+		MaxDistanceDifference = FMath::Max(MaxDistanceDifference, FMath::Abs(StaticCast<double>(ScalarDistances[i]) - KernelDistances[i]));
+		MaxPositionDifference = FMath::Max(MaxPositionDifference, FVector::Dist(ScalarPositions[i], KernelPositions[i]));
+	}
+
+	UE_LOG(TerrainGeneratorLog, Display, TEXT("UTerrainLayoutBenchmarkCommandlet::BenchmarkKernels - Distances of %i cells: per cell %.3f ms, kernel %.3f ms (%.2fx). Max difference %g."),
+		CellsAmount,
+		ScalarDistancesSeconds * 1000.0,
+		KernelDistancesSeconds * 1000.0,
+		KernelDistancesSeconds > 0 ? ScalarDistancesSeconds / KernelDistancesSeconds : 0,
+		MaxDistanceDifference);
+
+	UE_LOG(TerrainGeneratorLog, Display, TEXT("UTerrainLayoutBenchmarkCommandlet::BenchmarkKernels - World positions of %i cells: per cell %.3f ms, kernel %.3f ms (%.2fx). Max difference %g."),
+		CellsAmount,
+		ScalarPositionsSeconds * 1000.0,
+		KernelPositionsSeconds * 1000.0,
+		KernelPositionsSeconds > 0 ? ScalarPositionsSeconds / KernelPositionsSeconds : 0,
+		MaxPositionDifference);
+}
+
+FString UTerrainLayoutBenchmarkCommandlet::GetEntriesCSV(const TArray<FTerrainLayoutBenchmarkEntry>& EntriesIn, bool bMeasureMemoryIn) const
+{
+	const UEnum* StageEnum = StaticEnum<ETerrainGen_LayoutStage>();
+
+	FString Output = TEXT("Preset,Seed,Stage,MedianSeconds,MinSeconds,Cells,CellsPerSecond,Corridors,CorridorsPerSecond,LLMNetBytes,PipelinedRegionsSeconds,BarrierRegionsSeconds\n");
+	for (const FTerrainLayoutBenchmarkEntry& Entry : EntriesIn)
+	{
+		//Without memory measures the column is left empty, not zero.
+		Output += FString::Printf(TEXT("%s,%i,%s,%f,%f,%i,%f,%i,%f,%s,%f,%f\n"),
+			*Entry.Preset,
+			Entry.Seed,
+			*StageEnum->GetNameStringByValue(StaticCast<int64>(Entry.Stage)),
+			Entry.MedianSeconds,
+			Entry.MinSeconds,
+			Entry.CellsAmount,
+			Entry.GetCellsPerSecond(),
+			Entry.CorridorsAmount,
+			Entry.GetCorridorsPerSecond(),
+			bMeasureMemoryIn ? *LexToString(Entry.LLMNetBytes) : TEXT(""),
+			Entry.PipelinedRegionsSeconds,
+			Entry.BarrierRegionsSeconds);
+	}
+
+	return Output;
+}
+
+int32 UTerrainLayoutBenchmarkCommandlet::CompareWithBaseline(const TArray<FTerrainLayoutBenchmarkEntry>& EntriesIn, const FString& BaselinePathIn, float TolerancePercentIn) const
+{
+	TArray<FString> BaselineLines;
+	if (!FFileHelper::LoadFileToStringArray(BaselineLines, *BaselinePathIn))
+	{
+		UE_LOG(TerrainGeneratorLog, Error, TEXT("UTerrainLayoutBenchmarkCommandlet::CompareWithBaseline - Could not read baseline %s."), *BaselinePathIn);
+		return 1;
+	}
+
+	TMap<FString, double> BaselineSeconds;
+	for (int32 i = 1; i < BaselineLines.Num(); i++) //Skip header
+	{
+		TArray<FString> Columns;
+		BaselineLines[i].ParseIntoArray(Columns, TEXT(","), false);
+
+		if (Columns.Num() < 4)
+		{
+			continue;
+		}
+
+		BaselineSeconds.Add(GetEntryKey(Columns[0], FCString::Atoi(*Columns[1]), Columns[2]), FCString::Atod(*Columns[3]));
+	}
+
+	const UEnum* StageEnum = StaticEnum<ETerrainGen_LayoutStage>();
+	int32 Regressions = 0;
+
+	for (const FTerrainLayoutBenchmarkEntry& Entry : EntriesIn)
+	{
+		const FString StageName = StageEnum->GetNameStringByValue(StaticCast<int64>(Entry.Stage));
+		const double* Baseline = BaselineSeconds.Find(GetEntryKey(Entry.Preset, Entry.Seed, StageName));
+
+		if (!Baseline || *Baseline <= 0)
+		{
+			continue;
+		}
+
+		const double ChangePercent = (Entry.MedianSeconds - *Baseline) / *Baseline * 100.0;
+		if (ChangePercent > TolerancePercentIn)
+		{
+			UE_LOG(TerrainGeneratorLog, Error, TEXT("UTerrainLayoutBenchmarkCommandlet::CompareWithBaseline - %s seed %i %s is %.1f%% slower than baseline (%.3f ms -> %.3f ms)."),
+				*Entry.Preset, Entry.Seed, *StageName, ChangePercent, *Baseline * 1000.0, Entry.MedianSeconds * 1000.0);
+			Regressions++;
+		}
+	}
+
+	return Regressions;
+}
+
+FString UTerrainLayoutBenchmarkCommandlet::GetEntryKey(const FString& PresetIn, int32 SeedIn, const FString& StageIn) const
+{
+	return FString::Printf(TEXT("%s|%i|%s"), *PresetIn, SeedIn, *StageIn);
+}
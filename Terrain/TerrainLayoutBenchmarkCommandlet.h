@@ -0,0 +1,90 @@
+//Copyright 2020 Marchetti S. Alfredo I. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+#include "Layout/TerrainLayoutStats.h"
+#include "TerrainLayoutBenchmarkCommandlet.generated.h"
+
+class UTerrainData;
+class UTerrainLayoutSubsystem;
+
+/* The measure of a single layout stage run in isolation, for one preset and seed.*/
+struct FTerrainLayoutBenchmarkEntry
+{
+	FString Preset;
+	int32 Seed = 0;
+	ETerrainGen_LayoutStage Stage = ETerrainGen_LayoutStage::InitialLayout;
+
+	/* Median wall time of the iterations, in seconds.*/
+	double MedianSeconds = 0;
+	double MinSeconds = 0;
+
+	/* Cells in the layout after the stage, and corridors generated by the stage.*/
+	int32 CellsAmount = 0;
+	int32 CorridorsAmount = 0;
+
+	/**
+	*	Net change of the memory tracked under the layout LLM tags across the stage, averaged across iterations.
+	*	Not an amount of allocations: memory the stage frees counts against the memory it allocates, so it can be negative.
+	*/
+	int64 LLMNetBytes = 0;
+
+	/* Medians of CorridorsToRegionsSeconds in full generations, pipelined and with a barrier between stages. Only for the walls stage.*/
+	double PipelinedRegionsSeconds = 0;
+	double BarrierRegionsSeconds = 0;
+
+	double GetCellsPerSecond() const
+	{
+		return MedianSeconds > 0 ? CellsAmount / MedianSeconds : 0;
+	}
+
+	double GetCorridorsPerSecond() const
+	{
+		return MedianSeconds > 0 ? CorridorsAmount / MedianSeconds : 0;
+	}
+};
+
+/**
+*	Runs each layout stage in isolation for a set of preset terrain datas and fixed seeds, and reports wall time, throughput and the memory the stage keeps.
+*	Each stage starts from the snapshot captured at its start in a full generation, so every stage always receives the same input.
+*	Runs headless, e.g.: UnrealEditor-Cmd Project.uproject -run=TerrainLayoutBenchmark -nullrhi -unattended -llm
+*	Needs -llm to measure the memory of the stages, fails without it unless -NoMemory is given.
+*
+*	Optional:
+*	-Presets=<Preset>,<Path>	The terrain datas to measure, built in preset names or terrain data paths. Defaults to the Small, Medium and Huge built in presets.
+*	-Seeds=<Seed>,<Seed>		The fixed seeds used for every preset.
+*	-Iterations=<N>				Runs per stage. The median is reported.
+*	-Output=<File>				CSV output file.
+*	-Baseline=<File>			A previous CSV output. Returns an error code if a stage median got slower than the tolerance.
+*	-Tolerance=<Percent>		Allowed slowdown against the baseline. Defaults to 10.
+*	-Kernels					Also measures the cell distance and position kernels against the functions they replace, on synthetic cells before the presets.
+*	-NoMemory					Skips the memory measures, the LLMNetBytes column is left empty.
+*/
+UCLASS()
+class TERRAINGENERATOR_API UTerrainLayoutBenchmarkCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	UTerrainLayoutBenchmarkCommandlet();
+
+	virtual int32 Main(const FString& Params) override;
+
+private:
+	void BenchmarkPreset(UTerrainData* TerrainDataIn, const FString& PresetIn, int32 SeedIn, int32 IterationsIn, bool bMeasureMemoryIn, TArray<FTerrainLayoutBenchmarkEntry>& EntriesOut) const;
+
+	/* Median CorridorsToRegionsSeconds of full generations of the seed. The regions span the corridors and walls stages, so they can not be measured in isolation.*/
+	double MeasureRegionsTimeline(UTerrainLayoutSubsystem* GeneratorIn, UTerrainData* TerrainDataIn, int32 SeedIn, int32 IterationsIn, bool bPipelinedIn) const;
+
+	FString GetEntriesCSV(const TArray<FTerrainLayoutBenchmarkEntry>& EntriesIn, bool bMeasureMemoryIn) const;
+
+	/* Compares against a previous output. Returns the amount of stages slower than the tolerance.*/
+	int32 CompareWithBaseline(const TArray<FTerrainLayoutBenchmarkEntry>& EntriesIn, const FString& BaselinePathIn, float TolerancePercentIn) const;
+
+	FString GetEntryKey(const FString& PresetIn, int32 SeedIn, const FString& StageIn) const;
+
+	/* Logs the median time of each kernel and of the per cell function it replaces over the same random cells, and their largest difference. Uses a fixed cell size, independent of the presets.*/
+	void BenchmarkKernels(int32 IterationsIn) const;
+};
@@ -0,0 +1,114 @@
+//Copyright 2020 Marchetti S. Alfredo I. All Rights Reserved.
+
+#include "Layout/TerrainLayoutBenchmarkPresets.h"
+#include "Layout/TerrainLayoutData.h"
+#include "Layout/TerrainLayoutRoomData.h"
+#include "Terrain/TerrainData.h"
+#include "UObject/Package.h"
+
+TArray<FIntPoint> UTerrainLayoutBenchmarkGridData::GenerateLayout(FIntPoint& InitialCell, FRandomStream& Stream)
+{
+	TArray<FIntPoint> Cells;
+	Cells.Reserve(Side * Side);
+
+	for (int32 X = 0; X < Side; X++)
+	{
+		for (int32 Y = 0; Y < Side; Y++)
+		{
+			Cells.Add(FIntPoint(X * Spacing, Y * Spacing));
+		}
+	}
+
+	InitialCell = FIntPoint::ZeroValue;
+	return Cells;
+}
+
+int32 UTerrainLayoutBenchmarkGridData::GetMaxCells() const
+{
+	return Side * Side;
+}
+
+namespace TerrainLayoutBenchmarkPresets
+{
+	/* Size of a preset: the rooms are a RoomsSide x RoomsSide grid, half of them small and half big.*/
+	struct FPresetSize
+	{
+		const TCHAR* Name;
+		int32 RoomsSide;
+	};
+
+	static const FPresetSize PresetSizes[] =
+	{
+		{ TEXT("Small"), 8 },		//64 rooms
+		{ TEXT("Medium"), 24 },		//576 rooms
+		{ TEXT("Huge"), 64 },		//4096 rooms
+	};
+
+	/* Fixed for every preset, so the corridor searches and positions are comparable between presets.*/
+	static const float PresetCellSize = 100.f;
+	static const int32 PresetThreads = 8;
+
+	const TArray<FString>& GetPresetNames()
+	{
+		static const TArray<FString> Names = []()
+		{
+			TArray<FString> Result;
+			for (const FPresetSize& Size : PresetSizes)
+			{
+				Result.Add(Size.Name);
+			}
+
+			return Result;
+		}();
+
+		return Names;
+	}
+
+	static UTerrainLayoutRoomData* CreateRoom(UObject* OuterIn, int32 SideIn)
+	{
+		UTerrainLayoutBenchmarkGridData* RoomGrid = NewObject<UTerrainLayoutBenchmarkGridData>(OuterIn);
+		RoomGrid->Side = SideIn;
+		RoomGrid->Spacing = 1;
+
+		UTerrainLayoutRoomData* RoomData = NewObject<UTerrainLayoutRoomData>(OuterIn);
+		RoomData->RoomLayout = RoomGrid;
+		return RoomData;
+	}
+
+	UTerrainData* CreatePreset(const FString& NameIn)
+	{
+		const FPresetSize* Size = nullptr;
+		for (const FPresetSize& PresetSize : PresetSizes)
+		{
+			if (NameIn.Equals(PresetSize.Name, ESearchCase::IgnoreCase))
+			{
+				Size = &PresetSize;
+				break;
+			}
+		}
+
+		if (!Size)
+		{
+			return nullptr;
+		}
+
+		UTerrainData* TerrainData = NewObject<UTerrainData>(GetTransientPackage(), *FString::Printf(TEXT("BenchmarkTerrainData_%s"), Size->Name));
+		TerrainData->CellSize = PresetCellSize;
+		TerrainData->MaximunThreads = PresetThreads;
+
+		UTerrainLayoutData* LayoutData = NewObject<UTerrainLayoutData>(TerrainData);
+		TerrainData->TerrainLayoutData = LayoutData;
+
+		//The rooms start packed and the room movement stage separates them.
+		UTerrainLayoutBenchmarkGridData* InitialGrid = NewObject<UTerrainLayoutBenchmarkGridData>(LayoutData);
+		InitialGrid->Side = Size->RoomsSide;
+		InitialGrid->Spacing = 4;
+		LayoutData->InitialRoomsLayout = InitialGrid;
+
+		LayoutData->RoomLayouts.Add(CreateRoom(LayoutData, 4));
+		LayoutData->RoomLayouts.Add(CreateRoom(LayoutData, 7));
+
+		//The rest of the values are the defaults of the layout data.
+		return TerrainData;
+	}
+}
@@ -0,0 +1,42 @@
+//Copyright 2020 Marchetti S. Alfredo I. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Layout/TerrainBaseLayoutData.h"
+#include "TerrainLayoutBenchmarkPresets.generated.h"
+
+class UTerrainData;
+
+/**
+*	A square grid of cells, used as initial rooms layout and as room layout of the benchmark presets.
+*	Has no randomness, so a preset always generates the same amount of rooms and room cells.
+*/
+UCLASS(Transient, HideDropdown)
+class TERRAINGENERATOR_API UTerrainLayoutBenchmarkGridData : public UTerrainBaseLayoutData
+{
+	GENERATED_BODY()
+
+public:
+	/* Cells in each side of the grid.*/
+	int32 Side = 1;
+
+	/* Distance between two consecutive cells of the grid. 1 fills the whole square.*/
+	int32 Spacing = 1;
+
+	virtual TArray<FIntPoint> GenerateLayout(FIntPoint& InitialCell, FRandomStream& Stream) override;
+
+	virtual int32 GetMaxCells() const override;
+};
+
+namespace TerrainLayoutBenchmarkPresets
+{
+	/* Names of the presets built in code, from the smallest.*/
+	TERRAINGENERATOR_API const TArray<FString>& GetPresetNames();
+
+	/**
+	*	Builds the terrain data of a preset in the transient package, with a fixed cell size and thread count so the results of different machines only differ by the machine.
+	*	Returns nullptr if the name is not one of GetPresetNames.
+	*/
+	TERRAINGENERATOR_API UTerrainData* CreatePreset(const FString& NameIn);
+}
@@ -0,0 +1,35 @@
+//Copyright 2020 Marchetti S. Alfredo I. All Rights Reserved.
+
+#include "Layout/TerrainLayoutCancellation.h"
+#include "TerrainGeneratorMemory.h"
+
+bool FTerrainLayoutCancellationToken::PollMemoryBudget() const
+{
+	const uint64 NowCycles = FPlatformTime::Cycles64();
+	uint64 PollCycles = NextPollCycles.load(std::memory_order_relaxed);
+	if (NowCycles < PollCycles)
+	{
+		return false;
+	}
+
+	//Only the thread that moves the next poll forward measures, the others keep going.
+	const uint64 IntervalCycles = StaticCast<uint64>(PollIntervalSeconds / FPlatformTime::GetSecondsPerCycle64());
+	if (!NextPollCycles.compare_exchange_strong(PollCycles, NowCycles + IntervalCycles, std::memory_order_relaxed))
+	{
+		return false;
+	}
+
+	const int64 UsedBytes = TerrainGeneratorMemory::IsTracked()
+		? TerrainGeneratorMemory::GetLayoutTrackedBytes()
+		: BaseBytes.load(std::memory_order_relaxed) + WorkerBytes.load(std::memory_order_relaxed);
+
+	if (UsedBytes <= BudgetBytes.load(std::memory_order_relaxed))
+	{
+		return false;
+	}
+
+	//Reported by the subsystem, on its own thread, when the stage in flight ends.
+	MemoryBudgetExceededBytes.store(UsedBytes, std::memory_order_relaxed);
+	bIsMemoryBudgetExceeded.AtomicSet(true);
+	return true;
+}
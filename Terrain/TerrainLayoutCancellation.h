@@ -0,0 +1,89 @@
+//Copyright 2020 Marchetti S. Alfredo I. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/ThreadSafeBool.h"
+#include <atomic>
+
+/**
+*	Shared by a layout generation and all its workers. Cancelled when the generation is replaced by a new one or aborted.
+*	Workers check it in their loops and drop their results, so cancelled work never reaches the layout maps.
+*/
+class TERRAINGENERATOR_API FTerrainLayoutCancellationToken
+{
+public:
+	FTerrainLayoutCancellationToken() = default;
+
+	/* Also cancelled when ParentIn is. Cancelling this one does not cancel the parent.*/
+	explicit FTerrainLayoutCancellationToken(const TSharedPtr<FTerrainLayoutCancellationToken, ESPMode::ThreadSafe>& ParentIn) : Parent(ParentIn) {}
+
+	void Cancel()
+	{
+		bIsCancelled.AtomicSet(true);
+	}
+
+	/* Also polls the memory budget, so a worker checking it in its loop stops as soon as the budget is exceeded.*/
+	bool IsCancelled() const
+	{
+		if (bIsCancelled || bIsMemoryBudgetExceeded || (Parent.IsValid() && Parent->IsCancelled()))
+		{
+			return true;
+		}
+
+		return BudgetBytes.load(std::memory_order_relaxed) > 0 && PollMemoryBudget();
+	}
+
+	/**
+	*	Cancels the token from IsCancelled once the generation memory is over BudgetBytesIn. 0 for no budget.
+	*	The memory is the total of the layout LLM tags when LLM is enabled. Otherwise it is BaseBytesIn, measured by the subsystem, plus the bytes the workers report.
+	*/
+	void SetMemoryBudget(int64 BudgetBytesIn, int64 BaseBytesIn)
+	{
+		BaseBytes.store(BaseBytesIn, std::memory_order_relaxed);
+		BudgetBytes.store(BudgetBytesIn, std::memory_order_relaxed);
+	}
+
+	/* Memory kept by the workers until the stage merges it, negative when they release it.*/
+	void AddWorkerBytes(int64 BytesIn)
+	{
+		WorkerBytes.fetch_add(BytesIn, std::memory_order_relaxed);
+	}
+
+	/* Done when a stage begins, the memory of the workers of the previous stage was merged into the layout or released.*/
+	void ResetWorkerBytes()
+	{
+		WorkerBytes.store(0, std::memory_order_relaxed);
+	}
+
+	/* If the token was cancelled by the memory budget, and the memory it measured then.*/
+	bool IsMemoryBudgetExceeded() const
+	{
+		return bIsMemoryBudgetExceeded;
+	}
+
+	int64 GetMemoryBudgetExceededBytes() const
+	{
+		return MemoryBudgetExceededBytes.load(std::memory_order_relaxed);
+	}
+
+private:
+	FThreadSafeBool bIsCancelled = false;
+	TSharedPtr<FTerrainLayoutCancellationToken, ESPMode::ThreadSafe> Parent;
+
+	std::atomic<int64> BudgetBytes = 0;
+	std::atomic<int64> BaseBytes = 0;
+	std::atomic<int64> WorkerBytes = 0;
+
+	/* The workers check the token for each node of a path search, the memory is only measured once per PollIntervalSeconds.*/
+	static constexpr double PollIntervalSeconds = 0.01;
+	mutable std::atomic<uint64> NextPollCycles = 0;
+
+	mutable FThreadSafeBool bIsMemoryBudgetExceeded = false;
+	mutable std::atomic<int64> MemoryBudgetExceededBytes = 0;
+
+	/* Returns true if it cancelled the token.*/
+	bool PollMemoryBudget() const;
+};
+
+typedef TSharedPtr<FTerrainLayoutCancellationToken, ESPMode::ThreadSafe> FTerrainLayoutCancellationTokenPtr;
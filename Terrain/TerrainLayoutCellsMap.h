@@ -0,0 +1,291 @@
+//Copyright 2020 Marchetti S. Alfredo I. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Layout/LayoutTypes.h"
+#include "Misc/Optional.h"
+#include <type_traits>
+
+/**
+*	The cells of a layout, split in shards by blocks of 16x16 cells. Used as a map of cells.
+*	Each shard is a map of its own, so tasks can write different shards at once, and a shard built apart can be moved in without inserting its cells again.
+*/
+class TERRAINGENERATOR_API FTerrainLayoutCellsMap
+{
+public:
+	typedef TMap<FIntPoint, FCellLayout> FShard;
+
+	/* Fixed, so a cell is in the same shard in every layout and thread count.*/
+	static constexpr int32 ShardsAmount = 16;
+
+	FTerrainLayoutCellsMap()
+	{
+		Shards.SetNum(ShardsAmount);
+	}
+
+	FTerrainLayoutCellsMap(const FTerrainLayoutCellsMap&) = default;
+	FTerrainLayoutCellsMap& operator=(const FTerrainLayoutCellsMap&) = default;
+
+	/* A moved from map keeps its shards, empty, so it can still be used.*/
+	FTerrainLayoutCellsMap(FTerrainLayoutCellsMap&& OtherIn)
+		: Shards(MoveTemp(OtherIn.Shards))
+	{
+		OtherIn.Shards.SetNum(ShardsAmount);
+	}
+
+	FTerrainLayoutCellsMap& operator=(FTerrainLayoutCellsMap&& OtherIn)
+	{
+		if (this != &OtherIn)
+		{
+			Shards = MoveTemp(OtherIn.Shards);
+			OtherIn.Shards.SetNum(ShardsAmount);
+		}
+
+		return *this;
+	}
+
+	static int32 GetShardIndex(const FIntPoint& CellIn)
+	{
+		//Neighbour cells, e.g. of a corridor, are usually in the same shard.
+		const FIntPoint Block = FIntPoint(CellIn.X >> 4, CellIn.Y >> 4);
+		return StaticCast<int32>(GetTypeHash(Block) % StaticCast<uint32>(ShardsAmount));
+	}
+
+	FShard& GetShard(int32 ShardIndexIn)
+	{
+		return Shards[ShardIndexIn];
+	}
+
+	const FShard& GetShard(int32 ShardIndexIn) const
+	{
+		return Shards[ShardIndexIn];
+	}
+
+	/* Replaces the shard with one built apart. Every cell of ShardIn must belong to the shard.*/
+	void MoveShard(int32 ShardIndexIn, FShard&& ShardIn)
+	{
+		Shards[ShardIndexIn] = MoveTemp(ShardIn);
+	}
+
+	int32 Num() const
+	{
+		int32 Amount = 0;
+		for (const FShard& Shard : Shards)
+		{
+			Amount += Shard.Num();
+		}
+
+		return Amount;
+	}
+
+	bool Contains(const FIntPoint& CellIn) const
+	{
+		return Shards[GetShardIndex(CellIn)].Contains(CellIn);
+	}
+
+	FCellLayout* Find(const FIntPoint& CellIn)
+	{
+		return Shards[GetShardIndex(CellIn)].Find(CellIn);
+	}
+
+	const FCellLayout* Find(const FIntPoint& CellIn) const
+	{
+		return Shards[GetShardIndex(CellIn)].Find(CellIn);
+	}
+
+	FCellLayout& FindChecked(const FIntPoint& CellIn)
+	{
+		return Shards[GetShardIndex(CellIn)].FindChecked(CellIn);
+	}
+
+	const FCellLayout& FindChecked(const FIntPoint& CellIn) const
+	{
+		return Shards[GetShardIndex(CellIn)].FindChecked(CellIn);
+	}
+
+	FCellLayout FindRef(const FIntPoint& CellIn) const
+	{
+		return Shards[GetShardIndex(CellIn)].FindRef(CellIn);
+	}
+
+	FCellLayout& FindOrAdd(const FIntPoint& CellIn)
+	{
+		return Shards[GetShardIndex(CellIn)].FindOrAdd(CellIn);
+	}
+
+	FCellLayout& Add(const FIntPoint& CellIn, const FCellLayout& CellLayoutIn)
+	{
+		return Shards[GetShardIndex(CellIn)].Add(CellIn, CellLayoutIn);
+	}
+
+	FCellLayout& Add(const FIntPoint& CellIn, FCellLayout&& CellLayoutIn)
+	{
+		return Shards[GetShardIndex(CellIn)].Add(CellIn, MoveTemp(CellLayoutIn));
+	}
+
+	int32 Remove(const FIntPoint& CellIn)
+	{
+		return Shards[GetShardIndex(CellIn)].Remove(CellIn);
+	}
+
+	FCellLayout& operator[](const FIntPoint& CellIn)
+	{
+		return FindChecked(CellIn);
+	}
+
+	const FCellLayout& operator[](const FIntPoint& CellIn) const
+	{
+		return FindChecked(CellIn);
+	}
+
+	void Append(const FTerrainLayoutCellsMap& OtherIn)
+	{
+		for (int32 i = 0; i < ShardsAmount; i++)
+		{
+			Shards[i].Append(OtherIn.Shards[i]);
+		}
+	}
+
+	/* Spreads the amount evenly, the cells of a layout are spread across the shards.*/
+	void Reserve(int32 AmountIn)
+	{
+		for (FShard& Shard : Shards)
+		{
+			Shard.Reserve(AmountIn / ShardsAmount + 1);
+		}
+	}
+
+	void Empty()
+	{
+		for (FShard& Shard : Shards)
+		{
+			Shard.Empty();
+		}
+	}
+
+	void Reset()
+	{
+		for (FShard& Shard : Shards)
+		{
+			Shard.Reset();
+		}
+	}
+
+	void Compact()
+	{
+		for (FShard& Shard : Shards)
+		{
+			Shard.Compact();
+		}
+	}
+
+	SIZE_T GetAllocatedSize() const
+	{
+		SIZE_T Size = Shards.GetAllocatedSize();
+		for (const FShard& Shard : Shards)
+		{
+			Size += Shard.GetAllocatedSize();
+		}
+
+		return Size;
+	}
+
+	void GenerateKeyArray(TArray<FIntPoint>& CellsOut) const
+	{
+		CellsOut.Reset(Num());
+		for (const FShard& Shard : Shards)
+		{
+			for (const TPair<FIntPoint, FCellLayout>& pair : Shard)
+			{
+				CellsOut.Add(pair.Key);
+			}
+		}
+	}
+
+	/* A single map of all the cells, for the callers outside the layout generation.*/
+	TMap<FIntPoint, FCellLayout> ToMap() const
+	{
+		TMap<FIntPoint, FCellLayout> Cells;
+		Cells.Reserve(Num());
+		for (const FShard& Shard : Shards)
+		{
+			Cells.Append(Shard);
+		}
+
+		return Cells;
+	}
+
+	/* Goes through the shards in order. Only compared against the end, by the range based for loops.*/
+	template<bool bConst>
+	class TCellsIterator
+	{
+		typedef std::conditional_t<bConst, const TArray<FShard>, TArray<FShard>> FShardsType;
+		typedef std::conditional_t<bConst, FShard::TConstIterator, FShard::TIterator> FShardIterator;
+		typedef std::conditional_t<bConst, const TPair<FIntPoint, FCellLayout>, TPair<FIntPoint, FCellLayout>> FPairType;
+
+	public:
+		TCellsIterator(FShardsType& ShardsIn, int32 ShardIndexIn)
+			: Shards(ShardsIn)
+			, ShardIndex(ShardIndexIn)
+		{
+			SkipEmptyShards();
+		}
+
+		TCellsIterator& operator++()
+		{
+			++(*ShardIterator);
+			SkipEmptyShards();
+			return *this;
+		}
+
+		FPairType& operator*() const
+		{
+			return **ShardIterator;
+		}
+
+		bool operator!=(const TCellsIterator& OtherIn) const
+		{
+			return ShardIndex != OtherIn.ShardIndex;
+		}
+
+	private:
+		FShardsType& Shards;
+		int32 ShardIndex;
+		TOptional<FShardIterator> ShardIterator;
+
+		void SkipEmptyShards()
+		{
+			while (ShardIndex < Shards.Num())
+			{
+				if (!ShardIterator.IsSet())
+				{
+					if constexpr (bConst)
+					{
+						ShardIterator.Emplace(Shards[ShardIndex].CreateConstIterator());
+					}
+					else
+					{
+						ShardIterator.Emplace(Shards[ShardIndex].CreateIterator());
+					}
+				}
+
+				if (*ShardIterator)
+				{
+					return;
+				}
+
+				ShardIterator.Reset();
+				ShardIndex++;
+			}
+		}
+	};
+
+	TCellsIterator<false> begin() { return TCellsIterator<false>(Shards, 0); }
+	TCellsIterator<false> end() { return TCellsIterator<false>(Shards, Shards.Num()); }
+	TCellsIterator<true> begin() const { return TCellsIterator<true>(Shards, 0); }
+	TCellsIterator<true> end() const { return TCellsIterator<true>(Shards, Shards.Num()); }
+
+private:
+	TArray<FShard> Shards;
+};
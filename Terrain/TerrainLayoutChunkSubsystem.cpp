@@ -0,0 +1,797 @@
+//Copyright 2020 Marchetti S. Alfredo I. All Rights Reserved.
+
+#include "Layout/TerrainLayoutChunkSubsystem.h"
+#include "Layout/TerrainLayoutSubsystem.h"
+#include "Layout/TerrainLayoutData.h"
+#include "Layout/LayoutThreads/CorridorLayoutWorker.h"
+#include "Terrain/TerrainData.h"
+#include "TerrainGeneratorLogs.h"
+#include "Tags/TerrainTags.h"
+#include "Async/Async.h"
+#include "Algo/Sort.h"
+#include "GameFramework/Actor.h"
+#include "TerrainGeneratorMemory.h"
+
+namespace TerrainLayoutChunk
+{
+	static const FIntPoint NeighbourOffsets[] = { FIntPoint(1, 0), FIntPoint(-1, 0), FIntPoint(0, 1), FIntPoint(0, -1) };
+}
+
+/**
+*	The work of a chunk update. Filled on the game thread when the update starts, then only its tasks write it until it is published.
+*	The cached chunks it reads are not written by anyone while it is in flight. The chunks it completes are copies, so the cached ones stay as they were.
+*/
+struct FTerrainLayoutChunkUpdate
+{
+	FIntPoint CenterChunk = FIntPoint();
+
+	FTerrainLayoutCancellationTokenPtr CancellationToken;
+
+	/* Chunks of the load area and its ring that were not cached. Generated up to the corridors.*/
+	TArray<TSharedPtr<FTerrainLayoutChunk>> NewChunks;
+
+	/* Chunks of the load area to complete, new ones or copies of the cached ones.*/
+	TArray<TSharedPtr<FTerrainLayoutChunk>> ChunksToComplete;
+
+	/* The chunks at the corridors state read by the stitches.*/
+	TMap<FIntPoint, TSharedPtr<FTerrainLayoutChunk>> StitchChunks;
+
+	TArray<FIntVector> MissingStitches;
+	TArray<FTerrainLayoutChunkStitch> NewStitches;
+
+	/* Cached stitches of the chunks to complete, copied so the tasks do not read the stitches map.*/
+	TMap<FIntVector, FTerrainLayoutChunkStitch> CachedStitches;
+};
+
+int64 FTerrainLayoutChunk::GetAllocatedSize() const
+{
+	int64 Size = RoomsLayoutMap.GetAllocatedSize() + CellsLayoutMap.GetAllocatedSize();
+	for (const TPair<FIntPoint, FRoomLayout>& pair : RoomsLayoutMap)
+	{
+		Size += pair.Value.Cells.GetAllocatedSize();
+	}
+
+	return Size;
+}
+
+void UTerrainLayoutChunkSubsystem::Deinitialize()
+{
+	SetTrackedActor(nullptr);
+	CancelUpdateInFlight();
+
+	Chunks.Empty();
+	Stitches.Empty();
+	Generators.Empty();
+
+	Super::Deinitialize();
+}
+
+void UTerrainLayoutChunkSubsystem::StartChunkedGeneration(UTerrainData* InTerrainData, int32 InSeed)
+{
+	if (!InTerrainData || !InTerrainData->TerrainLayoutData)
+	{
+		UE_LOG(TerrainGeneratorLog, Error, TEXT("UTerrainLayoutChunkSubsystem::StartChunkedGeneration - Invalid terrain data."));
+		return;
+	}
+
+	CancelUpdateInFlight();
+
+	TerrainData = InTerrainData;
+	TerrainLayoutData = InTerrainData->TerrainLayoutData;
+	WorldSeed = InSeed;
+	ChunkSize = FMath::Max(TerrainLayoutData->ChunkSizeCells, 16);
+	UpdateCounter = 0;
+
+	Chunks.Empty();
+	Stitches.Empty();
+
+	TrackedActorChunk = FIntPoint::ZeroValue;
+	UpdateChunksAroundChunk(FIntPoint::ZeroValue);
+}
+
+void UTerrainLayoutChunkSubsystem::UpdateChunksAroundCell(const FIntPoint& CellIn)
+{
+	if (!TerrainData || !TerrainLayoutData)
+	{
+		UE_LOG(TerrainGeneratorLog, Error, TEXT("UTerrainLayoutChunkSubsystem::UpdateChunksAroundCell - Chunked generation not started."));
+		return;
+	}
+
+	UpdateChunksAroundChunk(GetChunkOfCell(CellIn));
+}
+
+void UTerrainLayoutChunkSubsystem::UpdateChunksAroundLocation(const FVector& WorldLocationIn)
+{
+	if (!TerrainData || TerrainData->CellSize <= 0)
+	{
+		return;
+	}
+
+	//Axis are reversed, see UTerrainLayoutSubsystem::GetCellWorldPosition
+	const FIntPoint Cell = FIntPoint(FMath::FloorToInt(WorldLocationIn.Y / TerrainData->CellSize), FMath::FloorToInt(WorldLocationIn.X / TerrainData->CellSize));
+	UpdateChunksAroundCell(Cell);
+}
+
+void UTerrainLayoutChunkSubsystem::SetTrackedActor(AActor* ActorIn)
+{
+	TrackedActor = ActorIn;
+
+	if (!ActorIn)
+	{
+		FTSTicker::GetCoreTicker().RemoveTicker(TrackedActorTickerHandle);
+		TrackedActorTickerHandle.Reset();
+		return;
+	}
+
+	if (!TrackedActorTickerHandle.IsValid())
+	{
+		TrackedActorTickerHandle = FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateUObject(this, &UTerrainLayoutChunkSubsystem::TickTrackedActor));
+	}
+
+	//The first tick updates around the actor, even in the chunk of the last update.
+	TrackedActorChunk = FIntPoint(MAX_int32, MAX_int32);
+}
+
+bool UTerrainLayoutChunkSubsystem::IsUpdateInFlight() const
+{
+	return UpdateInFlight.IsValid();
+}
+
+bool UTerrainLayoutChunkSubsystem::TickTrackedActor(float DeltaTime)
+{
+	const AActor* Actor = TrackedActor.Get();
+	if (!Actor)
+	{
+		TrackedActorTickerHandle.Reset();
+		return false;
+	}
+
+	if (!TerrainData || TerrainData->CellSize <= 0)
+	{
+		return true;
+	}
+
+	//Axis are reversed, see UTerrainLayoutSubsystem::GetCellWorldPosition
+	const FVector Location = Actor->GetActorLocation();
+	const FIntPoint Cell = FIntPoint(FMath::FloorToInt(Location.Y / TerrainData->CellSize), FMath::FloorToInt(Location.X / TerrainData->CellSize));
+	const FIntPoint Chunk = GetChunkOfCell(Cell);
+
+	if (Chunk != TrackedActorChunk)
+	{
+		TrackedActorChunk = Chunk;
+		UpdateChunksAroundChunk(Chunk);
+	}
+
+	return true;
+}
+
+const FCellLayout* UTerrainLayoutChunkSubsystem::FindCellLayout(const FIntPoint& CellIn) const
+{
+	const FTerrainLayoutChunk* Chunk = FindCompletedChunk(GetChunkOfCell(CellIn));
+	if (!Chunk)
+	{
+		return nullptr;
+	}
+
+	return Chunk->CellsLayoutMap.Find(CellIn);
+}
+
+const FTerrainLayoutChunk* UTerrainLayoutChunkSubsystem::FindCompletedChunk(const FIntPoint& ChunkIDIn) const
+{
+	const TSharedPtr<FTerrainLayoutChunk>* Chunk = Chunks.Find(ChunkIDIn);
+	if (!Chunk || (*Chunk)->State != ETerrainGen_LayoutChunkState::Completed)
+	{
+		return nullptr;
+	}
+
+	return Chunk->Get();
+}
+
+FIntPoint UTerrainLayoutChunkSubsystem::GetInitialRoom() const
+{
+	const TSharedPtr<FTerrainLayoutChunk>* Chunk = Chunks.Find(FIntPoint::ZeroValue);
+	if (!Chunk)
+	{
+		return FIntPoint();
+	}
+
+	return (*Chunk)->InitialRoom;
+}
+
+FIntPoint UTerrainLayoutChunkSubsystem::GetChunkOfCell(const FIntPoint& CellIn) const
+{
+	if (ChunkSize <= 0)
+	{
+		return FIntPoint();
+	}
+
+	//Floor division, so negative cells belong to negative chunks.
+	const int32 X = CellIn.X >= 0 ? CellIn.X / ChunkSize : (CellIn.X - ChunkSize + 1) / ChunkSize;
+	const int32 Y = CellIn.Y >= 0 ? CellIn.Y / ChunkSize : (CellIn.Y - ChunkSize + 1) / ChunkSize;
+	return FIntPoint(X, Y);
+}
+
+int64 UTerrainLayoutChunkSubsystem::GetCachedChunksSize() const
+{
+	int64 Size = 0;
+	for (const TPair<FIntPoint, TSharedPtr<FTerrainLayoutChunk>>& pair : Chunks)
+	{
+		Size += pair.Value->GetAllocatedSize();
+	}
+
+	return Size;
+}
+
+void UTerrainLayoutChunkSubsystem::UpdateChunksAroundChunk(const FIntPoint& CenterChunkIn)
+{
+	LLM_SCOPE_BYTAG(TerrainGenerator_Layout);
+
+	if (UpdateInFlight.IsValid())
+	{
+		PendingCenterChunk = CenterChunkIn;
+		return;
+	}
+
+	UpdateCounter++;
+
+	const int32 LoadRadius = FMath::Max(TerrainLayoutData->ChunkLoadRadius, 0);
+
+	TSharedRef<FTerrainLayoutChunkUpdate> Update = MakeShared<FTerrainLayoutChunkUpdate>();
+	Update->CenterChunk = CenterChunkIn;
+	Update->CancellationToken = MakeShared<FTerrainLayoutCancellationToken, ESPMode::ThreadSafe>();
+
+	//The ring around the load area is only needed up to the corridors, so the border chunks can be stitched.
+	TMap<FIntPoint, TSharedPtr<FTerrainLayoutChunk>> AreaChunks;
+	for (int32 x = -LoadRadius - 1; x <= LoadRadius + 1; x++)
+	{
+		for (int32 y = -LoadRadius - 1; y <= LoadRadius + 1; y++)
+		{
+			const FIntPoint ChunkID = CenterChunkIn + FIntPoint(x, y);
+
+			if (TSharedPtr<FTerrainLayoutChunk>* Chunk = Chunks.Find(ChunkID))
+			{
+				(*Chunk)->LastUsedUpdate = UpdateCounter;
+				AreaChunks.Add(ChunkID, *Chunk);
+				continue;
+			}
+
+			TSharedPtr<FTerrainLayoutChunk> NewChunk = MakeShared<FTerrainLayoutChunk>();
+			NewChunk->ChunkID = ChunkID;
+			NewChunk->Seed = GetChunkSeed(ChunkID);
+			NewChunk->LastUsedUpdate = UpdateCounter;
+			Update->NewChunks.Add(NewChunk);
+			AreaChunks.Add(ChunkID, NewChunk);
+		}
+	}
+
+	//The chunks of the load area to complete, and the stitches they are missing.
+	for (int32 x = -LoadRadius; x <= LoadRadius; x++)
+	{
+		for (int32 y = -LoadRadius; y <= LoadRadius; y++)
+		{
+			const FIntPoint ChunkID = CenterChunkIn + FIntPoint(x, y);
+			const TSharedPtr<FTerrainLayoutChunk>& Chunk = AreaChunks.FindChecked(ChunkID);
+
+			if (Chunk->State == ETerrainGen_LayoutChunkState::Completed)
+			{
+				continue;
+			}
+
+			//Cached chunks are completed on a copy, the cached one can still be read by the stitches of this update.
+			Update->ChunksToComplete.Add(Update->NewChunks.Contains(Chunk) ? Chunk : MakeShared<FTerrainLayoutChunk>(*Chunk));
+
+			for (const FIntPoint& Offset : TerrainLayoutChunk::NeighbourOffsets)
+			{
+				const FIntVector StitchKey = GetStitchKey(ChunkID, ChunkID + Offset);
+				if (const FTerrainLayoutChunkStitch* Stitch = Stitches.Find(StitchKey))
+				{
+					Update->CachedStitches.Add(StitchKey, *Stitch);
+				}
+				else
+				{
+					Update->MissingStitches.AddUnique(StitchKey);
+				}
+			}
+		}
+	}
+
+	//A completed chunk has all its stitches, and a stitch is only dropped once both of its chunks are evicted. So both chunks of a missing stitch are at the corridors state.
+	for (const FIntVector& StitchKey : Update->MissingStitches)
+	{
+		for (const FIntPoint& ChunkID : { FIntPoint(StitchKey.X, StitchKey.Y), GetStitchNeighbour(StitchKey) })
+		{
+			const TSharedPtr<FTerrainLayoutChunk>& Chunk = AreaChunks.FindChecked(ChunkID);
+			check(Chunk->State == ETerrainGen_LayoutChunkState::Corridors);
+			Update->StitchChunks.Add(ChunkID, Chunk);
+		}
+	}
+
+	Update->NewStitches.SetNum(Update->MissingStitches.Num());
+
+	//Each generator holds the layout state of one generation, so they cannot be shared between chunks in flight.
+	const int32 Concurrency = FMath::Max(TerrainData->MaximunThreads, 1);
+	while (Generators.Num() < Concurrency)
+	{
+		Generators.Add(NewObject<UTerrainLayoutSubsystem>(this));
+	}
+
+	const UE::Tasks::FTask CorridorsTask = LaunchGeneratorTasks(Update->NewChunks.Num(), [this, Update](UTerrainLayoutSubsystem* Generator, int32 Index)
+	{
+		GenerateChunkCorridors(Generator, *Update->NewChunks[Index], Update->CancellationToken);
+	}, UE::Tasks::FTask());
+
+	const UE::Tasks::FTask StitchesTask = LaunchGeneratorTasks(Update->MissingStitches.Num(), [this, Update](UTerrainLayoutSubsystem* Generator, int32 Index)
+	{
+		const FIntVector& StitchKey = Update->MissingStitches[Index];
+		const FTerrainLayoutChunk& ChunkA = *Update->StitchChunks.FindChecked(FIntPoint(StitchKey.X, StitchKey.Y));
+		const FTerrainLayoutChunk& ChunkB = *Update->StitchChunks.FindChecked(GetStitchNeighbour(StitchKey));
+		const int32 StitchSeed = StaticCast<int32>(HashCombine(GetTypeHash(WorldSeed), GetTypeHash(StitchKey)));
+
+		GenerateStitch(ChunkA, ChunkB, StitchSeed, Update->NewStitches[Index]);
+	}, CorridorsTask);
+
+	UpdateInFlightTask = LaunchGeneratorTasks(Update->ChunksToComplete.Num(), [this, Update](UTerrainLayoutSubsystem* Generator, int32 Index)
+	{
+		FTerrainLayoutChunk& Chunk = *Update->ChunksToComplete[Index];
+
+		for (const FIntPoint& Offset : TerrainLayoutChunk::NeighbourOffsets)
+		{
+			const FIntVector StitchKey = GetStitchKey(Chunk.ChunkID, Chunk.ChunkID + Offset);
+			const int32 MissingIndex = Update->MissingStitches.Find(StitchKey);
+
+			if (MissingIndex != INDEX_NONE)
+			{
+				ApplyStitch(Update->NewStitches[MissingIndex], Chunk);
+			}
+			else if (const FTerrainLayoutChunkStitch* Stitch = Update->CachedStitches.Find(StitchKey))
+			{
+				ApplyStitch(*Stitch, Chunk);
+			}
+		}
+
+		CompleteChunk(Generator, Chunk, Update->CancellationToken);
+	}, StitchesTask);
+
+	UpdateInFlight = Update;
+
+	TWeakObjectPtr<UTerrainLayoutChunkSubsystem> WeakThis = this;
+	UE::Tasks::Launch(TEXT("TerrainLayoutChunkUpdateEnd"), [WeakThis, Update]()
+	{
+		AsyncTask(ENamedThreads::GameThread, [WeakThis, Update]()
+		{
+			if (UTerrainLayoutChunkSubsystem* ChunkSubsystem = WeakThis.Get())
+			{
+				ChunkSubsystem->PublishChunkUpdate(Update);
+			}
+		});
+	}, UE::Tasks::Prerequisites(UpdateInFlightTask));
+}
+
+void UTerrainLayoutChunkSubsystem::PublishChunkUpdate(const TSharedRef<FTerrainLayoutChunkUpdate>& UpdateIn)
+{
+	LLM_SCOPE_BYTAG(TerrainGenerator_Layout);
+
+	//A cancelled update may end after a new one started.
+	if (UpdateInFlight != UpdateIn || UpdateIn->CancellationToken->IsCancelled())
+	{
+		return;
+	}
+
+	UpdateInFlight.Reset();
+
+	for (const TSharedPtr<FTerrainLayoutChunk>& NewChunk : UpdateIn->NewChunks)
+	{
+		Chunks.Add(NewChunk->ChunkID, NewChunk);
+	}
+
+	//Replaces the cached chunks that were completed on a copy.
+	for (const TSharedPtr<FTerrainLayoutChunk>& Chunk : UpdateIn->ChunksToComplete)
+	{
+		Chunks.Add(Chunk->ChunkID, Chunk);
+	}
+
+	//Failed stitches are stored too, so they are not tried again.
+	for (int32 i = 0; i < UpdateIn->MissingStitches.Num(); i++)
+	{
+		Stitches.Add(UpdateIn->MissingStitches[i], MoveTemp(UpdateIn->NewStitches[i]));
+	}
+
+	for (const TSharedPtr<FTerrainLayoutChunk>& Chunk : UpdateIn->ChunksToComplete)
+	{
+		OnChunkCompleted.Broadcast(Chunk->ChunkID);
+	}
+
+	UE_LOG(TerrainGeneratorLog, Log, TEXT("UTerrainLayoutChunkSubsystem::PublishChunkUpdate - Chunk (%i, %i): %i chunks generated, %i stitched, %i completed."),
+		UpdateIn->CenterChunk.X,
+		UpdateIn->CenterChunk.Y,
+		UpdateIn->NewChunks.Num(),
+		UpdateIn->MissingStitches.Num(),
+		UpdateIn->ChunksToComplete.Num());
+
+	EvictChunks(UpdateIn->CenterChunk);
+
+	if (PendingCenterChunk.IsSet())
+	{
+		const FIntPoint CenterChunk = PendingCenterChunk.GetValue();
+		PendingCenterChunk.Reset();
+		UpdateChunksAroundChunk(CenterChunk);
+	}
+}
+
+void UTerrainLayoutChunkSubsystem::CancelUpdateInFlight()
+{
+	PendingCenterChunk.Reset();
+
+	if (!UpdateInFlight.IsValid())
+	{
+		return;
+	}
+
+	//The generators check the token between their stages, so the wait is short.
+	UpdateInFlight->CancellationToken->Cancel();
+	UpdateInFlightTask.Wait();
+	UpdateInFlight.Reset();
+}
+
+UE::Tasks::FTask UTerrainLayoutChunkSubsystem::LaunchGeneratorTasks(int32 NumIn, TFunction<void(UTerrainLayoutSubsystem* Generator, int32 Index)> FunctionIn, const UE::Tasks::FTask& PrerequisiteIn)
+{
+	const int32 Concurrency = FMath::Min(Generators.Num(), NumIn);
+
+	TArray<UE::Tasks::FTask> Tasks;
+	for (int32 Slot = 0; Slot < Concurrency; Slot++)
+	{
+		Tasks.Add(UE::Tasks::Launch(TEXT("TerrainLayoutChunkGenerator"), [Generator = Generators[Slot], Slot, Concurrency, NumIn, FunctionIn]()
+		{
+			LLM_SCOPE_BYTAG(TerrainGenerator_Layout);
+
+			for (int32 Index = Slot; Index < NumIn; Index += Concurrency)
+			{
+				FunctionIn(Generator, Index);
+			}
+		}, UE::Tasks::Prerequisites(PrerequisiteIn)));
+	}
+
+	//Nothing to run still waits for the prerequisite, so the next step keeps the order.
+	Tasks.Add(PrerequisiteIn);
+	return UE::Tasks::Launch(TEXT("TerrainLayoutChunkGeneratorsEnd"), []() {}, UE::Tasks::Prerequisites(Tasks));
+}
+
+void UTerrainLayoutChunkSubsystem::GenerateChunkCorridors(UTerrainLayoutSubsystem* GeneratorIn, FTerrainLayoutChunk& ChunkOut, const FTerrainLayoutCancellationTokenPtr& CancellationTokenIn) const
+{
+	GeneratorIn->GenerateTerrainLayoutSynchronous(TerrainData, ChunkOut.Seed, ETerrainGen_LayoutStage::Corridors, CancellationTokenIn);
+	if (CancellationTokenIn->IsCancelled())
+	{
+		return;
+	}
+
+	ChunkOut.InitialRoom = GeneratorIn->InitialRoom;
+	ChunkOut.RoomsLayoutMap = MoveTemp(GeneratorIn->RoomsLayoutMap);
+	ChunkOut.CellsLayoutMap = MoveTemp(GeneratorIn->CellsLayoutMap);
+	ChunkOut.State = ETerrainGen_LayoutChunkState::Corridors;
+
+	MoveLayoutToChunk(ChunkOut);
+}
+
+void UTerrainLayoutChunkSubsystem::CompleteChunk(UTerrainLayoutSubsystem* GeneratorIn, FTerrainLayoutChunk& ChunkOut, const FTerrainLayoutCancellationTokenPtr& CancellationTokenIn) const
+{
+	if (CancellationTokenIn->IsCancelled())
+	{
+		return;
+	}
+
+	FTerrainLayoutSnapshot Snapshot = FTerrainLayoutSnapshot();
+	Snapshot.bIsValid = true;
+	Snapshot.Stream.Initialize(StaticCast<int32>(HashCombine(GetTypeHash(ChunkOut.Seed), GetTypeHash(ChunkOut.ChunkID))));
+	Snapshot.InitialRoom = ChunkOut.InitialRoom;
+	Snapshot.RoomsLayoutMap = MoveTemp(ChunkOut.RoomsLayoutMap);
+	Snapshot.CellsLayoutMap = MoveTemp(ChunkOut.CellsLayoutMap);
+
+	GeneratorIn->RestoreLayoutSnapshot(TerrainData, Snapshot);
+	GeneratorIn->RunLayoutStageSynchronous(ETerrainGen_LayoutStage::Walls);
+	if (CancellationTokenIn->IsCancelled())
+	{
+		return;
+	}
+
+	GeneratorIn->RunLayoutStageSynchronous(ETerrainGen_LayoutStage::Depth);
+
+	ChunkOut.RoomsLayoutMap = MoveTemp(GeneratorIn->RoomsLayoutMap);
+	ChunkOut.CellsLayoutMap = MoveTemp(GeneratorIn->CellsLayoutMap);
+	ChunkOut.State = ETerrainGen_LayoutChunkState::Completed;
+
+	ClipLayoutToChunk(ChunkOut);
+}
+
+void UTerrainLayoutChunkSubsystem::MoveLayoutToChunk(FTerrainLayoutChunk& ChunkOut) const
+{
+	if (ChunkOut.CellsLayoutMap.Num() == 0)
+	{
+		return;
+	}
+
+	FIntPoint MinCell = FIntPoint(MAX_int32, MAX_int32);
+	FIntPoint MaxCell = FIntPoint(MIN_int32, MIN_int32);
+	for (const TPair<FIntPoint, FCellLayout>& pair : ChunkOut.CellsLayoutMap)
+	{
+		MinCell = MinCell.ComponentMin(pair.Key);
+		MaxCell = MaxCell.ComponentMax(pair.Key);
+	}
+
+	//The layout is centered in the chunk.
+	const FIntPoint Offset = GetChunkCenter(ChunkOut.ChunkID) - (MinCell + MaxCell) / 2;
+
+	FTerrainLayoutCellsMap CellsLayoutMap;
+	CellsLayoutMap.Reserve(ChunkOut.CellsLayoutMap.Num());
+
+	int32 DiscardedCells = 0;
+	for (TPair<FIntPoint, FCellLayout>& pair : ChunkOut.CellsLayoutMap)
+	{
+		const FIntPoint Cell = pair.Key + Offset;
+		if (!IsCellInChunk(Cell, ChunkOut.ChunkID))
+		{
+			DiscardedCells++;
+			continue;
+		}
+
+		FCellLayout& CellLayout = CellsLayoutMap.Add(Cell, MoveTemp(pair.Value));
+		CellLayout.CellID = Cell;
+
+		if (ChunkOut.RoomsLayoutMap.Contains(CellLayout.RoomID))
+		{
+			CellLayout.RoomID += Offset;
+		}
+	}
+
+	TMap<FIntPoint, FRoomLayout> RoomsLayoutMap;
+	RoomsLayoutMap.Reserve(ChunkOut.RoomsLayoutMap.Num());
+
+	for (TPair<FIntPoint, FRoomLayout>& pair : ChunkOut.RoomsLayoutMap)
+	{
+		FRoomLayout& RoomLayout = RoomsLayoutMap.Add(pair.Key + Offset, MoveTemp(pair.Value));
+		RoomLayout.InitialCell += Offset;
+		RoomLayout.CentralCell += Offset;
+
+		for (int32 i = RoomLayout.Cells.Num() - 1; i >= 0; i--)
+		{
+			RoomLayout.Cells[i] += Offset;
+
+			if (!IsCellInChunk(RoomLayout.Cells[i], ChunkOut.ChunkID))
+			{
+				RoomLayout.Cells.RemoveAtSwap(i);
+			}
+		}
+	}
+
+	ChunkOut.InitialRoom += Offset;
+	ChunkOut.CellsLayoutMap = MoveTemp(CellsLayoutMap);
+	ChunkOut.RoomsLayoutMap = MoveTemp(RoomsLayoutMap);
+
+	if (DiscardedCells > 0)
+	{
+		UE_LOG(TerrainGeneratorLog, Warning, TEXT("UTerrainLayoutChunkSubsystem::MoveLayoutToChunk - Chunk (%i, %i) layout does not fit in the chunk, %i cells discarded. Increase the chunk size."),
+			ChunkOut.ChunkID.X,
+			ChunkOut.ChunkID.Y,
+			DiscardedCells);
+	}
+}
+
+void UTerrainLayoutChunkSubsystem::ClipLayoutToChunk(FTerrainLayoutChunk& ChunkOut) const
+{
+	for (int32 ShardIndex = 0; ShardIndex < FTerrainLayoutCellsMap::ShardsAmount; ShardIndex++)
+	{
+		for (auto It = ChunkOut.CellsLayoutMap.GetShard(ShardIndex).CreateIterator(); It; ++It)
+		{
+			if (!IsCellInChunk(It.Key(), ChunkOut.ChunkID))
+			{
+				It.RemoveCurrent();
+			}
+		}
+	}
+
+	ChunkOut.CellsLayoutMap.Compact();
+}
+
+bool UTerrainLayoutChunkSubsystem::GenerateStitch(const FTerrainLayoutChunk& ChunkA, const FTerrainLayoutChunk& ChunkB, int32 SeedIn, FTerrainLayoutChunkStitch& StitchOut) const
+{
+	FTerrain_RoomDistance RoomDistance = FTerrain_RoomDistance();
+	if (!FindNearestRoom(ChunkA, GetChunkCenter(ChunkB.ChunkID), RoomDistance.RoomA) || !FindNearestRoom(ChunkB, GetChunkCenter(ChunkA.ChunkID), RoomDistance.RoomB))
+	{
+		return false;
+	}
+
+	const FVector2D CentralCellA = FVector2D(ChunkA.RoomsLayoutMap[RoomDistance.RoomA].CentralCell);
+	const FVector2D CentralCellB = FVector2D(ChunkB.RoomsLayoutMap[RoomDistance.RoomB].CentralCell);
+	RoomDistance.Distance = FVector2D::Distance(CentralCellA, CentralCellB) * TerrainData->CellSize;
+
+	TMap<FIntPoint, FRoomLayout> RoomsLayoutMap;
+	RoomsLayoutMap.Reserve(ChunkA.RoomsLayoutMap.Num() + ChunkB.RoomsLayoutMap.Num());
+	RoomsLayoutMap.Append(ChunkA.RoomsLayoutMap);
+	RoomsLayoutMap.Append(ChunkB.RoomsLayoutMap);
+
+	FTerrainLayoutCellsMap CellsLayoutMap;
+	CellsLayoutMap.Reserve(ChunkA.CellsLayoutMap.Num() + ChunkB.CellsLayoutMap.Num());
+	CellsLayoutMap.Append(ChunkA.CellsLayoutMap);
+	CellsLayoutMap.Append(ChunkB.CellsLayoutMap);
+
+	TArray<FTerrain_RoomDistance> StartEndRoom;
+	StartEndRoom.Add(RoomDistance);
+
+	FCorridorLayoutWorker Worker = FCorridorLayoutWorker(
+		TerrainData->CellSize,
+		StartEndRoom,
+		TerrainLayoutData,
+		MakeShared<const TMap<FIntPoint, FRoomLayout>>(MoveTemp(RoomsLayoutMap)),
+		MakeShared<const FTerrainLayoutCellsMap>(MoveTemp(CellsLayoutMap)),
+		FTerrainLayoutCancellationTokenPtr(),
+		FTerrainLayoutStreamQueuePtr());
+
+	//The rooms of two chunks can be far apart, the search needs more nodes than a corridor inside a chunk.
+	Worker.MaxPathIterations = FMath::Max(Worker.MaxPathIterations, ChunkSize * 4);
+	Worker.Stream.Initialize(SeedIn);
+	Worker.Run();
+
+	if (Worker.GeneratedCorridorLayout.Num() == 0)
+	{
+		UE_LOG(TerrainGeneratorLog, Warning, TEXT("UTerrainLayoutChunkSubsystem::GenerateStitch - Could not stitch chunks (%i, %i) and (%i, %i)."),
+			ChunkA.ChunkID.X,
+			ChunkA.ChunkID.Y,
+			ChunkB.ChunkID.X,
+			ChunkB.ChunkID.Y);
+		return false;
+	}
+
+	StitchOut.bIsValid = true;
+	StitchOut.Corridor = MoveTemp(Worker.GeneratedCorridorLayout[0]);
+	return true;
+}
+
+void UTerrainLayoutChunkSubsystem::ApplyStitch(const FTerrainLayoutChunkStitch& StitchIn, FTerrainLayoutChunk& ChunkOut) const
+{
+	if (!StitchIn.bIsValid)
+	{
+		return;
+	}
+
+	//Each chunk takes the part of the corridor inside it.
+	for (const FIntPoint& cell : StitchIn.Corridor.Cells)
+	{
+		if (!IsCellInChunk(cell, ChunkOut.ChunkID))
+		{
+			continue;
+		}
+
+		FCellLayout& CellLayout = ChunkOut.CellsLayoutMap.FindOrAdd(cell);
+		CellLayout.CellID = cell;
+		CellLayout.Tags.AddTag(TAG_TERRAIN_CELL_TYPE_CORRIDOR);
+
+		if (cell == StitchIn.Corridor.EndCellId)
+		{
+			CellLayout.Tags.AddTag(TAG_TERRAIN_CELL_LAYOUT_DOOR_ENDCORRIDOR);
+		}
+		else if (cell == StitchIn.Corridor.StartCellId)
+		{
+			CellLayout.Tags.AddTag(TAG_TERRAIN_CELL_LAYOUT_DOOR_STARTCORRIDOR);
+		}
+	}
+}
+
+FIntVector UTerrainLayoutChunkSubsystem::GetStitchKey(const FIntPoint& ChunkA, const FIntPoint& ChunkB) const
+{
+	const bool bIsAFirst = ChunkA.X < ChunkB.X || ChunkA.Y < ChunkB.Y;
+	const FIntPoint& LowerChunk = bIsAFirst ? ChunkA : ChunkB;
+	const int32 Axis = ChunkA.X != ChunkB.X ? 0 : 1;
+
+	return FIntVector(LowerChunk.X, LowerChunk.Y, Axis);
+}
+
+FIntPoint UTerrainLayoutChunkSubsystem::GetStitchNeighbour(const FIntVector& StitchKeyIn) const
+{
+	return StitchKeyIn.Z == 0 ? FIntPoint(StitchKeyIn.X + 1, StitchKeyIn.Y) : FIntPoint(StitchKeyIn.X, StitchKeyIn.Y + 1);
+}
+
+bool UTerrainLayoutChunkSubsystem::FindNearestRoom(const FTerrainLayoutChunk& ChunkIn, const FIntPoint& TargetCellIn, FIntPoint& RoomOut) const
+{
+	bool bFoundRoom = false;
+	int64 NearestDistance = MAX_int64;
+
+	for (const TPair<FIntPoint, FRoomLayout>& pair : ChunkIn.RoomsLayoutMap)
+	{
+		if (pair.Value.Cells.Num() == 0)
+		{
+			continue;
+		}
+
+		const FIntPoint Delta = pair.Value.CentralCell - TargetCellIn;
+		const int64 Distance = StaticCast<int64>(Delta.X) * Delta.X + StaticCast<int64>(Delta.Y) * Delta.Y;
+
+		if (Distance < NearestDistance)
+		{
+			NearestDistance = Distance;
+			RoomOut = pair.Key;
+			bFoundRoom = true;
+		}
+	}
+
+	return bFoundRoom;
+}
+
+void UTerrainLayoutChunkSubsystem::EvictChunks(const FIntPoint& CenterChunkIn)
+{
+	const int64 Budget = StaticCast<int64>(TerrainLayoutData->ChunkMemoryBudgetMB * 1024.0 * 1024.0);
+	int64 Size = GetCachedChunksSize();
+
+	if (Size <= Budget)
+	{
+		return;
+	}
+
+	//The load area and the ring needed to stitch it are never evicted.
+	const int32 KeepRadius = FMath::Max(TerrainLayoutData->ChunkLoadRadius, 0) + 1;
+
+	TArray<TSharedPtr<FTerrainLayoutChunk>> Candidates;
+	for (const TPair<FIntPoint, TSharedPtr<FTerrainLayoutChunk>>& pair : Chunks)
+	{
+		if (GetChunkDistance(pair.Key, CenterChunkIn) > KeepRadius)
+		{
+			Candidates.Add(pair.Value);
+		}
+	}
+
+	Algo::Sort(Candidates, [](const TSharedPtr<FTerrainLayoutChunk>& A, const TSharedPtr<FTerrainLayoutChunk>& B)
+	{
+		return A->LastUsedUpdate < B->LastUsedUpdate;
+	});
+
+	for (const TSharedPtr<FTerrainLayoutChunk>& Chunk : Candidates)
+	{
+		if (Size <= Budget)
+		{
+			break;
+		}
+
+		Size -= Chunk->GetAllocatedSize();
+		Chunks.Remove(Chunk->ChunkID);
+		OnChunkEvicted.Broadcast(Chunk->ChunkID);
+	}
+
+	for (auto It = Stitches.CreateIterator(); It; ++It)
+	{
+		if (!Chunks.Contains(FIntPoint(It.Key().X, It.Key().Y)) && !Chunks.Contains(GetStitchNeighbour(It.Key())))
+		{
+			It.RemoveCurrent();
+		}
+	}
+
+	if (Size > Budget)
+	{
+		UE_LOG(TerrainGeneratorLog, Warning, TEXT("UTerrainLayoutChunkSubsystem::EvictChunks - The load area alone uses %.1f MB, over the budget of %.1f MB."),
+			Size / (1024.0 * 1024.0),
+			TerrainLayoutData->ChunkMemoryBudgetMB);
+	}
+}
+
+int32 UTerrainLayoutChunkSubsystem::GetChunkSeed(const FIntPoint& ChunkIDIn) const
+{
+	return StaticCast<int32>(HashCombine(GetTypeHash(WorldSeed), GetTypeHash(ChunkIDIn)));
+}
+
+FIntPoint UTerrainLayoutChunkSubsystem::GetChunkOrigin(const FIntPoint& ChunkIDIn) const
+{
+	return ChunkIDIn * ChunkSize;
+}
+
+FIntPoint UTerrainLayoutChunkSubsystem::GetChunkCenter(const FIntPoint& ChunkIDIn) const
+{
+	return GetChunkOrigin(ChunkIDIn) + FIntPoint(ChunkSize / 2, ChunkSize / 2);
+}
+
+bool UTerrainLayoutChunkSubsystem::IsCellInChunk(const FIntPoint& CellIn, const FIntPoint& ChunkIDIn) const
+{
+	const FIntPoint Origin = GetChunkOrigin(ChunkIDIn);
+	return CellIn.X >= Origin.X && CellIn.X < Origin.X + ChunkSize && CellIn.Y >= Origin.Y && CellIn.Y < Origin.Y + ChunkSize;
+}
+
+int32 UTerrainLayoutChunkSubsystem::GetChunkDistance(const FIntPoint& ChunkA, const FIntPoint& ChunkB) const
+{
+	return FMath::Max(FMath::Abs(ChunkA.X - ChunkB.X), FMath::Abs(ChunkA.Y - ChunkB.Y));
+}
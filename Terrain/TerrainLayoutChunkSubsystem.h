@@ -0,0 +1,190 @@
+//Copyright 2020 Marchetti S. Alfredo I. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/EngineSubsystem.h"
+#include "Layout/LayoutTypes.h"
+#include "Layout/CorridorTypes.h"
+#include "Layout/TerrainLayoutCellsMap.h"
+#include "Layout/TerrainLayoutCancellation.h"
+#include "Tasks/Task.h"
+#include "Containers/Ticker.h"
+#include "TerrainLayoutChunkSubsystem.generated.h"
+
+class UTerrainData;
+class UTerrainLayoutData;
+class UTerrainLayoutSubsystem;
+class AActor;
+struct FTerrainLayoutChunkUpdate;
+
+DECLARE_MULTICAST_DELEGATE_OneParam(FChunkDelegateLayoutChunkSubsystemSignature, const FIntPoint& /*ChunkID*/);
+
+/* How far the generation of a chunk got.*/
+enum class ETerrainGen_LayoutChunkState : uint8
+{
+	/* Rooms and the corridors inside the chunk. Needed by the neighbours to stitch their corridors.*/
+	Corridors,
+
+	/* Stitched with its neighbours, walls and depth. Ready to be used.*/
+	Completed
+};
+
+/* The layout of a single chunk, in world cells.*/
+struct TERRAINGENERATOR_API FTerrainLayoutChunk
+{
+	FIntPoint ChunkID = FIntPoint();
+
+	ETerrainGen_LayoutChunkState State = ETerrainGen_LayoutChunkState::Corridors;
+
+	int32 Seed = 0;
+
+	FIntPoint InitialRoom = FIntPoint();
+
+	TMap <FIntPoint, FRoomLayout> RoomsLayoutMap;
+
+	FTerrainLayoutCellsMap CellsLayoutMap;
+
+	/* The update the chunk was last inside the load area. Used to evict the least recently used chunks.*/
+	uint64 LastUsedUpdate = 0;
+
+	int64 GetAllocatedSize() const;
+};
+
+/* The corridor connecting two adjacent chunks.*/
+struct TERRAINGENERATOR_API FTerrainLayoutChunkStitch
+{
+	bool bIsValid = false;
+
+	FCorridorLayout Corridor;
+};
+
+/**
+*	Generates the layout in square chunks of cells on demand, for worlds larger than a single layout generation.
+*	Each chunk is a full layout generation with a seed derived from the world seed and the chunk, so any chunk can be generated again after it is evicted.
+*	Adjacent chunks are connected by a stitching corridor between their nearest rooms, generated before the walls of both chunks.
+*	Completed chunks are cached and the least recently used ones out of the load area are evicted above the memory budget.
+*
+*	The chunks are generated on the task threads and published on the game thread, one update at a time.
+*	The load area follows the actor set with SetTrackedActor, usually the player pawn. Game code moving the load area itself calls UpdateChunksAroundCell or UpdateChunksAroundLocation instead.
+*/
+UCLASS()
+class TERRAINGENERATOR_API UTerrainLayoutChunkSubsystem : public UEngineSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	FChunkDelegateLayoutChunkSubsystemSignature OnChunkCompleted;
+	FChunkDelegateLayoutChunkSubsystemSignature OnChunkEvicted;
+
+	virtual void Deinitialize() override;
+
+	/* Clears all the chunks, cancelling the update in flight, and generates the ones around the initial chunk.*/
+	void StartChunkedGeneration(UTerrainData* InTerrainData, int32 InSeed);
+
+	/**
+	*	Starts generating the missing chunks around the cell on the task threads. OnChunkCompleted is broadcast on the game thread when they are published,
+	*	then the chunks above the memory budget are evicted. If an update is in flight, only the last requested cell is updated after it.
+	*/
+	void UpdateChunksAroundCell(const FIntPoint& CellIn);
+
+	void UpdateChunksAroundLocation(const FVector& WorldLocationIn);
+
+	/**
+	*	Keeps the chunks around the actor loaded, e.g. the player pawn. Its location is checked every tick and an update starts when it enters another chunk.
+	*	Call it after StartChunkedGeneration. nullptr stops following the actor.
+	*/
+	void SetTrackedActor(AActor* ActorIn);
+
+	/* If an update is generating chunks on the task threads.*/
+	bool IsUpdateInFlight() const;
+
+	/* The layout of a cell, if its chunk is completed.*/
+	const FCellLayout* FindCellLayout(const FIntPoint& CellIn) const;
+
+	const FTerrainLayoutChunk* FindCompletedChunk(const FIntPoint& ChunkIDIn) const;
+
+	/* The initial room of the world, in the initial chunk.*/
+	FIntPoint GetInitialRoom() const;
+
+	FIntPoint GetChunkOfCell(const FIntPoint& CellIn) const;
+
+	int64 GetCachedChunksSize() const;
+
+protected:
+	UPROPERTY(Transient)
+	UTerrainData* TerrainData;
+
+	UPROPERTY(Transient)
+	UTerrainLayoutData* TerrainLayoutData;
+
+	/* Synchronous layout subsystems used to generate the chunks in parallel. One per concurrent chunk, used by the tasks of the update in flight.*/
+	UPROPERTY(Transient)
+	TArray<UTerrainLayoutSubsystem*> Generators;
+
+	int32 WorldSeed = 0;
+
+	int32 ChunkSize = 0;
+
+	uint64 UpdateCounter = 0;
+
+	TMap<FIntPoint, TSharedPtr<FTerrainLayoutChunk>> Chunks;
+
+	/* Key is the lower chunk and the axis of the neighbour, 0 for X and 1 for Y.*/
+	TMap<FIntVector, FTerrainLayoutChunkStitch> Stitches;
+
+	/* The chunks of the update in flight, owned by its tasks until it is published. Null if there is none.*/
+	TSharedPtr<FTerrainLayoutChunkUpdate> UpdateInFlight;
+
+	/* Ends when every task of the update in flight ended, before it is published.*/
+	UE::Tasks::FTask UpdateInFlightTask;
+
+	/* The center requested while an update was in flight, updated after it.*/
+	TOptional<FIntPoint> PendingCenterChunk;
+
+	TWeakObjectPtr<AActor> TrackedActor;
+	FIntPoint TrackedActorChunk = FIntPoint();
+	FTSTicker::FDelegateHandle TrackedActorTickerHandle;
+
+	bool TickTrackedActor(float DeltaTime);
+
+	void UpdateChunksAroundChunk(const FIntPoint& CenterChunkIn);
+
+	/* Moves the results of the update into the cached chunks and stitches, on the game thread.*/
+	void PublishChunkUpdate(const TSharedRef<FTerrainLayoutChunkUpdate>& UpdateIn);
+
+	/* Cancels the update in flight and waits for its tasks, so the generators are free.*/
+	void CancelUpdateInFlight();
+
+	/**
+	*	Launches a task per generator after the prerequisite, each going through the indices in turn with its own generator.
+	*	The returned task ends when all of them end.
+	*/
+	UE::Tasks::FTask LaunchGeneratorTasks(int32 NumIn, TFunction<void(UTerrainLayoutSubsystem* Generator, int32 Index)> FunctionIn, const UE::Tasks::FTask& PrerequisiteIn);
+
+	void GenerateChunkCorridors(UTerrainLayoutSubsystem* GeneratorIn, FTerrainLayoutChunk& ChunkOut, const FTerrainLayoutCancellationTokenPtr& CancellationTokenIn) const;
+	void CompleteChunk(UTerrainLayoutSubsystem* GeneratorIn, FTerrainLayoutChunk& ChunkOut, const FTerrainLayoutCancellationTokenPtr& CancellationTokenIn) const;
+
+	/* Moves the generated layout from the generator local cells to the chunk area. Cells out of the chunk are discarded.*/
+	void MoveLayoutToChunk(FTerrainLayoutChunk& ChunkOut) const;
+
+	/* Removes the cells out of the chunk, like walls of stitched corridors reaching the neighbours.*/
+	void ClipLayoutToChunk(FTerrainLayoutChunk& ChunkOut) const;
+
+	bool GenerateStitch(const FTerrainLayoutChunk& ChunkA, const FTerrainLayoutChunk& ChunkB, int32 SeedIn, FTerrainLayoutChunkStitch& StitchOut) const;
+	void ApplyStitch(const FTerrainLayoutChunkStitch& StitchIn, FTerrainLayoutChunk& ChunkOut) const;
+
+	FIntVector GetStitchKey(const FIntPoint& ChunkA, const FIntPoint& ChunkB) const;
+	FIntPoint GetStitchNeighbour(const FIntVector& StitchKeyIn) const;
+
+	/* The room of the chunk with the central cell nearest to the target.*/
+	bool FindNearestRoom(const FTerrainLayoutChunk& ChunkIn, const FIntPoint& TargetCellIn, FIntPoint& RoomOut) const;
+
+	void EvictChunks(const FIntPoint& CenterChunkIn);
+
+	int32 GetChunkSeed(const FIntPoint& ChunkIDIn) const;
+	FIntPoint GetChunkOrigin(const FIntPoint& ChunkIDIn) const;
+	FIntPoint GetChunkCenter(const FIntPoint& ChunkIDIn) const;
+	bool IsCellInChunk(const FIntPoint& CellIn, const FIntPoint& ChunkIDIn) const;
+	int32 GetChunkDistance(const FIntPoint& ChunkA, const FIntPoint& ChunkB) const;
+};
@@ -1,16 +1,99 @@
 #include "Layout/TerrainLayoutData.h"
+#include "Layout/TerrainLayoutRoomData.h"
+#include "Layout/LayoutTypes.h"
+#include "Layout/LayoutThreads/CorridorLayoutWorker.h"
+#include "Misc/DataValidation.h"
 
 #define LOCTEXT_NAMESPACE "TerrainLayoutData"
 
+namespace TerrainLayoutCost
+{
+	/* Seed used to generate the initial rooms layout of the estimate, so the estimate does not change between edits of other values.*/
+	static const int32 EstimateSeed = 0;
+}
+
+FTerrainLayoutCostEstimate UTerrainLayoutData::EstimateGenerationCost() const
+{
+	FTerrainLayoutCostEstimate Estimate = FTerrainLayoutCostEstimate();
+	if (!InitialRoomsLayout || RoomLayouts.Num() == 0)
+	{
+		return Estimate;
+	}
+
+	FIntPoint InitialCell = FIntPoint();
+	FRandomStream Stream = FRandomStream(TerrainLayoutCost::EstimateSeed);
+	Estimate.RoomsAmount = InitialRoomsLayout->GenerateLayout(InitialCell, Stream).Num();
+
+	int32 RoomLayoutsAmount = 0;
+	int32 TotalRoomCells = 0;
+	for (const UTerrainLayoutRoomData* RoomLayout : RoomLayouts)
+	{
+		if (RoomLayout && RoomLayout->RoomLayout)
+		{
+			TotalRoomCells += RoomLayout->RoomLayout->GetMaxCells();
+			RoomLayoutsAmount++;
+		}
+	}
+
+	Estimate.AverageRoomCells = RoomLayoutsAmount > 0 ? TotalRoomCells / RoomLayoutsAmount : 0;
+
+	const double Rooms = Estimate.RoomsAmount;
+	const double RoomSide = FMath::Sqrt(StaticCast<double>(Estimate.AverageRoomCells));
+	const double RoomDistance = (MinRoomDistance + MaxRoomDistance) * .5;
+	const double CorridorWidth = (CorridorsMinRange + CorridorsMaxRange) + 1.0;
+
+	//Room movement checks the collision cells of each room against the others.
+	const double SeparationCells = Estimate.AverageRoomCells * RoomSeparationPrecision / FMath::Max(RoomSeparationPatternIndex, 1);
+	const double SeparationChecks = Rooms * Rooms * SeparationCells;
+
+	//Same area as UTerrainLayoutSubsystem::GetRoomDistancesInNearArea, scanned around every room.
+	const double QuadSize = (MaxRoomDistance + RoomSide) * CorridorDetectionMultiplier;
+	Estimate.CorridorSearchAreaCells = StaticCast<int64>(Rooms * 4.0 * QuadSize * QuadSize);
+
+	const double RoomsInArea = (4.0 * QuadSize * QuadSize) / FMath::Max(FMath::Square(RoomSide + RoomDistance), 1.0);
+	Estimate.CandidateEdgesAmount = StaticCast<int32>(Rooms * FMath::Min(FMath::Max(Rooms - 1.0, 0.0), RoomsInArea));
+
+	//The spanning tree looks for the connected rooms in an array for each edge, once per added room.
+	const double SpanningTreeChecks = Rooms * Estimate.CandidateEdgesAmount * Rooms * .5;
+
+	Estimate.CorridorsAmount = StaticCast<int32>(FMath::Max(Rooms - 1.0, 0.0) + CircularCorridorsAmountPercent * Rooms);
+
+	//Each search keeps its nodes in an array that is searched for each expanded node.
+	const double PathNodes = FMath::Min(StaticCast<double>(FCorridorLayoutWorker::DefaultMaxPathIterations), RoomDistance * RoomDistance);
+	const double PathNodeChecks = Estimate.CorridorsAmount * PathNodes * PathNodes * 4.0;
+
+	const double CorridorCells = Estimate.CorridorsAmount * RoomDistance * CorridorWidth;
+	Estimate.LayoutCellsAmount = StaticCast<int32>(Rooms * Estimate.AverageRoomCells + CorridorCells);
+	Estimate.WallCellsAmount = StaticCast<int32>(Rooms * 4.0 * (RoomSide + WallsRange) * WallsRange + Estimate.CorridorsAmount * 2.0 * RoomDistance * WallsRange);
+
+	const double TotalCells = StaticCast<double>(Estimate.LayoutCellsAmount) + Estimate.WallCellsAmount;
+	Estimate.RoomSeparationChecks = StaticCast<int64>(SeparationChecks);
+	Estimate.SpanningTreeChecks = StaticCast<int64>(SpanningTreeChecks);
+	Estimate.PathNodeChecks = StaticCast<int64>(PathNodeChecks);
+
+	//Not weighted by a time per operation, none was measured. Each one is a cell or array entry visited.
+	Estimate.EstimatedOperations = Estimate.RoomSeparationChecks + Estimate.CorridorSearchAreaCells + Estimate.SpanningTreeChecks + Estimate.PathNodeChecks + StaticCast<int64>(TotalCells);
+
+	//Only the map entries of the cells, the tags and the copies of the stage workers add to it.
+	Estimate.MinLayoutMB = StaticCast<float>(TotalCells * sizeof(TPair<FIntPoint, FCellLayout>) / (1024.0 * 1024.0));
+
+	return Estimate;
+}
+
 #if WITH_EDITOR
-EDataValidationResult UTerrainLayoutData::IsDataValid(TArray<FText>& ValidationErrors)
+void UTerrainLayoutData::RefreshCostEstimate()
 {
-	EDataValidationResult Result = CombineDataValidationResults(Super::IsDataValid(ValidationErrors), EDataValidationResult::Valid);
+	CostEstimate = EstimateGenerationCost();
+}
+
+EDataValidationResult UTerrainLayoutData::IsDataValid(FDataValidationContext& Context)
+{
+	EDataValidationResult Result = CombineDataValidationResults(Super::IsDataValid(Context), EDataValidationResult::Valid);
 
 	if (!InitialRoomsLayout)
 	{
 		Result = EDataValidationResult::Invalid;
-		ValidationErrors.Add(FText(LOCTEXT("InitialRoomsLayoutInvalid", "InitialRoomsLayout is invalid")));
+		Context.AddError(FText(LOCTEXT("InitialRoomsLayoutInvalid", "InitialRoomsLayout is invalid")));
 	}
 
 	int32 EntryIndex = 0;
@@ -19,14 +102,78 @@ EDataValidationResult UTerrainLayoutData::IsDataValid(TArray<FText>& ValidationE
 		if (!roomlayot)
 		{
 			Result = EDataValidationResult::Invalid;
-			ValidationErrors.Add(FText::Format(LOCTEXT("RoomLayoutInvalid", "Null entry at index {0} in RoomLayouts"), FText::AsNumber(EntryIndex)));
+			Context.AddError(FText::Format(LOCTEXT("RoomLayoutInvalid", "Null entry at index {0} in RoomLayouts"), FText::AsNumber(EntryIndex)));
 		}
 
 		++EntryIndex;
 	}
 
+	if (Result != EDataValidationResult::Invalid)
+	{
+		//Slow values are still valid, they only warn.
+		const FTerrainLayoutCostEstimate Estimate = EstimateGenerationCost();
+
+		if (CostWarningOperations > 0 && Estimate.EstimatedOperations > CostWarningOperations)
+		{
+			FFormatNamedArguments Arguments;
+			Arguments.Add(TEXT("Operations"), FText::AsNumber(Estimate.EstimatedOperations));
+			Arguments.Add(TEXT("WarningOperations"), FText::AsNumber(CostWarningOperations));
+			Arguments.Add(TEXT("Rooms"), FText::AsNumber(Estimate.RoomsAmount));
+			Arguments.Add(TEXT("Edges"), FText::AsNumber(Estimate.CandidateEdgesAmount));
+			Arguments.Add(TEXT("AreaCells"), FText::AsNumber(Estimate.CorridorSearchAreaCells));
+
+			Context.AddWarning(FText::Format(LOCTEXT("CostWarningOperations", "Estimated {Operations} generation operations, above {WarningOperations}. {Rooms} rooms, {Edges} candidate edges, {AreaCells} cells in the corridor detection area. Check CorridorDetectionMultiplier, RoomSeparationPrecision and MaxRoomDistance"), Arguments));
+		}
+
+		if (CostWarningLayoutMB > 0 && Estimate.MinLayoutMB > CostWarningLayoutMB)
+		{
+			FFormatNamedArguments Arguments;
+			Arguments.Add(TEXT("LayoutMB"), FText::AsNumber(Estimate.MinLayoutMB));
+			Arguments.Add(TEXT("WarningLayoutMB"), FText::AsNumber(CostWarningLayoutMB));
+			Arguments.Add(TEXT("LayoutCells"), FText::AsNumber(Estimate.LayoutCellsAmount));
+			Arguments.Add(TEXT("WallCells"), FText::AsNumber(Estimate.WallCellsAmount));
+
+			Context.AddWarning(FText::Format(LOCTEXT("CostWarningLayoutMemory", "The layout cells take at least {LayoutMB} MB, above {WarningLayoutMB} MB. {LayoutCells} layout cells and {WallCells} wall cells"), Arguments));
+		}
+	}
+
 	return Result;
 }
+
+void UTerrainLayoutData::PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEvent)
+{
+	Super::PostEditChangeProperty(PropertyChangedEvent);
+
+	//Dragging a value would generate the initial rooms layout on every step.
+	if (PropertyChangedEvent.ChangeType != EPropertyChangeType::Interactive)
+	{
+		RefreshCostEstimate();
+	}
+}
+
+ETerrainGen_LayoutStage UTerrainLayoutData::GetFirstStageReading(const FProperty* PropertyIn)
+{
+	if (!PropertyIn)
+	{
+		return ETerrainGen_LayoutStage::InitialLayout;
+	}
+
+	static const TMap<FString, ETerrainGen_LayoutStage> CategoriesStages =
+	{
+		{ TEXT("Initial Layout"), ETerrainGen_LayoutStage::InitialLayout },
+		{ TEXT("Rooms Layout"), ETerrainGen_LayoutStage::RoomLayout },
+		{ TEXT("Rooms Separation"), ETerrainGen_LayoutStage::RoomMovement },
+		{ TEXT("Corridors Layout"), ETerrainGen_LayoutStage::Corridors },
+		{ TEXT("Walls Layout"), ETerrainGen_LayoutStage::Walls },
+		{ TEXT("Streaming"), ETerrainGen_LayoutStage::ETLS_MAX },
+		{ TEXT("Chunks"), ETerrainGen_LayoutStage::ETLS_MAX },
+		{ TEXT("Memory"), ETerrainGen_LayoutStage::ETLS_MAX },
+		{ TEXT("Cost Estimate"), ETerrainGen_LayoutStage::ETLS_MAX }
+	};
+
+	const ETerrainGen_LayoutStage* Stage = CategoriesStages.Find(PropertyIn->GetMetaData(TEXT("Category")));
+	return Stage ? *Stage : ETerrainGen_LayoutStage::InitialLayout;
+}
 #endif
 
 #undef LOCTEXT_NAMESPACE
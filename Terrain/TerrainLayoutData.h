@@ -4,6 +4,7 @@
 #include "LayoutObjects/BaseLayoutObject.h"
 #include "Layout/TerrainBaseLayoutData.h"
 #include "Layout/CorridorTypes.h"
+#include "Layout/TerrainLayoutStats.h"
 #include "TerrainLayoutData.generated.h"
 
 class UTerrainLayoutLayerData;
@@ -81,6 +82,36 @@ public:
 	UPROPERTY(EditAnywhere, Category = "Corridors Layout")
 	int32 CorridorSelectionThreshold = 5;
 
+	/**
+	*	Rooms starting many corridors build one distance field per door, shared by all their corridors, instead of a path search per corridor.
+	*	Each corridor then follows the field from its end door back to the start door. Corridors out of the field use a path search.
+	*/
+	UPROPERTY(EditAnywhere, Category = "Corridors Layout")
+	bool bUseCorridorFlowFields = false;
+
+	/**
+	*	The corridors a room must start to use flow fields.
+	*	A field covers up to 2 * FlowFieldRadius^2 cells, about 4600 at the default radius, while a path search of a near corridor expands a few hundred.
+	*	Below this amount the field costs more than the searches it replaces.
+	*/
+	UPROPERTY(EditAnywhere, meta = (ClampMin = "2", EditCondition = "bUseCorridorFlowFields"), Category = "Corridors Layout")
+	int32 FlowFieldMinCorridors = 8;
+
+	/* Max path length covered by a flow field, in cells.*/
+	UPROPERTY(EditAnywhere, meta = (ClampMin = "1", EditCondition = "bUseCorridorFlowFields"), Category = "Corridors Layout")
+	int32 FlowFieldRadius = 48;
+
+	/**
+	*	If the corridor path searches are kept for the next generations of the session.
+	*	A path is reused while the cells its search asked about have not changed, so regenerating the same rooms skips the searches.
+	*/
+	UPROPERTY(EditAnywhere, Category = "Corridors Layout")
+	bool bCacheCorridorPaths = true;
+
+	/* Memory used by the cached paths before the cache is emptied, in megabytes.*/
+	UPROPERTY(EditAnywhere, meta = (ClampMin = "1", EditCondition = "bCacheCorridorPaths"), Category = "Corridors Layout")
+	float CorridorPathCacheMB = 32.f;
+
 	/* The different room layouts.*/
 	UPROPERTY(EditAnywhere, BlueprintReadOnly, meta = (AssetBundles = "Rooms Layout"), meta = (Categories = "Rooms Layout"), Category = "Rooms Layout")
 	TArray <UTerrainLayoutRoomData*> RoomLayouts;
@@ -89,8 +120,67 @@ public:
 	UPROPERTY(EditAnywhere, BlueprintReadOnly, meta = (AssetBundles = "Walls Layout"), meta = (Categories = "Walls Layout"), Category = "Walls Layout")
 	int32 WallsRange = 3;
 
+	/**
+	*	If the corridors are merged into the layout while the stage is running, instead of all at once when every thread ends.
+	*	Avoids the hitch at the end of the stage on big layouts. Not used when generating synchronously.
+	*/
+	UPROPERTY(EditAnywhere, Category = "Streaming")
+	bool bStreamLayoutResults = true;
+
+	/* Time per frame used to merge the streamed results, in milliseconds.*/
+	UPROPERTY(EditAnywhere, meta = (ClampMin = "0.1", EditCondition = "bStreamLayoutResults"), Category = "Streaming")
+	float StreamMergeBudgetMs = 2.f;
+
+	/**
+	*	The side of a chunk in cells, when the layout is generated in chunks.
+	*	The layout of this data must fit in a chunk, the cells out of it are discarded.
+	*/
+	UPROPERTY(EditAnywhere, meta = (ClampMin = "16"), Category = "Chunks")
+	int32 ChunkSizeCells = 256;
+
+	/* Chunks around the player that are kept completed. A value of 1 completes the 3x3 chunks around the player.*/
+	UPROPERTY(EditAnywhere, meta = (ClampMin = "0"), Category = "Chunks")
+	int32 ChunkLoadRadius = 1;
+
+	/* Memory used by the cached chunks before the least recently used ones are evicted, in megabytes.*/
+	UPROPERTY(EditAnywhere, meta = (ClampMin = "1"), Category = "Chunks")
+	float ChunkMemoryBudgetMB = 256.f;
+
+	/**
+	*	Memory the layout and the copies of its stage workers can use during a generation, in megabytes. 0 means no budget.
+	*	Checked while the stages run, and polled by the workers between the checks. When it is exceeded the generation is cancelled and the memory of each stage is reported.
+	*	With LLM enabled the TerrainGenerator layout tags are read too. Their totals include every generation running at once.
+	*/
+	UPROPERTY(EditAnywhere, meta = (ClampMin = "0"), Category = "Memory")
+	float GenerationMemoryBudgetMB = 0.f;
+
+	/* Validation warns when the estimated operations of a generation are above this. 0 never warns.*/
+	UPROPERTY(EditAnywhere, meta = (ClampMin = "0"), Category = "Cost Estimate")
+	int64 CostWarningOperations = 2000000000;
+
+	/* Validation warns when the least memory the layout cells can take is above this, in megabytes. 0 never warns.*/
+	UPROPERTY(EditAnywhere, meta = (ClampMin = "0"), Category = "Cost Estimate")
+	float CostWarningLayoutMB = 256.f;
+
+	/* Predicts the size and cost of a generation with the current values. Generates the initial rooms layout with a fixed seed, the rest is approximated.*/
+	FTerrainLayoutCostEstimate EstimateGenerationCost() const;
+
+#if WITH_EDITORONLY_DATA
+	/* The estimate of the current values. Not calculated on load, only on each edit or with Refresh Cost Estimate.*/
+	UPROPERTY(VisibleAnywhere, Transient, Category = "Cost Estimate")
+	FTerrainLayoutCostEstimate CostEstimate;
+#endif
+
 #if WITH_EDITOR
-	virtual EDataValidationResult IsDataValid(TArray<FText>& ValidationErrors) override;
+	/* Updates CostEstimate without editing a value, e.g. after opening the asset.*/
+	UFUNCTION(CallInEditor, Category = "Cost Estimate")
+	void RefreshCostEstimate();
+
+	virtual EDataValidationResult IsDataValid(FDataValidationContext& Context) override;
+	virtual void PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEvent) override;
+
+	/* The first layout stage that reads the property, from its category. ETLS_MAX for the properties no layout depends on, InitialLayout if unknown.*/
+	static ETerrainGen_LayoutStage GetFirstStageReading(const FProperty* PropertyIn);
 #endif
 
 };
@@ -0,0 +1,124 @@
+//Copyright 2020 Marchetti S. Alfredo I. All Rights Reserved.
+
+#include "Layout/TerrainLayoutKernels.h"
+#include "Math/VectorRegister.h"
+
+static_assert(sizeof(FIntPoint) == sizeof(int32) * 2, "The kernels load two cells per integer vector register.");
+
+namespace TerrainLayoutKernels
+{
+	/* Length of four cell deltas, given as X0 Y0 X1 Y1 and X2 Y2 X3 Y3, scaled by the cell size.*/
+	FORCEINLINE VectorRegister4Float GetLengths(const VectorRegister4Float& DeltaXY01, const VectorRegister4Float& DeltaXY23, const VectorRegister4Float& CellSize)
+	{
+		const VectorRegister4Float DeltaX = VectorShuffle(DeltaXY01, DeltaXY23, 0, 2, 0, 2);
+		const VectorRegister4Float DeltaY = VectorShuffle(DeltaXY01, DeltaXY23, 1, 3, 1, 3);
+
+		//Not fused, so the scalar path rounds the same.
+		const VectorRegister4Float SquaredLength = VectorAdd(VectorMultiply(DeltaX, DeltaX), VectorMultiply(DeltaY, DeltaY));
+		return VectorMultiply(VectorSqrt(SquaredLength), CellSize);
+	}
+
+	FORCEINLINE float GetLength(const FIntPoint& DeltaIn, float CellSizeIn)
+	{
+		const float DeltaX = StaticCast<float>(DeltaIn.X);
+		const float DeltaY = StaticCast<float>(DeltaIn.Y);
+		return FMath::Sqrt(DeltaX * DeltaX + DeltaY * DeltaY) * CellSizeIn;
+	}
+}
+
+void FTerrainLayoutKernels::CellsToWorldPositions(TArrayView<const FIntPoint> CellsIn, float CellSizeIn, const FVector2D& AnchorIn, TArrayView<FVector> PositionsOut)
+{
+	check(PositionsOut.Num() >= CellsIn.Num());
+
+	const int32 CellsAmount = CellsIn.Num();
+	const int32* Cells = reinterpret_cast<const int32*>(CellsIn.GetData());
+	const VectorRegister4Float CellSize = VectorSetFloat1(CellSizeIn);
+
+	//Axis are reversed, the X of the position comes from the Y of the cell.
+	const double OffsetX = CellSizeIn * AnchorIn.Y;
+	const double OffsetY = CellSizeIn * AnchorIn.X;
+
+	alignas(16) float Scaled[4];
+
+	int32 i = 0;
+	for (; i + 2 <= CellsAmount; i += 2)
+	{
+		VectorStoreAligned(VectorMultiply(VectorIntToFloat(VectorIntLoad(Cells + i * 2)), CellSize), Scaled);
+		PositionsOut[i] = FVector(Scaled[1] + OffsetX, Scaled[0] + OffsetY, 0);
+		PositionsOut[i + 1] = FVector(Scaled[3] + OffsetX, Scaled[2] + OffsetY, 0);
+	}
+
+	for (; i < CellsAmount; i++)
+	{
+		PositionsOut[i] = FVector(CellsIn[i].Y * CellSizeIn + OffsetX, CellsIn[i].X * CellSizeIn + OffsetY, 0);
+	}
+}
+
+void FTerrainLayoutKernels::DistancesToCell(TArrayView<const FIntPoint> CellsIn, const FIntPoint& TargetIn, float CellSizeIn, TArrayView<float> DistancesOut)
+{
+	check(DistancesOut.Num() >= CellsIn.Num());
+
+	const int32 CellsAmount = CellsIn.Num();
+	const int32* Cells = reinterpret_cast<const int32*>(CellsIn.GetData());
+	const VectorRegister4Int Target = MakeVectorRegisterInt(TargetIn.X, TargetIn.Y, TargetIn.X, TargetIn.Y);
+	const VectorRegister4Float CellSize = VectorSetFloat1(CellSizeIn);
+
+	int32 i = 0;
+	for (; i + 4 <= CellsAmount; i += 4)
+	{
+		//The deltas are exact as integers, only the length is calculated in floats.
+		const VectorRegister4Float Delta01 = VectorIntToFloat(VectorIntSubtract(VectorIntLoad(Cells + i * 2), Target));
+		const VectorRegister4Float Delta23 = VectorIntToFloat(VectorIntSubtract(VectorIntLoad(Cells + i * 2 + 4), Target));
+		VectorStore(TerrainLayoutKernels::GetLengths(Delta01, Delta23, CellSize), DistancesOut.GetData() + i);
+	}
+
+	for (; i < CellsAmount; i++)
+	{
+		DistancesOut[i] = TerrainLayoutKernels::GetLength(CellsIn[i] - TargetIn, CellSizeIn);
+	}
+}
+
+void FTerrainLayoutKernels::DistancesBetweenCells(TArrayView<const FIntPoint> CellsAIn, TArrayView<const FIntPoint> CellsBIn, float CellSizeIn, TArrayView<float> DistancesOut)
+{
+	check(CellsBIn.Num() >= CellsAIn.Num());
+	check(DistancesOut.Num() >= CellsAIn.Num());
+
+	const int32 CellsAmount = CellsAIn.Num();
+	const int32* CellsA = reinterpret_cast<const int32*>(CellsAIn.GetData());
+	const int32* CellsB = reinterpret_cast<const int32*>(CellsBIn.GetData());
+	const VectorRegister4Float CellSize = VectorSetFloat1(CellSizeIn);
+
+	int32 i = 0;
+	for (; i + 4 <= CellsAmount; i += 4)
+	{
+		const VectorRegister4Float Delta01 = VectorIntToFloat(VectorIntSubtract(VectorIntLoad(CellsA + i * 2), VectorIntLoad(CellsB + i * 2)));
+		const VectorRegister4Float Delta23 = VectorIntToFloat(VectorIntSubtract(VectorIntLoad(CellsA + i * 2 + 4), VectorIntLoad(CellsB + i * 2 + 4)));
+		VectorStore(TerrainLayoutKernels::GetLengths(Delta01, Delta23, CellSize), DistancesOut.GetData() + i);
+	}
+
+	for (; i < CellsAmount; i++)
+	{
+		DistancesOut[i] = TerrainLayoutKernels::GetLength(CellsAIn[i] - CellsBIn[i], CellSizeIn);
+	}
+}
+
+void FTerrainLayoutKernels::OffsetCells(TArrayView<const FIntPoint> CellsIn, const FIntPoint& OffsetIn, TArrayView<FIntPoint> CellsOut)
+{
+	check(CellsOut.Num() >= CellsIn.Num());
+
+	const int32 CellsAmount = CellsIn.Num();
+	const int32* Cells = reinterpret_cast<const int32*>(CellsIn.GetData());
+	int32* OffsetCells = reinterpret_cast<int32*>(CellsOut.GetData());
+	const VectorRegister4Int Offset = MakeVectorRegisterInt(OffsetIn.X, OffsetIn.Y, OffsetIn.X, OffsetIn.Y);
+
+	int32 i = 0;
+	for (; i + 2 <= CellsAmount; i += 2)
+	{
+		VectorIntStore(VectorIntAdd(VectorIntLoad(Cells + i * 2), Offset), OffsetCells + i * 2);
+	}
+
+	for (; i < CellsAmount; i++)
+	{
+		CellsOut[i] = CellsIn[i] + OffsetIn;
+	}
+}
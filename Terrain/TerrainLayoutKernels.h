@@ -0,0 +1,26 @@
+//Copyright 2020 Marchetti S. Alfredo I. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/**
+*	Cell transforms and distances over spans of cells, four cells per vector register.
+*	The cells are loaded straight from the FIntPoint memory, the cells left after the last group of four use the scalar path with the same operations.
+*	Each output span must have at least as many elements as the cells span.
+*/
+class TERRAINGENERATOR_API FTerrainLayoutKernels
+{
+public:
+	/* Same positions as UTerrainLayoutSubsystem::GetCellWorldPosition. Axis are reversed.*/
+	static void CellsToWorldPositions(TArrayView<const FIntPoint> CellsIn, float CellSizeIn, const FVector2D& AnchorIn, TArrayView<FVector> PositionsOut);
+
+	/* World distance from each cell to the target cell, as UTerrainLayoutFunctionLibrary::GetWorldDistanceBetweenCells.*/
+	static void DistancesToCell(TArrayView<const FIntPoint> CellsIn, const FIntPoint& TargetIn, float CellSizeIn, TArrayView<float> DistancesOut);
+
+	/* World distance between the cells at the same index of both spans.*/
+	static void DistancesBetweenCells(TArrayView<const FIntPoint> CellsAIn, TArrayView<const FIntPoint> CellsBIn, float CellSizeIn, TArrayView<float> DistancesOut);
+
+	/* Adds the offset to each cell. CellsOut can be the same memory as CellsIn.*/
+	static void OffsetCells(TArrayView<const FIntPoint> CellsIn, const FIntPoint& OffsetIn, TArrayView<FIntPoint> CellsOut);
+};
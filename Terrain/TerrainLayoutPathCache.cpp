@@ -0,0 +1,217 @@
+//Copyright 2020 Marchetti S. Alfredo I. All Rights Reserved.
+
+#include "Layout/TerrainLayoutPathCache.h"
+#include "Misc/Crc.h"
+#include "TerrainGeneratorMemory.h"
+
+bool FTerrainLayoutPathCache::FindPath(const FIntPoint& StartCellIn, const FIntPoint& EndCellIn, TFunctionRef<bool(const FIntPoint&)> IsBlockingIn, bool& SuccessOut, TArray<FIntPoint>& PathOut) const
+{
+	//Copied so the occupancy is checked without holding the lock.
+	TArray<FTerrainLayoutCachedPath, TInlineAllocator<1>> CachedPaths;
+	{
+		FReadScopeLock ReadLock(Lock);
+		const TArray<FTerrainLayoutCachedPath, TInlineAllocator<1>>* FoundPaths = Paths.Find(MakeTuple(StartCellIn, EndCellIn));
+		if (!FoundPaths)
+		{
+			return false;
+		}
+
+		CachedPaths = *FoundPaths;
+	}
+
+	TArray<FIntPoint> BoundsCells;
+	TArray<bool> Blocking;
+
+	for (const FTerrainLayoutCachedPath& CachedPath : CachedPaths)
+	{
+		int32 Offset = 0;
+		FIntPoint PreviousCell = StartCellIn;
+
+		BoundsCells.Reset();
+		DecodeCells(CachedPath.EncodedCells, CachedPath.BoundsCellsAmount, Offset, PreviousCell, BoundsCells);
+
+		Blocking.Reset();
+		for (const FIntPoint& Cell : BoundsCells)
+		{
+			Blocking.Add(IsBlockingIn(Cell));
+		}
+
+		if (GetOccupancyHash(Blocking) != CachedPath.OccupancyHash)
+		{
+			continue;
+		}
+
+		SuccessOut = CachedPath.bSuccess;
+		PathOut.Reset(CachedPath.PathCellsAmount);
+		DecodeCells(CachedPath.EncodedCells, CachedPath.PathCellsAmount, Offset, PreviousCell, PathOut);
+		return true;
+	}
+
+	return false;
+}
+
+void FTerrainLayoutPathCache::AddPath(const FIntPoint& StartCellIn, const FIntPoint& EndCellIn, const FTerrainLayoutPathQueries& QueriesIn, bool bSuccessIn, const TArray<FIntPoint>& PathIn)
+{
+	//Called from the corridor workers, but the paths outlive them.
+	LLM_SCOPE_BYTAG(TerrainGenerator_LayoutPathCache);
+
+	//The search asks about most cells more than once, only the first answer is kept.
+	TSet<FIntPoint> AddedCells;
+	TArray<FIntPoint> BoundsCells;
+	TArray<bool> Blocking;
+	AddedCells.Reserve(QueriesIn.Cells.Num());
+	BoundsCells.Reserve(QueriesIn.Cells.Num());
+	Blocking.Reserve(QueriesIn.Cells.Num());
+
+	for (int32 i = 0; i < QueriesIn.Cells.Num(); i++)
+	{
+		bool bIsAlreadyInSet = false;
+		AddedCells.Add(QueriesIn.Cells[i], &bIsAlreadyInSet);
+
+		if (!bIsAlreadyInSet)
+		{
+			BoundsCells.Add(QueriesIn.Cells[i]);
+			Blocking.Add(QueriesIn.Blocking[i]);
+		}
+	}
+
+	FTerrainLayoutCachedPath CachedPath = FTerrainLayoutCachedPath();
+	CachedPath.bSuccess = bSuccessIn;
+	CachedPath.OccupancyHash = GetOccupancyHash(Blocking);
+	CachedPath.BoundsCellsAmount = BoundsCells.Num();
+	CachedPath.PathCellsAmount = PathIn.Num();
+
+	FIntPoint PreviousCell = StartCellIn;
+	EncodeCells(BoundsCells, PreviousCell, CachedPath.EncodedCells);
+	EncodeCells(PathIn, PreviousCell, CachedPath.EncodedCells);
+	CachedPath.EncodedCells.Shrink();
+
+	FWriteScopeLock WriteLock(Lock);
+	TArray<FTerrainLayoutCachedPath, TInlineAllocator<1>>& CachedPaths = Paths.FindOrAdd(MakeTuple(StartCellIn, EndCellIn));
+
+	for (const FTerrainLayoutCachedPath& Other : CachedPaths)
+	{
+		if (Other.OccupancyHash == CachedPath.OccupancyHash && Other.BoundsCellsAmount == CachedPath.BoundsCellsAmount)
+		{
+			return; //Added by another worker searching the same path.
+		}
+	}
+
+	if (CachedPaths.Num() >= MaxPathsPerKey)
+	{
+		AllocatedBytes -= CachedPaths[0].EncodedCells.GetAllocatedSize();
+		CachedPaths.RemoveAt(0);
+		PathsAmount--;
+	}
+
+	AllocatedBytes += CachedPath.EncodedCells.GetAllocatedSize();
+	CachedPaths.Add(MoveTemp(CachedPath));
+	PathsAmount++;
+
+	if (AllocatedBytes + Paths.GetAllocatedSize() > MaxBytes)
+	{
+		Paths.Empty();
+		AllocatedBytes = 0;
+		PathsAmount = 0;
+	}
+}
+
+void FTerrainLayoutPathCache::SetSearchSettings(uint32 SettingsHashIn)
+{
+	FWriteScopeLock WriteLock(Lock);
+	if (SettingsHash == SettingsHashIn)
+	{
+		return;
+	}
+
+	SettingsHash = SettingsHashIn;
+	Paths.Empty();
+	AllocatedBytes = 0;
+	PathsAmount = 0;
+}
+
+void FTerrainLayoutPathCache::SetMaxBytes(int64 MaxBytesIn)
+{
+	FWriteScopeLock WriteLock(Lock);
+	MaxBytes = MaxBytesIn;
+}
+
+void FTerrainLayoutPathCache::Empty()
+{
+	FWriteScopeLock WriteLock(Lock);
+	Paths.Empty();
+	AllocatedBytes = 0;
+	PathsAmount = 0;
+}
+
+int64 FTerrainLayoutPathCache::GetAllocatedSize() const
+{
+	FReadScopeLock ReadLock(Lock);
+	return AllocatedBytes + Paths.GetAllocatedSize();
+}
+
+int32 FTerrainLayoutPathCache::GetPathsAmount() const
+{
+	FReadScopeLock ReadLock(Lock);
+	return PathsAmount;
+}
+
+void FTerrainLayoutPathCache::EncodeCells(const TArray<FIntPoint>& CellsIn, FIntPoint& PreviousCellOut, TArray<uint8>& EncodedOut)
+{
+	//Consecutive cells are usually neighbours, so most deltas take a single byte per axis.
+	for (const FIntPoint& Cell : CellsIn)
+	{
+		const int32 Deltas[2] = { Cell.X - PreviousCellOut.X, Cell.Y - PreviousCellOut.Y };
+
+		for (int32 Delta : Deltas)
+		{
+			uint32 ZigZag = (StaticCast<uint32>(Delta) << 1) ^ StaticCast<uint32>(Delta >> 31);
+
+			while (ZigZag >= 0x80)
+			{
+				EncodedOut.Add(StaticCast<uint8>(ZigZag | 0x80));
+				ZigZag >>= 7;
+			}
+
+			EncodedOut.Add(StaticCast<uint8>(ZigZag));
+		}
+
+		PreviousCellOut = Cell;
+	}
+}
+
+void FTerrainLayoutPathCache::DecodeCells(const TArray<uint8>& EncodedIn, int32 CellsAmountIn, int32& OffsetOut, FIntPoint& PreviousCellOut, TArray<FIntPoint>& CellsOut)
+{
+	for (int32 i = 0; i < CellsAmountIn; i++)
+	{
+		int32 Deltas[2] = { 0, 0 };
+
+		for (int32& Delta : Deltas)
+		{
+			uint32 ZigZag = 0;
+			int32 Shift = 0;
+
+			while (OffsetOut < EncodedIn.Num())
+			{
+				const uint8 Byte = EncodedIn[OffsetOut++];
+				ZigZag |= StaticCast<uint32>(Byte & 0x7F) << Shift;
+				Shift += 7;
+
+				if ((Byte & 0x80) == 0)
+				{
+					break;
+				}
+			}
+
+			Delta = StaticCast<int32>(ZigZag >> 1) ^ -StaticCast<int32>(ZigZag & 1);
+		}
+
+		PreviousCellOut = FIntPoint(PreviousCellOut.X + Deltas[0], PreviousCellOut.Y + Deltas[1]);
+		CellsOut.Add(PreviousCellOut);
+	}
+}
+
+uint32 FTerrainLayoutPathCache::GetOccupancyHash(const TArray<bool>& BlockingIn)
+{
+	return FCrc::MemCrc32(BlockingIn.GetData(), BlockingIn.Num() * sizeof(bool), BlockingIn.Num());
+}
@@ -0,0 +1,86 @@
+//Copyright 2020 Marchetti S. Alfredo I. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Misc/ScopeRWLock.h"
+
+/* The cells a path search asked about and if they were blocking, in the order they were asked.*/
+struct TERRAINGENERATOR_API FTerrainLayoutPathQueries
+{
+	TArray<FIntPoint> Cells;
+	TArray<bool> Blocking;
+
+	void Reset()
+	{
+		Cells.Reset();
+		Blocking.Reset();
+	}
+
+	void Add(const FIntPoint& CellIn, bool bIsBlockingIn)
+	{
+		Cells.Add(CellIn);
+		Blocking.Add(bIsBlockingIn);
+	}
+};
+
+/* A path search result, with the cells the search depended on.*/
+struct TERRAINGENERATOR_API FTerrainLayoutCachedPath
+{
+	bool bSuccess = false;
+
+	/* Hash of the blocking state of the bounds cells when the path was searched.*/
+	uint32 OccupancyHash = 0;
+
+	int32 BoundsCellsAmount = 0;
+	int32 PathCellsAmount = 0;
+
+	/* The bounds cells followed by the path cells, each one as the zigzag varint delta to the previous cell.*/
+	TArray<uint8> EncodedCells;
+};
+
+/**
+*	Corridor path searches kept across the generations of a session, keyed by the start and end cells and the occupancy of the cells the search asked about.
+*	A search only depends on those cells, so if none of them changed the cached path is the same the search would generate.
+*	Shared by all the corridor workers.
+*/
+class TERRAINGENERATOR_API FTerrainLayoutPathCache
+{
+public:
+	/* Finds a path searched before between the cells with the same occupancy. IsBlockingIn answers the occupancy of the current layout.*/
+	bool FindPath(const FIntPoint& StartCellIn, const FIntPoint& EndCellIn, TFunctionRef<bool(const FIntPoint&)> IsBlockingIn, bool& SuccessOut, TArray<FIntPoint>& PathOut) const;
+
+	void AddPath(const FIntPoint& StartCellIn, const FIntPoint& EndCellIn, const FTerrainLayoutPathQueries& QueriesIn, bool bSuccessIn, const TArray<FIntPoint>& PathIn);
+
+	/* Removes all the paths if the search settings changed, since every cached path may be different now.*/
+	void SetSearchSettings(uint32 SettingsHashIn);
+
+	/* The cache is emptied when it grows above the budget.*/
+	void SetMaxBytes(int64 MaxBytesIn);
+
+	void Empty();
+
+	int64 GetAllocatedSize() const;
+
+	int32 GetPathsAmount() const;
+
+private:
+	/* Paths with different occupancy for the same cells. The oldest is replaced above this.*/
+	static const int32 MaxPathsPerKey = 4;
+
+	mutable FRWLock Lock;
+
+	TMap<TPair<FIntPoint, FIntPoint>, TArray<FTerrainLayoutCachedPath, TInlineAllocator<1>>> Paths;
+
+	int64 AllocatedBytes = 0;
+	int64 MaxBytes = 32 * 1024 * 1024;
+	uint32 SettingsHash = 0;
+	int32 PathsAmount = 0;
+
+	static void EncodeCells(const TArray<FIntPoint>& CellsIn, FIntPoint& PreviousCellOut, TArray<uint8>& EncodedOut);
+	static void DecodeCells(const TArray<uint8>& EncodedIn, int32 CellsAmountIn, int32& OffsetOut, FIntPoint& PreviousCellOut, TArray<FIntPoint>& CellsOut);
+
+	static uint32 GetOccupancyHash(const TArray<bool>& BlockingIn);
+};
+
+typedef TSharedPtr<FTerrainLayoutPathCache, ESPMode::ThreadSafe> FTerrainLayoutPathCachePtr;
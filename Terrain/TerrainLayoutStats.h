@@ -0,0 +1,251 @@
+//Copyright 2020 Marchetti S. Alfredo I. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "TerrainLayoutStats.generated.h"
+
+/* The stages of the layout pipeline, in the order they are executed.*/
+UENUM(BlueprintType)
+enum class ETerrainGen_LayoutStage : uint8
+{
+	InitialLayout,
+	RoomLayout,
+	RoomMovement,
+	Corridors,
+	Walls,
+	Depth,
+	ETLS_MAX UMETA(Hidden)
+};
+
+/* Timings of a single layout stage.*/
+USTRUCT(BlueprintType)
+struct TERRAINGENERATOR_API FTerrainLayoutStageStats
+{
+	GENERATED_BODY()
+
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Layout Stats")
+	ETerrainGen_LayoutStage Stage = ETerrainGen_LayoutStage::InitialLayout;
+
+	/* Time from the generation start until the stage start, in seconds.*/
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Layout Stats")
+	double StartSeconds = 0;
+
+	/* Wall time from the stage start until its end callback, in seconds.*/
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Layout Stats")
+	double WallSeconds = 0;
+
+	/* Busy time of all the workers and tasks of the stage added together, in seconds. Stages run only on the calling thread count it as a single worker.*/
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Layout Stats")
+	double CpuSeconds = 0;
+
+	/* The stage ran workers on the thread subsystem that don't report their times, its CpuSeconds and worker times are unknown instead of zero.*/
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Layout Stats")
+	bool bWorkerTimesMissing = false;
+
+	/* Busy time of each worker or task of the stage, in seconds.*/
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Layout Stats")
+	TArray<double> WorkerBusySeconds;
+
+	/* Time from the generation start until each worker or task started, in seconds, and the thread it ran on. Same order as WorkerBusySeconds.*/
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Layout Stats")
+	TArray<double> WorkerStartSeconds;
+
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Layout Stats")
+	TArray<int32> WorkerThreadIds;
+
+	/* Room and layout cells added by the stage.*/
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Layout Stats")
+	int32 CellsProduced = 0;
+
+	/* Peak allocated size of the layout and the copies made for the stage workers while the stage ran, in bytes.*/
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Layout Stats")
+	int64 PeakBytes = 0;
+};
+
+/* Predicted size and cost of a layout generation, calculated from the layout data without generating it.*/
+USTRUCT(BlueprintType)
+struct TERRAINGENERATOR_API FTerrainLayoutCostEstimate
+{
+	GENERATED_BODY()
+
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Cost Estimate")
+	int32 RoomsAmount = 0;
+
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Cost Estimate")
+	int32 AverageRoomCells = 0;
+
+	/* Room pairs found by the corridor detection area, the spanning tree is built from them.*/
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Cost Estimate")
+	int32 CandidateEdgesAmount = 0;
+
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Cost Estimate")
+	int32 CorridorsAmount = 0;
+
+	/* Cells checked around each room to find the candidate edges.*/
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Cost Estimate")
+	int64 CorridorSearchAreaCells = 0;
+
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Cost Estimate")
+	int32 LayoutCellsAmount = 0;
+
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Cost Estimate")
+	int32 WallCellsAmount = 0;
+
+	/* Collision cells checked by the room movement.*/
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Cost Estimate")
+	int64 RoomSeparationChecks = 0;
+
+	/* Connected rooms looked up while the spanning tree is built.*/
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Cost Estimate")
+	int64 SpanningTreeChecks = 0;
+
+	/* Open nodes checked by the corridor path searches.*/
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Cost Estimate")
+	int64 PathNodeChecks = 0;
+
+	/**
+	*	Sum of the checks, the corridor detection area and the layout cells. A count of the work, not a time.
+	*	Compare it between values of the same layout, the time of each operation is not known.
+	*/
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Cost Estimate")
+	int64 EstimatedOperations = 0;
+
+	/* Map entries of the layout and wall cells, in megabytes. A lower bound, without the tags and the copies of the stage workers.*/
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Cost Estimate")
+	float MinLayoutMB = 0;
+};
+
+/* Metrics of a single layout generation.*/
+USTRUCT(BlueprintType)
+struct TERRAINGENERATOR_API FTerrainLayoutStats
+{
+	GENERATED_BODY()
+
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Layout Stats")
+	int32 Seed = 0;
+
+	/* Wall time of the full generation, in seconds.*/
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Layout Stats")
+	double TotalSeconds = 0;
+
+	/* One entry per ETerrainGen_LayoutStage, indexed by the stage.*/
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Layout Stats")
+	TArray<FTerrainLayoutStageStats> Stages;
+
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Layout Stats")
+	int32 RoomsAmount = 0;
+
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Layout Stats")
+	int32 CorridorsAmount = 0;
+
+	/* Corridors requested by the layout that could not find a valid path.*/
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Layout Stats")
+	int32 FailedCorridorsAmount = 0;
+
+	/* Path searches that did not reach their end cell. A corridor tries other doors before it fails.*/
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Layout Stats")
+	int32 FailedPathsAmount = 0;
+
+	/* Nodes expanded by all the corridor path searches.*/
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Layout Stats")
+	int64 PathNodesExpanded = 0;
+
+	/* Corridor flow fields built, and corridors that followed one instead of a path search.*/
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Layout Stats")
+	int32 FlowFieldsAmount = 0;
+
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Layout Stats")
+	int32 FlowFieldPathsAmount = 0;
+
+	/* Path searches found in the corridor path cache, and the ones that had to be searched.*/
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Layout Stats")
+	int32 PathCacheHits = 0;
+
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Layout Stats")
+	int32 PathCacheMisses = 0;
+
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Layout Stats")
+	int32 WallCellsAmount = 0;
+
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Layout Stats")
+	int32 CellsAmount = 0;
+
+	/* Peak allocated size of the rooms and cells layout maps during the generation.*/
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Layout Stats")
+	int64 PeakLayoutBytes = 0;
+
+	/* Peak amount of entries in the cells layout map and in the corridors waiting to be merged.*/
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Layout Stats")
+	int32 PeakCellsLayoutSize = 0;
+
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Layout Stats")
+	int32 PeakPendingCorridorsSize = 0;
+
+	/* Time spent merging the corridors into the layout on the game thread, streamed and at the end of the stage, in seconds.*/
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Layout Stats")
+	double CorridorMergeSeconds = 0;
+
+	/* Regions the walls and depth were split in.*/
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Layout Stats")
+	int32 RegionsAmount = 0;
+
+	/* If the walls of each region started once the corridors that can reach it ended, instead of after the whole corridors stage.*/
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Layout Stats")
+	bool bRegionsPipelined = false;
+
+	/**
+	*	Measured, in seconds: from the start of the corridors stage to the end of the walls and depth merge. From the start of the walls stage if it ran on its own.
+	*	Generate the same seed with UTerrainLayoutSubsystem::SetPipelineLayoutRegions off to measure the barrier timeline.
+	*/
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Layout Stats")
+	double CorridorsToRegionsSeconds = 0;
+
+	/* If the generation was stopped for going over the layout data memory budget, and the stage it was stopped at.*/
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Layout Stats")
+	bool bMemoryBudgetExceeded = false;
+
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Layout Stats")
+	ETerrainGen_LayoutStage MemoryBudgetExceededStage = ETerrainGen_LayoutStage::ETLS_MAX;
+
+	void Reset(int32 SeedIn)
+	{
+		*this = FTerrainLayoutStats();
+		Seed = SeedIn;
+
+		const int32 StagesAmount = StaticCast<int32>(ETerrainGen_LayoutStage::ETLS_MAX);
+		Stages.SetNum(StagesAmount);
+		for (int32 i = 0; i < StagesAmount; i++)
+		{
+			Stages[i].Stage = StaticCast<ETerrainGen_LayoutStage>(i);
+		}
+	}
+
+	FTerrainLayoutStageStats& GetStage(ETerrainGen_LayoutStage StageIn)
+	{
+		return Stages[StaticCast<int32>(StageIn)];
+	}
+
+	const FTerrainLayoutStageStats& GetStage(ETerrainGen_LayoutStage StageIn) const
+	{
+		return Stages[StaticCast<int32>(StageIn)];
+	}
+};
+
+/* Effort of the corridor path searches in a single cell. Only collected for the editor heatmaps.*/
+struct FTerrainLayoutCellSearch
+{
+	/* Times the cell was expanded, by the path searches and the flow fields.*/
+	int32 Expansions = 0;
+
+	/* The lowest estimated cost of a path through the cell when it was expanded, in world units.*/
+	float Cost = MAX_flt;
+
+	void Add(int32 ExpansionsIn, float CostIn)
+	{
+		Expansions += ExpansionsIn;
+		Cost = FMath::Min(Cost, CostIn);
+	}
+};
+
+typedef TMap<FIntPoint, FTerrainLayoutCellSearch> FTerrainLayoutSearchHeatmap;
@@ -0,0 +1,19 @@
+//Copyright 2020 Marchetti S. Alfredo I. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Containers/Queue.h"
+#include "Layout/LayoutTypes.h"
+#include "Layout/CorridorTypes.h"
+
+/**
+*	Results pushed by the layout workers as soon as each one is completed, to be merged on the game thread while the stage is running.
+*	Created per generation, so the results of a cancelled generation are dropped with its queue instead of being merged.
+*/
+struct TERRAINGENERATOR_API FTerrainLayoutStreamQueue
+{
+	TQueue<FCorridorLayout, EQueueMode::Mpsc> Corridors;
+};
+
+typedef TSharedPtr<FTerrainLayoutStreamQueue, ESPMode::ThreadSafe> FTerrainLayoutStreamQueuePtr;
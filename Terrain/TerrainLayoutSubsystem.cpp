@@ -11,78 +11,1266 @@
 #include "Layout/LayoutThreads/CorridorLayoutWorker.h"
 #include "Layout/LayoutThreads/WallLayoutWorker.h"
 #include "Layout/TerrainLayoutFunctionLibrary.h"
+#include "Async/ParallelFor.h"
+#include "Algo/StableSort.h"
+#include "Async/Async.h"
+#include "Tasks/Task.h"
+#include "Misc/ScopeLock.h"
+#include "ProfilingDebugging/CpuProfilerTrace.h"
+#include "ProfilingDebugging/CountersTrace.h"
+#include "TerrainGeneratorMemory.h"
+#include "Layout/TerrainLayoutKernels.h"
+
+TRACE_DECLARE_INT_COUNTER(TerrainLayoutCells, TEXT("TerrainLayout/Cells"));
+TRACE_DECLARE_INT_COUNTER(TerrainLayoutRooms, TEXT("TerrainLayout/Rooms"));
+TRACE_DECLARE_INT_COUNTER(TerrainLayoutCorridors, TEXT("TerrainLayout/Corridors"));
+TRACE_DECLARE_INT_COUNTER(TerrainLayoutFailedPaths, TEXT("TerrainLayout/FailedPaths"));
+TRACE_DECLARE_INT_COUNTER(TerrainLayoutPathNodesExpanded, TEXT("TerrainLayout/PathNodesExpanded"));
+TRACE_DECLARE_MEMORY_COUNTER(TerrainLayoutPeakBytes, TEXT("TerrainLayout/PeakLayoutBytes"));
+
+/* When a worker or task started, for how long it ran and on which thread.*/
+struct FTerrainLayoutTaskTime
+{
+	double StartTime = 0;
+	double Seconds = 0;
+	uint32 ThreadId = 0;
+
+	void Begin()
+	{
+		StartTime = FPlatformTime::Seconds();
+		ThreadId = FPlatformTLS::GetCurrentThreadId();
+	}
+
+	void End()
+	{
+		Seconds = FPlatformTime::Seconds() - StartTime;
+	}
+};
+
+namespace TerrainLayoutRegions
+{
+	/* Side of the square regions, in cells.*/
+	static const int32 RegionSize = 32;
+
+	FIntPoint GetRegion(const FIntPoint& CellIn)
+	{
+		return FIntPoint(FMath::FloorToInt(CellIn.X / StaticCast<float>(RegionSize)), FMath::FloorToInt(CellIn.Y / StaticCast<float>(RegionSize)));
+	}
+
+	/**
+	*	Distance from each layout cell of the region to the nearest cell out of the layout, where the walls are placed.
+	*	Uses a two pass distance transform over the region and a border of MaxCellLayoutDepth cells, the farthest a cell out of the layout can change the result.
+	*/
+	void CalculateRegionCellsDepth(const FIntPoint& RegionIn, TFunctionRef<bool(const FIntPoint&)> IsLayoutCellIn, TArray<TPair<FIntPoint, int32>>& DepthOut)
+	{
+		const int32 Border = UTerrainLayoutSubsystem::MaxCellLayoutDepth;
+		const int32 Size = RegionSize + Border * 2;
+		const FIntPoint Origin = RegionIn * RegionSize - FIntPoint(Border, Border);
+
+		TArray<int32> Distances;
+		Distances.SetNumUninitialized(Size * Size);
+		for (int32 y = 0; y < Size; y++)
+		{
+			for (int32 x = 0; x < Size; x++)
+			{
+				Distances[y * Size + x] = IsLayoutCellIn(Origin + FIntPoint(x, y)) ? Border : 0;
+			}
+		}
+
+		for (int32 y = 0; y < Size; y++)
+		{
+			for (int32 x = 0; x < Size; x++)
+			{
+				int32& Distance = Distances[y * Size + x];
+				if (x > 0)
+				{
+					Distance = FMath::Min(Distance, Distances[y * Size + x - 1] + 1);
+				}
+
+				if (y > 0)
+				{
+					Distance = FMath::Min(Distance, Distances[(y - 1) * Size + x] + 1);
+				}
+			}
+		}
+
+		for (int32 y = Size - 1; y >= 0; y--)
+		{
+			for (int32 x = Size - 1; x >= 0; x--)
+			{
+				int32& Distance = Distances[y * Size + x];
+				if (x < Size - 1)
+				{
+					Distance = FMath::Min(Distance, Distances[y * Size + x + 1] + 1);
+				}
+
+				if (y < Size - 1)
+				{
+					Distance = FMath::Min(Distance, Distances[(y + 1) * Size + x] + 1);
+				}
+			}
+		}
+
+		for (int32 y = Border; y < Border + RegionSize; y++)
+		{
+			for (int32 x = Border; x < Border + RegionSize; x++)
+			{
+				if (Distances[y * Size + x] > 0)
+				{
+					DepthOut.Emplace(Origin + FIntPoint(x, y), Distances[y * Size + x]);
+				}
+			}
+		}
+	}
+
+	/**
+	*	Bounds, Max included, of the cells a corridor between two rooms can add: a path of at most PathLengthIn steps between a door of each room, and the range around it.
+	*	A path cell is at most PathLengthIn steps away from both doors added together, so it is in the bounds of both doors grown by half of the length left after the gap between them.
+	*	Returns false if the rooms are too far apart for any path.
+	*/
+	bool GetCorridorBounds(const FIntRect& RoomBoundsA, const FIntRect& RoomBoundsB, int32 PathLengthIn, int32 RangeIn, FIntRect& BoundsOut)
+	{
+		//The doors are the cells next to the rooms.
+		const FIntPoint One = FIntPoint(1, 1);
+		const FIntRect DoorsA = FIntRect(RoomBoundsA.Min - One, RoomBoundsA.Max + One);
+		const FIntRect DoorsB = FIntRect(RoomBoundsB.Min - One, RoomBoundsB.Max + One);
+
+		const int32 GapX = FMath::Max3(0, DoorsB.Min.X - DoorsA.Max.X, DoorsA.Min.X - DoorsB.Max.X);
+		const int32 GapY = FMath::Max3(0, DoorsB.Min.Y - DoorsA.Max.Y, DoorsA.Min.Y - DoorsB.Max.Y);
+		const int32 LengthLeft = PathLengthIn - GapX - GapY;
+		if (LengthLeft < 0)
+		{
+			return false;
+		}
+
+		const int32 Grow = (LengthLeft + 1) / 2 + RangeIn;
+		BoundsOut.Min = FIntPoint(FMath::Min(DoorsA.Min.X, DoorsB.Min.X), FMath::Min(DoorsA.Min.Y, DoorsB.Min.Y)) - FIntPoint(Grow, Grow);
+		BoundsOut.Max = FIntPoint(FMath::Max(DoorsA.Max.X, DoorsB.Max.X), FMath::Max(DoorsA.Max.Y, DoorsB.Max.Y)) + FIntPoint(Grow, Grow);
+		return true;
+	}
+}
+
+/* A corridor cell waiting to be added to the cells of its region, with the tags MergeCorridorLayout gives it.*/
+struct FTerrainLayoutRegionCorridorCell
+{
+	FIntPoint Cell = FIntPoint::ZeroValue;
+	int32 CorridorIndex = 0;
+	bool bIsStartDoor = false;
+	bool bIsEndDoor = false;
+};
+
+/**
+*	The walls and depth tasks of the regions, shared by the tasks, the corridor workers and the subsystem.
+*	The walls task of a region waits for its corridors event, triggered once every corridor that can reach the region ended. It adds those corridors cells to the region cells and runs the walls.
+*	The depth task of a region waits for the walls tasks of the region and its neighbours, the ones that build the cells it reads.
+*/
+struct FTerrainLayoutRegionTasks
+{
+	TArray<FIntPoint> Regions;
+	TMap<FIntPoint, int32> RegionIndices;
+
+	/* The cells of each region, the corridors ones included once its walls task started. Not changed by the walls.*/
+	TArray<TMap<FIntPoint, FCellLayout>> RegionsCells;
+
+	/* For each corridor of the stage, the regions its cells can fall in.*/
+	TArray<TArray<int32>> CorridorsRegions;
+
+	/* Written by the corridor workers under the lock, until the region is released.*/
+	TArray<TArray<FTerrainLayoutRegionCorridorCell>> RegionsCorridorCells;
+	TArray<int32> RegionsPendingCorridors;
+	TArray<bool> RegionsReleased;
+	TArray<UE::Tasks::FTaskEvent> RegionsCorridorsEvents;
+	FCriticalSection Lock;
+
+	/* If a region is released as soon as its corridors end. Otherwise every region waits for the end of the corridors stage, as a barrier.*/
+	bool bIsPipelined = false;
+
+	UTerrainLayoutSubsystem* ThreadOwner = nullptr;
+	UTerrainLayoutData* TerrainLayoutData = nullptr;
+
+	/* Each region walls stream is this seed combined with the region, so the walls do not depend on the order the regions run.*/
+	int32 WallsSeed = 0;
+
+	/* Created by the walls tasks. Null for the regions without cells.*/
+	TArray<FBaseTerrainWorker*> WallWorkers;
+	TArray<TArray<TPair<FIntPoint, int32>>> RegionsCellsDepth;
+
+	TArray<FTerrainLayoutTaskTime> WallTasksTimes;
+	TArray<FTerrainLayoutTaskTime> DepthTasksTimes;
+	TArray<UE::Tasks::FTask> LaunchedTasks;
+
+	/* When the tasks were created, at the start of the corridors or the walls stage.*/
+	double StartTime = 0;
+
+	/* A child of the generation token, so the tasks can be dropped without cancelling the generation.*/
+	FTerrainLayoutCancellationTokenPtr CancellationToken;
+
+	~FTerrainLayoutRegionTasks()
+	{
+		//Only left if the generation was cancelled before the merge.
+		for (FBaseTerrainWorker* Worker : WallWorkers)
+		{
+			delete Worker;
+		}
+	}
+
+	/* Called from the corridor workers once per corridor, generated or failed. LayoutIn is null for the failed ones.*/
+	void OnCorridorEnd(int32 CorridorIndexIn, const FCorridorLayout* LayoutIn)
+	{
+		if (CancellationToken->IsCancelled() || !CorridorsRegions.IsValidIndex(CorridorIndexIn))
+		{
+			return;
+		}
+
+		//Sorted out of the lock, only the appends are done under it.
+		TArray<TPair<int32, FTerrainLayoutRegionCorridorCell>> CorridorCells;
+		if (LayoutIn)
+		{
+			CorridorCells.Reserve(LayoutIn->Cells.Num());
+			for (const FIntPoint& cell : LayoutIn->Cells)
+			{
+				const int32* RegionIndex = RegionIndices.Find(TerrainLayoutRegions::GetRegion(cell));
+				if (!ensureMsgf(RegionIndex, TEXT("A corridor cell is out of the bounds its corridor was given.")))
+				{
+					continue;
+				}
+
+				FTerrainLayoutRegionCorridorCell CorridorCell = FTerrainLayoutRegionCorridorCell();
+				CorridorCell.Cell = cell;
+				CorridorCell.CorridorIndex = CorridorIndexIn;
+				CorridorCell.bIsEndDoor = cell == LayoutIn->EndCellId;
+				CorridorCell.bIsStartDoor = !CorridorCell.bIsEndDoor && cell == LayoutIn->StartCellId;
+				CorridorCells.Emplace(*RegionIndex, CorridorCell);
+			}
+		}
+
+		TArray<int32, TInlineAllocator<16>> ReleasedRegions;
+		{
+			FScopeLock ScopeLock(&Lock);
+
+			for (const TPair<int32, FTerrainLayoutRegionCorridorCell>& pair : CorridorCells)
+			{
+				ensureMsgf(!RegionsReleased[pair.Key], TEXT("A corridor cell reached a region that was already released."));
+				RegionsCorridorCells[pair.Key].Add(pair.Value);
+			}
+
+			for (const int32 RegionIndex : CorridorsRegions[CorridorIndexIn])
+			{
+				RegionsPendingCorridors[RegionIndex]--;
+				if (bIsPipelined && RegionsPendingCorridors[RegionIndex] == 0 && !RegionsReleased[RegionIndex])
+				{
+					RegionsReleased[RegionIndex] = true;
+					ReleasedRegions.Add(RegionIndex);
+				}
+			}
+		}
+
+		//Triggered out of the lock, the walls tasks may start right away.
+		for (const int32 RegionIndex : ReleasedRegions)
+		{
+			RegionsCorridorsEvents[RegionIndex].Trigger();
+		}
+	}
+
+	/* Releases the regions still waiting. Done when the corridors stage ends, and when the tasks are dropped so they end.*/
+	void ReleaseAll()
+	{
+		TArray<int32> ReleasedRegions;
+		{
+			FScopeLock ScopeLock(&Lock);
+
+			for (int32 i = 0; i < RegionsReleased.Num(); i++)
+			{
+				if (!RegionsReleased[i])
+				{
+					RegionsReleased[i] = true;
+					ReleasedRegions.Add(i);
+				}
+			}
+		}
+
+		for (const int32 RegionIndex : ReleasedRegions)
+		{
+			RegionsCorridorsEvents[RegionIndex].Trigger();
+		}
+	}
+
+	/* Adds the corridor cells of the region in the order of the corridors, as the merge of the corridors stage does. Called by the region walls task.*/
+	void AddRegionCorridorCells(int32 RegionIndexIn)
+	{
+		TArray<FTerrainLayoutRegionCorridorCell> CorridorCells;
+		{
+			FScopeLock ScopeLock(&Lock);
+			CorridorCells = MoveTemp(RegionsCorridorCells[RegionIndexIn]);
+		}
+
+		Algo::StableSortBy(CorridorCells, &FTerrainLayoutRegionCorridorCell::CorridorIndex);
+
+		TMap<FIntPoint, FCellLayout>& RegionCells = RegionsCells[RegionIndexIn];
+		for (const FTerrainLayoutRegionCorridorCell& CorridorCell : CorridorCells)
+		{
+			FCellLayout& CellLayout = RegionCells.FindOrAdd(CorridorCell.Cell);
+			CellLayout.CellID = CorridorCell.Cell;
+			CellLayout.Tags.AddTag(TAG_TERRAIN_CELL_TYPE_CORRIDOR);
+
+			if (CorridorCell.bIsEndDoor)
+			{
+				CellLayout.Tags.AddTag(TAG_TERRAIN_CELL_LAYOUT_DOOR_ENDCORRIDOR);
+			}
+			else if (CorridorCell.bIsStartDoor)
+			{
+				CellLayout.Tags.AddTag(TAG_TERRAIN_CELL_LAYOUT_DOOR_STARTCORRIDOR);
+			}
+		}
+	}
+
+	/* If the cell is a room or corridor cell. Only valid for the regions whose walls task ended.*/
+	bool IsLayoutCell(const FIntPoint& CellIn) const
+	{
+		const int32* RegionIndex = RegionIndices.Find(TerrainLayoutRegions::GetRegion(CellIn));
+		return RegionIndex && RegionsCells[*RegionIndex].Contains(CellIn);
+	}
+};
+
+FIntPoint UTerrainLayoutSubsystem::GetInitialRoom() const
+{
+	return InitialRoom;
+}
+
+TMap<FIntPoint, FRoomLayout> UTerrainLayoutSubsystem::GetRoomsLayoutMap() const
+{
+	return RoomsLayoutMap;
+}
+
+TMap<FIntPoint, FCellLayout> UTerrainLayoutSubsystem::GetCellsLayoutMap() const
+{
+	return CellsLayoutMap.ToMap();
+}
+
+const FTerrainLayoutStats& UTerrainLayoutSubsystem::GetLayoutStats() const
+{
+	return LayoutStats;
+}
+
+void UTerrainLayoutSubsystem::SetCaptureStageSnapshots(bool bCapture)
+{
+	bCaptureStageSnapshots = bCapture;
+
+	if (!bCaptureStageSnapshots)
+	{
+		StageSnapshots.Empty();
+	}
+}
+
+void UTerrainLayoutSubsystem::SetPipelineLayoutRegions(bool bPipeline)
+{
+	bPipelineLayoutRegions = bPipeline;
+}
+
+void UTerrainLayoutSubsystem::SetCollectSearchHeatmap(bool bCollect)
+{
+	bCollectSearchHeatmap = bCollect;
+
+	if (!bCollectSearchHeatmap)
+	{
+		CorridorSearchHeatmap.Empty();
+	}
+}
+
+const FTerrainLayoutSearchHeatmap& UTerrainLayoutSubsystem::GetCorridorSearchHeatmap() const
+{
+	return CorridorSearchHeatmap;
+}
+
+const FTerrainLayoutSnapshot& UTerrainLayoutSubsystem::GetStageSnapshot(ETerrainGen_LayoutStage StageIn) const
+{
+	static const FTerrainLayoutSnapshot InvalidSnapshot = FTerrainLayoutSnapshot();
+
+	const int32 StageIndex = StaticCast<int32>(StageIn);
+	if (!StageSnapshots.IsValidIndex(StageIndex))
+	{
+		return InvalidSnapshot;
+	}
+
+	return StageSnapshots[StageIndex];
+}
+
+FVector UTerrainLayoutSubsystem::GetCellWorldPosition(const FIntPoint& InCellsID, const FVector2D InAnchor) const
+{
+	if (!TerrainLayoutData)
+	{
+		return FVector::ZeroVector;
+	}
+
+	FVector Position = FVector::ZeroVector;
+
+	//Axis must be reversed for this to work(See landscape placement logic)
+	Position.X = InCellsID.Y * TerrainData->CellSize + TerrainData->CellSize * InAnchor.Y; //Show the location based on anchor
+	Position.Y = InCellsID.X * TerrainData->CellSize + TerrainData->CellSize * InAnchor.X;
+
+	Position.Z = 0;
+
+	return Position;
+}
+
+void UTerrainLayoutSubsystem::GetCellsWorldPositions(TArrayView<const FIntPoint> CellsIn, FVector2D AnchorIn, TArrayView<FVector> PositionsOut) const
+{
+	if (!TerrainLayoutData)
+	{
+		for (int32 i = 0; i < CellsIn.Num(); i++)
+		{
+			PositionsOut[i] = FVector::ZeroVector;
+		}
+
+		return;
+	}
+
+	FTerrainLayoutKernels::CellsToWorldPositions(CellsIn, TerrainData->CellSize, AnchorIn, PositionsOut);
+}
+
+int32 UTerrainLayoutSubsystem::GetRoomDungeonDepth(const FIntPoint& RoomIDIn) const
+{
+	const int32* Depth = RoomsDungeonDepth.Find(RoomIDIn);
+	return Depth ? *Depth : -1;
+}
+
+int32 UTerrainLayoutSubsystem::GetCellLayoutDepth(const FIntPoint& CellIDIn) const
+{
+	const int32* Depth = CellsLayoutDepth.Find(CellIDIn);
+	return Depth ? *Depth : -1;
+}
+
+float UTerrainLayoutSubsystem::GetWorldDistanceBetweenRooms(const FIntPoint& RoomA, const FIntPoint& RoomB) const
+{	
+	if(!RoomsLayoutMap.Contains(RoomA) || !RoomsLayoutMap.Contains(RoomB))
+	{
+		return 0;
+	}
+
+	const FVector RoomACenter = GetCellWorldPosition(RoomsLayoutMap[RoomA].CentralCell,{ .5,.5 });
+	const FVector RoomBCenter = GetCellWorldPosition(RoomsLayoutMap[RoomB].CentralCell, { .5,.5 });
+	return FVector::Dist2D(RoomACenter, RoomBCenter);
+}
+
+void UTerrainLayoutSubsystem::GenerateTerrainLayout(UTerrainData* InTerrainData)
+{
+	//A synchronous generation or stage run before must not leave this one blocking the calling thread.
+	bGenerateSynchronously = false;
+	StartLayoutGeneration(InTerrainData, ETerrainGen_LayoutStage::ETLS_MAX);
+}
+
+void UTerrainLayoutSubsystem::GenerateTerrainLayout(UTerrainData* InTerrainData, int32 InSeed)
+{
+	GetStream().Initialize(InSeed);
+	GenerateTerrainLayout(InTerrainData);
+}
+
+void UTerrainLayoutSubsystem::StartLayoutGeneration(UTerrainData* InTerrainData, ETerrainGen_LayoutStage LastStageIn)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(UTerrainLayoutSubsystem::StartLayoutGeneration);
+	LLM_SCOPE_BYTAG(TerrainGenerator_Layout);
+
+	CancelLayoutGeneration();
+
+	if (!bGenerateSynchronously && bIsStageBatchRunning)
+	{
+		UE_LOG(TerrainGeneratorLog, Log, TEXT("UTerrainLayoutSubsystem::StartLayoutGeneration - Waiting for the workers of the cancelled generation to end."));
+
+		const TWeakObjectPtr<UTerrainData> WeakTerrainData = InTerrainData;
+		PendingGenerationStart = [this, WeakTerrainData, LastStageIn]()
+		{
+			StartLayoutGeneration(WeakTerrainData.Get(), LastStageIn);
+		};
+		return;
+	}
+
+	LayoutStats.Reset(GetStream().GetInitialSeed());
+
+	if (!InTerrainData)
+	{
+		UE_LOG(TerrainGeneratorLog, Error, TEXT("UTerrainLayoutSubsystem::StartLayoutGeneration - Invalid terrain data."));
+		return;
+	}
+
+	if (!InTerrainData->TerrainLayoutData)
+	{
+		UE_LOG(TerrainGeneratorLog, Error, TEXT("UTerrainLayoutSubsystem::StartLayoutGeneration - Invalid layout data."));
+		return;
+	}
+
+	TerrainData = InTerrainData;
+	TerrainLayoutData = InTerrainData->TerrainLayoutData;
+
+	CellsLayoutMap.Empty();
+	RoomsLayoutMap.Empty();
+	RoomConnections.Empty();
+	RoomsDungeonDepth.Empty();
+	CellsLayoutDepth.Empty();
+	bCellsLayoutDepthCalculated = false;
+	CorridorSearchHeatmap.Empty();
+
+	LastStageToRun = LastStageIn;
+	GenerationStartTime = FPlatformTime::Seconds();
+	StartNewGenerationToken();
+
+	//Snapshots of the stages this generation does not reach must not be restored with its layout.
+	StageSnapshots.Reset();
+
+	BeginStage(ETerrainGen_LayoutStage::InitialLayout);
+	GenerateInitialRoomsLayout();
+	EndStage(ETerrainGen_LayoutStage::InitialLayout);
+
+	if (IsGenerationCancelled() || IsLastStageToRun(ETerrainGen_LayoutStage::InitialLayout))
+	{
+		return;
+	}
+
+	StartRoomLayoutGeneration();
+}
+
+void UTerrainLayoutSubsystem::CancelLayoutGeneration()
+{
+	//A newer generation or a cancel replaces the start waiting for the cancelled batch.
+	PendingGenerationStart.Reset();
+
+	if (!GenerationCancellationToken.IsValid())
+	{
+		return;
+	}
+
+	GenerationCancellationToken->Cancel();
+	GenerationCancellationToken.Reset();
+	StopStreamMerge();
+	PendingCorridorLayouts.Empty();
+
+	//The region tasks still running keep their own reference and drop their results.
+	CancelRegionTasks();
+
+	//The running batch still ends on its own, but its end must not continue the pipeline.
+	UnbindStageEnd();
+
+	//Its end is not told apart from the end of a later batch, so the next generation waits for it instead of binding its own stage end.
+	if (bIsStageBatchRunning)
+	{
+		FScriptDelegate OnCancelledBatchEndDelegate;
+		OnCancelledBatchEndDelegate.BindUFunction(this, GET_FUNCTION_NAME_CHECKED(UTerrainLayoutSubsystem, OnCancelledStageBatchEnd));
+		GetTerrainThreadSubsystem()->OnThreadOperationEnd.Add(OnCancelledBatchEndDelegate);
+	}
+
+	UE_LOG(TerrainGeneratorLog, Log, TEXT("UTerrainLayoutSubsystem::CancelLayoutGeneration - Layout generation cancelled."));
+}
+
+void UTerrainLayoutSubsystem::OnStageBatchEnd()
+{
+	//Synchronous stages run no batch. A cancelled async batch may still be running then, it ends in OnCancelledStageBatchEnd.
+	if (bGenerateSynchronously)
+	{
+		return;
+	}
+
+	UnbindStageEnd();
+	bIsStageBatchRunning = false;
+
+	//The workers poll the memory budget and cancel the generation when it is exceeded, it is reported here.
+	CheckMemoryBudget();
+}
+
+void UTerrainLayoutSubsystem::OnCancelledStageBatchEnd()
+{
+	//Only bound by async generations and called by the thread subsystem, even if a synchronous generation ran since.
+	GetTerrainThreadSubsystem()->OnThreadOperationEnd.RemoveAll(this);
+	bIsStageBatchRunning = false;
+
+	if (PendingGenerationStart)
+	{
+		const TFunction<void()> GenerationStart = MoveTemp(PendingGenerationStart);
+		PendingGenerationStart.Reset();
+		GenerationStart();
+	}
+}
+
+void UTerrainLayoutSubsystem::StartNewGenerationToken()
+{
+	GenerationCancellationToken = MakeShared<FTerrainLayoutCancellationToken, ESPMode::ThreadSafe>(ParentCancellationToken);
+}
+
+bool UTerrainLayoutSubsystem::IsGenerationCancelled() const
+{
+	return !GenerationCancellationToken.IsValid() || GenerationCancellationToken->IsCancelled();
+}
+
+void UTerrainLayoutSubsystem::StartStreamMerge()
+{
+	StopStreamMerge();
+
+	StreamQueue = MakeShared<FTerrainLayoutStreamQueue, ESPMode::ThreadSafe>();
+	StreamMergeTickerHandle = FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateUObject(this, &UTerrainLayoutSubsystem::TickStreamMerge));
+}
+
+void UTerrainLayoutSubsystem::StopStreamMerge()
+{
+	if (StreamMergeTickerHandle.IsValid())
+	{
+		FTSTicker::GetCoreTicker().RemoveTicker(StreamMergeTickerHandle);
+		StreamMergeTickerHandle.Reset();
+	}
+
+	StreamQueue.Reset();
+}
+
+bool UTerrainLayoutSubsystem::TickStreamMerge(float DeltaTime)
+{
+	MergeStreamedResults(TerrainLayoutData ? TerrainLayoutData->StreamMergeBudgetMs / 1000.0 : 0);
+	return true;
+}
+
+void UTerrainLayoutSubsystem::MergeStreamedResults(double BudgetSecondsIn)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(UTerrainLayoutSubsystem::MergeStreamedResults);
+	LLM_SCOPE_BYTAG(TerrainGenerator_Layout);
+
+	if (!StreamQueue.IsValid() || IsGenerationCancelled())
+	{
+		return;
+	}
+
+	const double StartTime = FPlatformTime::Seconds();
+
+	TArray<FIntPoint> ChangedCells;
+	FCorridorLayout Layout = FCorridorLayout();
+	while (StreamQueue->Corridors.Dequeue(Layout))
+	{
+		MergeCorridorLayout(Layout, ChangedCells);
+
+		if (BudgetSecondsIn >= 0 && FPlatformTime::Seconds() - StartTime >= BudgetSecondsIn)
+		{
+			break;
+		}
+	}
+
+	LayoutStats.CorridorMergeSeconds += FPlatformTime::Seconds() - StartTime;
+
+	if (!CheckMemoryBudget())
+	{
+		return;
+	}
+
+	if (ChangedCells.Num() > 0)
+	{
+		StageChangedCells.Append(ChangedCells);
+		OnLayoutCellsUpdated.Broadcast(ChangedCells);
+	}
+}
+
+void UTerrainLayoutSubsystem::MergeCorridorLayout(const FCorridorLayout& LayoutIn, TArray<FIntPoint>& ChangedCellsOut)
+{
+	for (const FIntPoint& cell : LayoutIn.Cells)
+	{
+		FCellLayout& CellLayout = CellsLayoutMap.FindOrAdd(cell);
+		CellLayout.CellID = cell;
+		CellLayout.Tags.AddTag(TAG_TERRAIN_CELL_TYPE_CORRIDOR);
+
+		if (cell == LayoutIn.EndCellId)
+		{
+			CellLayout.Tags.AddTag(TAG_TERRAIN_CELL_LAYOUT_DOOR_ENDCORRIDOR);
+		}
+		else if (cell == LayoutIn.StartCellId)
+		{
+			CellLayout.Tags.AddTag(TAG_TERRAIN_CELL_LAYOUT_DOOR_STARTCORRIDOR);
+		}
+
+		ChangedCellsOut.Add(cell);
+	}
+
+	if (LayoutIn.Cells.Num() > 0)
+	{
+		AddRoomConnection(LayoutIn.StartRoomId, LayoutIn.EndRoomId);
+	}
+}
+
+void UTerrainLayoutSubsystem::MergeCorridorLayoutsSharded(const TArray<FCorridorLayout>& LayoutsIn)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(UTerrainLayoutSubsystem::MergeCorridorLayoutsSharded);
+	LLM_SCOPE_BYTAG(TerrainGenerator_Layout);
+
+	//Below this the tasks cost more than the merge itself.
+	static const int32 MinCellsToShard = 4096;
+
+	const double StartTime = FPlatformTime::Seconds();
+
+	int32 CellsAmount = 0;
+	for (const FCorridorLayout& Layout : LayoutsIn)
+	{
+		CellsAmount += Layout.Cells.Num();
+	}
+
+	if (CellsAmount == 0)
+	{
+		return;
+	}
+
+	if (CellsAmount < MinCellsToShard)
+	{
+		for (const FCorridorLayout& Layout : LayoutsIn)
+		{
+			MergeCorridorLayout(Layout, StageChangedCells);
+		}
+
+		LayoutStats.CorridorMergeSeconds += FPlatformTime::Seconds() - StartTime;
+		return;
+	}
+
+	const int32 ShardsAmount = FTerrainLayoutCellsMap::ShardsAmount;
+
+	struct FShardCell
+	{
+		FIntPoint Cell;
+		int32 LayoutIndex;
+	};
+
+	//Consecutive corridors per slice, so the cells reach each shard in the order of the corridors, as in the single threaded merge.
+	const int32 SlicesAmount = FMath::Clamp(TerrainData->MaximunThreads, 1, LayoutsIn.Num());
+	TArray<TArray<TArray<FShardCell>>> SlicesShardsCells;
+	SlicesShardsCells.SetNum(SlicesAmount);
+
+	ParallelFor(SlicesAmount, [&LayoutsIn, &SlicesShardsCells, SlicesAmount, ShardsAmount](int32 SliceIndex)
+	{
+		LLM_SCOPE_BYTAG(TerrainGenerator_Layout);
+		TArray<TArray<FShardCell>>& ShardsCells = SlicesShardsCells[SliceIndex];
+		ShardsCells.SetNum(ShardsAmount);
+
+		const int32 FirstLayout = LayoutsIn.Num() * SliceIndex / SlicesAmount;
+		const int32 EndLayout = LayoutsIn.Num() * (SliceIndex + 1) / SlicesAmount;
+		for (int32 LayoutIndex = FirstLayout; LayoutIndex < EndLayout; LayoutIndex++)
+		{
+			for (const FIntPoint& cell : LayoutsIn[LayoutIndex].Cells)
+			{
+				ShardsCells[FTerrainLayoutCellsMap::GetShardIndex(cell)].Add({ cell, LayoutIndex });
+			}
+		}
+	});
+
+	TArray<TArray<FIntPoint>> ShardsChangedCells;
+	ShardsChangedCells.SetNum(ShardsAmount);
+
+	//Each task only writes its own shard of the layout. The shards share nothing, so the cells go straight into the layout.
+	ParallelFor(ShardsAmount, [this, &LayoutsIn, &SlicesShardsCells, &ShardsChangedCells](int32 ShardIndex)
+	{
+		LLM_SCOPE_BYTAG(TerrainGenerator_Layout);
+		FTerrainLayoutCellsMap::FShard& Shard = CellsLayoutMap.GetShard(ShardIndex);
+		TArray<FIntPoint>& ChangedCells = ShardsChangedCells[ShardIndex];
+
+		for (const TArray<TArray<FShardCell>>& ShardsCells : SlicesShardsCells)
+		{
+			for (const FShardCell& ShardCell : ShardsCells[ShardIndex])
+			{
+				const FCorridorLayout& Layout = LayoutsIn[ShardCell.LayoutIndex];
+				const FIntPoint& cell = ShardCell.Cell;
+
+				FCellLayout& CellLayout = Shard.FindOrAdd(cell);
+				CellLayout.CellID = cell;
+				CellLayout.Tags.AddTag(TAG_TERRAIN_CELL_TYPE_CORRIDOR);
+
+				if (cell == Layout.EndCellId)
+				{
+					CellLayout.Tags.AddTag(TAG_TERRAIN_CELL_LAYOUT_DOOR_ENDCORRIDOR);
+				}
+				else if (cell == Layout.StartCellId)
+				{
+					CellLayout.Tags.AddTag(TAG_TERRAIN_CELL_LAYOUT_DOOR_STARTCORRIDOR);
+				}
+
+				ChangedCells.Add(cell);
+			}
+		}
+	});
+
+	StageChangedCells.Reserve(StageChangedCells.Num() + CellsAmount);
+	for (const TArray<FIntPoint>& ChangedCells : ShardsChangedCells)
+	{
+		StageChangedCells.Append(ChangedCells);
+	}
+
+	for (const FCorridorLayout& Layout : LayoutsIn)
+	{
+		if (Layout.Cells.Num() > 0)
+		{
+			AddRoomConnection(Layout.StartRoomId, Layout.EndRoomId);
+		}
+	}
+
+	LayoutStats.CorridorMergeSeconds += FPlatformTime::Seconds() - StartTime;
+}
+
+void UTerrainLayoutSubsystem::AddRoomConnection(const FIntPoint& RoomA, const FIntPoint& RoomB)
+{
+	RoomConnections.FindOrAdd(RoomA).AddUnique(RoomB);
+	RoomConnections.FindOrAdd(RoomB).AddUnique(RoomA);
+}
+
+void UTerrainLayoutSubsystem::GenerateTerrainLayoutSynchronous(UTerrainData* InTerrainData, int32 InSeed, ETerrainGen_LayoutStage LastStageIn, const FTerrainLayoutCancellationTokenPtr& ParentCancellationTokenIn)
+{
+	//An async generation in flight is cancelled before the flag changes, so its stage end is still unbound.
+	CancelLayoutGeneration();
+	bGenerateSynchronously = true;
+	GetStream().Initialize(InSeed);
+
+	ParentCancellationToken = ParentCancellationTokenIn;
+	StartLayoutGeneration(InTerrainData, LastStageIn);
+	ParentCancellationToken.Reset();
+}
+
+bool UTerrainLayoutSubsystem::RestoreLayoutSnapshot(UTerrainData* InTerrainData, const FTerrainLayoutSnapshot& SnapshotIn)
+{
+	LLM_SCOPE_BYTAG(TerrainGenerator_Layout);
+
+	if (!InTerrainData || !InTerrainData->TerrainLayoutData)
+	{
+		UE_LOG(TerrainGeneratorLog, Error, TEXT("UTerrainLayoutSubsystem::RestoreLayoutSnapshot - Invalid terrain data."));
+		return false;
+	}
+
+	if (!SnapshotIn.bIsValid)
+	{
+		UE_LOG(TerrainGeneratorLog, Error, TEXT("UTerrainLayoutSubsystem::RestoreLayoutSnapshot - Invalid snapshot. Capture stage snapshots before restoring one."));
+		return false;
+	}
+
+	TerrainData = InTerrainData;
+	TerrainLayoutData = InTerrainData->TerrainLayoutData;
+
+	GetStream() = SnapshotIn.Stream;
+	InitialRoom = SnapshotIn.InitialRoom;
+	RoomsLayoutMap = SnapshotIn.RoomsLayoutMap;
+	CellsLayoutMap = SnapshotIn.CellsLayoutMap;
+	RoomConnections = SnapshotIn.RoomConnections;
+	RoomsDungeonDepth.Empty();
+	CellsLayoutDepth.Empty();
+	bCellsLayoutDepthCalculated = false;
+
+	return true;
+}
+
+void UTerrainLayoutSubsystem::RunLayoutStageSynchronous(ETerrainGen_LayoutStage StageIn)
+{
+	LLM_SCOPE_BYTAG(TerrainGenerator_Layout);
+
+	if (!TerrainData || !TerrainLayoutData)
+	{
+		UE_LOG(TerrainGeneratorLog, Error, TEXT("UTerrainLayoutSubsystem::RunLayoutStageSynchronous - Invalid terrain data. Restore a snapshot before running a stage."));
+		return;
+	}
+
+	CancelLayoutGeneration();
+	bGenerateSynchronously = true;
+
+	LayoutStats.Reset(GetStream().GetInitialSeed());
+	LastStageToRun = StageIn;
+	GenerationStartTime = FPlatformTime::Seconds();
+	StartNewGenerationToken();
+
+	switch (StageIn)
+	{
+	case ETerrainGen_LayoutStage::InitialLayout:
+		BeginStage(ETerrainGen_LayoutStage::InitialLayout);
+		GenerateInitialRoomsLayout();
+		EndStage(ETerrainGen_LayoutStage::InitialLayout);
+		break;
+	case ETerrainGen_LayoutStage::RoomLayout:
+		StartRoomLayoutGeneration();
+		break;
+	case ETerrainGen_LayoutStage::RoomMovement:
+		StartRoomMovement();
+		break;
+	case ETerrainGen_LayoutStage::Corridors:
+		StartCorridorsLayoutGeneration();
+		break;
+	case ETerrainGen_LayoutStage::Walls:
+		StartWallsLayoutGeneration();
+		break;
+	case ETerrainGen_LayoutStage::Depth:
+		OnLayoutGenerationEnd();
+		break;
+	default:
+		break;
+	}
+
+	UpdateLayoutCountStats();
+	LastStageToRun = ETerrainGen_LayoutStage::ETLS_MAX;
+	GenerationCancellationToken.Reset();
+}
+
+bool UTerrainLayoutSubsystem::RegenerateTerrainLayoutFromStage(UTerrainData* InTerrainData, ETerrainGen_LayoutStage StageIn)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(UTerrainLayoutSubsystem::RegenerateTerrainLayoutFromStage);
+	LLM_SCOPE_BYTAG(TerrainGenerator_Layout);
+
+	const int32 StageIndex = StaticCast<int32>(StageIn);
+	if (!StageSnapshots.IsValidIndex(StageIndex) || !StageSnapshots[StageIndex].bIsValid)
+	{
+		return false;
+	}
 
-FIntPoint UTerrainLayoutSubsystem::GetInitialRoom() const
+	bGenerateSynchronously = false;
+	CancelLayoutGeneration();
+
+	//Same as StartLayoutGeneration, the snapshots do not change until then.
+	if (bIsStageBatchRunning)
+	{
+		const TWeakObjectPtr<UTerrainData> WeakTerrainData = InTerrainData;
+		PendingGenerationStart = [this, WeakTerrainData, StageIn]()
+		{
+			RegenerateTerrainLayoutFromStage(WeakTerrainData.Get(), StageIn);
+		};
+		return true;
+	}
+
+	if (!RestoreLayoutSnapshot(InTerrainData, StageSnapshots[StageIndex]))
+	{
+		return false;
+	}
+
+	//The snapshots of the next stages have the layout from before the changes.
+	for (int32 i = StageIndex + 1; i < StageSnapshots.Num(); i++)
+	{
+		StageSnapshots[i].bIsValid = false;
+	}
+
+	LayoutStats.Reset(GetStream().GetInitialSeed());
+	LastStageToRun = ETerrainGen_LayoutStage::ETLS_MAX;
+	GenerationStartTime = FPlatformTime::Seconds();
+	StartNewGenerationToken();
+
+	OnLayoutRestored.Broadcast();
+
+	switch (StageIn)
+	{
+	case ETerrainGen_LayoutStage::InitialLayout:
+		BeginStage(ETerrainGen_LayoutStage::InitialLayout);
+		GenerateInitialRoomsLayout();
+		EndStage(ETerrainGen_LayoutStage::InitialLayout);
+
+		if (!IsGenerationCancelled())
+		{
+			StartRoomLayoutGeneration();
+		}
+		break;
+	case ETerrainGen_LayoutStage::RoomLayout:
+		StartRoomLayoutGeneration();
+		break;
+	case ETerrainGen_LayoutStage::RoomMovement:
+		StartRoomMovement();
+		break;
+	case ETerrainGen_LayoutStage::Corridors:
+		StartCorridorsLayoutGeneration();
+		break;
+	case ETerrainGen_LayoutStage::Walls:
+		StartWallsLayoutGeneration();
+		break;
+	case ETerrainGen_LayoutStage::Depth:
+		OnLayoutGenerationEnd();
+		break;
+	default:
+		break;
+	}
+
+	return true;
+}
+
+void UTerrainLayoutSubsystem::StartStageThreads(const TArray<FBaseTerrainWorker*>& Workers, FLayoutStageEndFunction OnStageEnd, const FName& OnStageEndName)
 {
-	return InitialRoom;
+	TRACE_CPUPROFILER_EVENT_SCOPE(UTerrainLayoutSubsystem::StartStageThreads);
+	LLM_SCOPE_BYTAG(TerrainGenerator_Layout);
+
+	if (!bGenerateSynchronously)
+	{
+		FScriptDelegate OnStageEndDelegate;
+		OnStageEndDelegate.BindUFunction(this, OnStageEndName);
+
+		GetTerrainThreadSubsystem()->OnThreadOperationEnd.RemoveAll(this);
+		GetTerrainThreadSubsystem()->OnThreadOperationEnd.Add(OnStageEndDelegate);
+		bIsStageBatchRunning = true;
+		bStageRanThreadWorkers = true;
+		GetTerrainThreadSubsystem()->StartThreads(this, GetStream(), Workers);
+		return;
+	}
+
+	//Same setup the thread subsystem does, but the workers are run here and the results merged in order.
+	for (FBaseTerrainWorker* Worker : Workers)
+	{
+		Worker->ThreadOwner = this;
+		Worker->Stream.Initialize(GetStream().RandHelper(MAX_int32));
+	}
+
+	TArray<FTerrainLayoutTaskTime> WorkersTimes;
+	WorkersTimes.SetNum(Workers.Num());
+
+	ParallelFor(Workers.Num(), [&Workers, &WorkersTimes](int32 Index)
+	{
+		LLM_SCOPE_BYTAG(TerrainGenerator_LayoutWorkers);
+		WorkersTimes[Index].Begin();
+		Workers[Index]->Run();
+		WorkersTimes[Index].End();
+	});
+
+	for (const FTerrainLayoutTaskTime& WorkerTime : WorkersTimes)
+	{
+		AddStageWorkerBusyTime(CurrentStage, WorkerTime.Seconds, WorkerTime.StartTime, WorkerTime.ThreadId);
+	}
+
+	for (FBaseTerrainWorker* Worker : Workers)
+	{
+		Worker->OnThreadEnd();
+		delete Worker;
+	}
+
+	//The workers poll the memory budget and cancel the generation when it is exceeded, it is reported here.
+	CheckMemoryBudget();
+
+	//Cancelled through the parent token, the stage end that would drop the region tasks is not called.
+	if (IsGenerationCancelled())
+	{
+		CancelRegionTasks();
+		return;
+	}
+
+	(this->*OnStageEnd)();
 }
 
-TMap<FIntPoint, FRoomLayout> UTerrainLayoutSubsystem::GetRoomsLayoutMap() const
+void UTerrainLayoutSubsystem::UnbindStageEnd()
 {
-	return RoomsLayoutMap;
+	//Synchronous generations never bind it. They may run on any thread, or on instances without a thread subsystem.
+	if (!bGenerateSynchronously && GetTerrainThreadSubsystem())
+	{
+		GetTerrainThreadSubsystem()->OnThreadOperationEnd.RemoveAll(this);
+	}
 }
 
-TMap<FIntPoint, FCellLayout> UTerrainLayoutSubsystem::GetCellsLayoutMap() const
+bool UTerrainLayoutSubsystem::IsLastStageToRun(ETerrainGen_LayoutStage StageIn) const
 {
-	return CellsLayoutMap;
+	return LastStageToRun == StageIn;
 }
 
-FVector UTerrainLayoutSubsystem::GetCellWorldPosition(const FIntPoint& InCellsID, const FVector2D InAnchor) const
+bool UTerrainLayoutSubsystem::ShouldStopAtState(ETerrainGen_State StateIn) const
 {
-	if (!TerrainLayoutData)
+#if WITH_EDITOR
+	if (!bGenerateSynchronously && IsDebug())
 	{
-		return FVector::ZeroVector;
+		return GetState() == StateIn;
 	}
+#endif
 
-	FVector Position = FVector::ZeroVector;
+	return false;
+}
 
-	//Axis must be reversed for this to work(See landscape placement logic)
-	Position.X = InCellsID.Y * TerrainData->CellSize + TerrainData->CellSize * InAnchor.Y; //Show the location based on anchor
-	Position.Y = InCellsID.X * TerrainData->CellSize + TerrainData->CellSize * InAnchor.X;
+void UTerrainLayoutSubsystem::BeginStage(ETerrainGen_LayoutStage StageIn)
+{
+	LLM_SCOPE_BYTAG(TerrainGenerator_Layout);
 
-	Position.Z = 0;
+	if (bCaptureStageSnapshots)
+	{
+		StageSnapshots.SetNum(StaticCast<int32>(ETerrainGen_LayoutStage::ETLS_MAX));
+
+		FTerrainLayoutSnapshot& Snapshot = StageSnapshots[StaticCast<int32>(StageIn)];
+		Snapshot.bIsValid = true;
+		Snapshot.Stream = GetStream();
+		Snapshot.InitialRoom = InitialRoom;
+		Snapshot.RoomsLayoutMap = RoomsLayoutMap;
+		Snapshot.CellsLayoutMap = CellsLayoutMap;
+		Snapshot.RoomConnections = RoomConnections;
+	}
 
-	return Position;
+	CurrentStage = StageIn;
+	StageStartTime = FPlatformTime::Seconds();
+	LayoutStats.GetStage(StageIn).StartSeconds = StageStartTime - GenerationStartTime;
+	StageStartCellsAmount = GetLayoutCellsAmount();
+	bStageRanThreadWorkers = false;
+	StageWorkerCopiesBytes = 0;
+	StageChangedCells.Reset();
+	UpdatePeakLayoutMemory();
+
+	if (GenerationCancellationToken.IsValid())
+	{
+		GenerationCancellationToken->ResetWorkerBytes();
+	}
 }
 
-float UTerrainLayoutSubsystem::GetWorldDistanceBetweenRooms(const FIntPoint& RoomA, const FIntPoint& RoomB) const
-{	
-	if(!RoomsLayoutMap.Contains(RoomA) || !RoomsLayoutMap.Contains(RoomB))
+void UTerrainLayoutSubsystem::EndStage(ETerrainGen_LayoutStage StageIn)
+{
+	const double Now = FPlatformTime::Seconds();
+	FTerrainLayoutStageStats& StageStats = LayoutStats.GetStage(StageIn);
+	StageStats.WallSeconds = Now - StageStartTime;
+	StageStats.CellsProduced = GetLayoutCellsAmount() - StageStartCellsAmount;
+	LayoutStats.TotalSeconds = Now - GenerationStartTime;
+
+	//Workers that don't report their times leave the stage marked, the stages run only here are a single worker on this thread.
+	if (StageStats.WorkerBusySeconds.Num() == 0)
 	{
-		return 0;
+		if (bStageRanThreadWorkers)
+		{
+			StageStats.bWorkerTimesMissing = true;
+		}
+		else
+		{
+			AddStageWorkerBusyTime(StageIn, StageStats.WallSeconds, StageStartTime, FPlatformTLS::GetCurrentThreadId());
+		}
 	}
 
-	const FVector RoomACenter = GetCellWorldPosition(RoomsLayoutMap[RoomA].CentralCell,{ .5,.5 });
-	const FVector RoomBCenter = GetCellWorldPosition(RoomsLayoutMap[RoomB].CentralCell, { .5,.5 });
-	return FVector::Dist2D(RoomACenter, RoomBCenter);
+	CheckMemoryBudget();
+
+	TRACE_COUNTER_SET(TerrainLayoutCells, CellsLayoutMap.Num());
+	TRACE_COUNTER_SET(TerrainLayoutRooms, RoomsLayoutMap.Num());
+	TRACE_COUNTER_SET(TerrainLayoutCorridors, LayoutStats.CorridorsAmount);
+	TRACE_COUNTER_SET(TerrainLayoutFailedPaths, LayoutStats.FailedPathsAmount);
+	TRACE_COUNTER_SET(TerrainLayoutPathNodesExpanded, LayoutStats.PathNodesExpanded);
+	TRACE_COUNTER_SET(TerrainLayoutPeakBytes, LayoutStats.PeakLayoutBytes);
 }
 
-void UTerrainLayoutSubsystem::GenerateTerrainLayout(UTerrainData* InTerrainData)
+void UTerrainLayoutSubsystem::AddStageWorkerBusyTime(ETerrainGen_LayoutStage StageIn, double SecondsIn, double StartTimeIn, uint32 ThreadIdIn)
 {
-	if (!InTerrainData)
+	FTerrainLayoutStageStats& StageStats = LayoutStats.GetStage(StageIn);
+	StageStats.WorkerBusySeconds.Add(SecondsIn);
+	StageStats.WorkerStartSeconds.Add(StartTimeIn - GenerationStartTime);
+	StageStats.WorkerThreadIds.Add(StaticCast<int32>(ThreadIdIn));
+	StageStats.CpuSeconds += SecondsIn;
+}
+
+int32 UTerrainLayoutSubsystem::GetLayoutCellsAmount() const
+{
+	int32 CellsAmount = CellsLayoutMap.Num();
+	for (const TPair<FIntPoint, FRoomLayout>& pair : RoomsLayoutMap)
 	{
-		UE_LOG(TerrainGeneratorLog, Error, TEXT("UTerrainLayoutSubsystem::GenerateTerrainLayout - Invalid terrain data."));
-		return;
+		CellsAmount += pair.Value.Cells.Num();
 	}
 
-	if (!InTerrainData->TerrainLayoutData)
+	return CellsAmount;
+}
+
+const TArray<FIntPoint>& UTerrainLayoutSubsystem::GetStageChangedCells() const
+{
+	return StageChangedCells;
+}
+
+int64 UTerrainLayoutSubsystem::GetLayoutAllocatedSize() const
+{
+	int64 LayoutBytes = RoomsLayoutMap.GetAllocatedSize() + CellsLayoutMap.GetAllocatedSize();
+	for (const TPair<FIntPoint, FRoomLayout>& pair : RoomsLayoutMap)
 	{
-		UE_LOG(TerrainGeneratorLog, Error, TEXT("UTerrainLayoutSubsystem::GenerateTerrainLayout - Invalid layout data."));
-		return;
+		LayoutBytes += pair.Value.Cells.GetAllocatedSize();
 	}
 
-	TerrainData = InTerrainData;
-	TerrainLayoutData = InTerrainData->TerrainLayoutData;
+	return LayoutBytes;
+}
 
-	CellsLayoutMap.Empty();
-	RoomsLayoutMap.Empty();
+int64 UTerrainLayoutSubsystem::GetStageAllocatedSize() const
+{
+	int64 StageBytes = StageWorkerCopiesBytes + RoomConnections.GetAllocatedSize() + RoomsDungeonDepth.GetAllocatedSize() + CellsLayoutDepth.GetAllocatedSize();
+	StageBytes += StageChangedCells.GetAllocatedSize();
 
-	GenerateInitialRoomsLayout();
-	StartRoomLayoutGeneration();
+	StageBytes += PendingCorridorLayouts.GetAllocatedSize();
+	for (const FCorridorLayout& Layout : PendingCorridorLayouts)
+	{
+		StageBytes += Layout.Cells.GetAllocatedSize();
+	}
+
+	return StageBytes;
+}
+
+void UTerrainLayoutSubsystem::UpdatePeakLayoutMemory()
+{
+	const int64 LayoutBytes = GetLayoutAllocatedSize();
+	LayoutStats.PeakLayoutBytes = FMath::Max(LayoutStats.PeakLayoutBytes, LayoutBytes);
+	LayoutStats.PeakCellsLayoutSize = FMath::Max(LayoutStats.PeakCellsLayoutSize, CellsLayoutMap.Num());
+
+	FTerrainLayoutStageStats& StageStats = LayoutStats.GetStage(CurrentStage);
+	StageStats.PeakBytes = FMath::Max(StageStats.PeakBytes, LayoutBytes + GetStageAllocatedSize());
+}
+
+bool UTerrainLayoutSubsystem::CheckMemoryBudget()
+{
+	UpdatePeakLayoutMemory();
+
+	//Cancelled by a worker that polled the budget, it is reported once, the report drops the token.
+	if (GenerationCancellationToken.IsValid() && GenerationCancellationToken->IsMemoryBudgetExceeded())
+	{
+		ReportMemoryBudgetExceeded(GenerationCancellationToken->GetMemoryBudgetExceededBytes());
+		return false;
+	}
+
+	if (!TerrainLayoutData || TerrainLayoutData->GenerationMemoryBudgetMB <= 0 || IsGenerationCancelled())
+	{
+		return true;
+	}
+
+	const int64 BudgetBytes = StaticCast<int64>(TerrainLayoutData->GenerationMemoryBudgetMB * 1024.0 * 1024.0);
+	int64 StageBytes = LayoutStats.GetStage(CurrentStage).PeakBytes;
+	if (TerrainGeneratorMemory::IsTracked())
+	{
+		StageBytes = FMath::Max(StageBytes, TerrainGeneratorMemory::GetLayoutTrackedBytes());
+	}
+
+	if (StageBytes > BudgetBytes)
+	{
+		ReportMemoryBudgetExceeded(StageBytes);
+		return false;
+	}
+
+	//Polled by the workers until the next check, from the memory measured now.
+	GenerationCancellationToken->SetMemoryBudget(BudgetBytes, GetLayoutAllocatedSize() + GetStageAllocatedSize());
+	return true;
+}
+
+void UTerrainLayoutSubsystem::ReportMemoryBudgetExceeded(int64 StageBytesIn)
+{
+	LayoutStats.bMemoryBudgetExceeded = true;
+	LayoutStats.MemoryBudgetExceededStage = CurrentStage;
+	LayoutStats.TotalSeconds = FPlatformTime::Seconds() - GenerationStartTime;
+
+	const UEnum* StageEnum = StaticEnum<ETerrainGen_LayoutStage>();
+	UE_LOG(TerrainGeneratorLog, Error, TEXT("UTerrainLayoutSubsystem::ReportMemoryBudgetExceeded - %s: %.1f MB used in the %s stage, over the GenerationMemoryBudgetMB of %.1f MB. The generation is cancelled. %i rooms, %i layout cells."),
+		*TerrainLayoutData->GetName(),
+		StageBytesIn / (1024.0 * 1024.0),
+		*StageEnum->GetNameStringByValue(StaticCast<int64>(CurrentStage)),
+		TerrainLayoutData->GenerationMemoryBudgetMB,
+		RoomsLayoutMap.Num(),
+		CellsLayoutMap.Num());
+
+	for (const FTerrainLayoutStageStats& StageStats : LayoutStats.Stages)
+	{
+		if (StageStats.PeakBytes > 0)
+		{
+			UE_LOG(TerrainGeneratorLog, Error, TEXT("UTerrainLayoutSubsystem::ReportMemoryBudgetExceeded - %s stage: Peak %.1f MB, %i cells produced."),
+				*StageEnum->GetNameStringByValue(StaticCast<int64>(StageStats.Stage)),
+				StageStats.PeakBytes / (1024.0 * 1024.0),
+				StageStats.CellsProduced);
+		}
+	}
+
+	//The workers check the token in their loops, so they stop without finishing the stage.
+	CancelLayoutGeneration();
+	OnLayoutGenerationFailed.Broadcast(LayoutStats);
+}
+
+void UTerrainLayoutSubsystem::UpdateLayoutCountStats()
+{
+	LayoutStats.RoomsAmount = RoomsLayoutMap.Num();
+	LayoutStats.CellsAmount = CellsLayoutMap.Num();
+	LayoutStats.WallCellsAmount = 0;
+
+	for (const TPair<FIntPoint, FCellLayout>& pair : CellsLayoutMap)
+	{
+		if (pair.Value.Tags.HasTag(TAG_TERRAIN_CELL_TYPE_WALL))
+		{
+			LayoutStats.WallCellsAmount++;
+		}
+	}
 }
 
 void UTerrainLayoutSubsystem::GenerateInitialRoomsLayout()
-{	
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(UTerrainLayoutSubsystem::GenerateInitialRoomsLayout);
+	LLM_SCOPE_BYTAG(TerrainGenerator_Layout);
+
 	FIntPoint InitialCell = FIntPoint();
 	TArray <FIntPoint> InitialLayout = TerrainLayoutData->InitialRoomsLayout->GenerateLayout(InitialCell, GetStream());
 
@@ -95,14 +1283,16 @@ void UTerrainLayoutSubsystem::GenerateInitialRoomsLayout()
 
 void UTerrainLayoutSubsystem::StartRoomLayoutGeneration()
 {
+	TRACE_CPUPROFILER_EVENT_SCOPE(UTerrainLayoutSubsystem::StartRoomLayoutGeneration);
+	LLM_SCOPE_BYTAG(TerrainGenerator_Layout);
+
 	if (TerrainLayoutData->RoomLayouts.Num() <= 0)
 	{
 		UE_LOG(TerrainGeneratorLog, Error, TEXT("UTerrainLayoutSubsystem::StartRoomLayoutGeneration - No room layouts used. Cannot generate rooms."));
 		return;
 	}
-		
-	GetTerrainThreadSubsystem()->OnThreadOperationEnd.RemoveAll(this);
-	GetTerrainThreadSubsystem()->OnThreadOperationEnd.AddDynamic(this, &UTerrainLayoutSubsystem::OnRoomLayoutEnd);
+
+	BeginStage(ETerrainGen_LayoutStage::RoomLayout);
 
 	//This is the amount of rooms per thread. The Idea is to not mass too many threads. The threads handle a few corridors ideally
 	const int32 Threads = FMath::Clamp(TerrainData->MaximunThreads, 1, TerrainData->MaximunThreads);
@@ -130,45 +1320,56 @@ void UTerrainLayoutSubsystem::StartRoomLayoutGeneration()
 		i++;
 	}
 
-	GetTerrainThreadSubsystem()->StartThreads(this, GetStream(), CurrentActiveThreads);
+	StartStageThreads(CurrentActiveThreads, &UTerrainLayoutSubsystem::OnRoomLayoutEnd, GET_FUNCTION_NAME_CHECKED(UTerrainLayoutSubsystem, OnRoomLayoutEnd));
 }
 
 void UTerrainLayoutSubsystem::OnRoomLayoutEnd()
 {
-	GetTerrainThreadSubsystem()->OnThreadOperationEnd.RemoveAll(this);
+	TRACE_CPUPROFILER_EVENT_SCOPE(UTerrainLayoutSubsystem::OnRoomLayoutEnd);
+	LLM_SCOPE_BYTAG(TerrainGenerator_Layout);
+
+	OnStageBatchEnd();
+	if (IsGenerationCancelled())
+	{
+		return;
+	}
+
+	EndStage(ETerrainGen_LayoutStage::RoomLayout);
+
+	if (IsGenerationCancelled() || IsLastStageToRun(ETerrainGen_LayoutStage::RoomLayout))
+	{
+		return;
+	}
 	
 #if WITH_EDITOR	
-	if (IsDebug())
-	{	
-		if (GetState() == ETerrainGen_State::InitialLayout)
-		{		
-			for (const TPair<FIntPoint, FRoomLayout>& pair : RoomsLayoutMap)
-			{				
-				for (const FIntPoint& cellID : pair.Value.Cells)
-				{
-					FCellLayout CellLayout = FCellLayout();
-					CellLayout.RoomID = pair.Key;
-					CellLayout.CellID = cellID;
+	if (ShouldStopAtState(ETerrainGen_State::InitialLayout))
+	{
+		for (const TPair<FIntPoint, FRoomLayout>& pair : RoomsLayoutMap)
+		{				
+			for (const FIntPoint& cellID : pair.Value.Cells)
+			{
+				FCellLayout CellLayout = FCellLayout();
+				CellLayout.RoomID = pair.Key;
+				CellLayout.CellID = cellID;
 
-					CellLayout.Tags.AddTag(TAG_TERRAIN_CELL_TYPE_ROOM);
+				CellLayout.Tags.AddTag(TAG_TERRAIN_CELL_TYPE_ROOM);
 
-					if (RoomsLayoutMap[pair.Key].InitialCell == cellID)
-					{
-						CellLayout.Tags.AddTag(TAG_TERRAIN_CELL_LAYOUT_INITIAL);
-					}
+				if (RoomsLayoutMap[pair.Key].InitialCell == cellID)
+				{
+					CellLayout.Tags.AddTag(TAG_TERRAIN_CELL_LAYOUT_INITIAL);
+				}
 
-					if (RoomsLayoutMap[pair.Key].CentralCell == cellID)
-					{
-						CellLayout.Tags.AddTag(TAG_TERRAIN_CELL_LAYOUT_CENTRAL);
-					}					
+				if (RoomsLayoutMap[pair.Key].CentralCell == cellID)
+				{
+					CellLayout.Tags.AddTag(TAG_TERRAIN_CELL_LAYOUT_CENTRAL);
+				}					
 
-					CellsLayoutMap.Add(cellID, CellLayout);
-				}
+				CellsLayoutMap.Add(cellID, CellLayout);
 			}
-			OnInitialLayoutGenerated.Broadcast();
+		}
+		OnInitialLayoutGenerated.Broadcast();
 
-			return;
-		}	
+		return;
 	}
 #endif
 
@@ -177,8 +1378,10 @@ void UTerrainLayoutSubsystem::OnRoomLayoutEnd()
 
 void UTerrainLayoutSubsystem::StartRoomMovement()
 {
-	GetTerrainThreadSubsystem()->OnThreadOperationEnd.RemoveAll(this);
-	GetTerrainThreadSubsystem()->OnThreadOperationEnd.AddDynamic(this, &UTerrainLayoutSubsystem::OnRoomMovementEnd);
+	TRACE_CPUPROFILER_EVENT_SCOPE(UTerrainLayoutSubsystem::StartRoomMovement);
+	LLM_SCOPE_BYTAG(TerrainGenerator_Layout);
+
+	BeginStage(ETerrainGen_LayoutStage::RoomMovement);
 
 	TArray<FIntPoint> CentralCells = TArray<FIntPoint>();
 	TArray<FIntPointPair> RoomCentralCellsPairs = GetRoomsCentralCells(CentralCells);
@@ -190,7 +1393,7 @@ void UTerrainLayoutSubsystem::StartRoomMovement()
 	{
 		const int32 ADistance = UTerrainLayoutFunctionLibrary::GetCellDistanceBetweenCells(InitialRoomCell, A.PointB);
 		const int32 BDistance = UTerrainLayoutFunctionLibrary::GetCellDistanceBetweenCells(InitialRoomCell, B.PointB);
-		return ADistance <= BDistance;
+		return ADistance < BDistance;
 	});
 		
 	InitialRoom = RoomCentralCellsPairs[0].PointA;
@@ -242,7 +1445,7 @@ void UTerrainLayoutSubsystem::StartRoomMovement()
 		ActiveThreads.Add(Worker);	
 	}
 	
-	GetTerrainThreadSubsystem()->StartThreads(this, GetStream(), ActiveThreads);
+	StartStageThreads(ActiveThreads, &UTerrainLayoutSubsystem::OnRoomMovementEnd, GET_FUNCTION_NAME_CHECKED(UTerrainLayoutSubsystem, OnRoomMovementEnd));
 }
 
 TArray<FIntPointPair> UTerrainLayoutSubsystem::GetRoomsCentralCells(TArray<FIntPoint>& CentralCellsOut) const
@@ -285,29 +1488,49 @@ TArray<FIntPoint> UTerrainLayoutSubsystem::GetRoomInitialCollisionCells(FIntPoin
 
 void UTerrainLayoutSubsystem::OnRoomMovementEnd()
 {
-	GetTerrainThreadSubsystem()->OnThreadOperationEnd.RemoveAll(this);
+	TRACE_CPUPROFILER_EVENT_SCOPE(UTerrainLayoutSubsystem::OnRoomMovementEnd);
+	LLM_SCOPE_BYTAG(TerrainGenerator_Layout);
+
+	OnStageBatchEnd();
+	if (IsGenerationCancelled())
+	{
+		return;
+	}
+
+	EndStage(ETerrainGen_LayoutStage::RoomMovement);
+	if (IsGenerationCancelled())
+	{
+		return;
+	}
+
 	OnInitialLayoutMovementCompleted.Broadcast();
 
-#if WITH_EDITOR		
-	if (IsDebug())
+	if (ShouldStopAtState(ETerrainGen_State::InitialLayoutMovement) || IsLastStageToRun(ETerrainGen_LayoutStage::RoomMovement))
 	{
-		if (GetState() == ETerrainGen_State::InitialLayoutMovement)
-		{
-			return;
-		}
+		return;
 	}
-#endif
 
 	StartCorridorsLayoutGeneration();
 }
 
 void UTerrainLayoutSubsystem::StartCorridorsLayoutGeneration()
 {
-	GetTerrainThreadSubsystem()->OnThreadOperationEnd.RemoveAll(this);
-	GetTerrainThreadSubsystem()->OnThreadOperationEnd.AddDynamic(this, &UTerrainLayoutSubsystem::OnCorridorLayoutEnd);
+	TRACE_CPUPROFILER_EVENT_SCOPE(UTerrainLayoutSubsystem::StartCorridorsLayoutGeneration);
+	LLM_SCOPE_BYTAG(TerrainGenerator_Layout);
+
+	BeginStage(ETerrainGen_LayoutStage::Corridors);
+	PendingCorridorLayouts.Empty();
+	RoomConnections.Empty();
+	CorridorSearchHeatmap.Empty();
 
 	TArray<FTerrain_RoomDistance> InitialCorridorsLayoutData = GenerateInitialCorridorsLayoutData();
 
+	TSet<FIntPoint> FlowFieldRooms;
+	if (TerrainLayoutData->bUseCorridorFlowFields)
+	{
+		GroupFlowFieldCorridors(InitialCorridorsLayoutData, FlowFieldRooms);
+	}
+
 	//This is the amount of corridors per thread. The Idea is to not mass too many threads. The threads handle a few corridors ideally
 	const int32 Threads = FMath::Clamp(TerrainData->MaximunThreads, 1, TerrainData->MaximunThreads);
 	const int32 TotalPerThread = InitialCorridorsLayoutData.Num() / (Threads - 1);
@@ -315,25 +1538,83 @@ void UTerrainLayoutSubsystem::StartCorridorsLayoutGeneration()
 	TArray <FBaseTerrainWorker*> CorridorLayoutActiveThreads;
 	TArray<FTerrain_RoomDistance> CurrentLayouts = TArray<FTerrain_RoomDistance>();
 
+	//The corridor workers only read the layout, so a single copy is shared by all of them instead of one copy per worker.
+	const TSharedRef<const TMap<FIntPoint, FRoomLayout>> SharedRoomsLayoutMap = MakeShared<const TMap<FIntPoint, FRoomLayout>>(RoomsLayoutMap);
+	const TSharedRef<const FTerrainLayoutCellsMap> SharedCellsLayoutMap = MakeShared<const FTerrainLayoutCellsMap>(CellsLayoutMap);
+
+	StageWorkerCopiesBytes = GetLayoutAllocatedSize();
+
+	//The walls of each region start as soon as the corridors that can reach it end, so the region tasks exist before the corridors run.
+	if (!IsLastStageToRun(ETerrainGen_LayoutStage::Corridors) && !ShouldStopAtState(ETerrainGen_State::CorridorsLayout))
+	{
+		CreateRegionTasks(InitialCorridorsLayoutData, FlowFieldRooms);
+	}
+
+	if (!CheckMemoryBudget())
+	{
+		return;
+	}
+
+	if (!bGenerateSynchronously && TerrainLayoutData->bStreamLayoutResults)
+	{
+		StartStreamMerge();
+	}
+
+	//A cached path has no search behind it, so the heatmap would miss its expansions.
+	FTerrainLayoutPathCachePtr PathCache;
+	if (TerrainLayoutData->bCacheCorridorPaths && !bCollectSearchHeatmap)
+	{
+		if (!CorridorPathCache.IsValid())
+		{
+			CorridorPathCache = MakeShared<FTerrainLayoutPathCache, ESPMode::ThreadSafe>();
+		}
+
+		//Besides the occupancy, the searches only change with the cell size.
+		CorridorPathCache->SetSearchSettings(GetTypeHash(TerrainData->CellSize));
+		CorridorPathCache->SetMaxBytes(StaticCast<int64>(TerrainLayoutData->CorridorPathCacheMB * 1024 * 1024));
+		PathCache = CorridorPathCache;
+	}
+
 	for (int32 i = 0; i < InitialCorridorsLayoutData.Num(); i++)
 	{
 		CurrentLayouts.Add(InitialCorridorsLayoutData[i]);
 
-		if (CurrentLayouts.Num() >= TotalPerThread || i == InitialCorridorsLayoutData.Num() - 1)
+		//The corridors of a flow field room stay in the same worker, so they share its flow fields.
+		const bool bSplitsFlowFieldRoom = i < InitialCorridorsLayoutData.Num() - 1
+			&& FlowFieldRooms.Contains(InitialCorridorsLayoutData[i].RoomA)
+			&& InitialCorridorsLayoutData[i + 1].RoomA == InitialCorridorsLayoutData[i].RoomA;
+
+		if ((CurrentLayouts.Num() >= TotalPerThread && !bSplitsFlowFieldRoom) || i == InitialCorridorsLayoutData.Num() - 1)
 		{
 			FCorridorLayoutWorker* Worker = new FCorridorLayoutWorker(
 				TerrainData->CellSize,
 				CurrentLayouts,
 				TerrainLayoutData, 			
-				RoomsLayoutMap,
-				CellsLayoutMap);
+				SharedRoomsLayoutMap,
+				SharedCellsLayoutMap,
+				GenerationCancellationToken,
+				StreamQueue);
+
+			Worker->FlowFieldRooms = FlowFieldRooms;
+			Worker->PathCache = PathCache;
+			Worker->bCollectSearchHeatmap = bCollectSearchHeatmap;
+
+			if (RegionTasks.IsValid())
+			{
+				const TSharedRef<FTerrainLayoutRegionTasks, ESPMode::ThreadSafe> Tasks = RegionTasks.ToSharedRef();
+				Worker->FirstCorridorIndex = i + 1 - CurrentLayouts.Num();
+				Worker->OnCorridorEnd = [Tasks](int32 CorridorIndexIn, const FCorridorLayout* LayoutIn)
+				{
+					Tasks->OnCorridorEnd(CorridorIndexIn, LayoutIn);
+				};
+			}
 
 			CorridorLayoutActiveThreads.Add(Worker);	
 			CurrentLayouts.Empty();
 		}
 	}	
 
-	GetTerrainThreadSubsystem()->StartThreads(this, GetStream(), CorridorLayoutActiveThreads);
+	StartStageThreads(CorridorLayoutActiveThreads, &UTerrainLayoutSubsystem::OnCorridorLayoutEnd, GET_FUNCTION_NAME_CHECKED(UTerrainLayoutSubsystem, OnCorridorLayoutEnd));
 }
 
 TArray<FTerrain_RoomDistance> UTerrainLayoutSubsystem::GenerateInitialCorridorsLayoutData()
@@ -342,6 +1623,9 @@ TArray<FTerrain_RoomDistance> UTerrainLayoutSubsystem::GenerateInitialCorridorsL
 	TArray<FIntPoint> ConnectedRooms = TArray<FIntPoint>();
 	ConnectedRooms.Add(InitialRoom);
 
+	//The connections of each room in the tree, including rooms next to each other that do not need a corridor.
+	TMap<FIntPoint, TArray<FTerrain_RoomDistance>> SpanningTree;
+
 	int32 WhileCounter = 0;
 	TArray<FTerrain_RoomDistance> AllDistances = GetAllRoomDistanceData();	
 	while (ConnectedRooms.Num() < RoomsLayoutMap.Num())
@@ -374,7 +1658,14 @@ TArray<FTerrain_RoomDistance> UTerrainLayoutSubsystem::GenerateInitialCorridorsL
 			}
 
 			if (bUsedDistance)
-			{			
+			{
+				if (distance.Distance <= 0)
+				{
+					AddRoomConnection(distance.RoomA, distance.RoomB);
+				}
+
+				SpanningTree.FindOrAdd(distance.RoomA).Add(distance);
+				SpanningTree.FindOrAdd(distance.RoomB).Add(distance);
 				break;
 			}
 		}
@@ -388,12 +1679,65 @@ TArray<FTerrain_RoomDistance> UTerrainLayoutSubsystem::GenerateInitialCorridorsL
 		
 	if (TerrainLayoutData->CircularCorridorsAmountPercent > 0)
 	{
-		AddUnusedCorridors(AllDistances, ThreeCorridorsLayout); //The circular corridors can repeat rooms, i could filter somehow, but is not really worth it
+		AddLoopCorridors(AllDistances, SpanningTree, ThreeCorridorsLayout);
 	}
 
 	return ThreeCorridorsLayout;
 }
 
+void UTerrainLayoutSubsystem::GroupFlowFieldCorridors(TArray<FTerrain_RoomDistance>& CorridorsLayoutDataOut, TSet<FIntPoint>& FlowFieldRoomsOut) const
+{
+	TMap<FIntPoint, int32> RoomCorridorsAmount;
+	for (const FTerrain_RoomDistance& Distance : CorridorsLayoutDataOut)
+	{
+		RoomCorridorsAmount.FindOrAdd(Distance.RoomA)++;
+		RoomCorridorsAmount.FindOrAdd(Distance.RoomB)++;
+	}
+
+	for (const TPair<FIntPoint, int32>& pair : RoomCorridorsAmount)
+	{
+		if (pair.Value >= TerrainLayoutData->FlowFieldMinCorridors)
+		{
+			FlowFieldRoomsOut.Add(pair.Key);
+		}
+	}
+
+	if (FlowFieldRoomsOut.Num() == 0)
+	{
+		return;
+	}
+
+	//The flow field is built from the start room, so a flow field room starts its corridors. The rest keep the order they had.
+	for (FTerrain_RoomDistance& Distance : CorridorsLayoutDataOut)
+	{
+		const bool bIsFlowFieldA = FlowFieldRoomsOut.Contains(Distance.RoomA);
+		const bool bIsFlowFieldB = FlowFieldRoomsOut.Contains(Distance.RoomB);
+
+		if (bIsFlowFieldB && (!bIsFlowFieldA || RoomCorridorsAmount[Distance.RoomB] > RoomCorridorsAmount[Distance.RoomA]))
+		{
+			Swap(Distance.RoomA, Distance.RoomB);
+		}
+	}
+
+	Algo::StableSort(CorridorsLayoutDataOut, [&FlowFieldRoomsOut](const FTerrain_RoomDistance& A, const FTerrain_RoomDistance& B)
+	{
+		const bool bIsFlowFieldA = FlowFieldRoomsOut.Contains(A.RoomA);
+		const bool bIsFlowFieldB = FlowFieldRoomsOut.Contains(B.RoomA);
+
+		if (bIsFlowFieldA != bIsFlowFieldB)
+		{
+			return bIsFlowFieldA;
+		}
+
+		if (!bIsFlowFieldA || A.RoomA == B.RoomA)
+		{
+			return false;
+		}
+
+		return A.RoomA.X < B.RoomA.X || (A.RoomA.X == B.RoomA.X && A.RoomA.Y < B.RoomA.Y);
+	});
+}
+
 TArray<FTerrain_RoomDistance> UTerrainLayoutSubsystem::GetAllRoomDistanceData() const
 {	
 	TArray<FTerrain_RoomDistance> AllDistances = TArray < FTerrain_RoomDistance>();
@@ -402,9 +1746,9 @@ TArray<FTerrain_RoomDistance> UTerrainLayoutSubsystem::GetAllRoomDistanceData()
 		AllDistances.Append(GetRoomDistancesInNearArea(pair.Key));
 	}
 
-	Algo::Sort(AllDistances, [](FTerrain_RoomDistance A, FTerrain_RoomDistance B)
+	Algo::StableSort(AllDistances, [](const FTerrain_RoomDistance& A, const FTerrain_RoomDistance& B)
 		{
-			return A.Distance <= B.Distance;
+			return A.Distance < B.Distance;
 		});
 	
 	return AllDistances;
@@ -434,6 +1778,7 @@ TArray<FTerrain_RoomDistance> UTerrainLayoutSubsystem::GetRoomDistancesInNearAre
 	const float MaxY = StartCell.Y + QuadSize - 1;
 		
 	TArray<FTerrain_RoomDistance> DistancesOut = TArray<FTerrain_RoomDistance>();
+	TArray<FIntPoint> OtherRoomsCentralCells;
 	for (int32 i = MinX; i < MaxX; i++)
 	{
 		for (int32 j = MinY; j < MaxY; j++)
@@ -459,136 +1804,626 @@ TArray<FTerrain_RoomDistance> UTerrainLayoutSubsystem::GetRoomDistancesInNearAre
 
 			if (!DistancesOut.Contains(distance))
 			{
-				distance.Distance = GetWorldDistanceBetweenRooms(distance.RoomA, distance.RoomB);
 				DistancesOut.Add(distance);
+				OtherRoomsCentralCells.Add(RoomsLayoutMap[distance.RoomB].CentralCell);
 			}		
 		}
 	}
+
+	//Same as GetWorldDistanceBetweenRooms, the anchor of both central cells cancels out.
+	TArray<float> Distances;
+	Distances.SetNumUninitialized(OtherRoomsCentralCells.Num());
+	FTerrainLayoutKernels::DistancesToCell(OtherRoomsCentralCells, StartCell, TerrainData->CellSize, Distances);
+
+	for (int32 i = 0; i < DistancesOut.Num(); i++)
+	{
+		DistancesOut[i].Distance = Distances[i];
+	}
 	
 	return DistancesOut;
 }
 
-void UTerrainLayoutSubsystem::AddUnusedCorridors(TArray<FTerrain_RoomDistance>& UnusedCorridorsIn, TArray<FTerrain_RoomDistance>& ThreeCorridorsOut)
+void UTerrainLayoutSubsystem::AddLoopCorridors(const TArray<FTerrain_RoomDistance>& CandidatesIn, const TMap<FIntPoint, TArray<FTerrain_RoomDistance>>& SpanningTreeIn, TArray<FTerrain_RoomDistance>& ThreeCorridorsOut) const
 {
-	if (TerrainLayoutData->CircularCorridorsAmountPercent <= 0)
+	const int32 CorridorsAmount = TerrainLayoutData->CircularCorridorsAmountPercent * RoomsLayoutMap.Num();
+	if (CorridorsAmount <= 0)
 	{
 		return;
 	}
 
-	TArray<FTerrain_RoomDistance> FilteredCorridors = TArray<FTerrain_RoomDistance>();
+	//Unique candidates, grouped by the room the tree search starts from. The distances contain each pair of rooms in both directions.
+	TMap<FIntPoint, TArray<FTerrain_RoomDistance>> CandidatesByRoom;
+	TSet<TPair<FIntPoint, FIntPoint>> UsedPairs;
+	for (const FTerrain_RoomDistance& Candidate : CandidatesIn)
+	{
+		if (Candidate.Distance <= 0) //Rooms next to each other are already connected
+		{
+			continue;
+		}
+
+		if (TerrainLayoutData->MaxCircularCorridorsCellDistance > 0 && (Candidate.Distance / TerrainData->CellSize) >= TerrainLayoutData->MaxCircularCorridorsCellDistance)
+		{
+			continue;
+		}
+
+		const bool bIsAFirst = Candidate.RoomA.X < Candidate.RoomB.X || (Candidate.RoomA.X == Candidate.RoomB.X && Candidate.RoomA.Y < Candidate.RoomB.Y);
+		const TPair<FIntPoint, FIntPoint> Pair = bIsAFirst ? TPair<FIntPoint, FIntPoint>(Candidate.RoomA, Candidate.RoomB) : TPair<FIntPoint, FIntPoint>(Candidate.RoomB, Candidate.RoomA);
+
+		bool bIsAlreadyUsed = false;
+		UsedPairs.Add(Pair, &bIsAlreadyUsed);
+		if (bIsAlreadyUsed)
+		{
+			continue;
+		}
+
+		CandidatesByRoom.FindOrAdd(Pair.Key).Add(Candidate);
+	}
+
+	TArray<FIntPoint> SourceRooms;
+	CandidatesByRoom.GenerateKeyArray(SourceRooms);
+
+	//The gain of a corridor is how much shorter it is than the path between its rooms through the tree.
+	TArray<TArray<float>> Gains;
+	Gains.SetNum(SourceRooms.Num());
+
+	ParallelFor(SourceRooms.Num(), [this, &SourceRooms, &CandidatesByRoom, &SpanningTreeIn, &Gains](int32 Index)
+	{
+		TMap<FIntPoint, float> TreeDistances;
+		GetSpanningTreeDistances(SourceRooms[Index], SpanningTreeIn, TreeDistances);
+
+		const TArray<FTerrain_RoomDistance>& Candidates = CandidatesByRoom.FindChecked(SourceRooms[Index]);
+		Gains[Index].SetNum(Candidates.Num());
+
+		for (int32 i = 0; i < Candidates.Num(); i++)
+		{
+			const FIntPoint& OtherRoom = Candidates[i].RoomA == SourceRooms[Index] ? Candidates[i].RoomB : Candidates[i].RoomA;
+			const float* TreeDistance = TreeDistances.Find(OtherRoom);
+
+			//Not connected by the tree, the corridor joins two parts of the layout.
+			Gains[Index][i] = TreeDistance ? *TreeDistance - Candidates[i].Distance : MAX_flt;
+		}
+	});
 
-	if (TerrainLayoutData->MaxCircularCorridorsCellDistance > 0)
+	TArray<TPair<float, FTerrain_RoomDistance>> ScoredCandidates;
+	for (int32 Index = 0; Index < SourceRooms.Num(); Index++)
 	{
-		for (const FTerrain_RoomDistance& RoomDistance : UnusedCorridorsIn)
+		const TArray<FTerrain_RoomDistance>& Candidates = CandidatesByRoom.FindChecked(SourceRooms[Index]);
+		for (int32 i = 0; i < Candidates.Num(); i++)
 		{
-			if ((RoomDistance.Distance / TerrainData->CellSize) < TerrainLayoutData->MaxCircularCorridorsCellDistance)
+			if (Gains[Index][i] > 0)
 			{
-				FilteredCorridors.Add(RoomDistance);
+				ScoredCandidates.Emplace(Gains[Index][i], Candidates[i]);
 			}
 		}
 	}
-	else 
-	{
-		FilteredCorridors = UnusedCorridorsIn;
-	}
 
-	Algo::Sort(FilteredCorridors, [this] (FTerrain_RoomDistance A, FTerrain_RoomDistance B)
+	Algo::StableSort(ScoredCandidates, [](const TPair<float, FTerrain_RoomDistance>& A, const TPair<float, FTerrain_RoomDistance>& B)
 	{
-		return GetStream().FRand() < .5f;
+		return A.Key > B.Key;
 	});
 
-	const int32 CorridorsAmount = TerrainLayoutData->CircularCorridorsAmountPercent * RoomsLayoutMap.Num();
-	for (int i = 0; i < CorridorsAmount; i++)
+	const int32 LoopsAmount = FMath::Min(CorridorsAmount, ScoredCandidates.Num());
+	for (int32 i = 0; i < LoopsAmount; i++)
+	{
+		ThreeCorridorsOut.Add(ScoredCandidates[i].Value);
+	}
+
+	UE_LOG(TerrainGeneratorLog, Log, TEXT("UTerrainLayoutSubsystem::AddLoopCorridors - %i loop corridors selected from %i candidates."), LoopsAmount, UsedPairs.Num());
+}
+
+void UTerrainLayoutSubsystem::GetSpanningTreeDistances(const FIntPoint& RoomIn, const TMap<FIntPoint, TArray<FTerrain_RoomDistance>>& SpanningTreeIn, TMap<FIntPoint, float>& DistancesOut) const
+{
+	//There is a single path between two rooms of a tree, so the first time a room is reached is its distance.
+	DistancesOut.Add(RoomIn, 0);
+
+	TArray<FIntPoint> PendingRooms;
+	PendingRooms.Add(RoomIn);
+
+	while (PendingRooms.Num() > 0)
 	{
-		const int32 RandomRoll = GetStream().RandRange(0, FilteredCorridors.Num());
-		if (FilteredCorridors.IsValidIndex(RandomRoll))
+		const FIntPoint Room = PendingRooms.Pop();
+		const float RoomDistance = DistancesOut.FindChecked(Room);
+
+		const TArray<FTerrain_RoomDistance>* Connections = SpanningTreeIn.Find(Room);
+		if (!Connections)
 		{
-			ThreeCorridorsOut.Add(FilteredCorridors[RandomRoll]);
+			continue;
+		}
+
+		for (const FTerrain_RoomDistance& Connection : *Connections)
+		{
+			const FIntPoint& OtherRoom = Connection.RoomA == Room ? Connection.RoomB : Connection.RoomA;
+			if (DistancesOut.Contains(OtherRoom))
+			{
+				continue;
+			}
+
+			DistancesOut.Add(OtherRoom, RoomDistance + Connection.Distance);
+			PendingRooms.Add(OtherRoom);
 		}
 	}
 }
 
 void UTerrainLayoutSubsystem::OnCorridorLayoutEnd()
 {
-	GetTerrainThreadSubsystem()->OnThreadOperationEnd.RemoveAll(this);
-	OnCorridorLayoutGenerated.Broadcast();
-	
-#if WITH_EDITOR		
-	if (IsDebug())
+	TRACE_CPUPROFILER_EVENT_SCOPE(UTerrainLayoutSubsystem::OnCorridorLayoutEnd);
+	LLM_SCOPE_BYTAG(TerrainGenerator_Layout);
+
+	OnStageBatchEnd();
+	if (IsGenerationCancelled())
+	{
+		CancelRegionTasks();
+		return;
+	}
+
+	//Whatever was not merged while the stage was running is merged with the results of the non streamed workers.
+	if (StreamQueue.IsValid())
 	{
-		if (GetState() == ETerrainGen_State::CorridorsLayout)
+		FCorridorLayout Layout = FCorridorLayout();
+		while (StreamQueue->Corridors.Dequeue(Layout))
 		{
-			return;
+			PendingCorridorLayouts.Add(MoveTemp(Layout));
 		}
 	}
-#endif
+
+	StopStreamMerge();
+	LayoutStats.PeakPendingCorridorsSize = FMath::Max(LayoutStats.PeakPendingCorridorsSize, PendingCorridorLayouts.Num());
+	MergeCorridorLayoutsSharded(PendingCorridorLayouts);
+	PendingCorridorLayouts.Empty();
+
+	EndStage(ETerrainGen_LayoutStage::Corridors);
+	if (IsGenerationCancelled())
+	{
+		CancelRegionTasks();
+		return;
+	}
+
+	OnCorridorLayoutGenerated.Broadcast();
+	
+	if (ShouldStopAtState(ETerrainGen_State::CorridorsLayout) || IsLastStageToRun(ETerrainGen_LayoutStage::Corridors))
+	{
+		CancelRegionTasks();
+		return;
+	}
 
 	StartWallsLayoutGeneration();	
 }
 
-void UTerrainLayoutSubsystem::StartWallsLayoutGeneration()
+void UTerrainLayoutSubsystem::CreateRegionTasks(const TArray<FTerrain_RoomDistance>& CorridorsIn, const TSet<FIntPoint>& FlowFieldRoomsIn)
 {
-	GetTerrainThreadSubsystem()->OnThreadOperationEnd.RemoveAll(this);
-	GetTerrainThreadSubsystem()->OnThreadOperationEnd.AddDynamic(this, &UTerrainLayoutSubsystem::OnWallsLayoutEnd);
+	TRACE_CPUPROFILER_EVENT_SCOPE(UTerrainLayoutSubsystem::CreateRegionTasks);
+	LLM_SCOPE_BYTAG(TerrainGenerator_Layout);
 
-	const int32 Threads = FMath::Clamp(TerrainData->MaximunThreads, 1, TerrainData->MaximunThreads);
-	const int32 TotalPerThread = CellsLayoutMap.Num() / (Threads - 1);
+	const TSharedRef<FTerrainLayoutRegionTasks, ESPMode::ThreadSafe> Tasks = MakeShared<FTerrainLayoutRegionTasks, ESPMode::ThreadSafe>();
+	Tasks->CancellationToken = MakeShared<FTerrainLayoutCancellationToken, ESPMode::ThreadSafe>(GenerationCancellationToken);
+	Tasks->bIsPipelined = bPipelineLayoutRegions;
+	Tasks->ThreadOwner = this;
+	Tasks->TerrainLayoutData = TerrainLayoutData;
+	Tasks->StartTime = FPlatformTime::Seconds();
 
-	TArray <FBaseTerrainWorker*> ActiveThreads;
-	TMap<FIntPoint, FCellLayout> CurrentLayouts;
+	//Read without drawing from the stream, so the corridor workers get the same seeds with and without the region tasks.
+	Tasks->WallsSeed = GetStream().GetCurrentSeed();
+
+	auto FindOrAddRegion = [&Tasks](const FIntPoint& RegionIn)
+	{
+		if (const int32* ExistingIndex = Tasks->RegionIndices.Find(RegionIn))
+		{
+			return *ExistingIndex;
+		}
+
+		const int32 RegionIndex = Tasks->Regions.Add(RegionIn);
+		Tasks->RegionIndices.Add(RegionIn, RegionIndex);
+		Tasks->RegionsCells.AddDefaulted();
+		Tasks->RegionsPendingCorridors.Add(0);
+		return RegionIndex;
+	};
 
-	int32 Index = -1;
 	for (const TPair<FIntPoint, FCellLayout>& pair : CellsLayoutMap)
 	{
-		Index++;
+		const int32 RegionIndex = FindOrAddRegion(TerrainLayoutRegions::GetRegion(pair.Key));
+		Tasks->RegionsCells[RegionIndex].Add(pair.Key, pair.Value);
+	}
 
-		CurrentLayouts.Add(pair);
+	TMap<FIntPoint, FIntRect> RoomsBounds;
+	for (const TPair<FIntPoint, FRoomLayout>& pair : RoomsLayoutMap)
+	{
+		FIntRect Bounds = FIntRect(FIntPoint(MAX_int32, MAX_int32), FIntPoint(MIN_int32, MIN_int32));
+		for (const FIntPoint& cell : pair.Value.Cells)
+		{
+			Bounds.Min = Bounds.Min.ComponentMin(cell);
+			Bounds.Max = Bounds.Max.ComponentMax(cell);
+		}
 
-		if (CurrentLayouts.Num() >= TotalPerThread || Index == CellsLayoutMap.Num() - 1)
+		if (Bounds.Min.X <= Bounds.Max.X)
 		{
-			FWallLayoutWorker* Worker = new FWallLayoutWorker(	
-				TerrainLayoutData,
-				CurrentLayouts);
+			RoomsBounds.Add(pair.Key, Bounds);
+		}
+	}
 
-			ActiveThreads.Add(Worker);
-			CurrentLayouts.Empty();
+	//A path search closes one cell per iteration, and a flow field path is at most FlowFieldRadius steps from the start door.
+	const int32 SearchPathLength = FCorridorLayoutWorker::DefaultMaxPathIterations;
+	const int32 FlowFieldPathLength = FMath::Max(SearchPathLength, TerrainLayoutData->FlowFieldRadius + 1);
+
+	//Which regions a corridor touches is only known once its path is found, so it is counted in every region its cells can fall in.
+	Tasks->CorridorsRegions.SetNum(CorridorsIn.Num());
+	for (int32 CorridorIndex = 0; CorridorIndex < CorridorsIn.Num(); CorridorIndex++)
+	{
+		const FTerrain_RoomDistance& Corridor = CorridorsIn[CorridorIndex];
+		const FIntRect* BoundsA = RoomsBounds.Find(Corridor.RoomA);
+		const FIntRect* BoundsB = RoomsBounds.Find(Corridor.RoomB);
+		const int32 PathLength = FlowFieldRoomsIn.Contains(Corridor.RoomA) ? FlowFieldPathLength : SearchPathLength;
+
+		FIntRect CorridorBounds;
+		if (!BoundsA || !BoundsB || !TerrainLayoutRegions::GetCorridorBounds(*BoundsA, *BoundsB, PathLength, TerrainLayoutData->CorridorsMaxRange, CorridorBounds))
+		{
+			continue;
+		}
+
+		const FIntPoint MinRegion = TerrainLayoutRegions::GetRegion(CorridorBounds.Min);
+		const FIntPoint MaxRegion = TerrainLayoutRegions::GetRegion(CorridorBounds.Max);
+		for (int32 y = MinRegion.Y; y <= MaxRegion.Y; y++)
+		{
+			for (int32 x = MinRegion.X; x <= MaxRegion.X; x++)
+			{
+				const int32 RegionIndex = FindOrAddRegion(FIntPoint(x, y));
+				Tasks->CorridorsRegions[CorridorIndex].Add(RegionIndex);
+				Tasks->RegionsPendingCorridors[RegionIndex]++;
+			}
+		}
+	}
+
+	const int32 RegionsAmount = Tasks->Regions.Num();
+	Tasks->RegionsCorridorCells.SetNum(RegionsAmount);
+	Tasks->RegionsReleased.SetNumZeroed(RegionsAmount);
+	Tasks->WallWorkers.SetNumZeroed(RegionsAmount);
+	Tasks->RegionsCellsDepth.SetNum(RegionsAmount);
+	Tasks->WallTasksTimes.SetNum(RegionsAmount);
+	Tasks->DepthTasksTimes.SetNum(RegionsAmount);
+	Tasks->RegionsCorridorsEvents.Reserve(RegionsAmount);
+	for (int32 i = 0; i < RegionsAmount; i++)
+	{
+		Tasks->RegionsCorridorsEvents.Emplace(TEXT("TerrainLayoutRegionCorridors"));
+	}
+
+	//Each walls worker gets its own copy of its region cells.
+	StageWorkerCopiesBytes += Tasks->RegionsCells.GetAllocatedSize() + Tasks->CorridorsRegions.GetAllocatedSize();
+	for (const TMap<FIntPoint, FCellLayout>& RegionCells : Tasks->RegionsCells)
+	{
+		StageWorkerCopiesBytes += RegionCells.GetAllocatedSize() * 2;
+	}
+
+	LayoutStats.RegionsAmount = RegionsAmount;
+	LayoutStats.bRegionsPipelined = Tasks->bIsPipelined;
+	RegionTasks = Tasks;
+
+	TArray<UE::Tasks::FTask> WallTasks;
+	WallTasks.Reserve(RegionsAmount);
+	for (int32 i = 0; i < RegionsAmount; i++)
+	{
+		WallTasks.Add(UE::Tasks::Launch(TEXT("TerrainLayoutRegionWalls"), [Tasks, i]()
+		{
+			if (Tasks->CancellationToken->IsCancelled())
+			{
+				return;
+			}
+
+			TRACE_CPUPROFILER_EVENT_SCOPE(TerrainLayoutRegionWalls);
+			LLM_SCOPE_BYTAG(TerrainGenerator_LayoutWorkers);
+			Tasks->WallTasksTimes[i].Begin();
+			Tasks->AddRegionCorridorCells(i);
+
+			if (Tasks->RegionsCells[i].Num() > 0)
+			{
+				//Same setup the thread subsystem does for its workers.
+				FWallLayoutWorker* Worker = new FWallLayoutWorker(
+					Tasks->TerrainLayoutData,
+					Tasks->RegionsCells[i]);
+
+				Worker->ThreadOwner = Tasks->ThreadOwner;
+				Worker->Stream.Initialize(StaticCast<int32>(HashCombine(StaticCast<uint32>(Tasks->WallsSeed), GetTypeHash(Tasks->Regions[i]))));
+				Tasks->WallWorkers[i] = Worker;
+				Worker->Run();
+			}
+
+			Tasks->WallTasksTimes[i].End();
+		}, UE::Tasks::Prerequisites(Tasks->RegionsCorridorsEvents[i])));
+	}
+
+	Tasks->LaunchedTasks = WallTasks;
+	for (int32 i = 0; i < RegionsAmount; i++)
+	{
+		//The depth border is smaller than a region, so only the cells of the region and its neighbours are read.
+		TArray<UE::Tasks::FTask> NeighbourWallTasks;
+		if (Tasks->bIsPipelined)
+		{
+			for (int32 y = -1; y <= 1; y++)
+			{
+				for (int32 x = -1; x <= 1; x++)
+				{
+					if (const int32* RegionIndex = Tasks->RegionIndices.Find(Tasks->Regions[i] + FIntPoint(x, y)))
+					{
+						NeighbourWallTasks.Add(WallTasks[*RegionIndex]);
+					}
+				}
+			}
+		}
+
+		Tasks->LaunchedTasks.Add(UE::Tasks::Launch(TEXT("TerrainLayoutRegionDepth"), [Tasks, i]()
+		{
+			if (Tasks->CancellationToken->IsCancelled() || Tasks->RegionsCells[i].Num() == 0)
+			{
+				return;
+			}
+
+			TRACE_CPUPROFILER_EVENT_SCOPE(TerrainLayoutRegionDepth);
+			LLM_SCOPE_BYTAG(TerrainGenerator_LayoutWorkers);
+			Tasks->DepthTasksTimes[i].Begin();
+
+			const FTerrainLayoutRegionTasks& RegionTasksRef = Tasks.Get();
+			TerrainLayoutRegions::CalculateRegionCellsDepth(Tasks->Regions[i], [&RegionTasksRef](const FIntPoint& CellIn) { return RegionTasksRef.IsLayoutCell(CellIn); }, Tasks->RegionsCellsDepth[i]);
+			Tasks->DepthTasksTimes[i].End();
+		}, UE::Tasks::Prerequisites(Tasks->bIsPipelined ? NeighbourWallTasks : WallTasks)));
+	}
+
+	//The regions no corridor can reach do not wait for the corridors.
+	if (Tasks->bIsPipelined)
+	{
+		for (int32 i = 0; i < RegionsAmount; i++)
+		{
+			if (Tasks->RegionsPendingCorridors[i] == 0)
+			{
+				Tasks->RegionsReleased[i] = true;
+				Tasks->RegionsCorridorsEvents[i].Trigger();
+			}
 		}
 	}
+}
+
+void UTerrainLayoutSubsystem::CancelRegionTasks()
+{
+	if (!RegionTasks.IsValid())
+	{
+		return;
+	}
 
-	GetTerrainThreadSubsystem()->StartThreads(this, GetStream(), ActiveThreads);
+	//The tasks still waiting end as soon as they start, the running ones drop their results.
+	RegionTasks->CancellationToken->Cancel();
+	RegionTasks->ReleaseAll();
+	RegionTasks.Reset();
 }
 
-void UTerrainLayoutSubsystem::OnWallsLayoutEnd()
+void UTerrainLayoutSubsystem::StartWallsLayoutGeneration()
 {
-	GetTerrainThreadSubsystem()->OnThreadOperationEnd.RemoveAll(this);
-	OnWallsLayoutGenerated.Broadcast();
+	TRACE_CPUPROFILER_EVENT_SCOPE(UTerrainLayoutSubsystem::StartWallsLayoutGeneration);
+	LLM_SCOPE_BYTAG(TerrainGenerator_Layout);
 
-#if WITH_EDITOR		
-	if (IsDebug())
+	BeginStage(ETerrainGen_LayoutStage::Walls);
+
+	//Created by the corridors stage, unless the walls stage runs on its own.
+	if (!RegionTasks.IsValid())
 	{
-		if (GetState() == ETerrainGen_State::WallsLayout)
+		CreateRegionTasks(TArray<FTerrain_RoomDistance>(), TSet<FIntPoint>());
+
+		if (!CheckMemoryBudget())
 		{
 			return;
 		}
 	}
-#endif
+
+	const TSharedRef<FTerrainLayoutRegionTasks, ESPMode::ThreadSafe> Tasks = RegionTasks.ToSharedRef();
+
+	//Every corridor ended. Pipelined, only the regions whose corridors were not all reported are still waiting.
+	Tasks->ReleaseAll();
+
+	if (bGenerateSynchronously)
+	{
+		UE::Tasks::Wait(Tasks->LaunchedTasks);
+		OnWallsRegionTasksEnd();
+		return;
+	}
+
+	//The merge writes the layout, so it is done on the game thread once every region task is completed.
+	TWeakObjectPtr<UTerrainLayoutSubsystem> WeakThis = this;
+	UE::Tasks::Launch(TEXT("TerrainLayoutRegionsEnd"), [WeakThis, Tasks]()
+	{
+		AsyncTask(ENamedThreads::GameThread, [WeakThis, Tasks]()
+		{
+			if (WeakThis.IsValid() && WeakThis->RegionTasks.Get() == &Tasks.Get())
+			{
+				WeakThis->OnWallsRegionTasksEnd();
+			}
+		});
+	}, UE::Tasks::Prerequisites(Tasks->LaunchedTasks));
+}
+
+void UTerrainLayoutSubsystem::OnWallsRegionTasksEnd()
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(UTerrainLayoutSubsystem::OnWallsRegionTasksEnd);
+	LLM_SCOPE_BYTAG(TerrainGenerator_Layout);
+
+	const TSharedPtr<FTerrainLayoutRegionTasks, ESPMode::ThreadSafe> Tasks = RegionTasks;
+	RegionTasks.Reset();
+
+	CheckMemoryBudget();
+	if (!Tasks.IsValid() || IsGenerationCancelled())
+	{
+		return;
+	}
+
+	for (FBaseTerrainWorker* Worker : Tasks->WallWorkers)
+	{
+		if (Worker)
+		{
+			Worker->OnThreadEnd();
+			delete Worker;
+		}
+	}
+
+	Tasks->WallWorkers.Empty();
+
+	//The walls workers only add wall cells around the layout.
+	for (const TPair<FIntPoint, FCellLayout>& pair : CellsLayoutMap)
+	{
+		if (pair.Value.Tags.HasTag(TAG_TERRAIN_CELL_TYPE_WALL))
+		{
+			StageChangedCells.Add(pair.Key);
+		}
+	}
+
+	CellsLayoutDepth.Empty(CellsLayoutMap.Num());
+	for (const TArray<TPair<FIntPoint, int32>>& RegionCellsDepth : Tasks->RegionsCellsDepth)
+	{
+		for (const TPair<FIntPoint, int32>& pair : RegionCellsDepth)
+		{
+			CellsLayoutDepth.Add(pair.Key, pair.Value);
+		}
+	}
+
+	bCellsLayoutDepthCalculated = true;
+
+	for (int32 i = 0; i < Tasks->Regions.Num(); i++)
+	{
+		if (Tasks->RegionsCells[i].Num() == 0)
+		{
+			continue;
+		}
+
+		const FTerrainLayoutTaskTime& WallTaskTime = Tasks->WallTasksTimes[i];
+		const FTerrainLayoutTaskTime& DepthTaskTime = Tasks->DepthTasksTimes[i];
+		AddStageWorkerBusyTime(ETerrainGen_LayoutStage::Walls, WallTaskTime.Seconds, WallTaskTime.StartTime, WallTaskTime.ThreadId);
+		AddStageWorkerBusyTime(ETerrainGen_LayoutStage::Walls, DepthTaskTime.Seconds, DepthTaskTime.StartTime, DepthTaskTime.ThreadId);
+	}
+
+	LayoutStats.CorridorsToRegionsSeconds = FPlatformTime::Seconds() - Tasks->StartTime;
+
+	OnWallsLayoutEnd();
+}
+
+void UTerrainLayoutSubsystem::OnWallsLayoutEnd()
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(UTerrainLayoutSubsystem::OnWallsLayoutEnd);
+	LLM_SCOPE_BYTAG(TerrainGenerator_Layout);
+
+	OnStageBatchEnd();
+	if (IsGenerationCancelled())
+	{
+		return;
+	}
+
+	EndStage(ETerrainGen_LayoutStage::Walls);
+	if (IsGenerationCancelled())
+	{
+		return;
+	}
+
+	OnWallsLayoutGenerated.Broadcast();
+
+	if (ShouldStopAtState(ETerrainGen_State::WallsLayout) || IsLastStageToRun(ETerrainGen_LayoutStage::Walls))
+	{
+		return;
+	}
 
 	OnLayoutGenerationEnd();
 }
 
 void UTerrainLayoutSubsystem::OnLayoutGenerationEnd()
 {
+	TRACE_CPUPROFILER_EVENT_SCOPE(UTerrainLayoutSubsystem::OnLayoutGenerationEnd);
+	LLM_SCOPE_BYTAG(TerrainGenerator_Layout);
+
+	BeginStage(ETerrainGen_LayoutStage::Depth);
 	CalculateRoomsDungeonDepth();
 	CalculateCellsLayoutDepth();	
-	OnLayoutGenerated.Broadcast();
+	EndStage(ETerrainGen_LayoutStage::Depth);
+	if (IsGenerationCancelled())
+	{
+		return;
+	}
+
+	UpdateLayoutCountStats();
+	GenerationCancellationToken.Reset(); //The generation is completed, there is nothing left to cancel.
+	OnLayoutGenerated.Broadcast(LayoutStats);
 }
 
 void UTerrainLayoutSubsystem::CalculateRoomsDungeonDepth()
 {
-	//@TODO: Calculate Distance to the start cell in "Rooms" for all rooms. (Minimun rooms the player has to pass to find the room)
+	TRACE_CPUPROFILER_EVENT_SCOPE(UTerrainLayoutSubsystem::CalculateRoomsDungeonDepth);
+	LLM_SCOPE_BYTAG(TerrainGenerator_Layout);
+
+	//Minimun rooms the player has to pass from the initial room to find the room.
+	RoomsDungeonDepth.Empty(RoomsLayoutMap.Num());
+	if (!RoomsLayoutMap.Contains(InitialRoom))
+	{
+		return;
+	}
+
+	TArray<FIntPoint> PendingRooms;
+	PendingRooms.Reserve(RoomsLayoutMap.Num());
+	PendingRooms.Add(InitialRoom);
+	RoomsDungeonDepth.Add(InitialRoom, 0);
+
+	for (int32 i = 0; i < PendingRooms.Num(); i++)
+	{
+		const FIntPoint Room = PendingRooms[i];
+		const int32 Depth = RoomsDungeonDepth[Room];
+
+		const TArray<FIntPoint>* ConnectedRooms = RoomConnections.Find(Room);
+		if (!ConnectedRooms)
+		{
+			continue;
+		}
+
+		for (const FIntPoint& ConnectedRoom : *ConnectedRooms)
+		{
+			if (!RoomsDungeonDepth.Contains(ConnectedRoom))
+			{
+				RoomsDungeonDepth.Add(ConnectedRoom, Depth + 1);
+				PendingRooms.Add(ConnectedRoom);
+			}
+		}
+	}
 }
 
 void UTerrainLayoutSubsystem::CalculateCellsLayoutDepth()
 {
-	//@TODO: Calculate Min Distance from the cell to a wall
+	TRACE_CPUPROFILER_EVENT_SCOPE(UTerrainLayoutSubsystem::CalculateCellsLayoutDepth);
+	LLM_SCOPE_BYTAG(TerrainGenerator_Layout);
+
+	if (bCellsLayoutDepthCalculated)
+	{
+		return;
+	}
+
+	//Only when the walls stage did not run before, like when the depth stage is run in isolation. The walls are not layout cells for the depth.
+	TSet<FIntPoint> LayoutCells;
+	TSet<FIntPoint> Regions;
+	LayoutCells.Reserve(CellsLayoutMap.Num());
+	for (const TPair<FIntPoint, FCellLayout>& pair : CellsLayoutMap)
+	{
+		if (!pair.Value.Tags.HasTag(TAG_TERRAIN_CELL_TYPE_WALL))
+		{
+			LayoutCells.Add(pair.Key);
+			Regions.Add(TerrainLayoutRegions::GetRegion(pair.Key));
+		}
+	}
+
+	const TArray<FIntPoint> RegionsArray = Regions.Array();
+	TArray<TArray<TPair<FIntPoint, int32>>> RegionsCellsDepth;
+	RegionsCellsDepth.SetNum(RegionsArray.Num());
+
+	ParallelFor(RegionsArray.Num(), [&RegionsArray, &LayoutCells, &RegionsCellsDepth](int32 Index)
+	{
+		TerrainLayoutRegions::CalculateRegionCellsDepth(RegionsArray[Index], [&LayoutCells](const FIntPoint& CellIn) { return LayoutCells.Contains(CellIn); }, RegionsCellsDepth[Index]);
+	});
+
+	CellsLayoutDepth.Empty(LayoutCells.Num());
+	for (const TArray<TPair<FIntPoint, int32>>& RegionCellsDepth : RegionsCellsDepth)
+	{
+		for (const TPair<FIntPoint, int32>& pair : RegionCellsDepth)
+		{
+			CellsLayoutDepth.Add(pair.Key, pair.Value);
+		}
+	}
+
+	bCellsLayoutDepthCalculated = true;
 }
@@ -7,13 +7,39 @@
 #include "LayoutTypes.h"
 #include "Layout/CorridorTypes.h"
 #include "Terrain/TerrainGeneratorTypes.h"
+#include "Layout/TerrainLayoutStats.h"
+#include "Layout/TerrainLayoutCancellation.h"
+#include "Layout/TerrainLayoutStream.h"
+#include "Layout/TerrainLayoutPathCache.h"
+#include "Layout/TerrainLayoutCellsMap.h"
+#include "Containers/Ticker.h"
 #include "TerrainLayoutSubsystem.generated.h"
 
 DECLARE_MULTICAST_DELEGATE(FNoParamsDelegateLayoutSubsystemSignature);
+DECLARE_MULTICAST_DELEGATE_OneParam(FCellsDelegateLayoutSubsystemSignature, const TArray<FIntPoint>& /*ChangedCells*/);
+DECLARE_MULTICAST_DELEGATE_OneParam(FStatsDelegateLayoutSubsystemSignature, const FTerrainLayoutStats& /*LayoutStats*/);
+
+/* The layout state at the start of a stage. Allows running the stage again in isolation.*/
+struct TERRAINGENERATOR_API FTerrainLayoutSnapshot
+{
+	bool bIsValid = false;
+
+	FRandomStream Stream;
+
+	FIntPoint InitialRoom = FIntPoint();
+
+	TMap <FIntPoint, FRoomLayout> RoomsLayoutMap;
+
+	FTerrainLayoutCellsMap CellsLayoutMap;
+
+	TMap <FIntPoint, TArray<FIntPoint>> RoomConnections;
+};
 
 class UTerrainData;
 class UTerrainLayoutData;
 class UTerrainGeneratorSubsystem;
+struct FTerrainLayoutRegionTasks;
+class FBaseTerrainWorker;
 
 UCLASS()
 class TERRAINGENERATOR_API UTerrainLayoutSubsystem : public UTerrainBaseSubsystem
@@ -22,6 +48,7 @@ class TERRAINGENERATOR_API UTerrainLayoutSubsystem : public UTerrainBaseSubsyste
 
 public:
 	friend class STerrainEditorViewport;
+	friend class STerrainEditorSeedExplorer;
 
 	friend class FRoomLayoutWorker;
 	friend class FRoomMovementWorker;
@@ -30,23 +57,100 @@ public:
 	friend class FBiomeMovementWorker;
 
 	friend class UTerrainBiomeSubsystem;
+	friend class UTerrainLayoutChunkSubsystem;
 
 
 	FNoParamsDelegateLayoutSubsystemSignature OnInitialLayoutGenerated;
 	FNoParamsDelegateLayoutSubsystemSignature OnInitialLayoutMovementCompleted;
 	FNoParamsDelegateLayoutSubsystemSignature OnCorridorLayoutGenerated;
 	FNoParamsDelegateLayoutSubsystemSignature OnWallsLayoutGenerated;
-	FNoParamsDelegateLayoutSubsystemSignature OnLayoutGenerated;
+	/* Called when the full layout is generated, with the metrics of the generation.*/
+	FStatsDelegateLayoutSubsystemSignature OnLayoutGenerated;
+	/* Called when the generation is cancelled for going over the layout data GenerationMemoryBudgetMB, with the memory of each stage.*/
+	FStatsDelegateLayoutSubsystemSignature OnLayoutGenerationFailed;
+
+	/* Called when the layout is set back to a stage snapshot to generate it again from that stage. The layout may have less cells than before.*/
+	FNoParamsDelegateLayoutSubsystemSignature OnLayoutRestored;
+
+	/* Called while a stage is running, each time streamed worker results are merged into the layout.*/
+	FCellsDelegateLayoutSubsystemSignature OnLayoutCellsUpdated;
+
+	/* Cells added or changed by the last corridors or walls stage, streamed ones included. Empty after the stages that place or move the whole layout.*/
+	const TArray<FIntPoint>& GetStageChangedCells() const;
 
 	FIntPoint GetInitialRoom() const;
 	TMap <FIntPoint, FRoomLayout> GetRoomsLayoutMap() const;
+	/* A copy of the cells in a single map.*/
 	TMap <FIntPoint, FCellLayout> GetCellsLayoutMap() const;
 
 	FVector GetCellWorldPosition(const FIntPoint& InCellsID, FVector2D InAnchor) const;
+
+	/* GetCellWorldPosition for each cell. PositionsOut must have at least as many elements as CellsIn.*/
+	void GetCellsWorldPositions(TArrayView<const FIntPoint> CellsIn, FVector2D AnchorIn, TArrayView<FVector> PositionsOut) const;
 	float GetWorldDistanceBetweenRooms(const FIntPoint& RoomA, const FIntPoint& RoomB) const;
+
+	/* Minimun rooms to pass from the initial room to reach the room. -1 if the room is not connected or the depth was not calculated.*/
+	int32 GetRoomDungeonDepth(const FIntPoint& RoomIDIn) const;
+
+	/* Distance in cells from a room or corridor cell to the nearest wall, clamped to MaxCellLayoutDepth. -1 for walls and cells out of the layout.*/
+	int32 GetCellLayoutDepth(const FIntPoint& CellIDIn) const;
+
+	static const int32 MaxCellLayoutDepth = 16;
 	
+	/* Starts a new layout generation. A generation still in flight is cancelled first.*/
 	void GenerateTerrainLayout(UTerrainData* InTerrainData);
 
+	/* Same as GenerateTerrainLayout, but for the given seed instead of the current stream.*/
+	void GenerateTerrainLayout(UTerrainData* InTerrainData, int32 InSeed);
+
+	/* Stops the generation in flight. Its workers end early and their results are discarded.*/
+	void CancelLayoutGeneration();
+
+	/**
+	*	Generates the full layout for the seed on the calling thread, without using the terrain thread subsystem.
+	*	Each stage workers are run in parallel and the stage ends before the function returns.
+	*	Used for headless generation. Can be called from any thread as long as each call uses its own subsystem instance.
+	*	The generation stops after LastStageIn ends, or as soon as ParentCancellationTokenIn is cancelled from another thread.
+	*/
+	void GenerateTerrainLayoutSynchronous(UTerrainData* InTerrainData, int32 InSeed, ETerrainGen_LayoutStage LastStageIn = ETerrainGen_LayoutStage::ETLS_MAX, const FTerrainLayoutCancellationTokenPtr& ParentCancellationTokenIn = nullptr);
+
+	/* The metrics of the last generation.*/
+	const FTerrainLayoutStats& GetLayoutStats() const;
+
+	/* If the layout state should be stored at the start of each stage on the next generations.*/
+	void SetCaptureStageSnapshots(bool bCapture);
+
+	/* The layout state captured at the start of the stage in the last generation.*/
+	const FTerrainLayoutSnapshot& GetStageSnapshot(ETerrainGen_LayoutStage StageIn) const;
+
+	/* Sets the layout state from a snapshot. Returns false if the snapshot or terrain data are invalid.*/
+	bool RestoreLayoutSnapshot(UTerrainData* InTerrainData, const FTerrainLayoutSnapshot& SnapshotIn);
+
+	/**
+	*	Runs only one stage synchronously from the current layout state. The following stages are not started.
+	*	Used with RestoreLayoutSnapshot to measure stages in isolation.
+	*/
+	void RunLayoutStageSynchronous(ETerrainGen_LayoutStage StageIn);
+
+	/**
+	*	Generates the layout again from the stage, starting from its snapshot of the last generation, like GenerateTerrainLayout does for the full layout.
+	*	The stages before are not run again, so changes to the data they read are not applied.
+	*	Returns false if the last generation did not capture the stage snapshot, a full generation is needed then.
+	*/
+	bool RegenerateTerrainLayoutFromStage(UTerrainData* InTerrainData, ETerrainGen_LayoutStage StageIn);
+
+	/**
+	*	If the walls of each region start as soon as the corridors that can reach the region end, on the next generations. On by default.
+	*	Off, the walls wait for the whole corridors stage and the depth for all the walls, as a barrier between stages. Used to measure the barrier timeline for the same seed.
+	*/
+	void SetPipelineLayoutRegions(bool bPipeline);
+
+	/* If the corridor searches count each cell they expand on the next generations. Off by default, it costs a map insertion per expanded cell.*/
+	void SetCollectSearchHeatmap(bool bCollect);
+
+	/* The cells expanded by the corridor searches of the last generation. Empty if it was not collected.*/
+	const FTerrainLayoutSearchHeatmap& GetCorridorSearchHeatmap() const;
+
 protected:
 	UPROPERTY(Transient)
 	UTerrainLayoutData* TerrainLayoutData;
@@ -58,8 +162,138 @@ protected:
 	UPROPERTY(Transient)
 	TMap <FIntPoint, FRoomLayout> RoomsLayoutMap;
 
+	/* Sharded, so the corridors are merged by one task per shard straight into the layout.*/
+	FTerrainLayoutCellsMap CellsLayoutMap;
+
+	/* The rooms connected to each room, by a corridor or by being next to each other.*/
+	TMap <FIntPoint, TArray<FIntPoint>> RoomConnections;
+
+	TMap <FIntPoint, int32> RoomsDungeonDepth;
+	TMap <FIntPoint, int32> CellsLayoutDepth;
+
+	/* If the cells depth was already calculated by the region tasks of the walls stage.*/
+	bool bCellsLayoutDepthCalculated = false;
+
 	UPROPERTY(Transient)
-	TMap <FIntPoint, FCellLayout> CellsLayoutMap;
+	FTerrainLayoutStats LayoutStats;
+
+	/* If stages are run on the calling thread instead of the terrain thread subsystem.*/
+	bool bGenerateSynchronously = false;
+
+	double GenerationStartTime = 0;
+	double StageStartTime = 0;
+	ETerrainGen_LayoutStage CurrentStage = ETerrainGen_LayoutStage::InitialLayout;
+	int32 StageStartCellsAmount = 0;
+
+	/* The stage in flight started workers on the thread subsystem. Only the ones that report their own times, like the corridor workers, show in its timings.*/
+	bool bStageRanThreadWorkers = false;
+
+	/* Layout copies made for the workers of the stage in flight, counted in the stage memory.*/
+	int64 StageWorkerCopiesBytes = 0;
+
+	/* Reset when each stage begins.*/
+	TArray<FIntPoint> StageChangedCells;
+
+	bool bCaptureStageSnapshots = false;
+	TArray<FTerrainLayoutSnapshot> StageSnapshots;
+
+	/* The pipeline stops after this stage ends.*/
+	ETerrainGen_LayoutStage LastStageToRun = ETerrainGen_LayoutStage::ETLS_MAX;
+
+	/* Token of the generation in flight. Passed to the workers of each stage.*/
+	FTerrainLayoutCancellationTokenPtr GenerationCancellationToken;
+
+	/* Set only during a synchronous generation whose caller can stop it. The generation token is cancelled with it.*/
+	FTerrainLayoutCancellationTokenPtr ParentCancellationToken;
+
+	void StartNewGenerationToken();
+
+	/* True if there is no generation in flight, or it was cancelled. Stage ends do nothing then.*/
+	bool IsGenerationCancelled() const;
+
+	/* Queue of the stage in flight when streaming its results. Drained on the game thread by the stream merge ticker.*/
+	FTerrainLayoutStreamQueuePtr StreamQueue;
+
+	FTSTicker::FDelegateHandle StreamMergeTickerHandle;
+
+	void StartStreamMerge();
+	void StopStreamMerge();
+	bool TickStreamMerge(float DeltaTime);
+
+	/* Merges the queued results until the budget is used. A negative budget merges everything queued.*/
+	void MergeStreamedResults(double BudgetSecondsIn);
+
+	void MergeCorridorLayout(const FCorridorLayout& LayoutIn, TArray<FIntPoint>& ChangedCellsOut);
+
+	/* Corridor path searches of all the generations of the session.*/
+	FTerrainLayoutPathCachePtr CorridorPathCache;
+
+	/* Corridors of the stage in flight waiting for the merge at the end of the stage.*/
+	TArray<FCorridorLayout> PendingCorridorLayouts;
+
+	bool bCollectSearchHeatmap = false;
+	FTerrainLayoutSearchHeatmap CorridorSearchHeatmap;
+
+	bool bPipelineLayoutRegions = true;
+
+	/**
+	*	Merges the corridors into the cells layout. The corridors are split in slices, and a task per slice sorts its cells by layout shard.
+	*	Then a task per shard writes its cells straight into its shard of the layout, so no cell is inserted on the calling thread.
+	*/
+	void MergeCorridorLayoutsSharded(const TArray<FCorridorLayout>& LayoutsIn);
+
+	void AddRoomConnection(const FIntPoint& RoomA, const FIntPoint& RoomB);
+
+	void StartLayoutGeneration(UTerrainData* InTerrainData, ETerrainGen_LayoutStage LastStageIn);
+
+	typedef void (UTerrainLayoutSubsystem::*FLayoutStageEndFunction)();
+
+	/* Starts the workers of a stage. OnStageEnd is bound by name to the thread subsystem, or called directly when generating synchronously.*/
+	void StartStageThreads(const TArray<FBaseTerrainWorker*>& Workers, FLayoutStageEndFunction OnStageEnd, const FName& OnStageEndName);
+
+	/* Unbinds the stage end from the thread subsystem. Called by each stage end and when cancelling.*/
+	void UnbindStageEnd();
+
+	/**
+	*	If the workers of an async stage are running. The thread subsystem end has no batch identity, so a cancelled batch end would end the stage of a generation started after it.
+	*	Generations started while it is true wait in PendingGenerationStart until OnCancelledStageBatchEnd.
+	*/
+	bool bIsStageBatchRunning = false;
+	TFunction<void()> PendingGenerationStart;
+
+	/* Called by each stage end, the batch that ran the stage is over.*/
+	void OnStageBatchEnd();
+
+	UFUNCTION()
+	void OnCancelledStageBatchEnd();
+	bool ShouldStopAtState(ETerrainGen_State StateIn) const;
+	bool IsLastStageToRun(ETerrainGen_LayoutStage StageIn) const;
+
+	void BeginStage(ETerrainGen_LayoutStage StageIn);
+	void EndStage(ETerrainGen_LayoutStage StageIn);
+	void UpdatePeakLayoutMemory();
+
+	/* The rooms and cells layout maps.*/
+	int64 GetLayoutAllocatedSize() const;
+
+	/* The data of the stage in flight besides the layout: worker copies, corridors waiting for the merge and the depth maps.*/
+	int64 GetStageAllocatedSize() const;
+
+	/**
+	*	Updates the peak memory and cancels the generation if the stage goes over the memory budget. Returns false if it was cancelled.
+	*	Also reports the budget exceeded by the workers, that poll it through the generation token between the checks.
+	*/
+	bool CheckMemoryBudget();
+
+	/* Logs the memory of each stage, cancels the generation and broadcasts the failure.*/
+	void ReportMemoryBudgetExceeded(int64 StageBytesIn);
+	void UpdateLayoutCountStats();
+
+	/* Cells in the rooms and in the cells layout.*/
+	int32 GetLayoutCellsAmount() const;
+
+	/* Adds a worker or task to the stage timings, with the time it started and the thread it ran on.*/
+	void AddStageWorkerBusyTime(ETerrainGen_LayoutStage StageIn, double SecondsIn, double StartTimeIn, uint32 ThreadIdIn);
 
 	void GenerateInitialRoomsLayout();	
 	void StartRoomLayoutGeneration();
@@ -77,15 +311,45 @@ protected:
 	void StartCorridorsLayoutGeneration();
 	TArray<FTerrain_RoomDistance> GenerateInitialCorridorsLayoutData();
 	TArray<FTerrain_RoomDistance> GetAllRoomDistanceData() const;
+
+	/**
+	*	Finds the rooms with at least FlowFieldMinCorridors corridors, makes them the start room of their corridors
+	*	and sorts the corridors so the ones of each of those rooms are together.
+	*/
+	void GroupFlowFieldCorridors(TArray<FTerrain_RoomDistance>& CorridorsLayoutDataOut, TSet<FIntPoint>& FlowFieldRoomsOut) const;
 	TArray<FTerrain_RoomDistance> GetRoomDistancesInNearArea(const FIntPoint& StartRoom) const;
 
-	void AddUnusedCorridors(TArray<FTerrain_RoomDistance>& UnusedCorridorsIn, TArray<FTerrain_RoomDistance>& ThreeCorridorsOut);
+	/**
+	*	Adds the corridors that close loops in the tree. Each unused room distance is scored by how much it shortens the path between its rooms through the tree,
+	*	and the best CircularCorridorsAmountPercent * rooms unique ones are used.
+	*/
+	void AddLoopCorridors(const TArray<FTerrain_RoomDistance>& CandidatesIn, const TMap<FIntPoint, TArray<FTerrain_RoomDistance>>& SpanningTreeIn, TArray<FTerrain_RoomDistance>& ThreeCorridorsOut) const;
+
+	/* The distance through the tree from the room to every room connected to it.*/
+	void GetSpanningTreeDistances(const FIntPoint& RoomIn, const TMap<FIntPoint, TArray<FTerrain_RoomDistance>>& SpanningTreeIn, TMap<FIntPoint, float>& DistancesOut) const;
 	
 	UFUNCTION()
 	void OnCorridorLayoutEnd();
 
+	/**
+	*	Splits the layout in square regions and launches a walls and a cells depth task per region.
+	*	Each corridor is counted in every region its cells can fall in, and the walls task of a region starts once all of them ended, or once the corridors stage ended if not pipelined.
+	*	The depth task of a region follows the walls tasks of the region and its neighbours, or of all the regions if not pipelined.
+	*/
+	void CreateRegionTasks(const TArray<FTerrain_RoomDistance>& CorridorsIn, const TSet<FIntPoint>& FlowFieldRoomsIn);
+
+	/* Drops the region tasks of the generation. The waiting ones are released so they end.*/
+	void CancelRegionTasks();
+
+	/* Waits for the region tasks, created by the corridors stage, or here if the stage runs on its own.*/
 	void StartWallsLayoutGeneration();
 
+	/* The walls and depth tasks of the generation in flight.*/
+	TSharedPtr<FTerrainLayoutRegionTasks, ESPMode::ThreadSafe> RegionTasks;
+
+	/* Merges the walls and depth of all the regions once their tasks are completed.*/
+	void OnWallsRegionTasksEnd();
+
 	UFUNCTION()
 	void OnWallsLayoutEnd();
 
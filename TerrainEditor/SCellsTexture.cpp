@@ -0,0 +1,540 @@
+#include "SCellsTexture.h"
+#include "SCellsGrid.h"
+#include "Engine/Texture2D.h"
+#include "Rendering/DrawElements.h"
+#include "RenderUtils.h"
+
+void SCellsTexture::Construct(const FArguments& InArgs)
+{
+	ShowGridLines = InArgs._ShowGridLines;
+	GridLinesColor = InArgs._GridLinesColor;
+	MinCellPixelsForGridLines = InArgs._MinCellPixelsForGridLines;
+}
+
+void SCellsTexture::SetCellsData(const TArray<FCellGridData>& DataIn)
+{
+	if (DataIn.Num() == 0)
+	{
+		Texels.Empty();
+		CellsSize = FIntPoint::ZeroValue;
+		Levels.Empty();
+		TileTexturesAmount = 0;
+		Invalidate(EInvalidateWidgetReason::Paint);
+		return;
+	}
+
+	FIntPoint NewMinCell = DataIn[0].GridID;
+	FIntPoint MaxCell = DataIn[0].GridID;
+	for (const FCellGridData& Cell : DataIn)
+	{
+		NewMinCell = NewMinCell.ComponentMin(Cell.GridID);
+		MaxCell = MaxCell.ComponentMax(Cell.GridID);
+	}
+
+	const FIntPoint NewCellsSize = MaxCell - NewMinCell + FIntPoint(1, 1);
+	const FIntPoint MinCellChange = MinCell - NewMinCell;
+	MinCell = NewMinCell;
+
+	if (NewCellsSize != CellsSize)
+	{
+		const bool bWasEmpty = CellsSize == FIntPoint::ZeroValue;
+		CellsSize = NewCellsSize;
+		Texels.SetNumUninitialized(CellsSize.X * CellsSize.Y);
+
+		int32 LevelsAmount = 1;
+		while (GetLevelSize(LevelsAmount - 1).GetMax() > TileSize)
+		{
+			LevelsAmount++;
+		}
+
+		Levels.Empty(LevelsAmount);
+		Levels.SetNum(LevelsAmount);
+		TileTexturesAmount = 0;
+
+		//Growing layouts keep the view on the same cells.
+		if (bWasEmpty)
+		{
+			ResetView();
+		}
+		else
+		{
+			ViewCenter += FVector2D(MinCellChange.X, MinCellChange.Y);
+		}
+	}
+	else
+	{
+		//Same bounds, the tiles and their textures are kept and built again when visible.
+		for (TMap<FIntPoint, FCellsTile>& Tiles : Levels)
+		{
+			for (TPair<FIntPoint, FCellsTile>& pair : Tiles)
+			{
+				pair.Value.bColorsDirty = true;
+				pair.Value.bTextureDirty = true;
+			}
+		}
+	}
+
+	FMemory::Memzero(Texels.GetData(), Texels.Num() * Texels.GetTypeSize());
+	for (const FCellGridData& Cell : DataIn)
+	{
+		const FIntPoint Texel = Cell.GridID - MinCell;
+		Texels[Texel.Y * CellsSize.X + Texel.X] = Cell.Color.ToFColor(true);
+	}
+
+	Invalidate(EInvalidateWidgetReason::Paint);
+}
+
+void SCellsTexture::UpdateCellsData(const TArray<FCellGridData>& DataIn)
+{
+	if (Levels.Num() == 0)
+	{
+		return;
+	}
+
+	//Changed cells are usually next to each other, the tiles are only marked again when the cells tile changes.
+	FIntPoint LastTile = FIntPoint(-1, -1);
+	bool bAnyChanged = false;
+
+	for (const FCellGridData& Cell : DataIn)
+	{
+		const FIntPoint Texel = Cell.GridID - MinCell;
+		if (Texel.X < 0 || Texel.Y < 0 || Texel.X >= CellsSize.X || Texel.Y >= CellsSize.Y)
+		{
+			continue;
+		}
+
+		Texels[Texel.Y * CellsSize.X + Texel.X] = Cell.Color.ToFColor(true);
+		bAnyChanged = true;
+
+		const FIntPoint Tile = FIntPoint(Texel.X >> TileSizeLog2, Texel.Y >> TileSizeLog2);
+		if (Tile != LastTile)
+		{
+			MarkCellDirty(Texel);
+			LastTile = Tile;
+		}
+	}
+
+	if (bAnyChanged)
+	{
+		Invalidate(EInvalidateWidgetReason::Paint);
+	}
+}
+
+void SCellsTexture::SetShowGridLines(bool bShowIn)
+{
+	ShowGridLines = bShowIn;
+	Invalidate(EInvalidateWidgetReason::Paint);
+}
+
+void SCellsTexture::ResetView()
+{
+	Zoom = 1.f;
+	ViewCenter = FVector2D(CellsSize.X, CellsSize.Y) * .5f;
+	Invalidate(EInvalidateWidgetReason::Paint);
+}
+
+FIntPoint SCellsTexture::GetLevelSize(int32 LevelIn) const
+{
+	const int32 LevelCells = 1 << LevelIn;
+	return FIntPoint((CellsSize.X + LevelCells - 1) >> LevelIn, (CellsSize.Y + LevelCells - 1) >> LevelIn);
+}
+
+void SCellsTexture::MarkCellDirty(const FIntPoint& TexelIn)
+{
+	//Tiles not created yet are built dirty when first needed.
+	for (int32 Level = 0; Level < Levels.Num(); Level++)
+	{
+		const int32 Shift = Level + TileSizeLog2;
+		FCellsTile* Tile = Levels[Level].Find(FIntPoint(TexelIn.X >> Shift, TexelIn.Y >> Shift));
+		if (!Tile)
+		{
+			continue;
+		}
+
+		Tile->bColorsDirty = Level > 0;
+		Tile->bTextureDirty = true;
+	}
+}
+
+SCellsTexture::FCellsTile& SCellsTexture::GetTileColors(int32 LevelIn, const FIntPoint& TileIn)
+{
+	FCellsTile& Tile = Levels[LevelIn].FindOrAdd(TileIn);
+	if (LevelIn == 0 || !Tile.bColorsDirty)
+	{
+		return Tile;
+	}
+
+	static const int32 HalfTileSize = TileSize / 2;
+	const FColor Transparent = FColor(0, 0, 0, 0);
+	const FIntPoint SourceSize = GetLevelSize(LevelIn - 1);
+	Tile.Colors.SetNumUninitialized(TileSize * TileSize);
+
+	//Each quarter of the tile is a child tile of the level below downsampled.
+	for (int32 ChildY = 0; ChildY < 2; ChildY++)
+	{
+		for (int32 ChildX = 0; ChildX < 2; ChildX++)
+		{
+			const FIntPoint ChildTile = FIntPoint(TileIn.X * 2 + ChildX, TileIn.Y * 2 + ChildY);
+			const FIntPoint ChildFirstTexel = ChildTile * TileSize;
+			const bool bIsChildOut = ChildFirstTexel.X >= SourceSize.X || ChildFirstTexel.Y >= SourceSize.Y;
+
+			//Only valid until the next child tile is added to the level below.
+			const TArray<FColor>* ChildColors = LevelIn > 1 && !bIsChildOut ? &GetTileColors(LevelIn - 1, ChildTile).Colors : nullptr;
+
+			for (int32 y = 0; y < HalfTileSize; y++)
+			{
+				for (int32 x = 0; x < HalfTileSize; x++)
+				{
+					FColor Block[4];
+					for (int32 i = 0; i < 4; i++)
+					{
+						const int32 SourceX = x * 2 + (i & 1);
+						const int32 SourceY = y * 2 + (i >> 1);
+
+						if (bIsChildOut)
+						{
+							Block[i] = Transparent;
+						}
+						else if (ChildColors)
+						{
+							Block[i] = (*ChildColors)[SourceY * TileSize + SourceX];
+						}
+						else
+						{
+							const FIntPoint Cell = ChildFirstTexel + FIntPoint(SourceX, SourceY);
+							Block[i] = Cell.X < CellsSize.X && Cell.Y < CellsSize.Y ? Texels[Cell.Y * CellsSize.X + Cell.X] : Transparent;
+						}
+					}
+
+					Tile.Colors[(ChildY * HalfTileSize + y) * TileSize + ChildX * HalfTileSize + x] = GetBlockColor(Block);
+				}
+			}
+		}
+	}
+
+	Tile.bColorsDirty = false;
+	return Tile;
+}
+
+FColor SCellsTexture::GetBlockColor(const FColor (&BlockIn)[4])
+{
+	int32 BestIndex = INDEX_NONE;
+	int32 BestCount = 0;
+
+	for (int32 i = 0; i < 4; i++)
+	{
+		if (BlockIn[i].A == 0)
+		{
+			continue;
+		}
+
+		int32 Count = 0;
+		for (int32 j = 0; j < 4; j++)
+		{
+			Count += BlockIn[j] == BlockIn[i] ? 1 : 0;
+		}
+
+		//Ties keep the first color of the block.
+		if (Count > BestCount)
+		{
+			BestIndex = i;
+			BestCount = Count;
+		}
+	}
+
+	return BestIndex != INDEX_NONE ? BlockIn[BestIndex] : FColor(0, 0, 0, 0);
+}
+
+void SCellsTexture::UploadTile(int32 LevelIn, const FIntPoint& TileIn, FCellsTile& TileOut)
+{
+	if (!TileOut.Texture)
+	{
+		TileOut.Texture = UTexture2D::CreateTransient(TileSize, TileSize, PF_B8G8R8A8, TEXT("TerrainEditorCellsTile"));
+		TileOut.Texture->Filter = TF_Nearest;
+		TileOut.Texture->LODGroup = TEXTUREGROUP_Pixels2D;
+		TileOut.Texture->SRGB = true;
+		TileOut.Texture->NeverStream = true;
+		TileOut.Texture->UpdateResource();
+
+		TileOut.Brush.DrawAs = ESlateBrushDrawType::Image;
+		TileOut.Brush.Tiling = ESlateBrushTileType::NoTile;
+		TileOut.Brush.SetResourceObject(TileOut.Texture);
+		TileOut.Brush.ImageSize = FVector2D(TileSize, TileSize);
+		TileTexturesAmount++;
+	}
+
+	const int32 Pitch = TileSize * sizeof(FColor);
+
+	//The render thread reads the copy after this returns, and frees it when the upload is done.
+	uint8* Data = StaticCast<uint8*>(FMemory::Malloc(TileSize * Pitch));
+	if (LevelIn > 0)
+	{
+		FMemory::Memcpy(Data, TileOut.Colors.GetData(), TileSize * Pitch);
+	}
+	else
+	{
+		//The tiles of the cells read the texels directly, the ones past the last cell are transparent.
+		FMemory::Memzero(Data, TileSize * Pitch);
+
+		const FIntPoint FirstCell = TileIn * TileSize;
+		const int32 Width = FMath::Min(TileSize, CellsSize.X - FirstCell.X);
+		const int32 Height = FMath::Min(TileSize, CellsSize.Y - FirstCell.Y);
+
+		for (int32 y = 0; y < Height; y++)
+		{
+			FMemory::Memcpy(Data + y * Pitch, Texels.GetData() + (FirstCell.Y + y) * CellsSize.X + FirstCell.X, Width * sizeof(FColor));
+		}
+	}
+
+	FUpdateTextureRegion2D* Region = new FUpdateTextureRegion2D(0, 0, 0, 0, TileSize, TileSize);
+	TileOut.Texture->UpdateTextureRegions(0, 1, Region, Pitch, sizeof(FColor), Data, [](uint8* DataIn, const FUpdateTextureRegion2D* RegionIn)
+	{
+		FMemory::Free(DataIn);
+		delete RegionIn;
+	});
+
+	TileOut.bTextureDirty = false;
+}
+
+void SCellsTexture::ReleaseTileTextures(const FVisibleTiles& VisibleIn)
+{
+	for (int32 Level = 0; Level < Levels.Num(); Level++)
+	{
+		for (TPair<FIntPoint, FCellsTile>& pair : Levels[Level])
+		{
+			const bool bIsVisible = Level == VisibleIn.Level
+				&& pair.Key.X >= VisibleIn.MinTile.X && pair.Key.Y >= VisibleIn.MinTile.Y
+				&& pair.Key.X <= VisibleIn.MaxTile.X && pair.Key.Y <= VisibleIn.MaxTile.Y;
+
+			if (!pair.Value.Texture || bIsVisible)
+			{
+				continue;
+			}
+
+			pair.Value.Texture = nullptr;
+			pair.Value.Brush.SetResourceObject(nullptr);
+			pair.Value.bTextureDirty = true;
+			TileTexturesAmount--;
+		}
+	}
+}
+
+float SCellsTexture::GetCellSize(const FVector2D& LocalSizeIn) const
+{
+	if (CellsSize.X <= 0 || CellsSize.Y <= 0)
+	{
+		return 0.f;
+	}
+
+	return FMath::Min(LocalSizeIn.X / CellsSize.X, LocalSizeIn.Y / CellsSize.Y);
+}
+
+SCellsTexture::FVisibleTiles SCellsTexture::GetVisibleTiles(const FGeometry& GeometryIn) const
+{
+	FVisibleTiles Visible = FVisibleTiles();
+
+	const FVector2D LocalSize = GeometryIn.GetLocalSize();
+	const float CellSize = GetCellSize(LocalSize) * Zoom;
+	if (Levels.Num() == 0 || CellSize <= 0.f)
+	{
+		return Visible;
+	}
+
+	//The first level where a texel is about a pixel on screen, more detail could not be seen.
+	const float CellPixels = CellSize * GeometryIn.Scale;
+	if (CellPixels < 1.f)
+	{
+		Visible.Level = FMath::Clamp(FMath::FloorToInt(FMath::Log2(1.f / CellPixels)), 0, Levels.Num() - 1);
+	}
+
+	Visible.TexelSize = CellSize * (1 << Visible.Level);
+	Visible.Origin = LocalSize * .5f - ViewCenter * CellSize;
+
+	const float TileLocalSize = Visible.TexelSize * TileSize;
+	const FIntPoint LevelSize = GetLevelSize(Visible.Level);
+	const FIntPoint LevelTiles = FIntPoint(FMath::DivideAndRoundUp(LevelSize.X, TileSize), FMath::DivideAndRoundUp(LevelSize.Y, TileSize));
+
+	Visible.MinTile.X = FMath::Max(0, FMath::FloorToInt(-Visible.Origin.X / TileLocalSize));
+	Visible.MinTile.Y = FMath::Max(0, FMath::FloorToInt(-Visible.Origin.Y / TileLocalSize));
+	Visible.MaxTile.X = FMath::Min(LevelTiles.X - 1, FMath::FloorToInt((LocalSize.X - Visible.Origin.X) / TileLocalSize));
+	Visible.MaxTile.Y = FMath::Min(LevelTiles.Y - 1, FMath::FloorToInt((LocalSize.Y - Visible.Origin.Y) / TileLocalSize));
+
+	return Visible;
+}
+
+void SCellsTexture::Tick(const FGeometry& AllottedGeometry, const double InCurrentTime, const float InDeltaTime)
+{
+	const FVisibleTiles Visible = GetVisibleTiles(AllottedGeometry);
+	bool bAnyUploaded = false;
+
+	for (int32 y = Visible.MinTile.Y; y <= Visible.MaxTile.Y; y++)
+	{
+		for (int32 x = Visible.MinTile.X; x <= Visible.MaxTile.X; x++)
+		{
+			FCellsTile& Tile = GetTileColors(Visible.Level, FIntPoint(x, y));
+			if (Tile.bTextureDirty || !Tile.Texture)
+			{
+				UploadTile(Visible.Level, FIntPoint(x, y), Tile);
+				bAnyUploaded = true;
+			}
+		}
+	}
+
+	if (TileTexturesAmount > MaxTileTextures)
+	{
+		ReleaseTileTextures(Visible);
+	}
+
+	if (bAnyUploaded)
+	{
+		Invalidate(EInvalidateWidgetReason::Paint);
+	}
+}
+
+int32 SCellsTexture::OnPaint(const FPaintArgs& Args, const FGeometry& AllottedGeometry, const FSlateRect& MyCullingRect, FSlateWindowElementList& OutDrawElements, int32 LayerId, const FWidgetStyle& InWidgetStyle, bool bParentEnabled) const
+{
+	if (Levels.Num() == 0)
+	{
+		return LayerId;
+	}
+
+	const FVisibleTiles Visible = GetVisibleTiles(AllottedGeometry);
+	const TMap<FIntPoint, FCellsTile>& Tiles = Levels[Visible.Level];
+	const float TileLocalSize = Visible.TexelSize * TileSize;
+
+	OutDrawElements.PushClip(FSlateClippingZone(AllottedGeometry));
+
+	for (int32 y = Visible.MinTile.Y; y <= Visible.MaxTile.Y; y++)
+	{
+		for (int32 x = Visible.MinTile.X; x <= Visible.MaxTile.X; x++)
+		{
+			const FCellsTile* Tile = Tiles.Find(FIntPoint(x, y));
+			if (!Tile || !Tile->Texture)
+			{
+				continue;
+			}
+
+			FSlateDrawElement::MakeBox(
+				OutDrawElements,
+				LayerId,
+				AllottedGeometry.ToPaintGeometry(FVector2D(TileLocalSize, TileLocalSize), FSlateLayoutTransform(Visible.Origin + FVector2D(x, y) * TileLocalSize)),
+				&Tile->Brush,
+				ESlateDrawEffect::None,
+				InWidgetStyle.GetColorAndOpacityTint());
+		}
+	}
+
+	//Only the cells level is drawn large enough for the lines.
+	const float CellSize = Visible.TexelSize;
+	if (ShowGridLines.Get() && Visible.Level == 0 && CellSize >= MinCellPixelsForGridLines / AllottedGeometry.Scale)
+	{
+		//A line per visible row and column, not per cell.
+		LayerId++;
+		const FVector2D LocalSize = AllottedGeometry.GetLocalSize();
+		const FIntPoint FirstCell = FIntPoint(FMath::Max(0, FMath::FloorToInt(-Visible.Origin.X / CellSize)), FMath::Max(0, FMath::FloorToInt(-Visible.Origin.Y / CellSize)));
+		const FIntPoint LastCell = FIntPoint(FMath::Min(CellsSize.X, FMath::CeilToInt((LocalSize.X - Visible.Origin.X) / CellSize)), FMath::Min(CellsSize.Y, FMath::CeilToInt((LocalSize.Y - Visible.Origin.Y) / CellSize)));
+
+		TArray<FVector2D> LinePoints;
+		LinePoints.SetNum(2);
+
+		for (int32 x = FirstCell.X; x <= LastCell.X; x++)
+		{
+			LinePoints[0] = Visible.Origin + FVector2D(x, FirstCell.Y) * CellSize;
+			LinePoints[1] = Visible.Origin + FVector2D(x, LastCell.Y) * CellSize;
+			FSlateDrawElement::MakeLines(OutDrawElements, LayerId, AllottedGeometry.ToPaintGeometry(), LinePoints, ESlateDrawEffect::None, GridLinesColor, false);
+		}
+
+		for (int32 y = FirstCell.Y; y <= LastCell.Y; y++)
+		{
+			LinePoints[0] = Visible.Origin + FVector2D(FirstCell.X, y) * CellSize;
+			LinePoints[1] = Visible.Origin + FVector2D(LastCell.X, y) * CellSize;
+			FSlateDrawElement::MakeLines(OutDrawElements, LayerId, AllottedGeometry.ToPaintGeometry(), LinePoints, ESlateDrawEffect::None, GridLinesColor, false);
+		}
+	}
+
+	OutDrawElements.PopClip();
+	return LayerId;
+}
+
+FVector2D SCellsTexture::ComputeDesiredSize(float LayoutScaleMultiplier) const
+{
+	return FVector2D(CellsSize.X, CellsSize.Y);
+}
+
+FReply SCellsTexture::OnMouseWheel(const FGeometry& MyGeometry, const FPointerEvent& MouseEvent)
+{
+	const FVector2D LocalSize = MyGeometry.GetLocalSize();
+	const float FitCellSize = GetCellSize(LocalSize);
+	if (FitCellSize <= 0.f)
+	{
+		return FReply::Unhandled();
+	}
+
+	//The cell under the mouse stays under it.
+	const FVector2D MouseOffset = MyGeometry.AbsoluteToLocal(MouseEvent.GetScreenSpacePosition()) - LocalSize * .5f;
+	const FVector2D MouseCell = ViewCenter + MouseOffset / (FitCellSize * Zoom);
+
+	Zoom = FMath::Clamp(Zoom * FMath::Pow(1.25f, MouseEvent.GetWheelDelta()), 1.f, FMath::Max(1.f, MaxCellPixels / FitCellSize));
+	ViewCenter = MouseCell - MouseOffset / (FitCellSize * Zoom);
+
+	Invalidate(EInvalidateWidgetReason::Paint);
+	return FReply::Handled();
+}
+
+FReply SCellsTexture::OnMouseButtonDown(const FGeometry& MyGeometry, const FPointerEvent& MouseEvent)
+{
+	if (MouseEvent.GetEffectingButton() != EKeys::RightMouseButton && MouseEvent.GetEffectingButton() != EKeys::MiddleMouseButton)
+	{
+		return FReply::Unhandled();
+	}
+
+	bIsPanning = true;
+	return FReply::Handled().CaptureMouse(SharedThis(this));
+}
+
+FReply SCellsTexture::OnMouseButtonUp(const FGeometry& MyGeometry, const FPointerEvent& MouseEvent)
+{
+	if (!bIsPanning)
+	{
+		return FReply::Unhandled();
+	}
+
+	bIsPanning = false;
+	return FReply::Handled().ReleaseMouseCapture();
+}
+
+FReply SCellsTexture::OnMouseMove(const FGeometry& MyGeometry, const FPointerEvent& MouseEvent)
+{
+	const float CellSize = GetCellSize(MyGeometry.GetLocalSize()) * Zoom;
+	if (!bIsPanning || !HasMouseCapture() || CellSize <= 0.f)
+	{
+		return FReply::Unhandled();
+	}
+
+	ViewCenter -= MouseEvent.GetCursorDelta() / (MyGeometry.Scale * CellSize);
+
+	Invalidate(EInvalidateWidgetReason::Paint);
+	return FReply::Handled();
+}
+
+FReply SCellsTexture::OnMouseButtonDoubleClick(const FGeometry& MyGeometry, const FPointerEvent& MouseEvent)
+{
+	ResetView();
+	return FReply::Handled();
+}
+
+void SCellsTexture::AddReferencedObjects(FReferenceCollector& Collector)
+{
+	for (TMap<FIntPoint, FCellsTile>& Tiles : Levels)
+	{
+		for (TPair<FIntPoint, FCellsTile>& pair : Tiles)
+		{
+			Collector.AddReferencedObject(pair.Value.Texture);
+		}
+	}
+}
+
+FString SCellsTexture::GetReferencerName() const
+{
+	return TEXT("SCellsTexture");
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Widgets/SLeafWidget.h"
+#include "UObject/GCObject.h"
+#include "Styling/SlateBrush.h"
+
+class UTexture2D;
+struct FCellGridData;
+
+/**
+*	Draws the cells as textures with one texel per cell, on quads with nearest filtering.
+*	The cells are split in square tiles kept in a quadtree. Each level above the cells has one texel per 2x2 texels of the level below,
+*	so zoomed out the layout is drawn from a few downsampled tiles instead of every cell.
+*	Only the tiles visible at the current zoom get a texture, and only the tiles with changed cells are built and uploaded again.
+*	Zoomed with the mouse wheel and panned dragging with the right or middle mouse button. Double click fits the cells again.
+*/
+class SCellsTexture : public SLeafWidget, public FGCObject
+{
+public:
+	SLATE_BEGIN_ARGS(SCellsTexture)
+		: _ShowGridLines(false)
+		, _GridLinesColor(FLinearColor(0.f, 0.f, 0.f, .5f))
+		, _MinCellPixelsForGridLines(6.f)
+	{}
+		/* Draws a line between the rows and columns of cells, instead of the lines of each cell.*/
+		SLATE_ATTRIBUTE(bool, ShowGridLines)
+		SLATE_ARGUMENT(FLinearColor, GridLinesColor)
+
+		/* The grid lines are not drawn when the cells are smaller than this on screen.*/
+		SLATE_ARGUMENT(float, MinCellPixelsForGridLines)
+	SLATE_END_ARGS()
+
+	/* Side of the tiles, in texels. Power of two, so tile coordinates are shifts.*/
+	static const int32 TileSizeLog2 = 8;
+	static const int32 TileSize = 1 << TileSizeLog2;
+
+	/* Tiles with a texture before the ones out of the view release theirs.*/
+	static const int32 MaxTileTextures = 256;
+
+	static constexpr float MaxCellPixels = 64.f;
+
+	void Construct(const FArguments& InArgs);
+
+	/* Replaces all the cells. The tiles are built again when visible. The view keeps on the same cells, unless there were none.*/
+	void SetCellsData(const TArray<FCellGridData>& DataIn);
+
+	/* Changes only the given cells. Only the tiles with them are built and uploaded again. Cells out of the current bounds are ignored.*/
+	void UpdateCellsData(const TArray<FCellGridData>& DataIn);
+
+	void SetShowGridLines(bool bShowIn);
+
+	/* Fits all the cells in the widget.*/
+	void ResetView();
+
+	virtual void Tick(const FGeometry& AllottedGeometry, const double InCurrentTime, const float InDeltaTime) override;
+	virtual int32 OnPaint(const FPaintArgs& Args, const FGeometry& AllottedGeometry, const FSlateRect& MyCullingRect, FSlateWindowElementList& OutDrawElements, int32 LayerId, const FWidgetStyle& InWidgetStyle, bool bParentEnabled) const override;
+	virtual FVector2D ComputeDesiredSize(float LayoutScaleMultiplier) const override;
+
+	virtual FReply OnMouseWheel(const FGeometry& MyGeometry, const FPointerEvent& MouseEvent) override;
+	virtual FReply OnMouseButtonDown(const FGeometry& MyGeometry, const FPointerEvent& MouseEvent) override;
+	virtual FReply OnMouseButtonUp(const FGeometry& MyGeometry, const FPointerEvent& MouseEvent) override;
+	virtual FReply OnMouseMove(const FGeometry& MyGeometry, const FPointerEvent& MouseEvent) override;
+	virtual FReply OnMouseButtonDoubleClick(const FGeometry& MyGeometry, const FPointerEvent& MouseEvent) override;
+
+	virtual void AddReferencedObjects(FReferenceCollector& Collector) override;
+	virtual FString GetReferencerName() const override;
+
+private:
+	struct FCellsTile
+	{
+		/* Downsampled colors of the levels above the cells. The cells tiles read the cells texels instead.*/
+		TArray<FColor> Colors;
+
+		TObjectPtr<UTexture2D> Texture = nullptr;
+		FSlateBrush Brush;
+
+		bool bColorsDirty = true;
+		bool bTextureDirty = true;
+	};
+
+	/* The tiles visible with the current view, at the level drawn.*/
+	struct FVisibleTiles
+	{
+		int32 Level = 0;
+		FIntPoint MinTile = FIntPoint::ZeroValue;
+		FIntPoint MaxTile = FIntPoint(-1, -1);
+
+		/* Local position of the first cell and local size of a texel of the level.*/
+		FVector2D Origin = FVector2D::ZeroVector;
+		float TexelSize = 0.f;
+	};
+
+	/* One color per cell, row by row. Cells without data are transparent.*/
+	TArray<FColor> Texels;
+
+	/* The cell of the first texel, and the cells per row and column.*/
+	FIntPoint MinCell = FIntPoint::ZeroValue;
+	FIntPoint CellsSize = FIntPoint::ZeroValue;
+
+	/* Tiles of each level, created when first needed. Level 0 has one texel per cell, the last level a single tile.*/
+	TArray<TMap<FIntPoint, FCellsTile>> Levels;
+	int32 TileTexturesAmount = 0;
+
+	/* The cell in the center of the widget, and the zoom over the size that fits all the cells.*/
+	FVector2D ViewCenter = FVector2D::ZeroVector;
+	float Zoom = 1.f;
+
+	bool bIsPanning = false;
+
+	TAttribute<bool> ShowGridLines;
+	FLinearColor GridLinesColor;
+	float MinCellPixelsForGridLines = 6.f;
+
+	/* Side of a cell on screen, in local units, when the cells are fit into the size.*/
+	float GetCellSize(const FVector2D& LocalSizeIn) const;
+
+	FVisibleTiles GetVisibleTiles(const FGeometry& GeometryIn) const;
+
+	/* Texels per row and column of the level.*/
+	FIntPoint GetLevelSize(int32 LevelIn) const;
+
+	/* Marks the tiles with the cell, in every level, to be built and uploaded again.*/
+	void MarkCellDirty(const FIntPoint& TexelIn);
+
+	/* Builds the tile colors from the 2x2 tiles below, building those first if they are dirty.*/
+	FCellsTile& GetTileColors(int32 LevelIn, const FIntPoint& TileIn);
+
+	void UploadTile(int32 LevelIn, const FIntPoint& TileIn, FCellsTile& TileOut);
+
+	/* Releases the textures of the tiles that are not visible.*/
+	void ReleaseTileTextures(const FVisibleTiles& VisibleIn);
+
+	/* The most repeated drawn color of the block, so thin corridors and walls do not fade out when zoomed out.*/
+	static FColor GetBlockColor(const FColor (&BlockIn)[4]);
+};
@@ -0,0 +1,242 @@
+#include "SLayoutStatsTimeline.h"
+#include "Rendering/DrawElements.h"
+#include "Styling/CoreStyle.h"
+#include "Fonts/FontMeasure.h"
+#include "Framework/Application/SlateApplication.h"
+
+#define LOCTEXT_NAMESPACE "SLayoutStatsTimeline"
+
+void SLayoutStatsTimeline::Construct(const FArguments& InArgs)
+{
+	RowHeight = InArgs._RowHeight;
+	LabelsWidth = InArgs._LabelsWidth;
+}
+
+void SLayoutStatsTimeline::SetStats(const FTerrainLayoutStats& StatsIn)
+{
+	Bars.Reset();
+	HoveredBar = INDEX_NONE;
+	TotalSeconds = StatsIn.TotalSeconds;
+
+	//Thread rows in the order the threads were first used. Workers without a thread id get a row each, they may have run on different threads.
+	TMap<int32, int32> ThreadRows;
+	ThreadRowsAmount = 0;
+
+	for (const FTerrainLayoutStageStats& StageStats : StatsIn.Stages)
+	{
+		if (StageStats.WallSeconds <= 0)
+		{
+			continue;
+		}
+
+		FTimelineBar StageBar = FTimelineBar();
+		StageBar.Stage = StageStats.Stage;
+		StageBar.StartSeconds = StageStats.StartSeconds;
+		StageBar.EndSeconds = StageStats.StartSeconds + StageStats.WallSeconds;
+		StageBar.bWorkerTimesMissing = StageStats.bWorkerTimesMissing;
+		Bars.Add(StageBar);
+
+		for (int32 i = 0; i < StageStats.WorkerBusySeconds.Num(); i++)
+		{
+			const int32 ThreadId = StageStats.WorkerThreadIds.IsValidIndex(i) ? StageStats.WorkerThreadIds[i] : 0;
+			const int32 ThreadRow = ThreadId != 0 ? ThreadRows.FindOrAdd(ThreadId, ThreadRowsAmount) : ThreadRowsAmount;
+			ThreadRowsAmount = FMath::Max(ThreadRowsAmount, ThreadRow + 1);
+
+			FTimelineBar WorkerBar = FTimelineBar();
+			WorkerBar.Row = ThreadRow + 1;
+			WorkerBar.Stage = StageStats.Stage;
+			WorkerBar.StartSeconds = StageStats.WorkerStartSeconds.IsValidIndex(i) ? StageStats.WorkerStartSeconds[i] : StageStats.StartSeconds;
+			WorkerBar.EndSeconds = WorkerBar.StartSeconds + StageStats.WorkerBusySeconds[i];
+			Bars.Add(WorkerBar);
+
+			TotalSeconds = FMath::Max(TotalSeconds, WorkerBar.EndSeconds);
+		}
+
+		TotalSeconds = FMath::Max(TotalSeconds, StageBar.EndSeconds);
+	}
+
+	SetToolTipText(FText::GetEmpty());
+	Invalidate(EInvalidateWidgetReason::LayoutAndVolatility);
+}
+
+FLinearColor SLayoutStatsTimeline::GetStageColor(ETerrainGen_LayoutStage StageIn)
+{
+	static const FLinearColor StageColors[] =
+	{
+		FLinearColor(0.35f, 0.35f, 0.8f),
+		FLinearColor(0.2f, 0.6f, 0.85f),
+		FLinearColor(0.2f, 0.75f, 0.55f),
+		FLinearColor(0.85f, 0.65f, 0.2f),
+		FLinearColor(0.8f, 0.35f, 0.3f),
+		FLinearColor(0.65f, 0.4f, 0.75f)
+	};
+
+	const int32 Index = StaticCast<int32>(StageIn);
+	return Index < UE_ARRAY_COUNT(StageColors) ? StageColors[Index] : FLinearColor::Gray;
+}
+
+int32 SLayoutStatsTimeline::OnPaint(const FPaintArgs& Args, const FGeometry& AllottedGeometry, const FSlateRect& MyCullingRect, FSlateWindowElementList& OutDrawElements, int32 LayerId, const FWidgetStyle& InWidgetStyle, bool bParentEnabled) const
+{
+	const FSlateBrush* WhiteBrush = FCoreStyle::Get().GetBrush("GenericWhiteBox");
+	const FSlateFontInfo Font = FCoreStyle::GetDefaultFontStyle("Regular", 8);
+	const FVector2D LocalSize = AllottedGeometry.GetLocalSize();
+	const TSharedRef<FSlateFontMeasure> FontMeasure = FSlateApplication::Get().GetRenderer()->GetFontMeasureService();
+
+	OutDrawElements.PushClip(FSlateClippingZone(AllottedGeometry));
+
+	//Row labels.
+	for (int32 Row = 0; Row <= ThreadRowsAmount; Row++)
+	{
+		const FText Label = Row == 0 ? LOCTEXT("Stages", "Stages") : FText::Format(LOCTEXT("ThreadRow", "Thread {0}"), Row);
+		FSlateDrawElement::MakeText(
+			OutDrawElements,
+			LayerId,
+			AllottedGeometry.ToPaintGeometry(FVector2D(LabelsWidth, RowHeight), FSlateLayoutTransform(FVector2D(0.f, Row * RowHeight))),
+			Label,
+			Font,
+			ESlateDrawEffect::None,
+			FLinearColor::White);
+	}
+
+	for (int32 i = 0; i < Bars.Num(); i++)
+	{
+		const FSlateRect Rect = GetBarRect(Bars[i], LocalSize);
+		const FVector2D Size = Rect.GetSize();
+		FLinearColor Color = GetStageColor(Bars[i].Stage);
+		if (i == HoveredBar)
+		{
+			Color = Color * 1.4f;
+		}
+
+		if (Bars[i].bWorkerTimesMissing)
+		{
+			Color.A = 0.4f;
+		}
+
+		FSlateDrawElement::MakeBox(
+			OutDrawElements,
+			LayerId,
+			AllottedGeometry.ToPaintGeometry(FVector2D(FMath::Max(Size.X, 1.f), Size.Y), FSlateLayoutTransform(Rect.GetTopLeft())),
+			WhiteBrush,
+			ESlateDrawEffect::None,
+			Color);
+
+		//Only the stage names, and only where they fit.
+		if (Bars[i].Row == 0)
+		{
+			const FText StageName = FText::FromString(StaticEnum<ETerrainGen_LayoutStage>()->GetNameStringByValue(StaticCast<int64>(Bars[i].Stage)));
+			if (FontMeasure->Measure(StageName, Font).X < Size.X)
+			{
+				FSlateDrawElement::MakeText(
+					OutDrawElements,
+					LayerId + 1,
+					AllottedGeometry.ToPaintGeometry(Size, FSlateLayoutTransform(Rect.GetTopLeft() + FVector2D(2.f, 0.f))),
+					StageName,
+					Font,
+					ESlateDrawEffect::None,
+					FLinearColor::Black);
+			}
+		}
+	}
+
+	//Time axis under the rows.
+	const float AxisY = (ThreadRowsAmount + 1) * RowHeight;
+	TArray<FVector2D> LinePoints;
+	LinePoints.Add(FVector2D(LabelsWidth, AxisY));
+	LinePoints.Add(FVector2D(LocalSize.X, AxisY));
+	FSlateDrawElement::MakeLines(OutDrawElements, LayerId, AllottedGeometry.ToPaintGeometry(), LinePoints, ESlateDrawEffect::None, FLinearColor::Gray, false);
+
+	const FText EndText = FText::FromString(FString::Printf(TEXT("%.1f ms"), TotalSeconds * 1000.0));
+	const float EndTextWidth = FontMeasure->Measure(EndText, Font).X;
+	FSlateDrawElement::MakeText(
+		OutDrawElements,
+		LayerId,
+		AllottedGeometry.ToPaintGeometry(FVector2D(LabelsWidth, RowHeight), FSlateLayoutTransform(FVector2D(LabelsWidth, AxisY))),
+		LOCTEXT("StartTime", "0 ms"),
+		Font,
+		ESlateDrawEffect::None,
+		FLinearColor::Gray);
+	FSlateDrawElement::MakeText(
+		OutDrawElements,
+		LayerId,
+		AllottedGeometry.ToPaintGeometry(FVector2D(EndTextWidth, RowHeight), FSlateLayoutTransform(FVector2D(LocalSize.X - EndTextWidth, AxisY))),
+		EndText,
+		Font,
+		ESlateDrawEffect::None,
+		FLinearColor::Gray);
+
+	OutDrawElements.PopClip();
+	return LayerId + 1;
+}
+
+FVector2D SLayoutStatsTimeline::ComputeDesiredSize(float LayoutScaleMultiplier) const
+{
+	//The stages row, the thread rows and the axis.
+	return FVector2D(LabelsWidth + 300.f, (ThreadRowsAmount + 2) * RowHeight);
+}
+
+FReply SLayoutStatsTimeline::OnMouseMove(const FGeometry& MyGeometry, const FPointerEvent& MouseEvent)
+{
+	const FVector2D LocalPosition = MyGeometry.AbsoluteToLocal(MouseEvent.GetScreenSpacePosition());
+	const FVector2D LocalSize = MyGeometry.GetLocalSize();
+
+	int32 NewHoveredBar = INDEX_NONE;
+	for (int32 i = 0; i < Bars.Num(); i++)
+	{
+		if (GetBarRect(Bars[i], LocalSize).ContainsPoint(LocalPosition))
+		{
+			NewHoveredBar = i;
+			break;
+		}
+	}
+
+	if (NewHoveredBar != HoveredBar)
+	{
+		HoveredBar = NewHoveredBar;
+		SetToolTipText(HoveredBar == INDEX_NONE ? FText::GetEmpty() : GetBarText(Bars[HoveredBar]));
+		Invalidate(EInvalidateWidgetReason::Paint);
+	}
+
+	return FReply::Unhandled();
+}
+
+void SLayoutStatsTimeline::OnMouseLeave(const FPointerEvent& MouseEvent)
+{
+	SLeafWidget::OnMouseLeave(MouseEvent);
+
+	if (HoveredBar != INDEX_NONE)
+	{
+		HoveredBar = INDEX_NONE;
+		SetToolTipText(FText::GetEmpty());
+		Invalidate(EInvalidateWidgetReason::Paint);
+	}
+}
+
+FSlateRect SLayoutStatsTimeline::GetBarRect(const FTimelineBar& BarIn, const FVector2D& LocalSizeIn) const
+{
+	const float BarsWidth = FMath::Max(LocalSizeIn.X - LabelsWidth, 1.f);
+	const double SecondsToLocal = TotalSeconds > 0 ? BarsWidth / TotalSeconds : 0;
+
+	const float Left = LabelsWidth + StaticCast<float>(BarIn.StartSeconds * SecondsToLocal);
+	const float Right = LabelsWidth + StaticCast<float>(BarIn.EndSeconds * SecondsToLocal);
+	const float Top = BarIn.Row * RowHeight + 1.f;
+
+	return FSlateRect(Left, Top, Right, Top + RowHeight - 2.f);
+}
+
+FText SLayoutStatsTimeline::GetBarText(const FTimelineBar& BarIn) const
+{
+	const FString StageName = StaticEnum<ETerrainGen_LayoutStage>()->GetNameStringByValue(StaticCast<int64>(BarIn.Stage));
+	const FString Owner = BarIn.Row == 0 ? FString(TEXT("Stage")) : FString::Printf(TEXT("Thread %i worker"), BarIn.Row);
+	const TCHAR* WorkerTimesNote = BarIn.bWorkerTimesMissing ? TEXT("\nThe workers of the stage didn't report their times.") : TEXT("");
+
+	return FText::FromString(FString::Printf(TEXT("%s %s\nStart: %.2f ms\nEnd: %.2f ms\nDuration: %.2f ms%s"),
+		*StageName,
+		*Owner,
+		BarIn.StartSeconds * 1000.0,
+		BarIn.EndSeconds * 1000.0,
+		(BarIn.EndSeconds - BarIn.StartSeconds) * 1000.0,
+		WorkerTimesNote));
+}
+
+#undef LOCTEXT_NAMESPACE
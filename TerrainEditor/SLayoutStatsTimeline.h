@@ -0,0 +1,62 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Widgets/SLeafWidget.h"
+#include "Layout/TerrainLayoutStats.h"
+
+/**
+*	Draws the stages of a layout generation and the workers of each stage on a time line.
+*	The first row has a bar per stage, the next rows a bar per worker or task, one row per thread they ran on.
+*	Hovering a bar shows its timings.
+*/
+class SLayoutStatsTimeline : public SLeafWidget
+{
+public:
+	SLATE_BEGIN_ARGS(SLayoutStatsTimeline)
+		: _RowHeight(14.f)
+		, _LabelsWidth(70.f)
+	{}
+		SLATE_ARGUMENT(float, RowHeight)
+		SLATE_ARGUMENT(float, LabelsWidth)
+	SLATE_END_ARGS()
+
+	void Construct(const FArguments& InArgs);
+
+	void SetStats(const FTerrainLayoutStats& StatsIn);
+
+	/* Colors of the stage bars, indexed by the stage.*/
+	static FLinearColor GetStageColor(ETerrainGen_LayoutStage StageIn);
+
+	virtual int32 OnPaint(const FPaintArgs& Args, const FGeometry& AllottedGeometry, const FSlateRect& MyCullingRect, FSlateWindowElementList& OutDrawElements, int32 LayerId, const FWidgetStyle& InWidgetStyle, bool bParentEnabled) const override;
+	virtual FVector2D ComputeDesiredSize(float LayoutScaleMultiplier) const override;
+
+	virtual FReply OnMouseMove(const FGeometry& MyGeometry, const FPointerEvent& MouseEvent) override;
+	virtual void OnMouseLeave(const FPointerEvent& MouseEvent) override;
+
+private:
+	struct FTimelineBar
+	{
+		/* 0 for the stages, the thread row plus one for the workers.*/
+		int32 Row = 0;
+		ETerrainGen_LayoutStage Stage = ETerrainGen_LayoutStage::InitialLayout;
+
+		/* A stage bar whose workers didn't report their times, drawn faded as it has no worker bars.*/
+		bool bWorkerTimesMissing = false;
+
+		/* Seconds from the generation start.*/
+		double StartSeconds = 0;
+		double EndSeconds = 0;
+	};
+
+	TArray<FTimelineBar> Bars;
+	int32 ThreadRowsAmount = 0;
+	double TotalSeconds = 0;
+	int32 HoveredBar = INDEX_NONE;
+
+	float RowHeight = 14.f;
+	float LabelsWidth = 70.f;
+
+	/* Local rect of the bar, left top and size.*/
+	FSlateRect GetBarRect(const FTimelineBar& BarIn, const FVector2D& LocalSizeIn) const;
+	FText GetBarText(const FTimelineBar& BarIn) const;
+};
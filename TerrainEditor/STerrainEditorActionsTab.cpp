@@ -5,9 +5,15 @@
 #include "Terrain/TerrainGeneratorSubsystem.h"
 #include "Terrain/TerrainData.h"
 #include "Terrain/TerrainGeneratorTypes.h"
+#include "Layout/TerrainLayoutSubsystem.h"
+#include "Layout/TerrainLayoutData.h"
+#include "Layout/TerrainLayoutRoomData.h"
 #include "STextCheckbox.h"
 #include "Widgets/Layout/SWrapBox.h"
 #include "STextButton.h"
+#include "STerrainEditorProfilerPanel.h"
+#include "STerrainEditorSeedExplorer.h"
+#include "Widgets/Layout/SExpandableArea.h"
 
 #define LOCTEXT_NAMESPACE "STerrainEditorActionsTab"
 
@@ -28,6 +34,13 @@ void STerrainEditorActionsTab::Construct(const FArguments& InArgs, const TShared
 
 	SelectedState = MakeShareable(new FText(*StateOptions[3]));
 
+	OverlayOptions.Add(MakeShareable(new FText(LOCTEXT("No Overlay", "No Overlay"))));
+	OverlayOptions.Add(MakeShareable(new FText(LOCTEXT("Search Expansions", "Search Expansions"))));
+	OverlayOptions.Add(MakeShareable(new FText(LOCTEXT("Search Cost", "Search Cost"))));
+	OverlayOptions.Add(MakeShareable(new FText(LOCTEXT("Room Depth", "Room Depth"))));
+	OverlayOptions.Add(MakeShareable(new FText(LOCTEXT("Wall Distance", "Wall Distance"))));
+	SelectedOverlay = OverlayOptions[0];
+
 	ChildSlot
 	[
 		SNew(SVerticalBox)
@@ -56,6 +69,30 @@ void STerrainEditorActionsTab::Construct(const FArguments& InArgs, const TShared
 					.IsChecked(ECheckBoxState::Checked)
 					.OnCheckStateChanged(this, &STerrainEditorActionsTab::OnCheckBoxStateChangedGridMesh)
 				]
+				+ SVerticalBox::Slot()
+				.AutoHeight()
+				[
+					SNew(STextCheckbox)
+					.Text(LOCTEXT("Use Texture", "Use Texture"))
+					.IsChecked(ECheckBoxState::Unchecked)
+					.OnCheckStateChanged(this, &STerrainEditorActionsTab::OnCheckBoxStateChangedTexture)
+				]
+				+ SVerticalBox::Slot()
+				.AutoHeight()
+				[
+					SNew(STextCheckbox)
+					.Text(LOCTEXT("Show Grid Lines", "Show Grid Lines"))
+					.IsChecked(ECheckBoxState::Unchecked)
+					.OnCheckStateChanged(this, &STerrainEditorActionsTab::OnCheckBoxStateChangedGridLines)
+				]
+				+ SVerticalBox::Slot()
+				.AutoHeight()
+				[
+					SNew(STextCheckbox)
+					.Text(LOCTEXT("Live Regeneration", "Live Regeneration"))
+					.IsChecked(ECheckBoxState::Unchecked)
+					.OnCheckStateChanged(this, &STerrainEditorActionsTab::OnCheckBoxStateChangedLiveRegeneration)
+				]
 			]
 			+ SHorizontalBox::Slot()
 			.FillWidth(.5f)
@@ -130,7 +167,42 @@ void STerrainEditorActionsTab::Construct(const FArguments& InArgs, const TShared
 						.IsChecked(ECheckBoxState::Checked)
 						.OnCheckStateChanged(this, &STerrainEditorActionsTab::OnCheckBoxStateChangedDraw)
 					]					
-				]			
+				]
+				+ SVerticalBox::Slot()
+				.AutoHeight()
+				[
+					SNew(SComboBox<TSharedPtr<FText>>)
+					.OptionsSource(&OverlayOptions)
+					.InitiallySelectedItem(SelectedOverlay)
+					.OnSelectionChanged_Lambda([this](TSharedPtr<FText> NewSelection, ESelectInfo::Type SelectInfo)
+					{
+						int32 Index = 0;
+						if (!NewSelection.IsValid() || !OverlayOptions.Find(NewSelection, Index))
+						{
+							return;
+						}
+
+						SelectedOverlay = NewSelection;
+						if (!TerrainEditor.IsValid() || !TerrainEditor->GetTerrainEditorViewport())
+						{
+							return;
+						}
+
+						TerrainEditor->GetTerrainEditorViewport()->SetLayoutOverlay(StaticCast<ETerrainEditorLayoutOverlay>(Index));
+					})
+					.OnGenerateWidget_Lambda([](TSharedPtr<FText> Option)
+					{
+						return SNew(STextBlock)
+							.Text(*Option);
+					})
+					[
+						SNew(STextBlock)
+						.Text_Lambda([this]()
+						{
+							return SelectedOverlay.IsValid() ? *SelectedOverlay : FText::FromString("-");
+						})
+					]
+				]
 			]
 		]				
 		+ SVerticalBox::Slot()
@@ -208,10 +280,47 @@ void STerrainEditorActionsTab::Construct(const FArguments& InArgs, const TShared
 					]							
 				]
 			]
-		]			
+		]
+		+ SVerticalBox::Slot()
+		.Padding(SlotsPadding)
+		.AutoHeight()
+		[
+			SNew(SExpandableArea)
+			.InitiallyCollapsed(true)
+			.AreaTitle(LOCTEXT("Generation Profiler", "Generation Profiler"))
+			.BodyContent()
+			[
+				SAssignNew(ProfilerPanel, STerrainEditorProfilerPanel)
+			]
+		]
+		+ SVerticalBox::Slot()
+		.Padding(SlotsPadding)
+		.AutoHeight()
+		[
+			SNew(SExpandableArea)
+			.InitiallyCollapsed(true)
+			.AreaTitle(LOCTEXT("Seed Explorer", "Seed Explorer"))
+			.BodyContent()
+			[
+				SNew(STerrainEditorSeedExplorer)
+				.TerrainData_Lambda([this]()
+				{
+					return TerrainData;
+				})
+				.OnSeedSelected(this, &STerrainEditorActionsTab::OnExploredSeedSelected)
+			]
+		]
 	];	
 		
 	LoadTerrainData();
+	FCoreUObjectDelegates::OnObjectPropertyChanged.AddSP(this, &STerrainEditorActionsTab::OnObjectPropertyChanged);
+
+	UTerrainLayoutSubsystem* TerrainLayoutSubsystem = GEngine->GetEngineSubsystem<UTerrainLayoutSubsystem>();
+	if (TerrainLayoutSubsystem)
+	{
+		TerrainLayoutSubsystem->OnLayoutGenerated.AddSP(this, &STerrainEditorActionsTab::OnLayoutGenerated);
+	}
+
 	GenerateTerrainButtonClicked();	
 }
 
@@ -244,6 +353,12 @@ FReply STerrainEditorActionsTab::GenerateTerrainButtonClicked()
 	return FReply::Handled();
 }
 
+void STerrainEditorActionsTab::OnExploredSeedSelected(int32 Seed)
+{
+	const FString textString = FString("Seed: " + FString::FromInt(Seed));
+	SeedText->SetText(FText::FromString(textString));
+}
+
 void STerrainEditorActionsTab::UpdateSeedText()
 {
 	if (!GetTerrainGeneratorSubsystem())
@@ -297,6 +412,38 @@ void STerrainEditorActionsTab::OnCheckBoxStateChangedGridMesh(ECheckBoxState New
 	TerrainEditor->GetTerrainEditorViewport()->SetUseGridMesh(bIsChecked);
 }
 
+void STerrainEditorActionsTab::OnCheckBoxStateChangedTexture(ECheckBoxState NewState) const
+{
+	if (!TerrainEditor.IsValid())
+	{
+		return;
+	}
+
+	if (!TerrainEditor->GetTerrainEditorViewport())
+	{
+		return;
+	}
+
+	const bool bIsChecked = ECheckBoxState::Checked == NewState;
+	TerrainEditor->GetTerrainEditorViewport()->SetUseTexture(bIsChecked);
+}
+
+void STerrainEditorActionsTab::OnCheckBoxStateChangedGridLines(ECheckBoxState NewState) const
+{
+	if (!TerrainEditor.IsValid())
+	{
+		return;
+	}
+
+	if (!TerrainEditor->GetTerrainEditorViewport())
+	{
+		return;
+	}
+
+	const bool bIsChecked = ECheckBoxState::Checked == NewState;
+	TerrainEditor->GetTerrainEditorViewport()->SetShowGridLines(bIsChecked);
+}
+
 void STerrainEditorActionsTab::OnCheckBoxStateChangedDraw(ECheckBoxState NewState) const
 {
 	if (!TerrainEditor.IsValid())
@@ -322,6 +469,135 @@ void STerrainEditorActionsTab::OnCheckBoxStateChangedDraw(ECheckBoxState NewStat
 	);
 }
 
+STerrainEditorActionsTab::~STerrainEditorActionsTab()
+{
+	FCoreUObjectDelegates::OnObjectPropertyChanged.RemoveAll(this);
+
+	//The subsystem is shared with the rest of the editor, the snapshots are only worth their copies while this tab uses them.
+	if (!bLiveRegeneration || !GEngine)
+	{
+		return;
+	}
+
+	UTerrainLayoutSubsystem* TerrainLayoutSubsystem = GEngine->GetEngineSubsystem<UTerrainLayoutSubsystem>();
+	if (TerrainLayoutSubsystem)
+	{
+		TerrainLayoutSubsystem->SetCaptureStageSnapshots(false);
+	}
+}
+
+void STerrainEditorActionsTab::OnCheckBoxStateChangedLiveRegeneration(ECheckBoxState NewState)
+{
+	bLiveRegeneration = ECheckBoxState::Checked == NewState;
+
+	if (!bLiveRegeneration && LiveRegenerationTimer.IsValid())
+	{
+		UnRegisterActiveTimer(LiveRegenerationTimer.ToSharedRef());
+		LiveRegenerationTimer.Reset();
+	}
+
+	UTerrainLayoutSubsystem* TerrainLayoutSubsystem = GEngine->GetEngineSubsystem<UTerrainLayoutSubsystem>();
+	if (!TerrainLayoutSubsystem)
+	{
+		return;
+	}
+
+	//The snapshots let an edit regenerate only from the stage it changes.
+	TerrainLayoutSubsystem->SetCaptureStageSnapshots(bLiveRegeneration);
+}
+
+void STerrainEditorActionsTab::OnObjectPropertyChanged(UObject* Object, FPropertyChangedEvent& PropertyChangedEvent)
+{
+	if (!bLiveRegeneration)
+	{
+		return;
+	}
+
+	const ETerrainGen_LayoutStage Stage = GetFirstStageChangedBy(Object, PropertyChangedEvent);
+	if (Stage == ETerrainGen_LayoutStage::ETLS_MAX)
+	{
+		return;
+	}
+
+	UTerrainLayoutSubsystem* TerrainLayoutSubsystem = GEngine->GetEngineSubsystem<UTerrainLayoutSubsystem>();
+	if (!TerrainLayoutSubsystem)
+	{
+		return;
+	}
+
+	//The generation in flight uses the values from before the edit.
+	TerrainLayoutSubsystem->CancelLayoutGeneration();
+	LiveRegenerationStage = FMath::Min(LiveRegenerationStage, Stage);
+
+	if (LiveRegenerationTimer.IsValid())
+	{
+		UnRegisterActiveTimer(LiveRegenerationTimer.ToSharedRef());
+	}
+
+	LiveRegenerationTimer = RegisterActiveTimer(LiveRegenerationDelay, FWidgetActiveTimerDelegate::CreateSP(this, &STerrainEditorActionsTab::OnLiveRegenerationTimer));
+}
+
+ETerrainGen_LayoutStage STerrainEditorActionsTab::GetFirstStageChangedBy(const UObject* Object, const FPropertyChangedEvent& PropertyChangedEvent) const
+{
+	if (!Object || !TerrainData || !TerrainData->TerrainLayoutData)
+	{
+		return ETerrainGen_LayoutStage::ETLS_MAX;
+	}
+
+	const UTerrainLayoutData* LayoutData = TerrainData->TerrainLayoutData;
+	if (Object == LayoutData)
+	{
+		return UTerrainLayoutData::GetFirstStageReading(PropertyChangedEvent.MemberProperty ? PropertyChangedEvent.MemberProperty : PropertyChangedEvent.Property);
+	}
+
+	if (Object == TerrainData)
+	{
+		const bool bIsLayoutDataChanged = PropertyChangedEvent.GetMemberPropertyName() == GET_MEMBER_NAME_CHECKED(UTerrainData, TerrainLayoutData);
+		return bIsLayoutDataChanged ? ETerrainGen_LayoutStage::InitialLayout : ETerrainGen_LayoutStage::ETLS_MAX;
+	}
+
+	//The assets the layout data uses, or objects inside them.
+	for (const UTerrainLayoutRoomData* RoomData : LayoutData->RoomLayouts)
+	{
+		if (RoomData && (Object == RoomData || Object->IsIn(RoomData)))
+		{
+			return ETerrainGen_LayoutStage::RoomLayout;
+		}
+	}
+
+	const UObject* InitialRoomsLayout = LayoutData->InitialRoomsLayout;
+	if (InitialRoomsLayout && (Object == InitialRoomsLayout || Object->IsIn(InitialRoomsLayout)))
+	{
+		return ETerrainGen_LayoutStage::InitialLayout;
+	}
+
+	return Object->IsIn(LayoutData) ? ETerrainGen_LayoutStage::InitialLayout : ETerrainGen_LayoutStage::ETLS_MAX;
+}
+
+EActiveTimerReturnType STerrainEditorActionsTab::OnLiveRegenerationTimer(double InCurrentTime, float InDeltaTime)
+{
+	LiveRegenerationTimer.Reset();
+
+	UTerrainLayoutSubsystem* TerrainLayoutSubsystem = GEngine->GetEngineSubsystem<UTerrainLayoutSubsystem>();
+	if (!TerrainLayoutSubsystem || !TerrainData || LiveRegenerationStage == ETerrainGen_LayoutStage::ETLS_MAX)
+	{
+		return EActiveTimerReturnType::Stop;
+	}
+
+	//Without the snapshot of the stage the whole layout is generated again, with the same seed so only the edit changes it.
+	if (!TerrainLayoutSubsystem->RegenerateTerrainLayoutFromStage(TerrainData, LiveRegenerationStage))
+	{
+		TerrainLayoutSubsystem->GenerateTerrainLayout(TerrainData, TerrainLayoutSubsystem->GetLayoutStats().Seed);
+	}
+
+	return EActiveTimerReturnType::Stop;
+}
+
+void STerrainEditorActionsTab::OnLayoutGenerated(const FTerrainLayoutStats& LayoutStats)
+{
+	LiveRegenerationStage = ETerrainGen_LayoutStage::ETLS_MAX;
+}
+
 END_SLATE_FUNCTION_BUILD_OPTIMIZATION
 
 #undef LOCTEXT_NAMESPACE
\ No newline at end of file
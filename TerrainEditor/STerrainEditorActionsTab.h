@@ -2,12 +2,15 @@
 
 #include "CoreMinimal.h"
 #include "Widgets/SCompoundWidget.h"
+#include "Layout/TerrainLayoutStats.h"
 
 class SBaseTerrainEditor;
 class STextBlock;
 class UTerrainGeneratorSubsystem;
 class UTerrainData;
 class STextCheckbox;
+class STerrainEditorProfilerPanel;
+class FActiveTimerHandle;
 
 class STerrainEditorActionsTab : public SCompoundWidget
 {		
@@ -16,6 +19,7 @@ public:
 	SLATE_END_ARGS()
 
 	void Construct(const FArguments& InArgs, const TSharedRef<SBaseTerrainEditor>& InTerrainEditor);
+	virtual ~STerrainEditorActionsTab();
 
 private:	
 	TSharedPtr<STextBlock> SeedText;
@@ -31,12 +35,29 @@ private:
 	TSharedPtr <STextCheckbox> TextboxDrawDoors;	
 	TSharedPtr <STextCheckbox> TextboxDrawCells;
 
+	TSharedPtr<STerrainEditorProfilerPanel> ProfilerPanel;
+
 	TSharedPtr<SComboBox<TSharedPtr<FText>>> StateComboBox;
 	TSharedPtr<FText> SelectedState;
 	TArray<TSharedPtr<FText>> StateOptions;
 
+	/* Same order as ETerrainEditorLayoutOverlay.*/
+	TSharedPtr<FText> SelectedOverlay;
+	TArray<TSharedPtr<FText>> OverlayOptions;
+
 	UTerrainGeneratorSubsystem* TerrainGeneratorSubsystem= nullptr;
 
+	/**
+	*	Layout data edits regenerate the layout from the first stage they change, after a delay so dragging a value does not restart it each frame.
+	*	Off by default, it makes every generation copy the layout at each stage start.
+	*/
+	bool bLiveRegeneration = false;
+	static constexpr float LiveRegenerationDelay = .3f;
+
+	/* The first stage changed since the last completed generation. Edits during a regeneration cancel it, so it must start again from the earliest one.*/
+	ETerrainGen_LayoutStage LiveRegenerationStage = ETerrainGen_LayoutStage::ETLS_MAX;
+	TSharedPtr<FActiveTimerHandle> LiveRegenerationTimer;
+
 protected:
 
 	UTerrainData* TerrainData = nullptr;
@@ -53,11 +74,25 @@ protected:
 	}
 
 	void UpdateSeedText();
+
+	/* The seed explorer loads its seeds straight into the layout subsystem.*/
+	void OnExploredSeedSelected(int32 Seed);
 	UTerrainGeneratorSubsystem* GetTerrainGeneratorSubsystem();
 	
 	void LoadTerrainData();
 
 	void OnCheckBoxStateChangedGrid(ECheckBoxState NewState) const;
 	void OnCheckBoxStateChangedGridMesh(ECheckBoxState NewState) const;
+	void OnCheckBoxStateChangedTexture(ECheckBoxState NewState) const;
+	void OnCheckBoxStateChangedGridLines(ECheckBoxState NewState) const;
 	void OnCheckBoxStateChangedDraw(ECheckBoxState NewState) const;
+	void OnCheckBoxStateChangedLiveRegeneration(ECheckBoxState NewState);
+
+	void OnObjectPropertyChanged(UObject* Object, FPropertyChangedEvent& PropertyChangedEvent);
+
+	/* The first layout stage that reads the changed value. ETLS_MAX if the object is not used by the layout of the terrain data.*/
+	ETerrainGen_LayoutStage GetFirstStageChangedBy(const UObject* Object, const FPropertyChangedEvent& PropertyChangedEvent) const;
+
+	EActiveTimerReturnType OnLiveRegenerationTimer(double InCurrentTime, float InDeltaTime);
+	void OnLayoutGenerated(const FTerrainLayoutStats& LayoutStats);
 };
\ No newline at end of file
@@ -0,0 +1,325 @@
+#include "STerrainEditorProfilerPanel.h"
+#include "SlateOptMacros.h"
+#include "SLayoutStatsTimeline.h"
+#include "Layout/TerrainLayoutSubsystem.h"
+#include "Widgets/Layout/SGridPanel.h"
+#include "Widgets/Layout/SScrollBox.h"
+#include "Widgets/Input/SButton.h"
+#include "Widgets/Text/STextBlock.h"
+
+#define LOCTEXT_NAMESPACE "STerrainEditorProfilerPanel"
+
+#define SlotsPadding 5.f
+
+namespace TerrainEditorProfiler
+{
+	FSlateFontInfo GetFont()
+	{
+		return FCoreStyle::GetDefaultFontStyle("Regular", 9);
+	}
+
+	FText GetMilliseconds(double SecondsIn)
+	{
+		return FText::FromString(FString::Printf(TEXT("%.2f ms"), SecondsIn * 1000.0));
+	}
+
+	FText GetMegabytes(int64 BytesIn)
+	{
+		return FText::FromString(FString::Printf(TEXT("%.2f MB"), BytesIn / (1024.0 * 1024.0)));
+	}
+
+	/* The change over the previous run, so a parameter change can be judged at a glance.*/
+	FText GetChange(double ValueIn, double PreviousValueIn)
+	{
+		if (PreviousValueIn <= 0)
+		{
+			return FText::GetEmpty();
+		}
+
+		return FText::FromString(FString::Printf(TEXT("%+.0f%%"), (ValueIn / PreviousValueIn - 1.0) * 100.0));
+	}
+
+	FString GetStageName(ETerrainGen_LayoutStage StageIn)
+	{
+		return StaticEnum<ETerrainGen_LayoutStage>()->GetNameStringByValue(StaticCast<int64>(StageIn));
+	}
+
+	TSharedRef<SWidget> MakeCell(const FText& TextIn, const FLinearColor& ColorIn = FLinearColor::White)
+	{
+		return SNew(STextBlock)
+			.Font(GetFont())
+			.ColorAndOpacity(ColorIn)
+			.Text(TextIn);
+	}
+}
+
+BEGIN_SLATE_FUNCTION_BUILD_OPTIMIZATION
+
+void STerrainEditorProfilerPanel::Construct(const FArguments& InArgs)
+{
+	MaxRunsAmount = FMath::Max(InArgs._MaxRunsAmount, 1);
+
+	ChildSlot
+	[
+		SNew(SVerticalBox)
+		+ SVerticalBox::Slot()
+		.Padding(SlotsPadding)
+		.AutoHeight()
+		[
+			SAssignNew(SummaryText, STextBlock)
+			.Font(TerrainEditorProfiler::GetFont())
+			.AutoWrapText(true)
+			.Text(LOCTEXT("No runs", "Generate a layout to profile it."))
+		]
+		+ SVerticalBox::Slot()
+		.Padding(SlotsPadding)
+		.AutoHeight()
+		[
+			SAssignNew(Timeline, SLayoutStatsTimeline)
+		]
+		+ SVerticalBox::Slot()
+		.Padding(SlotsPadding)
+		.AutoHeight()
+		[
+			SAssignNew(StagesGrid, SGridPanel)
+		]
+		+ SVerticalBox::Slot()
+		.Padding(SlotsPadding)
+		.AutoHeight()
+		[
+			SNew(SHorizontalBox)
+			+ SHorizontalBox::Slot()
+			.FillWidth(1.f)
+			.VAlign(EVerticalAlignment::VAlign_Center)
+			[
+				SNew(STextBlock)
+				.Font(FCoreStyle::GetDefaultFontStyle("Bold", 9))
+				.Text(LOCTEXT("Last runs", "Last runs"))
+			]
+			+ SHorizontalBox::Slot()
+			.AutoWidth()
+			[
+				SNew(SButton)
+				.Text(LOCTEXT("Clear", "Clear"))
+				.OnClicked_Lambda([this]()
+				{
+					ClearRuns();
+					return FReply::Handled();
+				})
+			]
+		]
+		+ SVerticalBox::Slot()
+		.Padding(SlotsPadding)
+		.AutoHeight()
+		[
+			SNew(SScrollBox)
+			.Orientation(EOrientation::Orient_Horizontal)
+			+ SScrollBox::Slot()
+			[
+				SAssignNew(RunsGrid, SGridPanel)
+			]
+		]
+	];
+
+	UTerrainLayoutSubsystem* TerrainLayoutSubsystem = GEngine->GetEngineSubsystem<UTerrainLayoutSubsystem>();
+	if (!TerrainLayoutSubsystem)
+	{
+		return;
+	}
+
+	TerrainLayoutSubsystem->OnLayoutGenerated.AddSP(this, &STerrainEditorProfilerPanel::OnLayoutGenerated);
+	TerrainLayoutSubsystem->OnLayoutGenerationFailed.AddSP(this, &STerrainEditorProfilerPanel::OnLayoutGenerated);
+}
+
+void STerrainEditorProfilerPanel::AddRun(const FTerrainLayoutStats& StatsIn)
+{
+	if (Runs.Num() >= MaxRunsAmount)
+	{
+		Runs.RemoveAt(0, Runs.Num() - MaxRunsAmount + 1);
+	}
+
+	Runs.Add(StatsIn);
+	SelectRun(Runs.Num() - 1);
+}
+
+void STerrainEditorProfilerPanel::ClearRuns()
+{
+	Runs.Empty();
+	SelectedRun = INDEX_NONE;
+
+	Timeline->SetStats(FTerrainLayoutStats());
+	SummaryText->SetText(LOCTEXT("No runs", "Generate a layout to profile it."));
+	StagesGrid->ClearChildren();
+	RunsGrid->ClearChildren();
+}
+
+void STerrainEditorProfilerPanel::SelectRun(int32 RunIndexIn)
+{
+	if (!Runs.IsValidIndex(RunIndexIn))
+	{
+		return;
+	}
+
+	SelectedRun = RunIndexIn;
+	RefreshSelectedRun();
+	RefreshRuns();
+}
+
+void STerrainEditorProfilerPanel::RefreshSelectedRun()
+{
+	using namespace TerrainEditorProfiler;
+
+	const FTerrainLayoutStats& Stats = Runs[SelectedRun];
+	Timeline->SetStats(Stats);
+
+	FString Summary = FString::Printf(TEXT("Seed %i - %.2f ms. Rooms: %i, corridors: %i, failed corridors: %i, failed paths: %i, nodes expanded: %lld, path cache hits: %i/%i, walls: %i, cells: %i, peak layout: %.2f MB."),
+		Stats.Seed,
+		Stats.TotalSeconds * 1000.0,
+		Stats.RoomsAmount,
+		Stats.CorridorsAmount,
+		Stats.FailedCorridorsAmount,
+		Stats.FailedPathsAmount,
+		Stats.PathNodesExpanded,
+		Stats.PathCacheHits,
+		Stats.PathCacheHits + Stats.PathCacheMisses,
+		Stats.WallCellsAmount,
+		Stats.CellsAmount,
+		Stats.PeakLayoutBytes / (1024.0 * 1024.0));
+
+	if (Stats.bMemoryBudgetExceeded)
+	{
+		Summary += FString::Printf(TEXT("\nStopped at %s for going over the memory budget."), *GetStageName(Stats.MemoryBudgetExceededStage));
+	}
+
+	SummaryText->SetText(FText::FromString(Summary));
+
+	//A row per stage: start, wall and cpu time, workers, how many of them ran at once on average, cells and memory.
+	StagesGrid->ClearChildren();
+
+	const FText Headers[] =
+	{
+		LOCTEXT("Stage", "Stage"),
+		LOCTEXT("Start", "Start"),
+		LOCTEXT("Wall", "Wall"),
+		LOCTEXT("Cpu", "CPU"),
+		LOCTEXT("Workers", "Workers"),
+		LOCTEXT("Parallelism", "Parallelism"),
+		LOCTEXT("Cells", "Cells"),
+		LOCTEXT("Peak", "Peak memory")
+	};
+
+	for (int32 Column = 0; Column < UE_ARRAY_COUNT(Headers); Column++)
+	{
+		StagesGrid->AddSlot(Column, 0)
+		.Padding(FMargin(0.f, 0.f, 10.f, 2.f))
+		[
+			MakeCell(Headers[Column], FLinearColor::Gray)
+		];
+	}
+
+	int32 Row = 1;
+	for (const FTerrainLayoutStageStats& StageStats : Stats.Stages)
+	{
+		if (StageStats.WallSeconds <= 0)
+		{
+			continue;
+		}
+
+		//Unknown, not zero, when the workers didn't report their times.
+		const FText UnknownText = LOCTEXT("UnknownTime", "-");
+		const FText Cells[] =
+		{
+			FText::FromString(GetStageName(StageStats.Stage)),
+			GetMilliseconds(StageStats.StartSeconds),
+			GetMilliseconds(StageStats.WallSeconds),
+			StageStats.bWorkerTimesMissing ? UnknownText : GetMilliseconds(StageStats.CpuSeconds),
+			StageStats.bWorkerTimesMissing ? UnknownText : FText::AsNumber(StageStats.WorkerBusySeconds.Num()),
+			StageStats.bWorkerTimesMissing ? UnknownText : FText::FromString(FString::Printf(TEXT("%.2f"), StageStats.CpuSeconds / StageStats.WallSeconds)),
+			FText::AsNumber(StageStats.CellsProduced),
+			GetMegabytes(StageStats.PeakBytes)
+		};
+
+		for (int32 Column = 0; Column < UE_ARRAY_COUNT(Cells); Column++)
+		{
+			StagesGrid->AddSlot(Column, Row)
+			.Padding(FMargin(0.f, 0.f, 10.f, 0.f))
+			[
+				MakeCell(Cells[Column], Column == 0 ? SLayoutStatsTimeline::GetStageColor(StageStats.Stage) : FLinearColor::White)
+			];
+		}
+
+		Row++;
+	}
+}
+
+void STerrainEditorProfilerPanel::RefreshRuns()
+{
+	using namespace TerrainEditorProfiler;
+
+	RunsGrid->ClearChildren();
+
+	//A column per stage wall time, besides the totals.
+	const int32 StagesAmount = StaticCast<int32>(ETerrainGen_LayoutStage::ETLS_MAX);
+	int32 Column = 0;
+
+	RunsGrid->AddSlot(Column++, 0).Padding(FMargin(0.f, 0.f, 10.f, 2.f))[MakeCell(LOCTEXT("Seed", "Seed"), FLinearColor::Gray)];
+	RunsGrid->AddSlot(Column++, 0).Padding(FMargin(0.f, 0.f, 10.f, 2.f))[MakeCell(LOCTEXT("Total", "Total"), FLinearColor::Gray)];
+	RunsGrid->AddSlot(Column++, 0).Padding(FMargin(0.f, 0.f, 10.f, 2.f))[MakeCell(FText::GetEmpty())];
+	for (int32 i = 0; i < StagesAmount; i++)
+	{
+		const ETerrainGen_LayoutStage Stage = StaticCast<ETerrainGen_LayoutStage>(i);
+		RunsGrid->AddSlot(Column++, 0).Padding(FMargin(0.f, 0.f, 10.f, 2.f))[MakeCell(FText::FromString(GetStageName(Stage)), SLayoutStatsTimeline::GetStageColor(Stage))];
+	}
+
+	RunsGrid->AddSlot(Column++, 0).Padding(FMargin(0.f, 0.f, 10.f, 2.f))[MakeCell(LOCTEXT("Nodes expanded", "Nodes expanded"), FLinearColor::Gray)];
+	RunsGrid->AddSlot(Column++, 0).Padding(FMargin(0.f, 0.f, 10.f, 2.f))[MakeCell(LOCTEXT("Failed corridors", "Failed corridors"), FLinearColor::Gray)];
+	RunsGrid->AddSlot(Column++, 0).Padding(FMargin(0.f, 0.f, 10.f, 2.f))[MakeCell(LOCTEXT("Peak layout", "Peak layout"), FLinearColor::Gray)];
+
+	//Newest first.
+	for (int32 RunIndex = Runs.Num() - 1; RunIndex >= 0; RunIndex--)
+	{
+		const FTerrainLayoutStats& Stats = Runs[RunIndex];
+		const FTerrainLayoutStats* PreviousStats = Runs.IsValidIndex(RunIndex - 1) ? &Runs[RunIndex - 1] : nullptr;
+		const FLinearColor Color = RunIndex == SelectedRun ? FLinearColor::Yellow : FLinearColor::White;
+		const int32 Row = Runs.Num() - RunIndex;
+		Column = 0;
+
+		RunsGrid->AddSlot(Column++, Row)
+		.Padding(FMargin(0.f, 0.f, 10.f, 0.f))
+		[
+			SNew(SButton)
+			.ButtonStyle(FCoreStyle::Get(), "NoBorder")
+			.ContentPadding(0.f)
+			.OnClicked_Lambda([this, RunIndex]()
+			{
+				SelectRun(RunIndex);
+				return FReply::Handled();
+			})
+			[
+				MakeCell(FText::AsNumber(Stats.Seed, &FNumberFormattingOptions::DefaultNoGrouping()), Color)
+			]
+		];
+
+		RunsGrid->AddSlot(Column++, Row).Padding(FMargin(0.f, 0.f, 10.f, 0.f))[MakeCell(GetMilliseconds(Stats.TotalSeconds), Color)];
+		RunsGrid->AddSlot(Column++, Row).Padding(FMargin(0.f, 0.f, 10.f, 0.f))[MakeCell(PreviousStats ? GetChange(Stats.TotalSeconds, PreviousStats->TotalSeconds) : FText::GetEmpty(), FLinearColor::Gray)];
+
+		for (int32 i = 0; i < StagesAmount; i++)
+		{
+			const double WallSeconds = Stats.Stages.IsValidIndex(i) ? Stats.Stages[i].WallSeconds : 0;
+			RunsGrid->AddSlot(Column++, Row).Padding(FMargin(0.f, 0.f, 10.f, 0.f))[MakeCell(GetMilliseconds(WallSeconds), Color)];
+		}
+
+		RunsGrid->AddSlot(Column++, Row).Padding(FMargin(0.f, 0.f, 10.f, 0.f))[MakeCell(FText::AsNumber(Stats.PathNodesExpanded), Color)];
+		RunsGrid->AddSlot(Column++, Row).Padding(FMargin(0.f, 0.f, 10.f, 0.f))[MakeCell(FText::AsNumber(Stats.FailedCorridorsAmount), Color)];
+		RunsGrid->AddSlot(Column++, Row).Padding(FMargin(0.f, 0.f, 10.f, 0.f))[MakeCell(GetMegabytes(Stats.PeakLayoutBytes), Color)];
+	}
+}
+
+void STerrainEditorProfilerPanel::OnLayoutGenerated(const FTerrainLayoutStats& StatsIn)
+{
+	AddRun(StatsIn);
+}
+
+END_SLATE_FUNCTION_BUILD_OPTIMIZATION
+
+#undef LOCTEXT_NAMESPACE
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Widgets/SCompoundWidget.h"
+#include "Layout/TerrainLayoutStats.h"
+
+class SLayoutStatsTimeline;
+class SGridPanel;
+class STextBlock;
+
+/**
+*	Shows the stats of the last layout generations: a time line of the stages and their workers, the totals of each stage and the search and memory counters.
+*	Keeps the last runs, so the timings can be compared after changing the layout data. Clicking a run shows it.
+*/
+class STerrainEditorProfilerPanel : public SCompoundWidget
+{
+public:
+	SLATE_BEGIN_ARGS(STerrainEditorProfilerPanel)
+		: _MaxRunsAmount(10)
+	{}
+		SLATE_ARGUMENT(int32, MaxRunsAmount)
+	SLATE_END_ARGS()
+
+	void Construct(const FArguments& InArgs);
+
+	void AddRun(const FTerrainLayoutStats& StatsIn);
+	void ClearRuns();
+
+private:
+	/* Oldest first.*/
+	TArray<FTerrainLayoutStats> Runs;
+	int32 SelectedRun = INDEX_NONE;
+	int32 MaxRunsAmount = 10;
+
+	TSharedPtr<SLayoutStatsTimeline> Timeline;
+	TSharedPtr<STextBlock> SummaryText;
+	TSharedPtr<SGridPanel> StagesGrid;
+	TSharedPtr<SGridPanel> RunsGrid;
+
+	void SelectRun(int32 RunIndexIn);
+
+	void RefreshSelectedRun();
+	void RefreshRuns();
+
+	void OnLayoutGenerated(const FTerrainLayoutStats& StatsIn);
+};
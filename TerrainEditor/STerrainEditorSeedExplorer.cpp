@@ -0,0 +1,402 @@
+#include "STerrainEditorSeedExplorer.h"
+#include "SlateOptMacros.h"
+#include "STerrainEditorViewport.h"
+#include "Layout/TerrainLayoutSubsystem.h"
+#include "Layout/TerrainLayoutCancellation.h"
+#include "Terrain/TerrainData.h"
+#include "Engine/Texture2D.h"
+#include "UObject/StrongObjectPtr.h"
+#include "Async/Async.h"
+#include "Tasks/Task.h"
+#include "ProfilingDebugging/CpuProfilerTrace.h"
+#include "Widgets/Images/SImage.h"
+#include "Widgets/Input/SButton.h"
+#include "Widgets/Input/SSpinBox.h"
+#include "Widgets/Layout/SBox.h"
+#include "Widgets/Text/STextBlock.h"
+
+#define LOCTEXT_NAMESPACE "STerrainEditorSeedExplorer"
+
+#define SlotsPadding 5.f
+
+/**
+*	One exploration in flight, shared with its tasks. Each task generates seeds with its own layout subsystem until none are left.
+*	Only released on the game thread, the strong pointers cannot be destroyed on the tasks.
+*/
+struct FTerrainEditorSeedExploration
+{
+	TArray<int32> Seeds;
+	FThreadSafeCounter NextSeedIndex;
+
+	TArray<TStrongObjectPtr<UTerrainLayoutSubsystem>> Generators;
+	TStrongObjectPtr<UTerrainData> TerrainData;
+
+	/* Also the parent of the generation token of each generator, so stopping cancels the seeds in flight too.*/
+	FTerrainLayoutCancellationTokenPtr CancellationToken = MakeShared<FTerrainLayoutCancellationToken, ESPMode::ThreadSafe>();
+	int32 ThumbnailSize = 0;
+};
+
+BEGIN_SLATE_FUNCTION_BUILD_OPTIMIZATION
+
+void STerrainEditorSeedExplorer::Construct(const FArguments& InArgs)
+{
+	TerrainData = InArgs._TerrainData;
+	ThumbnailSize = FMath::Max(InArgs._ThumbnailSize, 8);
+	SeedsAmount = FMath::Max(InArgs._SeedsAmount, 1);
+	OnSeedSelected = InArgs._OnSeedSelected;
+
+	ChildSlot
+	[
+		SNew(SVerticalBox)
+		+ SVerticalBox::Slot()
+		.Padding(SlotsPadding)
+		.AutoHeight()
+		[
+			SNew(SHorizontalBox)
+			+ SHorizontalBox::Slot()
+			.AutoWidth()
+			.VAlign(EVerticalAlignment::VAlign_Center)
+			.Padding(0.f, 0.f, SlotsPadding, 0.f)
+			[
+				SNew(STextBlock)
+				.Text(LOCTEXT("Seeds", "Seeds"))
+			]
+			+ SHorizontalBox::Slot()
+			.FillWidth(1.f)
+			.Padding(0.f, 0.f, SlotsPadding, 0.f)
+			[
+				SNew(SSpinBox<int32>)
+				.MinValue(1)
+				.MaxValue(256)
+				.Value_Lambda([this]()
+				{
+					return SeedsAmount;
+				})
+				.OnValueChanged_Lambda([this](int32 NewValue)
+				{
+					SeedsAmount = NewValue;
+				})
+			]
+			+ SHorizontalBox::Slot()
+			.AutoWidth()
+			.Padding(0.f, 0.f, SlotsPadding, 0.f)
+			[
+				SNew(SButton)
+				.Text(LOCTEXT("Explore", "Explore"))
+				.OnClicked_Lambda([this]()
+				{
+					ExploreSeeds();
+					return FReply::Handled();
+				})
+			]
+			+ SHorizontalBox::Slot()
+			.AutoWidth()
+			[
+				SNew(SButton)
+				.Text(LOCTEXT("Stop", "Stop"))
+				.IsEnabled_Lambda([this]()
+				{
+					return Exploration.IsValid();
+				})
+				.OnClicked_Lambda([this]()
+				{
+					StopExploration();
+					return FReply::Handled();
+				})
+			]
+		]
+		+ SVerticalBox::Slot()
+		.Padding(SlotsPadding)
+		.AutoHeight()
+		[
+			SAssignNew(StatusText, STextBlock)
+			.Text(LOCTEXT("No seeds", "Explore to generate seeds in the background. Click one to load it in the viewport."))
+		]
+		+ SVerticalBox::Slot()
+		.Padding(SlotsPadding)
+		.AutoHeight()
+		.MaxHeight(600.f)
+		[
+			SAssignNew(SeedsView, STileView<FExploredSeedPtr>)
+			.ListItemsSource(&ExploredSeeds)
+			.ItemWidth(ThumbnailSize + 12.f)
+			.ItemHeight(ThumbnailSize + 60.f)
+			.SelectionMode(ESelectionMode::Single)
+			.OnGenerateTile(this, &STerrainEditorSeedExplorer::OnGenerateSeedTile)
+			.OnMouseButtonClick(this, &STerrainEditorSeedExplorer::OnSeedClicked)
+		]
+	];
+}
+
+END_SLATE_FUNCTION_BUILD_OPTIMIZATION
+
+STerrainEditorSeedExplorer::~STerrainEditorSeedExplorer()
+{
+	StopExploration();
+}
+
+void STerrainEditorSeedExplorer::ExploreSeeds()
+{
+	StopExploration();
+
+	ExploredSeeds.Empty();
+	GeneratedSeedsAmount = 0;
+	SeedsView->RequestListRefresh();
+
+	UTerrainData* Data = TerrainData.Get();
+	if (!Data || !Data->TerrainLayoutData)
+	{
+		StatusText->SetText(LOCTEXT("No terrain data", "There is no terrain data to generate."));
+		return;
+	}
+
+	//Half the cores, the stages of each seed run their own workers and the editor has to keep responding.
+	const int32 Concurrency = FMath::Clamp(FPlatformMisc::NumberOfCoresIncludingHyperthreads() / 2, 1, SeedsAmount);
+
+	const TSharedRef<FTerrainEditorSeedExploration, ESPMode::ThreadSafe> NewExploration = MakeShared<FTerrainEditorSeedExploration, ESPMode::ThreadSafe>();
+	NewExploration->TerrainData.Reset(Data);
+	NewExploration->ThumbnailSize = ThumbnailSize;
+
+	for (int32 i = 0; i < SeedsAmount; i++)
+	{
+		FExploredSeedPtr ExploredSeed = MakeShared<FExploredSeed>();
+		ExploredSeed->Seed = FMath::RandHelper(MAX_int32);
+
+		NewExploration->Seeds.Add(ExploredSeed->Seed);
+		ExploredSeeds.Add(ExploredSeed);
+	}
+
+	//Each task has its own subsystem, the layout state is stored in the subsystem so they cannot be shared between seeds in flight.
+	for (int32 i = 0; i < Concurrency; i++)
+	{
+		NewExploration->Generators.Emplace(NewObject<UTerrainLayoutSubsystem>(GEngine));
+	}
+
+	Exploration = NewExploration;
+	SeedsView->RequestListRefresh();
+	UpdateStatusText();
+
+	const TWeakPtr<STerrainEditorSeedExplorer> WeakThis = SharedThis(this);
+	for (int32 Slot = 0; Slot < Concurrency; Slot++)
+	{
+		UE::Tasks::Launch(TEXT("TerrainEditorExploreSeeds"), [WeakThis, TaskExploration = TSharedPtr<FTerrainEditorSeedExploration, ESPMode::ThreadSafe>(NewExploration), Slot]() mutable
+		{
+			TRACE_CPUPROFILER_EVENT_SCOPE(TerrainEditorExploreSeeds);
+
+			UTerrainLayoutSubsystem* Generator = TaskExploration->Generators[Slot].Get();
+			for (int32 SeedIndex = TaskExploration->NextSeedIndex.Increment() - 1; SeedIndex < TaskExploration->Seeds.Num(); SeedIndex = TaskExploration->NextSeedIndex.Increment() - 1)
+			{
+				if (TaskExploration->CancellationToken->IsCancelled())
+				{
+					break;
+				}
+
+				Generator->GenerateTerrainLayoutSynchronous(TaskExploration->TerrainData.Get(), TaskExploration->Seeds[SeedIndex], ETerrainGen_LayoutStage::ETLS_MAX, TaskExploration->CancellationToken);
+
+				//Stopped in the middle of the generation, the layout is incomplete.
+				if (TaskExploration->CancellationToken->IsCancelled())
+				{
+					break;
+				}
+
+				FTerrainEditorLayoutCells Cells = FTerrainEditorLayoutCells();
+				STerrainEditorViewport::ClassifyLayoutCells(Generator->CellsLayoutMap, Generator->GetInitialRoom(), FTerrainEditorLayoutDrawConfiguration(), Cells);
+
+				TArray<FColor> Pixels;
+				BuildThumbnail(Cells, TaskExploration->ThumbnailSize, Pixels);
+
+				AsyncTask(ENamedThreads::GameThread, [WeakThis, TaskExploration, SeedIndex, Stats = Generator->GetLayoutStats(), Pixels = MoveTemp(Pixels)]()
+				{
+					const TSharedPtr<STerrainEditorSeedExplorer> Explorer = WeakThis.Pin();
+					if (Explorer.IsValid() && Explorer->Exploration == TaskExploration)
+					{
+						Explorer->OnSeedExplored(SeedIndex, Stats, Pixels);
+					}
+				});
+			}
+
+			//The last reference may be this one.
+			AsyncTask(ENamedThreads::GameThread, [ReleasedExploration = MoveTemp(TaskExploration)]()
+			{
+			});
+		});
+	}
+}
+
+void STerrainEditorSeedExplorer::StopExploration()
+{
+	if (!Exploration.IsValid())
+	{
+		return;
+	}
+
+	Exploration->CancellationToken->Cancel();
+	Exploration.Reset();
+	UpdateStatusText();
+}
+
+void STerrainEditorSeedExplorer::OnSeedExplored(int32 SeedIndexIn, const FTerrainLayoutStats& StatsIn, const TArray<FColor>& PixelsIn)
+{
+	if (!ExploredSeeds.IsValidIndex(SeedIndexIn))
+	{
+		return;
+	}
+
+	FExploredSeed& ExploredSeed = *ExploredSeeds[SeedIndexIn];
+	ExploredSeed.Stats = StatsIn;
+	ExploredSeed.bIsGenerated = true;
+
+	ExploredSeed.Texture = UTexture2D::CreateTransient(ThumbnailSize, ThumbnailSize, PF_B8G8R8A8, TEXT("TerrainEditorSeedThumbnail"));
+	ExploredSeed.Texture->Filter = TF_Nearest;
+	ExploredSeed.Texture->LODGroup = TEXTUREGROUP_Pixels2D;
+	ExploredSeed.Texture->SRGB = true;
+	ExploredSeed.Texture->NeverStream = true;
+	ExploredSeed.Texture->UpdateResource();
+
+	ExploredSeed.Brush.DrawAs = ESlateBrushDrawType::Image;
+	ExploredSeed.Brush.Tiling = ESlateBrushTileType::NoTile;
+	ExploredSeed.Brush.SetResourceObject(ExploredSeed.Texture);
+	ExploredSeed.Brush.ImageSize = FVector2D(ThumbnailSize, ThumbnailSize);
+
+	const int32 Pitch = ThumbnailSize * sizeof(FColor);
+
+	//The render thread reads the copy after this returns, and frees it when the upload is done.
+	uint8* Data = StaticCast<uint8*>(FMemory::Malloc(ThumbnailSize * Pitch));
+	FMemory::Memcpy(Data, PixelsIn.GetData(), ThumbnailSize * Pitch);
+
+	FUpdateTextureRegion2D* Region = new FUpdateTextureRegion2D(0, 0, 0, 0, ThumbnailSize, ThumbnailSize);
+	ExploredSeed.Texture->UpdateTextureRegions(0, 1, Region, Pitch, sizeof(FColor), Data, [](uint8* DataIn, const FUpdateTextureRegion2D* RegionIn)
+	{
+		FMemory::Free(DataIn);
+		delete RegionIn;
+	});
+
+	GeneratedSeedsAmount++;
+	if (GeneratedSeedsAmount == ExploredSeeds.Num())
+	{
+		Exploration.Reset();
+	}
+
+	UpdateStatusText();
+}
+
+void STerrainEditorSeedExplorer::UpdateStatusText()
+{
+	if (ExploredSeeds.Num() == 0)
+	{
+		return;
+	}
+
+	const FText Format = Exploration.IsValid()
+		? LOCTEXT("Exploring", "Generating seeds: {0} of {1}.")
+		: LOCTEXT("Explored", "Generated seeds: {0} of {1}. Click one to load it in the viewport.");
+
+	StatusText->SetText(FText::Format(Format, GeneratedSeedsAmount, ExploredSeeds.Num()));
+}
+
+TSharedRef<ITableRow> STerrainEditorSeedExplorer::OnGenerateSeedTile(FExploredSeedPtr SeedIn, const TSharedRef<STableViewBase>& OwnerTableIn)
+{
+	return SNew(STableRow<FExploredSeedPtr>, OwnerTableIn)
+		.Padding(4.f)
+		[
+			SNew(SVerticalBox)
+			+ SVerticalBox::Slot()
+			.AutoHeight()
+			[
+				SNew(SBox)
+				.WidthOverride(ThumbnailSize)
+				.HeightOverride(ThumbnailSize)
+				[
+					SNew(SImage)
+					.Image_Lambda([SeedIn]()
+					{
+						return SeedIn->Texture ? &SeedIn->Brush : FStyleDefaults::GetNoBrush();
+					})
+				]
+			]
+			+ SVerticalBox::Slot()
+			.AutoHeight()
+			[
+				SNew(STextBlock)
+				.Font(FCoreStyle::GetDefaultFontStyle("Regular", 8))
+				.Text_Lambda([SeedIn]()
+				{
+					if (!SeedIn->bIsGenerated)
+					{
+						return FText::FromString(FString::Printf(TEXT("Seed %i\nGenerating..."), SeedIn->Seed));
+					}
+
+					const FTerrainLayoutStats& Stats = SeedIn->Stats;
+					return FText::FromString(FString::Printf(TEXT("Seed %i\n%.1f ms\nRooms: %i, corridors: %i"), SeedIn->Seed, Stats.TotalSeconds * 1000.0, Stats.RoomsAmount, Stats.CorridorsAmount));
+				})
+			]
+		];
+}
+
+void STerrainEditorSeedExplorer::OnSeedClicked(FExploredSeedPtr SeedIn)
+{
+	if (!SeedIn.IsValid() || !SeedIn->bIsGenerated)
+	{
+		return;
+	}
+
+	UTerrainLayoutSubsystem* TerrainLayoutSubsystem = GEngine->GetEngineSubsystem<UTerrainLayoutSubsystem>();
+	if (!TerrainLayoutSubsystem)
+	{
+		return;
+	}
+
+	//Generated again instead of copied, the explored layouts are not kept. The viewport draws it as any other generation.
+	TerrainLayoutSubsystem->GenerateTerrainLayout(TerrainData.Get(), SeedIn->Seed);
+	OnSeedSelected.ExecuteIfBound(SeedIn->Seed);
+}
+
+void STerrainEditorSeedExplorer::BuildThumbnail(const FTerrainEditorLayoutCells& CellsIn, int32 SizeIn, TArray<FColor>& PixelsOut)
+{
+	PixelsOut.Init(FColor::Transparent, SizeIn * SizeIn);
+	if (CellsIn.Data.Num() == 0)
+	{
+		return;
+	}
+
+	const FIntPoint CellsSize = CellsIn.MaxCell - CellsIn.MinCell + FIntPoint(1, 1);
+	const int32 CellsPerTexel = FMath::Max(1, FMath::DivideAndRoundUp(FMath::Max(CellsSize.X, CellsSize.Y), SizeIn));
+	const FIntPoint TexelsSize = FIntPoint(FMath::DivideAndRoundUp(CellsSize.X, CellsPerTexel), FMath::DivideAndRoundUp(CellsSize.Y, CellsPerTexel));
+	const FIntPoint Offset = (FIntPoint(SizeIn, SizeIn) - TexelsSize) / 2;
+
+	TArray<int32> TexelsColorIndex;
+	TexelsColorIndex.Init(MAX_int32, SizeIn * SizeIn);
+
+	for (int32 i = 0; i < CellsIn.Data.Num(); i++)
+	{
+		const int32 ColorIndex = CellsIn.Colors[i];
+		if (ColorIndex == INDEX_NONE)
+		{
+			continue;
+		}
+
+		const FIntPoint Texel = Offset + CellsIn.Data[i].GridID / CellsPerTexel;
+		const int32 TexelIndex = Texel.Y * SizeIn + Texel.X;
+
+		if (ColorIndex < TexelsColorIndex[TexelIndex])
+		{
+			TexelsColorIndex[TexelIndex] = ColorIndex;
+			PixelsOut[TexelIndex] = CellsIn.Data[i].Color.ToFColor(true);
+		}
+	}
+}
+
+void STerrainEditorSeedExplorer::AddReferencedObjects(FReferenceCollector& Collector)
+{
+	for (FExploredSeedPtr& ExploredSeed : ExploredSeeds)
+	{
+		Collector.AddReferencedObject(ExploredSeed->Texture);
+	}
+}
+
+FString STerrainEditorSeedExplorer::GetReferencerName() const
+{
+	return TEXT("STerrainEditorSeedExplorer");
+}
+
+#undef LOCTEXT_NAMESPACE
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Widgets/SCompoundWidget.h"
+#include "Widgets/Views/STileView.h"
+#include "UObject/GCObject.h"
+#include "Styling/SlateBrush.h"
+#include "Layout/TerrainLayoutStats.h"
+
+class UTexture2D;
+class UTerrainData;
+class STextBlock;
+struct FTerrainEditorLayoutCells;
+struct FTerrainEditorSeedExploration;
+
+DECLARE_DELEGATE_OneParam(FOnTerrainEditorSeedSelected, int32 /*Seed*/);
+
+/**
+*	Generates many seeds at once on background tasks, each one with its own layout subsystem, without touching the viewport.
+*	Each layout is drawn in a small thumbnail with the viewport cell colors, next to its generation time and rooms and corridors.
+*	Clicking a thumbnail generates its seed in the editor layout subsystem, so it is drawn in the viewport.
+*/
+class STerrainEditorSeedExplorer : public SCompoundWidget, public FGCObject
+{
+public:
+	SLATE_BEGIN_ARGS(STerrainEditorSeedExplorer)
+		: _ThumbnailSize(128)
+		, _SeedsAmount(16)
+	{}
+		SLATE_ATTRIBUTE(UTerrainData*, TerrainData)
+
+		/* Side of the thumbnails, in texels.*/
+		SLATE_ARGUMENT(int32, ThumbnailSize)
+		SLATE_ARGUMENT(int32, SeedsAmount)
+
+		/* Called when a seed is loaded in the viewport.*/
+		SLATE_EVENT(FOnTerrainEditorSeedSelected, OnSeedSelected)
+	SLATE_END_ARGS()
+
+	void Construct(const FArguments& InArgs);
+	virtual ~STerrainEditorSeedExplorer();
+
+	/* Starts generating new random seeds. The exploration in flight is stopped and its thumbnails removed.*/
+	void ExploreSeeds();
+
+	/* No more seeds are started. The ones in flight complete, but their results are discarded.*/
+	void StopExploration();
+
+	virtual void AddReferencedObjects(FReferenceCollector& Collector) override;
+	virtual FString GetReferencerName() const override;
+
+private:
+	struct FExploredSeed
+	{
+		int32 Seed = 0;
+		bool bIsGenerated = false;
+		FTerrainLayoutStats Stats;
+
+		TObjectPtr<UTexture2D> Texture = nullptr;
+		FSlateBrush Brush;
+	};
+
+	typedef TSharedPtr<FExploredSeed> FExploredSeedPtr;
+
+	TArray<FExploredSeedPtr> ExploredSeeds;
+	int32 GeneratedSeedsAmount = 0;
+
+	TSharedPtr<FTerrainEditorSeedExploration, ESPMode::ThreadSafe> Exploration;
+
+	TSharedPtr<STileView<FExploredSeedPtr>> SeedsView;
+	TSharedPtr<STextBlock> StatusText;
+
+	TAttribute<UTerrainData*> TerrainData;
+	int32 ThumbnailSize = 128;
+	int32 SeedsAmount = 16;
+	FOnTerrainEditorSeedSelected OnSeedSelected;
+
+	TSharedRef<ITableRow> OnGenerateSeedTile(FExploredSeedPtr SeedIn, const TSharedRef<STableViewBase>& OwnerTableIn);
+	void OnSeedClicked(FExploredSeedPtr SeedIn);
+
+	/* Called on the game thread with the result of a seed of the current exploration.*/
+	void OnSeedExplored(int32 SeedIndexIn, const FTerrainLayoutStats& StatsIn, const TArray<FColor>& PixelsIn);
+
+	void UpdateStatusText();
+
+	/* Draws the layout cells centered in the thumbnail. With more cells than texels, each texel keeps the cell with the lowest color index, so corridors and doors are not lost.*/
+	static void BuildThumbnail(const FTerrainEditorLayoutCells& CellsIn, int32 SizeIn, TArray<FColor>& PixelsOut);
+};
@@ -3,6 +3,7 @@
 
 #include "SCellsGrid.h"
 #include "SCellsGridMesh.h"
+#include "SCellsTexture.h"
 #include "Widgets/SInvalidationPanel.h"
 
 #include "Terrain/TerrainGeneratorSubsystem.h"
@@ -14,6 +15,12 @@
 #include "Biomes/TerrainBiomeLayerData.h"
 #include "Biomes/TerrainBiomeData.h"
 #include "Layout/TerrainLayoutFunctionLibrary.h"
+#include "Layout/TerrainLayoutKernels.h"
+
+#include "Tasks/Task.h"
+#include "Containers/Ticker.h"
+#include "Async/Async.h"
+#include "ProfilingDebugging/CpuProfilerTrace.h"
 
 #include "GameplayTagContainer.h"
 #include "Tags/TerrainTags.h"
@@ -22,6 +29,121 @@
 
 #define LOCTEXT_NAMESPACE "STerrainEditorViewport"
 
+namespace TerrainEditorViewportCells
+{
+	/* The tags that decide the color of a layout cell. Ordered by priority, the first drawn category gives the color.*/
+	enum ECellCategory : uint8
+	{
+		InitialCell = 1 << 0,
+		CentralCell = 1 << 1,
+		InitialRoom = 1 << 2,
+		RoomBorder = 1 << 3,
+		RoomCollision = 1 << 4,
+		Door = 1 << 5,
+		Corridor = 1 << 6,
+		Wall = 1 << 7
+	};
+
+	static const int32 CategoriesAmount = 256;
+
+	/* After the colors of each category.*/
+	static const int32 CellColor = 8;
+	static const int32 UndrawnCellColor = 9;
+
+	FLinearColor GetColor(int32 ColorIndex)
+	{
+		static const FLinearColor Colors[] =
+		{
+			FLinearColor::Red,
+			FLinearColor(1.f, 0.2f, 0.f),
+			FLinearColor(.0f, 5.f, 0.f),
+			FLinearColor(.5f, 5.f, 0.f),
+			FLinearColor::Yellow,
+			FLinearColor(0.f, 0.f, .1f),
+			FLinearColor(0.15f, 0.15f, .15f),
+			FLinearColor(0.001f, 0.001f, .001f),
+			FLinearColor(0.5f, .5f, .5f)
+		};
+
+		if (ColorIndex == INDEX_NONE)
+		{
+			return FLinearColor::Transparent;
+		}
+
+		return ColorIndex == UndrawnCellColor ? FCellGridData().Color : Colors[ColorIndex];
+	}
+
+	/* The biome colors are read from the assets on the game thread, the classification tasks only get the copy.*/
+	TArray<FLinearColor> GetBiomesColors(const UTerrainBiomeLayoutData* BiomeData)
+	{
+		TArray<FLinearColor> BiomesColors;
+		if (!BiomeData)
+		{
+			return BiomesColors;
+		}
+
+		BiomesColors.Reserve(BiomeData->Biomes.Num());
+		for (int32 i = 0; i < BiomeData->Biomes.Num(); i++)
+		{
+			BiomesColors.Add(BiomeData->Biomes[i]->BiomeColor);
+		}
+
+		return BiomesColors;
+	}
+
+	/* The cells with their colors, offset so the first cell is at the origin.*/
+	void BuildCellsData(const TArray<FIntPoint>& CellsIn, const TArray<FLinearColor>& ColorsIn, TArray<FCellGridData>& CellsDataOut)
+	{
+		const FIntPoint MinGridSize = UTerrainLayoutFunctionLibrary::GetMinGridSize(CellsIn);
+
+		CellsDataOut.Reserve(CellsIn.Num());
+		for (int32 i = 0; i < CellsIn.Num(); i++)
+		{
+			FCellGridData Cell = FCellGridData();
+			Cell.GridID = CellsIn[i];
+
+			Cell.GridID.X -= MinGridSize.X;
+			Cell.GridID.Y -= MinGridSize.Y;
+			Cell.Color = ColorsIn[i];
+
+			CellsDataOut.Add(Cell);
+		}
+	}
+
+	/* BuildCellsData with the values from blue for the lowest to red for the highest. Cells with negative values have no value and are drawn dark.*/
+	void BuildHeatmapCellsData(const TArray<FIntPoint>& CellsIn, const TArray<float>& ValuesIn, TArray<FCellGridData>& CellsDataOut)
+	{
+		float MinValue = MAX_flt;
+		float MaxValue = 0.f;
+		for (const float Value : ValuesIn)
+		{
+			if (Value >= 0.f)
+			{
+				MinValue = FMath::Min(MinValue, Value);
+				MaxValue = FMath::Max(MaxValue, Value);
+			}
+		}
+
+		const float Range = MaxValue - MinValue;
+
+		TArray<FLinearColor> Colors;
+		Colors.Reserve(ValuesIn.Num());
+		for (const float Value : ValuesIn)
+		{
+			if (Value < 0.f)
+			{
+				Colors.Add(FLinearColor(0.02f, 0.02f, 0.02f));
+				continue;
+			}
+
+			const float Alpha = Range > 0.f ? (Value - MinValue) / Range : 1.f;
+			Colors.Add(FLinearColor::LerpUsingHSV(FLinearColor::Blue, FLinearColor::Red, Alpha));
+		}
+
+		BuildCellsData(CellsIn, Colors, CellsDataOut);
+	}
+}
+
 BEGIN_SLATE_FUNCTION_BUILD_OPTIMIZATION
 void STerrainEditorViewport::Construct(const FArguments& InArgs)
 {
@@ -52,6 +174,13 @@ void STerrainEditorViewport::Construct(const FArguments& InArgs)
 					.LineThickness(0.f)					
 				]
 			]
+			+ SOverlay::Slot()
+			.HAlign(HAlign_Fill)
+			.VAlign(VAlign_Fill)
+			[
+				SAssignNew(CellsTexture, SCellsTexture)
+				.Visibility(EVisibility::Collapsed)
+			]
 		]
 	];
 
@@ -78,9 +207,11 @@ void STerrainEditorViewport::Construct(const FArguments& InArgs)
 
 	TerrainLayoutSubsystem->OnInitialLayoutGenerated.AddSP(this, &STerrainEditorViewport::DrawLayout);
 	TerrainLayoutSubsystem->OnInitialLayoutMovementCompleted.AddSP(this, &STerrainEditorViewport::DrawLayout);
-	TerrainLayoutSubsystem->OnCorridorLayoutGenerated.AddSP(this, &STerrainEditorViewport::DrawLayout);
-	TerrainLayoutSubsystem->OnWallsLayoutGenerated.AddSP(this, &STerrainEditorViewport::DrawLayout);
-	TerrainLayoutSubsystem->OnLayoutGenerated.AddSP(this, &STerrainEditorViewport::DrawLayout);
+	TerrainLayoutSubsystem->OnCorridorLayoutGenerated.AddSP(this, &STerrainEditorViewport::OnLayoutStageGenerated);
+	TerrainLayoutSubsystem->OnWallsLayoutGenerated.AddSP(this, &STerrainEditorViewport::OnLayoutStageGenerated);
+	TerrainLayoutSubsystem->OnLayoutGenerated.AddSP(this, &STerrainEditorViewport::OnLayoutGenerated);
+	TerrainLayoutSubsystem->OnLayoutCellsUpdated.AddSP(this, &STerrainEditorViewport::OnLayoutCellsUpdated);
+	TerrainLayoutSubsystem->OnLayoutRestored.AddSP(this, &STerrainEditorViewport::DrawLayout);
 	
 	TerrainBiomeSubsystem->OnBiomesLayoutGenerated.AddSP(this, &STerrainEditorViewport::DrawInitialBiomesLayout);
 	TerrainBiomeSubsystem->OnBiomesLayoutMovementEnd.AddSP(this, &STerrainEditorViewport::DrawBiomesLayout);	
@@ -92,146 +223,604 @@ void STerrainEditorViewport::Construct(const FArguments& InArgs)
 }
 
 void STerrainEditorViewport::DrawLayout() const
-{	
+{
 	UTerrainLayoutSubsystem* TerrainLayoutSubsystem = GEngine->GetEngineSubsystem<UTerrainLayoutSubsystem>();
 	if (!TerrainLayoutSubsystem)
 	{
 		return;
 	}
 
-	TArray <FCellGridData> CellsDataGenerated;
-	
-	TArray <FIntPoint> CellsIDs = TArray <FIntPoint>();
-	TerrainLayoutSubsystem->CellsLayoutMap.GetKeys(CellsIDs);
-	const FIntPoint MinGridSize = UTerrainLayoutFunctionLibrary::GetMinGridSize(CellsIDs);
-	
-	for (const TPair<FIntPoint, FCellLayout>& pair : TerrainLayoutSubsystem->CellsLayoutMap)
-	{				
-		FCellGridData Cell = FCellGridData();
-		Cell.GridID = pair.Key;
+	if (LayoutOverlay != ETerrainEditorLayoutOverlay::None)
+	{
+		DrawLayoutOverlay();
+		return;
+	}
+
+	const uint32 Request = BeginClassification();
+	bIsClassifyingLayout = true;
+	CellsChangedWhileClassifying.Reset();
+	PendingStreamedCells.Reset();
+
+	//The back buffer is in use until the classification completes.
+	const TSharedRef<FTerrainEditorLayoutCells, ESPMode::ThreadSafe> Cells = BackLayoutCells.IsValid() ? BackLayoutCells.ToSharedRef() : MakeShared<FTerrainEditorLayoutCells, ESPMode::ThreadSafe>();
+	BackLayoutCells.Reset();
+
+	const FIntPoint InitialRoom = TerrainLayoutSubsystem->GetInitialRoom();
 
-		Cell.GridID.X -= MinGridSize.X;
-		Cell.GridID.Y -= MinGridSize.Y;
+	if (TerrainLayoutSubsystem->CellsLayoutMap.Num() < AsyncClassificationCellsThreshold)
+	{
+		ClassifyLayoutCells(TerrainLayoutSubsystem->CellsLayoutMap, InitialRoom, DrawConfiguration, *Cells);
+		OnLayoutCellsClassified(Cells, Request);
+		return;
+	}
+
+	//The layout keeps changing while the stages run. Only the keys are copied here, the categories are looked up over the frames like the biome layers.
+	//The cells changed meanwhile are applied once the classification completes.
+	const TSharedRef<TArray<FIntPoint>, ESPMode::ThreadSafe> CellsKeys = MakeShared<TArray<FIntPoint>, ESPMode::ThreadSafe>();
+	TerrainLayoutSubsystem->CellsLayoutMap.GenerateKeyArray(*CellsKeys);
 
-		if (pair.Value.Tags.HasTag(TAG_TERRAIN_CELL_LAYOUT_INITIAL) && bDrawInitialCell)
-		{	
-			Cell.Color = FLinearColor::Red;
+	const TSharedRef<TArray<FTerrainEditorLayoutCellCategories>, ESPMode::ThreadSafe> CellsCategories = MakeShared<TArray<FTerrainEditorLayoutCellCategories>, ESPMode::ThreadSafe>();
+	CellsCategories->Reserve(CellsKeys->Num());
+
+	const FTerrainEditorLayoutDrawConfiguration Configuration = DrawConfiguration;
+	const TWeakPtr<const STerrainEditorViewport> WeakThis = SharedThis(this);
+	const TWeakObjectPtr<UTerrainLayoutSubsystem> WeakLayoutSubsystem = TerrainLayoutSubsystem;
+
+	auto LookupSlice = [WeakThis, WeakLayoutSubsystem, CellsKeys, CellsCategories, Configuration, Cells, Request, InitialRoom, NextIndex = 0](float DeltaTime) mutable
+	{
+		const TSharedPtr<const STerrainEditorViewport> Viewport = WeakThis.Pin();
+		if (!Viewport.IsValid() || Viewport->ClassificationRequest != Request || !WeakLayoutSubsystem.IsValid())
+		{
+			return false;
 		}
-		else if (pair.Value.Tags.HasTag(TAG_TERRAIN_CELL_LAYOUT_CENTRAL) && bDrawCentralCell)
+
+		const FTerrainLayoutCellsMap& CellsLayoutMap = WeakLayoutSubsystem->CellsLayoutMap;
+		const double EndTime = FPlatformTime::Seconds() + SlicedLookupsBudgetSeconds;
+		while (NextIndex < CellsKeys->Num())
 		{
-			Cell.Color = FLinearColor(1.f, 0.2f, 0.f);
+			const FIntPoint Cell = (*CellsKeys)[NextIndex++];
+
+			//Removed since the keys were copied, the count check of the next update draws the layout again.
+			if (const FCellLayout* CellLayout = CellsLayoutMap.Find(Cell))
+			{
+				FTerrainEditorLayoutCellCategories CellCategories = FTerrainEditorLayoutCellCategories();
+				CellCategories.Cell = Cell;
+				CellCategories.Categories = GetCellCategories(*CellLayout, InitialRoom);
+				CellsCategories->Add(CellCategories);
+			}
+
+			//The clock is only read every few cells.
+			if ((NextIndex & 255) == 0 && FPlatformTime::Seconds() > EndTime)
+			{
+				return true;
+			}
 		}
-		else if (pair.Value.RoomID == TerrainLayoutSubsystem->GetInitialRoom() && pair.Value.Tags.HasTag(TAG_TERRAIN_CELL_TYPE_ROOM) && bDrawInitialRoom)
+
+		UE::Tasks::Launch(TEXT("TerrainEditorClassifyLayout"), [WeakThis, CellsCategories, Configuration, Cells, Request]()
 		{
-			Cell.Color = FLinearColor(.0f, 5.f, 0.f);
-		}	
-		else if (pair.Value.Tags.HasTag(TAG_TERRAIN_CELL_LAYOUT_BORDER) && bDrawRoomBorders)
+			ClassifyLayoutCells(*CellsCategories, Configuration, *Cells);
+
+			AsyncTask(ENamedThreads::GameThread, [WeakThis, Cells, Request]()
+			{
+				if (const TSharedPtr<const STerrainEditorViewport> Viewport = WeakThis.Pin())
+				{
+					Viewport->OnLayoutCellsClassified(Cells, Request);
+				}
+			});
+		});
+
+		return false;
+	};
+
+	//The first slice runs right away, so small layouts are classified without waiting a frame.
+	if (LookupSlice(0.f))
+	{
+		FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateLambda(MoveTemp(LookupSlice)));
+	}
+}
+
+void STerrainEditorViewport::ClassifyLayoutCells(const FTerrainLayoutCellsMap& CellsLayoutMapIn, const FIntPoint& InitialRoomIn, const FTerrainEditorLayoutDrawConfiguration& ConfigurationIn, FTerrainEditorLayoutCells& CellsOut)
+{
+	TArray<FTerrainEditorLayoutCellCategories> CellsCategories;
+	GetLayoutCellsCategories(CellsLayoutMapIn, InitialRoomIn, CellsCategories);
+	ClassifyLayoutCells(CellsCategories, ConfigurationIn, CellsOut);
+}
+
+void STerrainEditorViewport::GetLayoutCellsCategories(const FTerrainLayoutCellsMap& CellsLayoutMapIn, const FIntPoint& InitialRoomIn, TArray<FTerrainEditorLayoutCellCategories>& CellsOut)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(STerrainEditorViewport::GetLayoutCellsCategories);
+
+	CellsOut.Reset(CellsLayoutMapIn.Num());
+	for (const TPair<FIntPoint, FCellLayout>& pair : CellsLayoutMapIn)
+	{
+		FTerrainEditorLayoutCellCategories Cell = FTerrainEditorLayoutCellCategories();
+		Cell.Cell = pair.Key;
+		Cell.Categories = GetCellCategories(pair.Value, InitialRoomIn);
+		CellsOut.Add(Cell);
+	}
+}
+
+void STerrainEditorViewport::ClassifyLayoutCells(const TArray<FTerrainEditorLayoutCellCategories>& CellsIn, const FTerrainEditorLayoutDrawConfiguration& ConfigurationIn, FTerrainEditorLayoutCells& CellsOut)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(STerrainEditorViewport::ClassifyLayoutCells);
+
+	TArray <FIntPoint> CellsIDs = TArray <FIntPoint>();
+	CellsIDs.Reserve(CellsIn.Num());
+	for (const FTerrainEditorLayoutCellCategories& Cell : CellsIn)
+	{
+		CellsIDs.Add(Cell.Cell);
+	}
+
+	const FIntPoint MinGridSize = UTerrainLayoutFunctionLibrary::GetMinGridSize(CellsIDs);
+
+	CellsOut.MinCell = MinGridSize;
+	CellsOut.MaxCell = MinGridSize;
+	for (const FIntPoint& CellID : CellsIDs)
+	{
+		CellsOut.MaxCell = CellsOut.MaxCell.ComponentMax(CellID);
+	}
+
+	FTerrainLayoutKernels::OffsetCells(CellsIDs, FIntPoint(-MinGridSize.X, -MinGridSize.Y), CellsIDs);
+
+	CellsOut.Indices.Empty(CellsIDs.Num());
+	CellsOut.Data.SetNum(CellsIDs.Num());
+	CellsOut.Categories.SetNumUninitialized(CellsIDs.Num());
+	CellsOut.Colors.SetNumUninitialized(CellsIDs.Num());
+
+	for (int32 CellIndex = 0; CellIndex < CellsIn.Num(); CellIndex++)
+	{
+		CellsOut.Indices.Add(CellsIn[CellIndex].Cell, CellIndex);
+		CellsOut.Data[CellIndex].GridID = CellsIDs[CellIndex];
+		CellsOut.Categories[CellIndex] = CellsIn[CellIndex].Categories;
+		CellsOut.SetCellColor(CellIndex, ConfigurationIn.GetCellColorIndex(CellsOut.Categories[CellIndex]));
+	}
+}
+
+void STerrainEditorViewport::OnLayoutCellsClassified(const TSharedRef<FTerrainEditorLayoutCells, ESPMode::ThreadSafe>& CellsIn, uint32 RequestIn) const
+{
+	if (RequestIn != ClassificationRequest)
+	{
+		if (!BackLayoutCells.IsValid())
 		{
-			Cell.Color = FLinearColor(.5f, 5.f, 0.f);
+			BackLayoutCells = CellsIn;
 		}
-		else if (pair.Value.Tags.HasTag(TAG_TERRAIN_CELL_LAYOUT_BORDERCOLLISION) && bDrawRoomCollision)
+
+		return;
+	}
+
+	bIsClassifyingLayout = false;
+	Swap(LayoutCells, CellsIn.Get());
+	BackLayoutCells = CellsIn;
+
+	//The draw configuration could have changed while classifying. The cells are all sent below anyway.
+	TArray<int32> ChangedIndices;
+	ApplyDrawConfiguration(ChangedIndices);
+	DrawLayoutCells();
+
+	if (CellsChangedWhileClassifying.Num() > 0)
+	{
+		const TArray<FIntPoint> ChangedCells = MoveTemp(CellsChangedWhileClassifying);
+		CellsChangedWhileClassifying.Reset();
+		UpdateLayoutCells(ChangedCells);
+	}
+}
+
+uint32 STerrainEditorViewport::BeginClassification() const
+{
+	bIsClassifyingLayout = false;
+	return ++ClassificationRequest;
+}
+
+uint8 STerrainEditorViewport::GetCellCategories(const FCellLayout& CellLayout, const FIntPoint& InitialRoom)
+{
+	using namespace TerrainEditorViewportCells;
+
+	uint8 Categories = 0;
+	Categories |= CellLayout.Tags.HasTag(TAG_TERRAIN_CELL_LAYOUT_INITIAL) ? InitialCell : 0;
+	Categories |= CellLayout.Tags.HasTag(TAG_TERRAIN_CELL_LAYOUT_CENTRAL) ? CentralCell : 0;
+	Categories |= CellLayout.RoomID == InitialRoom && CellLayout.Tags.HasTag(TAG_TERRAIN_CELL_TYPE_ROOM) ? ECellCategory::InitialRoom : 0;
+	Categories |= CellLayout.Tags.HasTag(TAG_TERRAIN_CELL_LAYOUT_BORDER) ? RoomBorder : 0;
+	Categories |= CellLayout.Tags.HasTag(TAG_TERRAIN_CELL_LAYOUT_BORDERCOLLISION) ? RoomCollision : 0;
+	Categories |= CellLayout.Tags.HasTag(TAG_TERRAIN_CELL_LAYOUT_DOOR) ? Door : 0;
+	Categories |= CellLayout.Tags.HasTag(TAG_TERRAIN_CELL_TYPE_CORRIDOR) ? Corridor : 0;
+	Categories |= CellLayout.Tags.HasTag(TAG_TERRAIN_CELL_TYPE_WALL) ? Wall : 0;
+
+	return Categories;
+}
+
+int32 FTerrainEditorLayoutDrawConfiguration::GetCellColorIndex(uint8 Categories) const
+{
+	using namespace TerrainEditorViewportCells;
+
+	const bool DrawCategories[] = { bDrawInitialCell, bDrawCentralCell, bDrawInitialRoom, bDrawRoomBorders, bDrawRoomCollision, bDrawDoors };
+	for (int32 i = 0; i < UE_ARRAY_COUNT(DrawCategories); i++)
+	{
+		if ((Categories & (1 << i)) && DrawCategories[i])
 		{
-			Cell.Color = FLinearColor::Yellow;
+			return i;
 		}
-		else if (pair.Value.Tags.HasTag(TAG_TERRAIN_CELL_LAYOUT_DOOR) && bDrawDoors)
+	}
+
+	//Corridors and walls are not drawn at all when hidden, instead of falling to the next category.
+	if (Categories & Corridor)
+	{
+		return bDrawCorridors ? 6 : INDEX_NONE;
+	}
+
+	if (Categories & Wall)
+	{
+		return bDrawWalls ? 7 : INDEX_NONE;
+	}
+
+	return bDrawCells ? CellColor : UndrawnCellColor;
+}
+
+void FTerrainEditorLayoutCells::SetCellColor(int32 CellIndex, int32 ColorIndex)
+{
+	Colors[CellIndex] = ColorIndex;
+	Data[CellIndex].Color = TerrainEditorViewportCells::GetColor(ColorIndex);
+}
+
+void STerrainEditorViewport::ApplyDrawConfiguration(TArray<int32>& ChangedIndicesOut) const
+{
+	//The categories do not change with the configuration, only the cells whose color does are changed.
+	int32 CategoriesColors[TerrainEditorViewportCells::CategoriesAmount];
+	for (int32 Categories = 0; Categories < TerrainEditorViewportCells::CategoriesAmount; Categories++)
+	{
+		CategoriesColors[Categories] = DrawConfiguration.GetCellColorIndex(StaticCast<uint8>(Categories));
+	}
+
+	for (int32 CellIndex = 0; CellIndex < LayoutCells.Categories.Num(); CellIndex++)
+	{
+		const int32 ColorIndex = CategoriesColors[LayoutCells.Categories[CellIndex]];
+		if (ColorIndex != LayoutCells.Colors[CellIndex])
+		{
+			LayoutCells.SetCellColor(CellIndex, ColorIndex);
+			ChangedIndicesOut.Add(CellIndex);
+		}
+	}
+}
+
+void STerrainEditorViewport::UpdateLayoutCells(const TArray<FIntPoint>& ChangedCells) const
+{
+	UTerrainLayoutSubsystem* TerrainLayoutSubsystem = GEngine->GetEngineSubsystem<UTerrainLayoutSubsystem>();
+	if (!TerrainLayoutSubsystem)
+	{
+		return;
+	}
+
+	//The overlays are drawn again when the stage ends.
+	if (LayoutOverlay != ETerrainEditorLayoutOverlay::None)
+	{
+		return;
+	}
+
+	if (bIsClassifyingLayout)
+	{
+		CellsChangedWhileClassifying.Append(ChangedCells);
+		return;
+	}
+
+	if (!bIsLayoutDrawn)
+	{
+		DrawLayout();
+		return;
+	}
+
+	const FIntPoint InitialRoom = TerrainLayoutSubsystem->GetInitialRoom();
+	const FIntPoint PreviousMinCell = LayoutCells.MinCell;
+	bool bBoundsChanged = false;
+
+	TArray<int32> ChangedIndices;
+	ChangedIndices.Reserve(ChangedCells.Num());
+
+	for (const FIntPoint& Cell : ChangedCells)
+	{
+		const FCellLayout* CellLayout = TerrainLayoutSubsystem->CellsLayoutMap.Find(Cell);
+		if (!CellLayout)
 		{
-			Cell.Color = FLinearColor(0.f, 0.f, .1f);
+			continue;
 		}
-		else if (pair.Value.Tags.HasTag(TAG_TERRAIN_CELL_TYPE_CORRIDOR))
+
+		int32 CellIndex = INDEX_NONE;
+		bool bIsNewCell = false;
+		if (const int32* FoundIndex = LayoutCells.Indices.Find(Cell))
 		{
-			if (bDrawCorridors)
-			{				
-				Cell.Color = FLinearColor(0.15f, 0.15f, .15f);
-			}
-			else
-			{
-				continue;
-			}			
-		}	
-		else if(pair.Value.Tags.HasTag(TAG_TERRAIN_CELL_TYPE_WALL))
+			CellIndex = *FoundIndex;
+		}
+		else
 		{
-			if (bDrawWalls)
+			CellIndex = LayoutCells.Data.AddDefaulted();
+			bIsNewCell = true;
+			LayoutCells.Categories.Add(0);
+			LayoutCells.Colors.Add(INDEX_NONE);
+			LayoutCells.Indices.Add(Cell, CellIndex);
+
+			//The offset is fixed below, when all the new cells are known.
+			LayoutCells.Data[CellIndex].GridID = Cell - PreviousMinCell;
+
+			if (Cell.X < LayoutCells.MinCell.X || Cell.Y < LayoutCells.MinCell.Y || Cell.X > LayoutCells.MaxCell.X || Cell.Y > LayoutCells.MaxCell.Y)
 			{
-				Cell.Color = FLinearColor(0.001f, 0.001f, .001f);
-				
+				LayoutCells.MinCell = LayoutCells.MinCell.ComponentMin(Cell);
+				LayoutCells.MaxCell = LayoutCells.MaxCell.ComponentMax(Cell);
+				bBoundsChanged = true;
 			}
-			else
-			{
-				continue;
-			}		
 		}
-		else if (bDrawCells)
+
+		LayoutCells.Categories[CellIndex] = GetCellCategories(*CellLayout, InitialRoom);
+		const int32 ColorIndex = DrawConfiguration.GetCellColorIndex(LayoutCells.Categories[CellIndex]);
+		if (bIsNewCell || ColorIndex != LayoutCells.Colors[CellIndex])
 		{
-			Cell.Color = FLinearColor(0.5f, .5f, .5f);
+			LayoutCells.SetCellColor(CellIndex, ColorIndex);
+			ChangedIndices.Add(CellIndex);
 		}
+	}
+
+	//Cells removed or replaced without a stage, like a restored snapshot.
+	if (LayoutCells.Indices.Num() != TerrainLayoutSubsystem->CellsLayoutMap.Num())
+	{
+		DrawLayout();
+		return;
+	}
 
-		CellsDataGenerated.Add(Cell);				
+	if (!bBoundsChanged)
+	{
+		RecolorLayoutCells(ChangedIndices);
+		return;
 	}
 
-	DrawViewport(CellsDataGenerated);
+	//Only the offset changes, the cells do not need to be classified again.
+	const FIntPoint OffsetChange = PreviousMinCell - LayoutCells.MinCell;
+	if (OffsetChange != FIntPoint::ZeroValue)
+	{
+		for (FCellGridData& CellData : LayoutCells.Data)
+		{
+			CellData.GridID += OffsetChange;
+		}
+	}
+
+	DrawLayoutCells();
 }
 
-void STerrainEditorViewport::DrawInitialBiomesLayout() const
+void STerrainEditorViewport::RecolorLayoutCells(const TArray<int32>& CellsIndices) const
 {
-	UTerrainBiomeSubsystem* TerrainBiomeSubsystem = GEngine->GetEngineSubsystem<UTerrainBiomeSubsystem>();
-	if (!TerrainBiomeSubsystem)
+	if (CellsIndices.Num() == 0)
 	{
 		return;
 	}
 
-	//Cells of layouts generated	
-	UTerrainBiomeLayoutData* BiomeData = TerrainBiomeSubsystem->GetBiomeLayoutData();
-	TArray <FCellGridData> CellsDataGenerated;
-	TArray <FIntPoint> CellsIDs = TArray <FIntPoint>();
+	if (!bIsLayoutDrawnInTexture || !ShouldUseTexture(LayoutCells.Data.Num()))
+	{
+		DrawLayoutCells();
+		return;
+	}
 
-	for (const TPair<FIntPoint, FBiomeLayout>& pair : TerrainBiomeSubsystem->BiomesLayoutMap)
+	TArray<FCellGridData> ChangedCellsData;
+	ChangedCellsData.Reserve(CellsIndices.Num());
+	for (int32 CellIndex : CellsIndices)
 	{
-		FCellGridData CellGrid = FCellGridData();		
-	
-		if (BiomeData->Biomes.IsValidIndex(pair.Value.BiomeIndex))
+		ChangedCellsData.Add(LayoutCells.Data[CellIndex]);
+	}
+
+	CellsTexture->UpdateCellsData(ChangedCellsData);
+}
+
+void STerrainEditorViewport::DrawLayoutCells() const
+{
+	const bool bUseTextureForLayout = ShouldUseTexture(LayoutCells.Data.Num());
+	if (bUseTextureForLayout)
+	{
+		DrawViewport(LayoutCells.Data);
+	}
+	else
+	{
+		TArray<FCellGridData> DrawnCellsData;
+		DrawnCellsData.Reserve(LayoutCells.Data.Num());
+		for (int32 CellIndex = 0; CellIndex < LayoutCells.Data.Num(); CellIndex++)
 		{
-			CellGrid.Color = BiomeData->Biomes[pair.Value.BiomeIndex]->BiomeColor;
+			if (LayoutCells.Colors[CellIndex] != INDEX_NONE)
+			{
+				DrawnCellsData.Add(LayoutCells.Data[CellIndex]);
+			}
 		}
-		else
+
+		DrawViewport(DrawnCellsData);
+	}
+
+	bIsLayoutDrawn = true;
+	bIsLayoutDrawnInTexture = bUseTextureForLayout;
+}
+
+void STerrainEditorViewport::DrawLayoutOverlay() const
+{
+	using namespace TerrainEditorViewportCells;
+
+	UTerrainLayoutSubsystem* TerrainLayoutSubsystem = GEngine->GetEngineSubsystem<UTerrainLayoutSubsystem>();
+	if (!TerrainLayoutSubsystem)
+	{
+		return;
+	}
+
+	//Only the lookups are done here, the colors are built like the biome layers.
+	const TSharedRef<TArray<FIntPoint>, ESPMode::ThreadSafe> Cells = MakeShared<TArray<FIntPoint>, ESPMode::ThreadSafe>();
+	const TSharedRef<TArray<float>, ESPMode::ThreadSafe> Values = MakeShared<TArray<float>, ESPMode::ThreadSafe>();
+	const FTerrainLayoutCellsMap& CellsLayoutMap = TerrainLayoutSubsystem->CellsLayoutMap;
+
+	if (LayoutOverlay == ETerrainEditorLayoutOverlay::SearchExpansions || LayoutOverlay == ETerrainEditorLayoutOverlay::SearchCost)
+	{
+		const FTerrainLayoutSearchHeatmap& Heatmap = TerrainLayoutSubsystem->GetCorridorSearchHeatmap();
+		Cells->Reserve(CellsLayoutMap.Num() + Heatmap.Num());
+		Values->Reserve(CellsLayoutMap.Num() + Heatmap.Num());
+
+		//The searches never expand room cells, most of the searched cells are free cells out of the layout.
+		for (const TPair<FIntPoint, FCellLayout>& pair : CellsLayoutMap)
 		{
-			CellGrid.Color = FLinearColor::White;
+			if (!Heatmap.Contains(pair.Key))
+			{
+				Cells->Add(pair.Key);
+				Values->Add(-1.f);
+			}
+		}
+
+		const bool bIsCost = LayoutOverlay == ETerrainEditorLayoutOverlay::SearchCost;
+		for (const TPair<FIntPoint, FTerrainLayoutCellSearch>& pair : Heatmap)
+		{
+			Cells->Add(pair.Key);
+			Values->Add(bIsCost ? pair.Value.Cost : StaticCast<float>(pair.Value.Expansions));
 		}
+	}
+	else
+	{
+		const bool bIsRoomDepth = LayoutOverlay == ETerrainEditorLayoutOverlay::RoomDepth;
+		Cells->Reserve(CellsLayoutMap.Num());
+		Values->Reserve(CellsLayoutMap.Num());
 
-		for (const FIntPoint& cell : pair.Value.BiomeCells)
-		{			
-			CellGrid.GridID = cell;	
-			CellsIDs.Add(cell);
-			CellsDataGenerated.Add(CellGrid);
+		//Both depths are calculated when the layout ends, they are -1 before.
+		for (const TPair<FIntPoint, FCellLayout>& pair : CellsLayoutMap)
+		{
+			Cells->Add(pair.Key);
+			Values->Add(StaticCast<float>(bIsRoomDepth ? TerrainLayoutSubsystem->GetRoomDungeonDepth(pair.Value.RoomID) : TerrainLayoutSubsystem->GetCellLayoutDepth(pair.Key)));
 		}
 	}
 
-	//Cells that did not get into any layout
-	for (const TPair<FIntPoint, FBiomeCellLayout>& pair : TerrainBiomeSubsystem->CellsBiomeLayoutMap)
+	PendingStreamedCells.Reset();
+	DrawViewCells(Cells->Num(), false, [Cells, Values](TArray<FCellGridData>& CellsDataOut)
+	{
+		BuildHeatmapCellsData(*Cells, *Values, CellsDataOut);
+	});
+}
+
+void STerrainEditorViewport::RedrawLayout() const
+{
+	if (LayoutOverlay != ETerrainEditorLayoutOverlay::None)
 	{
-		if (!CellsIDs.Contains(pair.Key))
+		DrawLayoutOverlay();
+		return;
+	}
+
+	if (bIsClassifyingLayout)
+	{
+		return; //Drawn when the classification completes.
+	}
+
+	if (bIsLayoutDrawn)
+	{
+		DrawLayoutCells();
+		return;
+	}
+
+	DrawLayout();
+}
+
+bool STerrainEditorViewport::ShouldUseTexture(int32 CellsAmount) const
+{
+	return bUseTexture || CellsAmount >= TextureCellsThreshold;
+}
+
+void STerrainEditorViewport::OnLayoutCellsUpdated(const TArray<FIntPoint>& ChangedCells) const
+{
+	PendingStreamedCells.Append(ChangedCells);
+
+	const double Now = FPlatformTime::Seconds();
+	if (Now - LastStreamedDrawTime < .1)
+	{
+		return;
+	}
+
+	LastStreamedDrawTime = Now;
+	const TArray<FIntPoint> StreamedCells = MoveTemp(PendingStreamedCells);
+	PendingStreamedCells.Reset();
+	UpdateLayoutCells(StreamedCells);
+}
+
+void STerrainEditorViewport::OnLayoutStageGenerated() const
+{
+	UTerrainLayoutSubsystem* TerrainLayoutSubsystem = GEngine->GetEngineSubsystem<UTerrainLayoutSubsystem>();
+	if (!TerrainLayoutSubsystem)
+	{
+		return;
+	}
+
+	if (LayoutOverlay != ETerrainEditorLayoutOverlay::None)
+	{
+		DrawLayoutOverlay();
+		return;
+	}
+
+	//The stage changed cells include the streamed ones still pending.
+	PendingStreamedCells.Reset();
+	UpdateLayoutCells(TerrainLayoutSubsystem->GetStageChangedCells());
+}
+
+void STerrainEditorViewport::OnLayoutGenerated(const FTerrainLayoutStats& LayoutStats) const
+{
+	OnLayoutStageGenerated();
+}
+
+void STerrainEditorViewport::DrawViewCells(int32 CellsAmount, bool bIsVertexView, TFunction<void(TArray<FCellGridData>&)> BuildCellsIn) const
+{
+	const uint32 Request = BeginClassification();
+
+	//The back buffer is in use until the build completes.
+	const TSharedRef<TArray<FCellGridData>, ESPMode::ThreadSafe> Cells = BackViewCellsData.IsValid() ? BackViewCellsData.ToSharedRef() : MakeShared<TArray<FCellGridData>, ESPMode::ThreadSafe>();
+	BackViewCellsData.Reset();
+
+	if (CellsAmount < AsyncClassificationCellsThreshold)
+	{
+		Cells->Reset();
+		BuildCellsIn(*Cells);
+		OnViewCellsBuilt(Cells, Request, bIsVertexView);
+		return;
+	}
+
+	const TWeakPtr<const STerrainEditorViewport> WeakThis = SharedThis(this);
+	UE::Tasks::Launch(TEXT("TerrainEditorClassifyView"), [WeakThis, BuildCellsIn = MoveTemp(BuildCellsIn), Cells, Request, bIsVertexView]()
+	{
+		TRACE_CPUPROFILER_EVENT_SCOPE(TerrainEditorClassifyView);
+		Cells->Reset();
+		BuildCellsIn(*Cells);
+
+		AsyncTask(ENamedThreads::GameThread, [WeakThis, Cells, Request, bIsVertexView]()
 		{
-			FCellGridData CellGrid = FCellGridData();
-			CellGrid.GridID = pair.Key;
-			CellGrid.Color = FLinearColor::White;
+			if (const TSharedPtr<const STerrainEditorViewport> Viewport = WeakThis.Pin())
+			{
+				Viewport->OnViewCellsBuilt(Cells, Request, bIsVertexView);
+			}
+		});
+	});
+}
 
-			CellsIDs.Add(CellGrid.GridID);
-			CellsDataGenerated.Add(CellGrid);
+void STerrainEditorViewport::OnViewCellsBuilt(const TSharedRef<TArray<FCellGridData>, ESPMode::ThreadSafe>& CellsIn, uint32 RequestIn, bool bIsVertexView) const
+{
+	if (RequestIn != ClassificationRequest)
+	{
+		if (!BackViewCellsData.IsValid())
+		{
+			BackViewCellsData = CellsIn;
 		}
+
+		return;
 	}
-	
-	//Fix the offset
-	const FIntPoint MinGridSize = UTerrainLayoutFunctionLibrary::GetMinGridSize(CellsIDs);
 
-	for (FCellGridData& Cell : CellsDataGenerated)
+	Swap(ViewCellsData, CellsIn.Get());
+	BackViewCellsData = CellsIn;
+
+	if (!bIsVertexView)
 	{
-		Cell.GridID.X -= MinGridSize.X;
-		Cell.GridID.Y -= MinGridSize.Y;
+		DrawViewport(ViewCellsData);
+		return;
 	}
 
-	DrawViewport(CellsDataGenerated);
+	//Cannot use the grids for this, too many lines they fail. The texture has no geometry per cell.
+	bIsLayoutDrawn = false;
+	bIsLayoutDrawnInTexture = false;
+	CellsTexture->SetCellsData(ViewCellsData);
+	CellsTexture.Get()->SetVisibility(EVisibility::Visible);
+	CellsGridMesh.Get()->SetVisibility(EVisibility::Collapsed);
+	CellsGrid.Get()->SetVisibility(EVisibility::Collapsed);
 }
 
-void STerrainEditorViewport::DrawBiomesLayout() const
+void STerrainEditorViewport::DrawInitialBiomesLayout() const
 {
 	UTerrainBiomeSubsystem* TerrainBiomeSubsystem = GEngine->GetEngineSubsystem<UTerrainBiomeSubsystem>();
 	if (!TerrainBiomeSubsystem)
@@ -239,38 +828,58 @@ void STerrainEditorViewport::DrawBiomesLayout() const
 		return;
 	}
 
-	TArray <FCellGridData> CellsDataGenerated;
-	
-	TArray <FIntPoint> CellsIDs = TArray <FIntPoint>();
-	TerrainBiomeSubsystem->CellsBiomeLayoutMap.GetKeys(CellsIDs);
-	const FIntPoint MinGridSize = UTerrainLayoutFunctionLibrary::GetMinGridSize(CellsIDs);
+	const TArray<FLinearColor> BiomesColors = TerrainEditorViewportCells::GetBiomesColors(TerrainBiomeSubsystem->GetBiomeLayoutData());
+	const TSharedRef<const TMap<FIntPoint, FBiomeLayout>, ESPMode::ThreadSafe> BiomesLayoutMap = MakeShared<const TMap<FIntPoint, FBiomeLayout>, ESPMode::ThreadSafe>(TerrainBiomeSubsystem->BiomesLayoutMap);
 
-	UTerrainBiomeLayoutData* BiomeData = TerrainBiomeSubsystem->GetBiomeLayoutData();
+	const TSharedRef<TArray<FIntPoint>, ESPMode::ThreadSafe> AllCells = MakeShared<TArray<FIntPoint>, ESPMode::ThreadSafe>();
+	TerrainBiomeSubsystem->CellsBiomeLayoutMap.GetKeys(*AllCells);
 
-	for (const TPair<FIntPoint, FBiomeCellLayout>& pair : TerrainBiomeSubsystem->CellsBiomeLayoutMap)
+	DrawViewCells(AllCells->Num(), false, [BiomesColors, BiomesLayoutMap, AllCells](TArray<FCellGridData>& CellsDataOut)
 	{
-		FCellGridData Cell = FCellGridData();
-		Cell.GridID = pair.Key;
+		TArray <FIntPoint> CellsIDs = TArray <FIntPoint>();
+		TSet<FIntPoint> AddedCells;
 
-		Cell.GridID.X -= MinGridSize.X;
-		Cell.GridID.Y -= MinGridSize.Y;
-				
-		if (BiomeData->Biomes.IsValidIndex(pair.Value.BiomeIndex))
+		//Cells of layouts generated
+		for (const TPair<FIntPoint, FBiomeLayout>& pair : *BiomesLayoutMap)
 		{
-			Cell.Color = BiomeData->Biomes[pair.Value.BiomeIndex]->BiomeColor;
+			FCellGridData CellGrid = FCellGridData();
+			CellGrid.Color = BiomesColors.IsValidIndex(pair.Value.BiomeIndex) ? BiomesColors[pair.Value.BiomeIndex] : FLinearColor::White;
+
+			for (const FIntPoint& cell : pair.Value.BiomeCells)
+			{
+				CellGrid.GridID = cell;
+				CellsIDs.Add(cell);
+				AddedCells.Add(cell);
+				CellsDataOut.Add(CellGrid);
+			}
 		}
-		else
+
+		//Cells that did not get into any layout
+		for (const FIntPoint& cell : *AllCells)
 		{
-			Cell.Color = FLinearColor::White;
+			if (!AddedCells.Contains(cell))
+			{
+				FCellGridData CellGrid = FCellGridData();
+				CellGrid.GridID = cell;
+				CellGrid.Color = FLinearColor::White;
+
+				CellsIDs.Add(CellGrid.GridID);
+				CellsDataOut.Add(CellGrid);
+			}
 		}
 
-		CellsDataGenerated.Add(Cell);
-	}
+		//Fix the offset
+		const FIntPoint MinGridSize = UTerrainLayoutFunctionLibrary::GetMinGridSize(CellsIDs);
 
-	DrawViewport(CellsDataGenerated);
+		for (FCellGridData& Cell : CellsDataOut)
+		{
+			Cell.GridID.X -= MinGridSize.X;
+			Cell.GridID.Y -= MinGridSize.Y;
+		}
+	});
 }
 
-void STerrainEditorViewport::DrawBiomesLayersLayout() const
+void STerrainEditorViewport::DrawBiomesLayout() const
 {
 	UTerrainBiomeSubsystem* TerrainBiomeSubsystem = GEngine->GetEngineSubsystem<UTerrainBiomeSubsystem>();
 	if (!TerrainBiomeSubsystem)
@@ -278,33 +887,48 @@ void STerrainEditorViewport::DrawBiomesLayersLayout() const
 		return;
 	}
 
-	TArray <FCellGridData> CellsDataGenerated;	
+	const TArray<FLinearColor> BiomesColors = TerrainEditorViewportCells::GetBiomesColors(TerrainBiomeSubsystem->GetBiomeLayoutData());
+	const TSharedRef<const TMap<FIntPoint, FBiomeCellLayout>, ESPMode::ThreadSafe> CellsBiomeLayoutMap = MakeShared<const TMap<FIntPoint, FBiomeCellLayout>, ESPMode::ThreadSafe>(TerrainBiomeSubsystem->CellsBiomeLayoutMap);
 
-	TArray <FIntPoint> CellsIDs = TArray <FIntPoint>();
-	TerrainBiomeSubsystem->CellsBiomeLayoutMap.GetKeys(CellsIDs);
-	const FIntPoint MinGridSize = UTerrainLayoutFunctionLibrary::GetMinGridSize(CellsIDs);
-			
-	for (const TPair<FIntPoint, FBiomeCellLayout>& pair : TerrainBiomeSubsystem->CellsBiomeLayoutMap)
+	DrawViewCells(CellsBiomeLayoutMap->Num(), false, [BiomesColors, CellsBiomeLayoutMap](TArray<FCellGridData>& CellsDataOut)
 	{
-		FCellGridData Cell = FCellGridData();
-		Cell.GridID = pair.Key;
-
-		Cell.GridID.X -= MinGridSize.X;
-		Cell.GridID.Y -= MinGridSize.Y;
+		TArray <FIntPoint> CellsIDs = TArray <FIntPoint>();
+		CellsBiomeLayoutMap->GetKeys(CellsIDs);
+		const FIntPoint MinGridSize = UTerrainLayoutFunctionLibrary::GetMinGridSize(CellsIDs);
 
-		if (TerrainBiomeSubsystem->GetCellLayerData(pair.Key))
-		{
-			Cell.Color = TerrainBiomeSubsystem->GetCellLayerData(pair.Key)->LayerColor;
-		}
-		else
+		CellsDataOut.Reserve(CellsIDs.Num());
+		for (const TPair<FIntPoint, FBiomeCellLayout>& pair : *CellsBiomeLayoutMap)
 		{
-			Cell.Color = FLinearColor::White;
+			FCellGridData Cell = FCellGridData();
+			Cell.GridID = pair.Key;
+
+			Cell.GridID.X -= MinGridSize.X;
+			Cell.GridID.Y -= MinGridSize.Y;
+			Cell.Color = BiomesColors.IsValidIndex(pair.Value.BiomeIndex) ? BiomesColors[pair.Value.BiomeIndex] : FLinearColor::White;
+
+			CellsDataOut.Add(Cell);
 		}
+	});
+}
 
-		CellsDataGenerated.Add(Cell);
+void STerrainEditorViewport::DrawBiomesLayersLayout() const
+{
+	UTerrainBiomeSubsystem* TerrainBiomeSubsystem = GEngine->GetEngineSubsystem<UTerrainBiomeSubsystem>();
+	if (!TerrainBiomeSubsystem)
+	{
+		return;
 	}
 
-	DrawViewport(CellsDataGenerated);
+	//The layers are found by the subsystem, which is not thread safe. The lookups are sliced over the frames instead.
+	const TSharedRef<TArray<FIntPoint>, ESPMode::ThreadSafe> Cells = MakeShared<TArray<FIntPoint>, ESPMode::ThreadSafe>();
+	TerrainBiomeSubsystem->CellsBiomeLayoutMap.GetKeys(*Cells);
+
+	const TWeakObjectPtr<UTerrainBiomeSubsystem> WeakBiomeSubsystem = TerrainBiomeSubsystem;
+	DrawViewCellsSliced(Cells, false, [WeakBiomeSubsystem](const FIntPoint& Cell)
+	{
+		const UTerrainBiomeLayerData* LayerData = WeakBiomeSubsystem.IsValid() ? WeakBiomeSubsystem->GetCellLayerData(Cell) : nullptr;
+		return LayerData ? LayerData->LayerColor : FLinearColor::White;
+	});
 }
 
 void STerrainEditorViewport::DrawVertexLayout() const
@@ -315,40 +939,79 @@ void STerrainEditorViewport::DrawVertexLayout() const
 		return;
 	}
 
-	TArray <FCellGridData> CellsDataGenerated;
+	//Same as the layers, the subsystem lookups are sliced over the frames.
+	const TSharedRef<TArray<FIntPoint>, ESPMode::ThreadSafe> Vertices = MakeShared<TArray<FIntPoint>, ESPMode::ThreadSafe>();
+	TerrainMeshSubsystem->VertexMap.GetKeys(*Vertices);
 
-	TArray <FIntPoint> CellsIDs = TArray <FIntPoint>();
-	TerrainMeshSubsystem->VertexMap.GetKeys(CellsIDs);
-	const FIntPoint MinGridSize = UTerrainLayoutFunctionLibrary::GetMinGridSize(CellsIDs);
-
-	for (const TPair<FIntPoint, FTerrainVertex>& pair : TerrainMeshSubsystem->VertexMap)
+	const TWeakObjectPtr<UTerrainMeshSubsystem> WeakMeshSubsystem = TerrainMeshSubsystem;
+	DrawViewCellsSliced(Vertices, true, [WeakMeshSubsystem](const FIntPoint& Vertex)
 	{
-		FCellGridData Cell = FCellGridData();
-		Cell.GridID = pair.Key;
+		const UTerrainBiomeLayerData* LayerData = WeakMeshSubsystem.IsValid() ? WeakMeshSubsystem->GetVertexLayerData(Vertex) : nullptr;
+		return LayerData ? LayerData->LayerColor : FLinearColor::White;
+	});
+}
+
+void STerrainEditorViewport::DrawViewCellsSliced(const TSharedRef<TArray<FIntPoint>, ESPMode::ThreadSafe>& CellsIn, bool bIsVertexView, TFunction<FLinearColor(const FIntPoint&)> GetCellColorIn) const
+{
+	//Any draw started before the lookups end discards them.
+	const uint32 Request = BeginClassification();
 
-		Cell.GridID.X -= MinGridSize.X;
-		Cell.GridID.Y -= MinGridSize.Y;
+	const TSharedRef<TArray<FLinearColor>, ESPMode::ThreadSafe> Colors = MakeShared<TArray<FLinearColor>, ESPMode::ThreadSafe>();
+	Colors->Reserve(CellsIn->Num());
 
-		if (TerrainMeshSubsystem->GetVertexLayerData(pair.Key))
+	const TWeakPtr<const STerrainEditorViewport> WeakThis = SharedThis(this);
+	auto LookupSlice = [WeakThis, CellsIn, Colors, GetCellColorIn = MoveTemp(GetCellColorIn), Request, bIsVertexView](float DeltaTime)
+	{
+		const TSharedPtr<const STerrainEditorViewport> Viewport = WeakThis.Pin();
+		if (!Viewport.IsValid() || Viewport->ClassificationRequest != Request)
 		{
-			Cell.Color = TerrainMeshSubsystem->GetVertexLayerData(pair.Key)->LayerColor;
+			return false;
 		}
-		else
+
+		const double EndTime = FPlatformTime::Seconds() + SlicedLookupsBudgetSeconds;
+		while (Colors->Num() < CellsIn->Num())
 		{
-			Cell.Color = FLinearColor::White;
+			Colors->Add(GetCellColorIn((*CellsIn)[Colors->Num()]));
+
+			//The clock is only read every few cells.
+			if ((Colors->Num() & 255) == 0 && FPlatformTime::Seconds() > EndTime)
+			{
+				return true;
+			}
 		}
 
-		CellsDataGenerated.Add(Cell);
-	}
+		Viewport->DrawViewCells(CellsIn->Num(), bIsVertexView, [CellsIn, Colors](TArray<FCellGridData>& CellsDataOut)
+		{
+			TerrainEditorViewportCells::BuildCellsData(*CellsIn, *Colors, CellsDataOut);
+		});
 
-	//Cannot use grid for this, too many lines it fails.
-	CellsGridMesh->SetCellsData(CellsDataGenerated);
-	CellsGridMesh.Get()->SetVisibility(EVisibility::SelfHitTestInvisible);
-	CellsGrid.Get()->SetVisibility(EVisibility::Collapsed);
+		return false;
+	};
+
+	//The first slice runs right away, so small views are drawn without waiting a frame.
+	if (LookupSlice(0.f))
+	{
+		FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateLambda(MoveTemp(LookupSlice)));
+	}
 }
 
 void STerrainEditorViewport::DrawViewport(const TArray<FCellGridData>& Data) const
 {
+	//Set again by DrawLayoutCells when drawing the layout.
+	bIsLayoutDrawn = false;
+	bIsLayoutDrawnInTexture = false;
+
+	if (ShouldUseTexture(Data.Num()))
+	{
+		CellsTexture->SetCellsData(Data);
+		CellsTexture.Get()->SetVisibility(EVisibility::Visible);
+		CellsGrid.Get()->SetVisibility(EVisibility::Collapsed);
+		CellsGridMesh.Get()->SetVisibility(EVisibility::Collapsed);
+		return;
+	}
+
+	CellsTexture.Get()->SetVisibility(EVisibility::Collapsed);
+
 	if (bUseGrid)
 	{
 		CellsGrid->SetCellsData(Data);
@@ -372,28 +1035,69 @@ void STerrainEditorViewport::DrawViewport(const TArray<FCellGridData>& Data) con
 
 void STerrainEditorViewport::SetDrawConfiguration(bool DrawCentralCell, bool DrawInitialCell, bool DrawInitialRoom, bool DrawRoomBorders, bool DrawRoomCollision, bool DrawCorridors, bool DrawWalls, bool DrawDoors, bool DrawCells)
 {
-	bDrawCentralCell = DrawCentralCell;
-	bDrawInitialCell = DrawInitialCell;
-	bDrawInitialRoom = DrawInitialRoom;
-	bDrawRoomBorders = DrawRoomBorders;
-	bDrawRoomCollision = DrawRoomCollision;
-	bDrawCorridors = DrawCorridors;
-	bDrawWalls = DrawWalls;
-	bDrawDoors = DrawDoors;
-	bDrawCells = DrawCells;
+	DrawConfiguration.bDrawCentralCell = DrawCentralCell;
+	DrawConfiguration.bDrawInitialCell = DrawInitialCell;
+	DrawConfiguration.bDrawInitialRoom = DrawInitialRoom;
+	DrawConfiguration.bDrawRoomBorders = DrawRoomBorders;
+	DrawConfiguration.bDrawRoomCollision = DrawRoomCollision;
+	DrawConfiguration.bDrawCorridors = DrawCorridors;
+	DrawConfiguration.bDrawWalls = DrawWalls;
+	DrawConfiguration.bDrawDoors = DrawDoors;
+	DrawConfiguration.bDrawCells = DrawCells;
 
-	DrawLayout();
+	if (bIsClassifyingLayout)
+	{
+		return; //Applied when the classification completes.
+	}
+
+	if (!bIsLayoutDrawn)
+	{
+		DrawLayout();
+		return;
+	}
+
+	TArray<int32> ChangedIndices;
+	ApplyDrawConfiguration(ChangedIndices);
+	RecolorLayoutCells(ChangedIndices);
 }
 
 void STerrainEditorViewport::SetUseGrid(bool IsChecked)
 {
 	bUseGrid = IsChecked;
-	DrawLayout();
+	RedrawLayout();
 }
 
 void STerrainEditorViewport::SetUseGridMesh(bool IsChecked)
 {
 	bUseGridMesh = IsChecked;
+	RedrawLayout();
+}
+
+void STerrainEditorViewport::SetUseTexture(bool IsChecked)
+{
+	bUseTexture = IsChecked;
+	RedrawLayout();
+}
+
+void STerrainEditorViewport::SetShowGridLines(bool IsChecked)
+{
+	CellsTexture->SetShowGridLines(IsChecked);
+}
+
+void STerrainEditorViewport::SetLayoutOverlay(ETerrainEditorLayoutOverlay OverlayIn)
+{
+	LayoutOverlay = OverlayIn;
+
+	UTerrainLayoutSubsystem* TerrainLayoutSubsystem = GEngine->GetEngineSubsystem<UTerrainLayoutSubsystem>();
+	if (!TerrainLayoutSubsystem)
+	{
+		return;
+	}
+
+	const bool bIsSearchOverlay = LayoutOverlay == ETerrainEditorLayoutOverlay::SearchExpansions || LayoutOverlay == ETerrainEditorLayoutOverlay::SearchCost;
+	TerrainLayoutSubsystem->SetCollectSearchHeatmap(bIsSearchOverlay);
+
+	//The overlays are not kept as layout cells, the layout is classified again when they are hidden.
 	DrawLayout();
 }
 
@@ -2,13 +2,78 @@
 
 #include "CoreMinimal.h"
 #include "Widgets/SCompoundWidget.h"
+#include "SCellsGrid.h"
 
 class SCellsGrid;
 class SCellsGridMesh;
+class SCellsTexture;
 class SInvalidationPanel;
 class UTerrainGeneratorSubsystem;
 
-struct FCellGridData;
+struct FCellLayout;
+struct FTerrainLayoutStats;
+class FTerrainLayoutCellsMap;
+
+/* Which layout cells are drawn. Copied into the background classifications, so the toggles do not race with them.*/
+struct FTerrainEditorLayoutDrawConfiguration
+{
+	bool bDrawCentralCell = true;
+	bool bDrawInitialCell = false;
+	bool bDrawInitialRoom = true;
+	bool bDrawRoomBorders = false;
+	bool bDrawRoomCollision = false;
+	bool bDrawCorridors = true;
+	bool bDrawWalls = true;
+	bool bDrawDoors = false;
+	bool bDrawCells = true;
+
+	/* The color of a cell with the categories. INDEX_NONE if the cell is not drawn.*/
+	int32 GetCellColorIndex(uint8 Categories) const;
+};
+
+/* What the layout is colored by instead of the cell tags. The overlays go from blue for the lowest value to red for the highest.*/
+enum class ETerrainEditorLayoutOverlay : uint8
+{
+	None,
+
+	/* Times the corridor searches expanded each cell, added for all the corridors. Includes the free cells searched.*/
+	SearchExpansions,
+
+	/* Lowest estimated cost of a corridor path through each searched cell.*/
+	SearchCost,
+
+	/* Rooms to pass from the initial room to reach the room of each cell.*/
+	RoomDepth,
+
+	/* Cells from each room or corridor cell to the nearest wall.*/
+	WallDistance
+};
+
+/* A layout cell and its categories, all a classification reads from the layout. Looked up over the frames for the background classifications.*/
+struct FTerrainEditorLayoutCellCategories
+{
+	FIntPoint Cell = FIntPoint::ZeroValue;
+	uint8 Categories = 0;
+};
+
+/* The layout cells as drawn. Built on a background task and swapped with the drawn ones when completed.*/
+struct FTerrainEditorLayoutCells
+{
+	/* Index of each layout cell in the arrays.*/
+	TMap<FIntPoint, int32> Indices;
+	TArray<FCellGridData> Data;
+
+	/* The tags of each cell that decide its color, as flags. They do not depend on the draw configuration.*/
+	TArray<uint8> Categories;
+
+	/* The color drawn for each cell, INDEX_NONE for the cells not drawn.*/
+	TArray<int32> Colors;
+
+	FIntPoint MinCell = FIntPoint::ZeroValue;
+	FIntPoint MaxCell = FIntPoint::ZeroValue;
+
+	void SetCellColor(int32 CellIndex, int32 ColorIndex);
+};
 
 class STerrainEditorViewport : public SCompoundWidget
 {		
@@ -18,6 +83,7 @@ public:
 
 	void Construct(const FArguments& InArgs);
 	
+	/* Classifies every layout cell again and draws them all. Stages and draw toggles after this only recolor the cells that changed.*/
 	void DrawLayout() const;
 
 	void SetDrawConfiguration(
@@ -33,28 +99,112 @@ public:
 
 	void SetUseGrid(bool IsChecked);
 	void SetUseGridMesh(bool IsChecked);
+	void SetUseTexture(bool IsChecked);
+	void SetShowGridLines(bool IsChecked);
+
+	/* The search overlays are only collected while they are shown, they are empty until the next generation.*/
+	void SetLayoutOverlay(ETerrainEditorLayoutOverlay OverlayIn);
+
+	/* From this amount of cells the texture is used, even if it is not enabled. The grids build geometry per cell and stall Slate.*/
+	static const int32 TextureCellsThreshold = 65536;
+
+	/* From this amount of cells the colors are classified on a background task. Below it the task costs more than the classification.*/
+	static const int32 AsyncClassificationCellsThreshold = 16384;
+
+	/* Builds all the layout cells from the snapshot. Does not touch the viewport, so it runs on any thread.*/
+	static void ClassifyLayoutCells(const TArray<FTerrainEditorLayoutCellCategories>& CellsIn, const FTerrainEditorLayoutDrawConfiguration& ConfigurationIn, FTerrainEditorLayoutCells& CellsOut);
+
+	/* Same, from a layout only read by the calling thread.*/
+	static void ClassifyLayoutCells(const FTerrainLayoutCellsMap& CellsLayoutMapIn, const FIntPoint& InitialRoomIn, const FTerrainEditorLayoutDrawConfiguration& ConfigurationIn, FTerrainEditorLayoutCells& CellsOut);
+
+	/* The categories of all the cells at once, for the classifications on the calling thread.*/
+	static void GetLayoutCellsCategories(const FTerrainLayoutCellsMap& CellsLayoutMapIn, const FIntPoint& InitialRoomIn, TArray<FTerrainEditorLayoutCellCategories>& CellsOut);
 
 protected:
 	bool bUseGridMesh = true;
 	bool bUseGrid = true;
+	bool bUseTexture = false;
 
-	bool bDrawCentralCell = true;
-	bool bDrawInitialCell = false;
-	bool bDrawInitialRoom = true;
-	bool bDrawRoomBorders = false;
-	bool bDrawRoomCollision = false;
-	bool bDrawCorridors = true;
-	bool bDrawWalls = true;
-	bool bDrawDoors = false;
-	bool bDrawCells = true;
+	FTerrainEditorLayoutDrawConfiguration DrawConfiguration;
+	ETerrainEditorLayoutOverlay LayoutOverlay = ETerrainEditorLayoutOverlay::None;
 
 	TSharedPtr<SCellsGrid> CellsGrid;
 	TSharedPtr<SCellsGridMesh> CellsGridMesh;
+	TSharedPtr<SCellsTexture> CellsTexture;
 	TSharedPtr<SInvalidationPanel> InvalidationPanel;
 	TSharedPtr<SInvalidationPanel> InvalidationPanelMesh;
 
 	UTerrainGeneratorSubsystem* TerrainGeneratorSubsystem = nullptr;
 
+	/* Layout cells as drawn, kept between draws.*/
+	mutable FTerrainEditorLayoutCells LayoutCells;
+
+	/* The buffer the next layout classification is built in. The drawn cells are swapped into it when a classification completes.*/
+	mutable TSharedPtr<FTerrainEditorLayoutCells, ESPMode::ThreadSafe> BackLayoutCells;
+
+	/* Biomes or vertices as drawn, and the buffer their next classification is built in.*/
+	mutable TArray<FCellGridData> ViewCellsData;
+	mutable TSharedPtr<TArray<FCellGridData>, ESPMode::ThreadSafe> BackViewCellsData;
+
+	/* Increased on each classification. Results of older ones are discarded.*/
+	mutable uint32 ClassificationRequest = 0;
+
+	/* The layout is being classified. Changes until it completes are applied after the swap.*/
+	mutable bool bIsClassifyingLayout = false;
+	mutable TArray<FIntPoint> CellsChangedWhileClassifying;
+
+	/* False when the viewport shows the biomes or vertices, the layout is classified again before drawing it.*/
+	mutable bool bIsLayoutDrawn = false;
+	mutable bool bIsLayoutDrawnInTexture = false;
+
+	/* Streamed cells waiting for the next throttled update.*/
+	mutable TArray<FIntPoint> PendingStreamedCells;
+
+	static uint8 GetCellCategories(const FCellLayout& CellLayout, const FIntPoint& InitialRoom);
+
+	/* Swaps the classified cells with the drawn ones and draws them.*/
+	void OnLayoutCellsClassified(const TSharedRef<FTerrainEditorLayoutCells, ESPMode::ThreadSafe>& CellsIn, uint32 RequestIn) const;
+
+	/**
+	*	Runs BuildCellsIn on a background task when there are many cells, or right away when there are few, and draws the result.
+	*	BuildCellsIn must only read the snapshot it captured.
+	*/
+	void DrawViewCells(int32 CellsAmount, bool bIsVertexView, TFunction<void(TArray<FCellGridData>&)> BuildCellsIn) const;
+
+	/* Seconds per frame the lookups of DrawViewCellsSliced run on the game thread.*/
+	static constexpr double SlicedLookupsBudgetSeconds = .004;
+
+	/**
+	*	Gets the color of each cell on the game thread, a slice each frame, then builds the cells with DrawViewCells.
+	*	For colors read from subsystems that are not thread safe, so a large view does not stall a frame.
+	*/
+	void DrawViewCellsSliced(const TSharedRef<TArray<FIntPoint>, ESPMode::ThreadSafe>& CellsIn, bool bIsVertexView, TFunction<FLinearColor(const FIntPoint&)> GetCellColorIn) const;
+
+	void OnViewCellsBuilt(const TSharedRef<TArray<FCellGridData>, ESPMode::ThreadSafe>& CellsIn, uint32 RequestIn, bool bIsVertexView) const;
+
+	/* Starts a new classification, discarding the one in flight.*/
+	uint32 BeginClassification() const;
+
+	/* Recolors the kept layout cells with the current draw configuration, without sending them.*/
+	void ApplyDrawConfiguration(TArray<int32>& ChangedIndicesOut) const;
+
+	/* Classifies only the given cells. Cells out of the drawn bounds move the offset of the others, so everything is sent again then.*/
+	void UpdateLayoutCells(const TArray<FIntPoint>& ChangedCells) const;
+
+	/* Sends the recolored cells. The texture uploads only them, the grids are sent every cell since they cannot be partially updated.*/
+	void RecolorLayoutCells(const TArray<int32>& CellsIndices) const;
+
+	/* Sends the kept layout cells to the viewport. Hidden cells are transparent texels in the texture, so showing them does not change its bounds.*/
+	void DrawLayoutCells() const;
+
+	/* Draws the layout cells and the searched cells with the overlay values. Built like the biomes views, the cells are not kept.*/
+	void DrawLayoutOverlay() const;
+
+	/* Draws the kept layout cells, or the full layout if the viewport shows something else.*/
+	void RedrawLayout() const;
+
+	bool ShouldUseTexture(int32 CellsAmount) const;
+
 	void DrawInitialBiomesLayout() const;
 	void DrawBiomesLayout() const;
 
@@ -62,5 +212,15 @@ protected:
 
 	void DrawVertexLayout() const;
 
+	/* Updates the streamed cells while a stage runs. Throttled, since the grids are sent every cell on each update.*/
+	void OnLayoutCellsUpdated(const TArray<FIntPoint>& ChangedCells) const;
+
+	/* Updates the cells changed by the stage that just ended.*/
+	void OnLayoutStageGenerated() const;
+
+	mutable double LastStreamedDrawTime = 0;
+
+	void OnLayoutGenerated(const FTerrainLayoutStats& LayoutStats) const;
+
 	void DrawViewport(const TArray<FCellGridData>& Data) const;
 };
\ No newline at end of file